@@ -9,7 +9,9 @@
 #define ROUND_SIZE_UP_TO_MAX_ALIGN(size) ROUND_SIZE_UP_TO_ALIGN(size, _Alignof(max_align_t))
 
 #define MIN(a, b) (a < b ? a : b)
+#define MAX(a, b) (a > b ? a : b)
 #define SIZE(a) (sizeof(a) / sizeof(a[0]))
+#define CONTAINER_OF(ptr, type, member) ((type *)((uintptr_t)(ptr) - offsetof(type, member)))
 
 #define ITERATOR_NEXT(obj) _Generic((obj), \
     VecIter *: VecIter_next,               \
@@ -101,15 +103,21 @@ void MaybeOwned_drop(MaybeOwned *this)
 
 // [Iterator]
 
+typedef struct LinkedIterator LinkedIterator;
+
 typedef void *(*IteratorNextFn)(void *this);
 typedef void *(*IteratorNextBackFn)(void *this);
 typedef size_t (*IteratorLenFn)(const void *this);
+typedef void (*IteratorSplitAtFn)(void *this, size_t index, LinkedIterator *right);
+typedef bool (*IteratorSplitFn)(void *this, LinkedIterator *right);
 
 typedef enum
 {
     ITERATOR_CAPABILITY_ITERATOR = 1,
     ITERATOR_CAPABILITY_DOUBLE_ENDED_ITERATOR = 1 << 1,
     ITERATOR_CAPABILITY_EXACT_SIZE_ITERATOR = 1 << 2,
+    ITERATOR_CAPABILITY_SPLIT_ITERATOR = 1 << 3,
+    ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR = 1 << 4,
 } IteratorCapability;
 
 typedef struct
@@ -117,6 +125,9 @@ typedef struct
     IteratorNextFn next;
     IteratorNextBackFn next_back;
     IteratorLenFn len;
+    // split_at() splits an exact size iterator at an index, split() splits an iterator of unknown length roughly in half
+    IteratorSplitAtFn split_at;
+    IteratorSplitFn split;
 } IteratorProps;
 
 typedef struct
@@ -131,6 +142,8 @@ Iterator Iterator_new(void *concrete, const IteratorProps *props)
     IteratorCapability capabilities = ITERATOR_CAPABILITY_ITERATOR;
     capabilities |= props->next_back != NULL ? ITERATOR_CAPABILITY_DOUBLE_ENDED_ITERATOR : 0;
     capabilities |= props->len != NULL ? ITERATOR_CAPABILITY_EXACT_SIZE_ITERATOR : 0;
+    capabilities |= props->split_at != NULL || props->split != NULL ? ITERATOR_CAPABILITY_SPLIT_ITERATOR : 0;
+    capabilities |= props->split_at != NULL ? ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR : 0;
 
     return (Iterator){
         .concrete = concrete,
@@ -205,17 +218,87 @@ bool Iterator_is_empty(const Iterator *this)
     return Iterator_len(this) == 0;
 }
 
+void Iterator_split_at(Iterator *this, size_t index, LinkedIterator *right)
+{
+    assert(this->capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR);
+
+    this->props.split_at(this->concrete, MIN(index, Iterator_len(this)), right);
+}
+
+bool Iterator_split(Iterator *this, LinkedIterator *right)
+{
+    assert(this->capabilities & ITERATOR_CAPABILITY_SPLIT_ITERATOR);
+
+    if (this->capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR)
+    {
+        size_t len = Iterator_len(this);
+
+        if (len < 2)
+        {
+            return false;
+        }
+
+        Iterator_split_at(this, len / 2, right);
+        return true;
+    }
+    else
+    {
+        return this->props.split(this->concrete, right);
+    }
+}
+
 void Iterator_drop(Iterator *this)
 {
 }
 
 // [LinkedIterator]
 
-typedef struct
+struct LinkedIterator
 {
     Iterator iter;
     DropFn drop;
-} LinkedIterator;
+};
+
+void LinkedIterator_drop(LinkedIterator *this)
+{
+    if (this->drop != NULL)
+    {
+        this->drop(this->iter.concrete);
+    }
+}
+
+// [IteratorSplit]
+
+// The right half of a split owns its concrete iterator, and the concrete iterator of an adapter it was split from
+typedef struct
+{
+    DropFn drop;
+    LinkedIterator concrete;
+} _IteratorSplitHeader;
+
+static void *_IteratorSplit_new(size_t size, DropFn drop, const LinkedIterator *concrete)
+{
+    _IteratorSplitHeader *header = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*header)) + size);
+
+    header->drop = drop;
+    header->concrete = concrete == NULL ? (LinkedIterator){} : *concrete;
+
+    return (uint8_t *)(header) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*header));
+}
+
+static void _IteratorSplit_drop(void *this)
+{
+    _IteratorSplitHeader *header = (_IteratorSplitHeader *)((uint8_t *)(this) - ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*header)));
+
+    if (header->drop != NULL)
+    {
+        header->drop(this);
+    }
+
+    LinkedIterator_drop(&header->concrete);
+
+    free(header);
+}
 
 // [SkipIter]
 
@@ -269,6 +352,36 @@ void SkipIter_drop(SkipIter *this)
     Iterator_drop(&this->concrete);
 }
 
+Iterator SkipIter_iter(SkipIter *this);
+
+void SkipIter_split_at(SkipIter *this, size_t index, LinkedIterator *right)
+{
+    LinkedIterator concrete;
+    Iterator_split_at(&this->concrete, this->n + index, &concrete);
+
+    SkipIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)SkipIter_drop, &concrete);
+    SkipIter_new(other, &concrete.iter, 0);
+
+    *right = (LinkedIterator){
+        .iter = SkipIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+}
+
+Iterator SkipIter_iter(SkipIter *this)
+{
+    bool is_splittable = this->concrete.capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR;
+
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)SkipIter_next,
+            .next_back = (IteratorNextBackFn)SkipIter_next_back,
+            .len = (IteratorLenFn)SkipIter_len,
+            .split_at = is_splittable ? (IteratorSplitAtFn)SkipIter_split_at : NULL,
+        });
+}
+
 // [TakeIter]
 
 typedef struct
@@ -299,17 +412,16 @@ void *TakeIter_next(TakeIter *this)
 
 void *TakeIter_next_back(TakeIter *this)
 {
-    size_t len = Iterator_len(&this->concrete);
-
-    if (this->n > len)
-    {
-        return Iterator_nth_back(&this->concrete, 0);
-    }
-    else
+    if (this->n == 0)
     {
-        this->n -= 1;
-        return Iterator_nth_back(&this->concrete, len - this->n);
+        return NULL;
     }
+
+    size_t len = Iterator_len(&this->concrete);
+    size_t skipped = this->n >= len ? 0 : len - this->n;
+
+    this->n -= 1;
+    return Iterator_nth_back(&this->concrete, skipped);
 }
 
 size_t TakeIter_len(const TakeIter *this)
@@ -323,6 +435,38 @@ void TakeIter_drop(TakeIter *this)
     Iterator_drop(&this->concrete);
 }
 
+Iterator TakeIter_iter(TakeIter *this);
+
+void TakeIter_split_at(TakeIter *this, size_t index, LinkedIterator *right)
+{
+    LinkedIterator concrete;
+    Iterator_split_at(&this->concrete, index, &concrete);
+
+    TakeIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)TakeIter_drop, &concrete);
+    TakeIter_new(other, &concrete.iter, this->n - index);
+
+    this->n = index;
+
+    *right = (LinkedIterator){
+        .iter = TakeIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+}
+
+Iterator TakeIter_iter(TakeIter *this)
+{
+    bool is_splittable = this->concrete.capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR;
+
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)TakeIter_next,
+            .next_back = (IteratorNextBackFn)TakeIter_next_back,
+            .len = (IteratorLenFn)TakeIter_len,
+            .split_at = is_splittable ? (IteratorSplitAtFn)TakeIter_split_at : NULL,
+        });
+}
+
 // [StepByIter]
 
 typedef struct
@@ -391,6 +535,40 @@ void StepByIter_drop(StepByIter *this)
     Iterator_drop(&this->concrete);
 }
 
+Iterator StepByIter_iter(StepByIter *this);
+
+void StepByIter_split_at(StepByIter *this, size_t index, LinkedIterator *right)
+{
+    // the index-th element lives at index * step in the concrete iterator, whether or not the first element was taken
+    size_t concrete_index = index < StepByIter_len(this) ? index * this->step : Iterator_len(&this->concrete);
+
+    LinkedIterator concrete;
+    Iterator_split_at(&this->concrete, concrete_index, &concrete);
+
+    StepByIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)StepByIter_drop, &concrete);
+    StepByIter_new(other, &concrete.iter, this->step);
+    other->first_take = this->first_take;
+
+    *right = (LinkedIterator){
+        .iter = StepByIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+}
+
+Iterator StepByIter_iter(StepByIter *this)
+{
+    bool is_splittable = this->concrete.capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR;
+
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)StepByIter_next,
+            .next_back = (IteratorNextBackFn)StepByIter_next_back,
+            .len = (IteratorLenFn)StepByIter_len,
+            .split_at = is_splittable ? (IteratorSplitAtFn)StepByIter_split_at : NULL,
+        });
+}
+
 // [RevIter]
 
 typedef struct
@@ -471,13 +649,7 @@ static Iterator _AdapterIterSpec_new_skip(SkipIter *this, Iterator *concrete, co
 {
     SkipIter_new(this, concrete, spec->skip.n);
 
-    return Iterator_new(
-        this,
-        &(IteratorProps){
-            .next = (IteratorNextFn)SkipIter_next,
-            .next_back = (IteratorNextBackFn)SkipIter_next_back,
-            .len = (IteratorLenFn)SkipIter_len,
-        });
+    return SkipIter_iter(this);
 }
 
 AdapterIterSpec AdapterIterSpec_skip(size_t n)
@@ -498,13 +670,7 @@ static Iterator _AdapterIterSpec_new_take(TakeIter *this, Iterator *concrete, co
 {
     TakeIter_new(this, concrete, spec->take.n);
 
-    return Iterator_new(
-        this,
-        &(IteratorProps){
-            .next = (IteratorNextFn)TakeIter_next,
-            .next_back = (IteratorNextBackFn)TakeIter_next_back,
-            .len = (IteratorLenFn)TakeIter_len,
-        });
+    return TakeIter_iter(this);
 }
 
 AdapterIterSpec AdapterIterSpec_take(size_t n)
@@ -525,13 +691,7 @@ static Iterator _AdapterIterSpec_new_step_by(StepByIter *this, Iterator *concret
 {
     StepByIter_new(this, concrete, spec->step_by.step);
 
-    return Iterator_new(
-        this,
-        &(IteratorProps){
-            .next = (IteratorNextFn)StepByIter_next,
-            .next_back = (IteratorNextBackFn)StepByIter_next_back,
-            .len = (IteratorLenFn)StepByIter_len,
-        });
+    return StepByIter_iter(this);
 }
 
 AdapterIterSpec AdapterIterSpec_step_by(size_t step)
@@ -581,26 +741,51 @@ AdapterIterSpec AdapterIterSpec_none()
     };
 }
 
+typedef union
+{
+    SkipIter skip;
+    TakeIter take;
+    StepByIter step_by;
+    RevIter rev;
+} _AdapterIterAny;
+
+// Upper bound of the buffer size AdapterIter_new_in() needs for adapter_count adapters, usable in constant expressions
+#define ADAPTER_ITER_BUFFER_SIZE(adapter_count) \
+    ((adapter_count) * (ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(AdapterIterSpecProps)) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_AdapterIterAny))))
+
+// Declares a buffer for AdapterIter_new_in(), e.g. ADAPTER_ITER_BUFFER(buffer, SIZE(specs) - 1) for a none-terminated spec array
+#define ADAPTER_ITER_BUFFER(name, adapter_count) _Alignas(max_align_t) uint8_t name[ADAPTER_ITER_BUFFER_SIZE(adapter_count)]
+
 typedef struct
 {
     Iterator concrete;
     LinkedIterator base;
     void *buffer;
     size_t length;
+    bool owns_buffer;
 } AdapterIter;
 
-AdapterIter AdapterIter_new(LinkedIterator concrete, const AdapterIterSpec *adapters)
+size_t AdapterIter_buffer_size(const AdapterIterSpec *adapters)
 {
     size_t size = 0;
-    size_t adapter_count = 0;
 
     for (const AdapterIterSpec *current = adapters; !current->is_none; current++)
     {
         size += ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(current->props)) + ROUND_SIZE_UP_TO_MAX_ALIGN(current->props.size);
+    }
+
+    return size;
+}
+
+static AdapterIter _AdapterIter_new_in_buffer(LinkedIterator concrete, const AdapterIterSpec *adapters, void *buffer, bool owns_buffer)
+{
+    size_t adapter_count = 0;
+
+    for (const AdapterIterSpec *current = adapters; !current->is_none; current++)
+    {
         adapter_count++;
     }
 
-    void *buffer = malloc(size);
     uint8_t *current = buffer;
 
     Iterator previous_iter = concrete.iter;
@@ -620,9 +805,25 @@ AdapterIter AdapterIter_new(LinkedIterator concrete, const AdapterIterSpec *adap
         .base = concrete,
         .buffer = buffer,
         .length = adapter_count,
+        .owns_buffer = owns_buffer,
     };
 }
 
+AdapterIter AdapterIter_new(LinkedIterator concrete, const AdapterIterSpec *adapters)
+{
+    return _AdapterIter_new_in_buffer(concrete, adapters, malloc(AdapterIter_buffer_size(adapters)), true);
+}
+
+// Same as AdapterIter_new(), but the adapters live in a caller provided, max_align_t aligned buffer that must outlive
+// the iterator. No allocation happens, so it suits iterators built and dropped in tight loops.
+AdapterIter AdapterIter_new_in(LinkedIterator concrete, const AdapterIterSpec *adapters, void *buffer, size_t buffer_size)
+{
+    assert(buffer_size >= AdapterIter_buffer_size(adapters));
+    assert((uintptr_t)(buffer) % _Alignof(max_align_t) == 0);
+
+    return _AdapterIter_new_in_buffer(concrete, adapters, buffer, false);
+}
+
 void *AdapterIter_next(AdapterIter *this)
 {
     return Iterator_next(&this->concrete);
@@ -638,23 +839,28 @@ void *AdapterIter_next_back(AdapterIter *this)
     return Iterator_next_back(&this->concrete);
 }
 
+void AdapterIter_split_at(AdapterIter *this, size_t index, LinkedIterator *right)
+{
+    Iterator_split_at(&this->concrete, index, right);
+}
+
 Iterator AdapterIter_iter(AdapterIter *this)
 {
+    bool is_splittable = this->concrete.capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR;
+
     return Iterator_new(
         this,
         &(IteratorProps){
             .next = (IteratorNextFn)AdapterIter_next,
             .next_back = (IteratorNextBackFn)AdapterIter_next_back,
             .len = (IteratorLenFn)AdapterIter_len,
+            .split_at = is_splittable ? (IteratorSplitAtFn)AdapterIter_split_at : NULL,
         });
 }
 
 void AdapterIter_drop(AdapterIter *this)
 {
-    if (this->base.drop != NULL)
-    {
-        this->base.drop(&this->base.iter.concrete);
-    }
+    LinkedIterator_drop(&this->base);
 
     uint8_t *current = this->buffer;
 
@@ -667,9 +873,14 @@ void AdapterIter_drop(AdapterIter *this)
         {
             props.drop(current);
         }
+
+        current += ROUND_SIZE_UP_TO_MAX_ALIGN(props.size);
     }
 
-    free(this->buffer);
+    if (this->owns_buffer)
+    {
+        free(this->buffer);
+    }
 }
 
 LinkedIterator AdapterIter_linked_iter(AdapterIter *this)
@@ -856,6 +1067,21 @@ void Vec_clear(Vec *this)
     Vec_truncate(this, 0);
 }
 
+void Vec_append(Vec *this, Vec *other)
+{
+    if (other->length == 0)
+    {
+        return;
+    }
+
+    Vec_reserve(this, other->length);
+
+    memcpy(Vec_get_mut(this, this->length), other->data, other->length * this->element_size);
+
+    this->length += other->length;
+    other->length = 0;
+}
+
 void Vec_shrink_to_fit(Vec *this)
 {
     if (this->length == this->capacity)
@@ -940,13 +1166,44 @@ const void *VecIter_next_back(VecIter *this)
 
 size_t VecIter_len(const VecIter *this)
 {
-    return this->end - this->start + 1;
+    return this->is_done ? 0 : this->end - this->start + 1;
 }
 
 void VecIter_drop(VecIter *this)
 {
 }
 
+Iterator VecIter_iter(VecIter *this);
+
+void VecIter_split_at(VecIter *this, size_t index, LinkedIterator *right)
+{
+    size_t len = VecIter_len(this);
+
+    VecIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)VecIter_drop, NULL);
+    other->vec = this->vec;
+    other->is_done = index == len;
+
+    if (!other->is_done)
+    {
+        other->start = this->start + index;
+        other->end = this->end;
+    }
+
+    if (index == 0)
+    {
+        this->is_done = true;
+    }
+    else if (index < len)
+    {
+        this->end = this->start + index - 1;
+    }
+
+    *right = (LinkedIterator){
+        .iter = VecIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+}
+
 VecIter Vec_iter(const Vec *this)
 {
     VecIter iter;
@@ -963,6 +1220,7 @@ Iterator VecIter_iter(VecIter *this)
             .next = (IteratorNextFn)VecIter_next,
             .next_back = (IteratorNextBackFn)VecIter_next_back,
             .len = (IteratorLenFn)VecIter_len,
+            .split_at = (IteratorSplitAtFn)VecIter_split_at,
         });
 }
 
@@ -1028,11 +1286,13 @@ RangeBound RangeBound_unbound(void *value)
 
 // [BTreeMap]
 
-#define BTREEMAP_T 3
-#define BTREEMAP_MINIMUM_KEY_COUNT (BTREEMAP_T - 1)
-#define BTREEMAP_MAXIMUM_KEY_COUNT (2 * BTREEMAP_T - 1)
-#define BTREEMAP_MINIMUM_CHILD_COUNT (BTREEMAP_MINIMUM_KEY_COUNT + 1)
-#define BTREEMAP_MAXIMUM_CHILD_COUNT (BTREEMAP_MAXIMUM_KEY_COUNT + 1)
+// A map with branching factor t holds between t - 1 and 2 * t - 1 keys per node (except the root)
+#define BTREEMAP_MINIMUM_T 2
+#define BTREEMAP_MAXIMUM_T 64
+// BTreeMap_new() picks t so that the keys and values of a full node take about this many bytes
+#define BTREEMAP_TARGET_NODE_SIZE 512
+// Integer keys are searched by halving the node down to this many keys, then counting the smaller ones
+#define BTREEMAP_LINEAR_SEARCH_THRESHOLD 16
 
 static void _swap(void *a, void *b, size_t size)
 {
@@ -1045,11 +1305,12 @@ static void _swap(void *a, void *b, size_t size)
 
 #define SWAP(a, b) _swap(&a, &b, sizeof(a))
 
+// A node is followed in the same allocation by its keys, its values and, for internal nodes only, its children
 typedef struct __BTreeMapNode
 {
     struct __BTreeMapNode *parent;
     bool is_leaf;
-    struct __BTreeMapNode *children[BTREEMAP_MAXIMUM_CHILD_COUNT];
+    struct __BTreeMapNode **children;
     size_t key_count;
 } _BTreeMapNode;
 
@@ -1059,13 +1320,19 @@ typedef struct
     size_t child_idx;
 } BTreeMapChildPos;
 
-static void _BTreeMapNode_new(_BTreeMapNode *this, const _BTreeMapNode *parent, bool is_leaf)
+static void _BTreeMapNode_new(_BTreeMapNode *this, const _BTreeMapNode *parent, bool is_leaf, size_t children_offset)
 {
     this->parent = (_BTreeMapNode *)parent;
     this->is_leaf = is_leaf;
+    this->children = is_leaf ? NULL : (_BTreeMapNode **)((uint8_t *)this + children_offset);
     this->key_count = 0;
 }
 
+static uint8_t *_BTreeMapNode_keys(const _BTreeMapNode *this)
+{
+    return (uint8_t *)this + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this));
+}
+
 static BTreeMapChildPos _BTreeMapNode_child_pos(const _BTreeMapNode *this, _BTreeMapNode *child)
 {
     size_t child_idx = SIZE_MAX;
@@ -1086,11 +1353,29 @@ static BTreeMapChildPos _BTreeMapNode_child_pos(const _BTreeMapNode *this, _BTre
     return result;
 }
 
+// Lets the map search nodes without calling cmp, which must still order keys the same way
+typedef enum
+{
+    BTREEMAP_KEY_KIND_OPAQUE,
+    BTREEMAP_KEY_KIND_I32,
+    BTREEMAP_KEY_KIND_U32,
+    BTREEMAP_KEY_KIND_I64,
+    BTREEMAP_KEY_KIND_U64,
+} BTreeMapKeyKind;
+
+// Maps a key to 8 bytes that order like it: cmp(a, b) < 0 must imply prefix(a) <= prefix(b), and equal keys must
+// have equal prefixes
+typedef uint64_t (*BTreeMapPrefixFn)(const void *key);
+
 typedef struct
 {
     size_t size;
     CmpFn cmp;
     DropFn drop;
+    BTreeMapKeyKind kind;
+    // Optional, for opaque keys. Nodes then store the prefix of each key next to it and only call cmp on keys whose
+    // prefix equals that of the key searched for.
+    BTreeMapPrefixFn prefix;
 } BTreeMapKeyProps;
 
 typedef struct
@@ -1099,12 +1384,105 @@ typedef struct
     DropFn drop;
 } BTreeMapValueProps;
 
+typedef struct
+{
+    size_t min_key_count;
+    size_t max_key_count;
+    size_t prefixes_offset;
+    size_t values_offset;
+    size_t children_offset;
+    size_t leaf_size;
+    size_t internal_size;
+    // Internal nodes of maps with order statistics also store the number of entries under each child
+    bool has_order_statistics;
+    size_t child_lens_offset;
+} _BTreeMapLayout;
+
+// Nodes are carved out of large chunks, and freed nodes are kept on a free list per node kind for reuse
+#define BTREEMAP_POOL_CHUNK_SIZE 65536
+
+typedef struct __BTreeMapPoolChunk
+{
+    struct __BTreeMapPoolChunk *next;
+} _BTreeMapPoolChunk;
+
+typedef struct
+{
+    _BTreeMapPoolChunk *chunks;
+    void *free_leaves;
+    void *free_internals;
+    uint8_t *cursor;
+    uint8_t *end;
+} _BTreeMapNodePool;
+
+static void _BTreeMapNodePool_new(_BTreeMapNodePool *this)
+{
+    this->chunks = NULL;
+    this->free_leaves = NULL;
+    this->free_internals = NULL;
+    this->cursor = NULL;
+    this->end = NULL;
+}
+
+static void _BTreeMapNodePool_add_chunk(_BTreeMapNodePool *this, size_t size)
+{
+    const size_t header_size = ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_BTreeMapPoolChunk));
+
+    _BTreeMapPoolChunk *chunk = malloc(header_size + size);
+    chunk->next = this->chunks;
+    this->chunks = chunk;
+
+    this->cursor = (uint8_t *)chunk + header_size;
+    this->end = this->cursor + size;
+}
+
+static void *_BTreeMapNodePool_alloc(_BTreeMapNodePool *this, size_t size, bool is_leaf)
+{
+    void **free_list = is_leaf ? &this->free_leaves : &this->free_internals;
+
+    if (*free_list != NULL)
+    {
+        void *node = *free_list;
+        *free_list = *(void **)node;
+        return node;
+    }
+
+    if (this->cursor == NULL || (size_t)(this->end - this->cursor) < size)
+    {
+        _BTreeMapNodePool_add_chunk(this, MAX(BTREEMAP_POOL_CHUNK_SIZE, size));
+    }
+
+    void *node = this->cursor;
+    this->cursor += size;
+    return node;
+}
+
+static void _BTreeMapNodePool_free(_BTreeMapNodePool *this, void *node, bool is_leaf)
+{
+    void **free_list = is_leaf ? &this->free_leaves : &this->free_internals;
+
+    *(void **)node = *free_list;
+    *free_list = node;
+}
+
+static void _BTreeMapNodePool_drop(_BTreeMapNodePool *this)
+{
+    while (this->chunks != NULL)
+    {
+        _BTreeMapPoolChunk *next = this->chunks->next;
+        free(this->chunks);
+        this->chunks = next;
+    }
+}
+
 typedef struct
 {
     _BTreeMapNode *root;
     size_t length;
     BTreeMapKeyProps key_props;
     BTreeMapValueProps value_props;
+    _BTreeMapLayout layout;
+    _BTreeMapNodePool *pool;
 } BTreeMap;
 
 typedef struct
@@ -1153,8 +1531,8 @@ BTreeMapEntryPos BTreeMapEntryPos_new(_BTreeMapNode *node, size_t kv_idx)
 
 BTreeMapEntry BTreeMapEntryPos_to_entry(BTreeMapEntryPos this, const BTreeMap *map)
 {
-    uint8_t *keys = (uint8_t *)(this.node) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this.node));
-    uint8_t *values = keys + ROUND_SIZE_UP_TO_MAX_ALIGN(BTREEMAP_MAXIMUM_KEY_COUNT * map->key_props.size);
+    uint8_t *keys = _BTreeMapNode_keys(this.node);
+    uint8_t *values = (uint8_t *)(this.node) + map->layout.values_offset;
 
     BTreeMapEntry result = {
         .key = keys + (this.kv_idx * map->key_props.size),
@@ -1163,44 +1541,109 @@ BTreeMapEntry BTreeMapEntryPos_to_entry(BTreeMapEntryPos this, const BTreeMap *m
     return result;
 }
 
-void _BTreeMap_move_entries(const BTreeMap *this, BTreeMapEntryPos from, BTreeMapEntryPos to)
+static uint64_t *_BTreeMap_prefixes(const BTreeMap *this, const _BTreeMapNode *node)
 {
-    const size_t to_move = from.node->key_count - from.kv_idx;
-
-    if (to_move)
-    {
-        BTreeMapEntry src = BTreeMapEntryPos_to_entry(from, this);
-        BTreeMapEntry dest = BTreeMapEntryPos_to_entry(to, this);
+    return (uint64_t *)((uint8_t *)node + this->layout.prefixes_offset);
+}
 
-        memmove(dest.key, src.key, to_move * this->key_props.size);
-        memmove(dest.value, src.value, to_move * this->value_props.size);
-    }
+static size_t *_BTreeMap_child_lens(const BTreeMap *this, const _BTreeMapNode *node)
+{
+    return (size_t *)((uint8_t *)node + this->layout.child_lens_offset);
 }
 
-void _BTreeMap_move_children(BTreeMapChildPos from, BTreeMapChildPos to)
+// Number of entries in the subtree of node, from the child lens of a map with order statistics
+static size_t _BTreeMap_node_len(const BTreeMap *this, const _BTreeMapNode *node)
 {
-    const size_t to_move = (from.node->key_count + 1) - from.child_idx;
+    size_t len = node->key_count;
 
-    if (to_move)
+    if (!node->is_leaf)
     {
-        memmove(&from.node[from.child_idx], &to.node[to.child_idx], to_move * sizeof(from.node[0]));
+        const size_t *child_lens = _BTreeMap_child_lens(this, node);
 
-        if (!from.node->is_leaf && from.node != to.node)
+        for (size_t i = 0; i < node->key_count + 1; i++)
         {
-            for (size_t i = 0; i < to_move; i++)
-            {
-                from.node->children[from.child_idx + i]->parent = to.node;
-            }
+            len += child_lens[i];
         }
     }
+
+    return len;
 }
 
-void _BTreeMap_replace_entry_at(const BTreeMap *this, const BTreeMapEntry *new, const BTreeMapEntryPos *pos)
+static void _BTreeMap_update_child_len(const BTreeMap *this, _BTreeMapNode *node, size_t child_idx)
 {
-    BTreeMapEntry old = BTreeMapEntryPos_to_entry(*pos, this);
-
+    if (this->layout.has_order_statistics)
+    {
+        _BTreeMap_child_lens(this, node)[child_idx] = _BTreeMap_node_len(this, node->children[child_idx]);
+    }
+}
+
+// Adds delta entries to the subtree lens of every ancestor of node
+static void _BTreeMap_update_ancestor_lens(const BTreeMap *this, _BTreeMapNode *node, int delta)
+{
+    if (!this->layout.has_order_statistics)
+    {
+        return;
+    }
+
+    for (; node->parent != NULL; node = node->parent)
+    {
+        _BTreeMap_child_lens(this, node->parent)[_BTreeMapNode_child_pos(node->parent, node).child_idx] += delta;
+    }
+}
+
+void _BTreeMap_move_entries(const BTreeMap *this, BTreeMapEntryPos from, BTreeMapEntryPos to)
+{
+    const size_t to_move = from.node->key_count - from.kv_idx;
+
+    if (to_move)
+    {
+        BTreeMapEntry src = BTreeMapEntryPos_to_entry(from, this);
+        BTreeMapEntry dest = BTreeMapEntryPos_to_entry(to, this);
+
+        memmove(dest.key, src.key, to_move * this->key_props.size);
+        memmove(dest.value, src.value, to_move * this->value_props.size);
+
+        if (this->key_props.prefix != NULL)
+        {
+            memmove(&_BTreeMap_prefixes(this, to.node)[to.kv_idx], &_BTreeMap_prefixes(this, from.node)[from.kv_idx], to_move * sizeof(uint64_t));
+        }
+    }
+}
+
+void _BTreeMap_move_children(const BTreeMap *this, BTreeMapChildPos from, BTreeMapChildPos to)
+{
+    const size_t to_move = (from.node->key_count + 1) - from.child_idx;
+
+    if (to_move)
+    {
+        memmove(&to.node->children[to.child_idx], &from.node->children[from.child_idx], to_move * sizeof(from.node->children[0]));
+
+        if (this->layout.has_order_statistics)
+        {
+            memmove(&_BTreeMap_child_lens(this, to.node)[to.child_idx], &_BTreeMap_child_lens(this, from.node)[from.child_idx], to_move * sizeof(size_t));
+        }
+
+        if (from.node != to.node)
+        {
+            for (size_t i = 0; i < to_move; i++)
+            {
+                to.node->children[to.child_idx + i]->parent = to.node;
+            }
+        }
+    }
+}
+
+void _BTreeMap_replace_entry_at(const BTreeMap *this, const BTreeMapEntry *new, const BTreeMapEntryPos *pos)
+{
+    BTreeMapEntry old = BTreeMapEntryPos_to_entry(*pos, this);
+
     memcpy(old.key, new->key, this->key_props.size);
     memcpy(old.value, new->value, this->value_props.size);
+
+    if (this->key_props.prefix != NULL)
+    {
+        _BTreeMap_prefixes(this, pos->node)[pos->kv_idx] = this->key_props.prefix(new->key);
+    }
 }
 
 void _BTreeMap_drop_entry_at(const BTreeMap *this, const BTreeMapEntryPos *pos)
@@ -1236,16 +1679,20 @@ void _BTreeMap_insert_entry_at(const BTreeMap *this, const BTreeMapEntry *entry,
 
 void _BTreeMap_insert_child_at(const BTreeMap *this, const _BTreeMapNode *child, BTreeMapChildPos pos)
 {
-    BTreeMapChildPos from_pos = pos;
-
-    BTreeMapChildPos to_pos = {
-        .node = from_pos.node,
-        .child_idx = from_pos.child_idx + 1,
-    };
+    // The entry that separates the new child has already been inserted, so the node holds key_count children
+    const size_t to_move = pos.node->key_count - pos.child_idx;
 
-    _BTreeMap_move_children(from_pos, to_pos);
+    memmove(&pos.node->children[pos.child_idx + 1], &pos.node->children[pos.child_idx], to_move * sizeof(pos.node->children[0]));
 
     pos.node->children[pos.child_idx] = (_BTreeMapNode *)child;
+    pos.node->children[pos.child_idx]->parent = pos.node;
+
+    if (this->layout.has_order_statistics)
+    {
+        size_t *child_lens = _BTreeMap_child_lens(this, pos.node);
+        memmove(&child_lens[pos.child_idx + 1], &child_lens[pos.child_idx], to_move * sizeof(size_t));
+        child_lens[pos.child_idx] = _BTreeMap_node_len(this, child);
+    }
 }
 
 void _BTreeMap_remove_entry_at(const BTreeMap *this, const BTreeMapEntryPos *pos)
@@ -1262,22 +1709,35 @@ void _BTreeMap_remove_entry_at(const BTreeMap *this, const BTreeMapEntryPos *pos
     from_pos.node->key_count--;
 }
 
-void _BTreeMap_remove_child_at(BTreeMapChildPos pos)
+void _BTreeMap_remove_child_at(const BTreeMap *this, BTreeMapChildPos pos)
 {
-    BTreeMapChildPos from_pos = {
-        .node = pos.node,
-        .child_idx = pos.child_idx + 1,
-    };
+    // The entry that separated the removed child has already been removed, so the node holds key_count + 2 children
+    const size_t to_move = pos.node->key_count + 1 - pos.child_idx;
 
-    BTreeMapChildPos to_pos = pos;
+    memmove(&pos.node->children[pos.child_idx], &pos.node->children[pos.child_idx + 1], to_move * sizeof(pos.node->children[0]));
 
-    _BTreeMap_move_children(from_pos, to_pos);
+    if (this->layout.has_order_statistics)
+    {
+        size_t *child_lens = _BTreeMap_child_lens(this, pos.node);
+        memmove(&child_lens[pos.child_idx], &child_lens[pos.child_idx + 1], to_move * sizeof(size_t));
+    }
 }
 
-void _BTreeMap_split(const BTreeMap *this, _BTreeMapNode *left, _BTreeMapNode *right, BTreeMapEntryPos *separator_pos)
+static _BTreeMapNode *_BTreeMap_new_node(const BTreeMap *this, const _BTreeMapNode *parent, bool is_leaf)
 {
-    _BTreeMapNode_new(right, left->parent, left->is_leaf);
+    _BTreeMapNode *node = _BTreeMapNodePool_alloc(this->pool, is_leaf ? this->layout.leaf_size : this->layout.internal_size, is_leaf);
+    _BTreeMapNode_new(node, parent, is_leaf, this->layout.children_offset);
 
+    return node;
+}
+
+static void _BTreeMap_free_node(const BTreeMap *this, _BTreeMapNode *node)
+{
+    _BTreeMapNodePool_free(this->pool, node, node->is_leaf);
+}
+
+void _BTreeMap_split(const BTreeMap *this, _BTreeMapNode *left, _BTreeMapNode *right, BTreeMapEntryPos *separator_pos)
+{
     size_t separator_idx = left->key_count / 2;
 
     *separator_pos = BTreeMapEntryPos_new(left, separator_idx);
@@ -1286,18 +1746,13 @@ void _BTreeMap_split(const BTreeMap *this, _BTreeMapNode *left, _BTreeMapNode *r
 
     if (!left->is_leaf)
     {
-        _BTreeMap_move_children(BTreeMapChildPos_new(left, separator_idx + 1), BTreeMapChildPos_new(right, 0));
+        _BTreeMap_move_children(this, BTreeMapChildPos_new(left, separator_idx + 1), BTreeMapChildPos_new(right, 0));
     }
 
     right->key_count = left->key_count - (separator_idx + 1);
     left->key_count -= right->key_count;
 }
 
-static size_t _BTreeMap_node_size(const BTreeMap *this)
-{
-    return ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_BTreeMapNode)) + ROUND_SIZE_UP_TO_MAX_ALIGN(BTREEMAP_MAXIMUM_KEY_COUNT * this->key_props.size) + ROUND_SIZE_UP_TO_MAX_ALIGN(BTREEMAP_MAXIMUM_KEY_COUNT * this->value_props.size);
-}
-
 static _BTreeMapNode *_BTreeMap_successor(const BTreeMap *this, const BTreeMapEntryPos *entry)
 {
     _BTreeMapNode *current = entry->node->children[entry->kv_idx + 1];
@@ -1324,7 +1779,7 @@ static BTreeMapEntryPos _BTreeMap_predecessor(const BTreeMap *this, const BTreeM
 
     while (!current->is_leaf)
     {
-        current = current->children[current->key_count - 1];
+        current = current->children[current->key_count];
     }
 
     BTreeMapEntryPos result = {
@@ -1447,6 +1902,229 @@ typedef struct
     };
 } _BTreeMapFindResult;
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+static size_t _BTreeMap_count_less_i32(const int32_t *keys, size_t count, int32_t key)
+{
+    size_t result = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // every lane that compares less is -1, so subtracting the masks counts them per lane
+    __m128i needle = _mm_set1_epi32(key);
+    __m128i counts = _mm_setzero_si128();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i lanes = _mm_loadu_si128((const __m128i *)(keys + i));
+        counts = _mm_sub_epi32(counts, _mm_cmplt_epi32(lanes, needle));
+    }
+
+    int32_t lane_counts[4];
+    _mm_storeu_si128((__m128i *)lane_counts, counts);
+    result = lane_counts[0] + lane_counts[1] + lane_counts[2] + lane_counts[3];
+#endif
+
+    for (; i < count; i++)
+    {
+        result += keys[i] < key;
+    }
+
+    return result;
+}
+
+static size_t _BTreeMap_count_less_u32(const uint32_t *keys, size_t count, uint32_t key)
+{
+    size_t result = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // flipping the sign bit turns the unsigned order into the signed one
+    __m128i bias = _mm_set1_epi32(INT32_MIN);
+    __m128i needle = _mm_xor_si128(_mm_set1_epi32((int32_t)key), bias);
+    __m128i counts = _mm_setzero_si128();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i lanes = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+        counts = _mm_sub_epi32(counts, _mm_cmplt_epi32(lanes, needle));
+    }
+
+    int32_t lane_counts[4];
+    _mm_storeu_si128((__m128i *)lane_counts, counts);
+    result = lane_counts[0] + lane_counts[1] + lane_counts[2] + lane_counts[3];
+#endif
+
+    for (; i < count; i++)
+    {
+        result += keys[i] < key;
+    }
+
+    return result;
+}
+
+static size_t _BTreeMap_count_less_i64(const int64_t *keys, size_t count, int64_t key)
+{
+    size_t result = 0;
+    size_t i = 0;
+
+#if defined(__SSE4_2__)
+    __m128i needle = _mm_set1_epi64x(key);
+    __m128i counts = _mm_setzero_si128();
+
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i lanes = _mm_loadu_si128((const __m128i *)(keys + i));
+        counts = _mm_sub_epi64(counts, _mm_cmpgt_epi64(needle, lanes));
+    }
+
+    int64_t lane_counts[2];
+    _mm_storeu_si128((__m128i *)lane_counts, counts);
+    result = lane_counts[0] + lane_counts[1];
+#endif
+
+    for (; i < count; i++)
+    {
+        result += keys[i] < key;
+    }
+
+    return result;
+}
+
+static size_t _BTreeMap_count_less_u64(const uint64_t *keys, size_t count, uint64_t key)
+{
+    size_t result = 0;
+    size_t i = 0;
+
+#if defined(__SSE4_2__)
+    __m128i bias = _mm_set1_epi64x(INT64_MIN);
+    __m128i needle = _mm_xor_si128(_mm_set1_epi64x((int64_t)key), bias);
+    __m128i counts = _mm_setzero_si128();
+
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i lanes = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+        counts = _mm_sub_epi64(counts, _mm_cmpgt_epi64(needle, lanes));
+    }
+
+    int64_t lane_counts[2];
+    _mm_storeu_si128((__m128i *)lane_counts, counts);
+    result = lane_counts[0] + lane_counts[1];
+#endif
+
+    for (; i < count; i++)
+    {
+        result += keys[i] < key;
+    }
+
+    return result;
+}
+
+// Halves the (sorted) keys without branching on the comparison until few enough are left to count the smaller ones
+#define _BTREEMAP_INTEGER_SEARCH(type, count_less, keys_ptr, count, key_ptr, found, result)    \
+    do                                                                                         \
+    {                                                                                          \
+        const type *_keys = (const type *)(keys_ptr);                                          \
+        const type _key = *(const type *)(key_ptr);                                            \
+        const type *_base = _keys;                                                             \
+        size_t _n = (count);                                                                   \
+                                                                                               \
+        while (_n > BTREEMAP_LINEAR_SEARCH_THRESHOLD)                                          \
+        {                                                                                      \
+            size_t _half = _n / 2;                                                             \
+            _base = _base[_half - 1] < _key ? _base + _half : _base;                           \
+            _n -= _half;                                                                       \
+        }                                                                                      \
+                                                                                               \
+        (result) = (size_t)(_base - _keys) + count_less(_base, _n, _key);                      \
+        *(found) = (result) < (count) && _keys[(result)] == _key;                              \
+    } while (false)
+
+// Returns the index of the first of the sorted keys that is not less than key, and whether that key is equal to it
+static size_t _BTreeMap_search_keys(const BTreeMapKeyProps *key_props, const uint8_t *keys, size_t key_count, const void *key, bool *found)
+{
+    size_t result;
+
+    switch (key_props->kind)
+    {
+    case BTREEMAP_KEY_KIND_I32:
+        _BTREEMAP_INTEGER_SEARCH(int32_t, _BTreeMap_count_less_i32, keys, key_count, key, found, result);
+        return result;
+    case BTREEMAP_KEY_KIND_U32:
+        _BTREEMAP_INTEGER_SEARCH(uint32_t, _BTreeMap_count_less_u32, keys, key_count, key, found, result);
+        return result;
+    case BTREEMAP_KEY_KIND_I64:
+        _BTREEMAP_INTEGER_SEARCH(int64_t, _BTreeMap_count_less_i64, keys, key_count, key, found, result);
+        return result;
+    case BTREEMAP_KEY_KIND_U64:
+        _BTREEMAP_INTEGER_SEARCH(uint64_t, _BTreeMap_count_less_u64, keys, key_count, key, found, result);
+        return result;
+    case BTREEMAP_KEY_KIND_OPAQUE:
+        break;
+    }
+
+    size_t low = 0;
+    size_t high = key_count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        int32_t ordering = key_props->cmp(key, keys + mid * key_props->size);
+
+        if (ordering > 0)
+        {
+            low = mid + 1;
+        }
+        else if (ordering < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            *found = true;
+            return mid;
+        }
+    }
+
+    *found = false;
+    return low;
+}
+
+static size_t _BTreeMap_search_node(const BTreeMap *this, const _BTreeMapNode *node, const void *key, bool *found)
+{
+    if (this->key_props.prefix == NULL)
+    {
+        return _BTreeMap_search_keys(&this->key_props, _BTreeMapNode_keys(node), node->key_count, key, found);
+    }
+
+    // narrow down to the keys sharing the prefix of key, which are the only ones cmp has to look at
+    const uint64_t *prefixes = _BTreeMap_prefixes(this, node);
+    uint64_t key_prefix = this->key_props.prefix(key);
+    bool prefix_found;
+    size_t idx;
+
+    _BTREEMAP_INTEGER_SEARCH(uint64_t, _BTreeMap_count_less_u64, prefixes, node->key_count, &key_prefix, &prefix_found, idx);
+
+    for (; idx < node->key_count && prefixes[idx] == key_prefix; idx++)
+    {
+        int32_t ordering = this->key_props.cmp(key, _BTreeMapNode_keys(node) + idx * this->key_props.size);
+
+        if (ordering <= 0)
+        {
+            *found = ordering == 0;
+            return idx;
+        }
+    }
+
+    *found = false;
+    return idx;
+}
+
 static _BTreeMapFindResult _BTreeMap_find(BTreeMap *this, const void *key)
 {
     _BTreeMapFindResult result;
@@ -1455,16 +2133,10 @@ static _BTreeMapFindResult _BTreeMap_find(BTreeMap *this, const void *key)
 
     while (true)
     {
-        BTreeMapEntryPos current_pos = BTreeMapEntryPos_new(current, 0);
-        size_t i = 0;
-
-        for (; i < current->key_count && this->key_props.cmp(key, BTreeMapEntryPos_to_entry(current_pos, this).key) > 0;)
-        {
-            current_pos.kv_idx += 1;
-            i += 1;
-        }
+        bool found;
+        size_t i = _BTreeMap_search_node(this, current, key, &found);
 
-        if (i < current->key_count && this->key_props.cmp(key, BTreeMapEntryPos_to_entry(current_pos, this).key) == 0)
+        if (found)
         {
             result.kind = GET_RESULT_KIND_FOUND;
             result.found.node = current;
@@ -1516,7 +2188,7 @@ static BTreeMapEntryPos _BTreeMap_lower_bound(const BTreeMap *this, const RangeB
     }
     else
     {
-        BTreeMapEntryPos entry = result.go_down;
+        entry = result.go_down;
 
         if (result.go_down.kv_idx >= result.go_down.node->key_count)
         {
@@ -1536,7 +2208,7 @@ static BTreeMapEntryPos _BTreeMap_upper_bound(const BTreeMap *this, const RangeB
         if (rightmost->key_count == 0)
         {
             // if root and empty
-            rightmost = NULL;
+            return BTreeMapEntryPos_new(NULL, 0);
         }
 
         return BTreeMapEntryPos_new(rightmost, rightmost->key_count - 1);
@@ -1563,6 +2235,10 @@ static BTreeMapEntryPos _BTreeMap_upper_bound(const BTreeMap *this, const RangeB
         {
             entry = _BTreeMap_previous_inorder(this, &entry);
         }
+        else
+        {
+            entry.kv_idx -= 1;
+        }
     }
 
     return entry;
@@ -1584,18 +2260,17 @@ static void _BTreeMap_fix_overflow_up(BTreeMap *this, _BTreeMapNode *node)
 {
     _BTreeMapNode *current = node;
 
-    while (current->key_count == BTREEMAP_MAXIMUM_KEY_COUNT)
+    while (current->key_count == this->layout.max_key_count)
     {
         BTreeMapEntryPos separator_pos;
-        _BTreeMapNode *right = malloc(_BTreeMap_node_size(this));
+        _BTreeMapNode *right = _BTreeMap_new_node(this, current->parent, current->is_leaf);
         _BTreeMap_split(this, current, right, &separator_pos);
 
         BTreeMapEntry separator = BTreeMapEntryPos_to_entry(separator_pos, this);
 
         if (current->parent == NULL)
         {
-            _BTreeMapNode *new_root = malloc(_BTreeMap_node_size(this));
-            _BTreeMapNode_new(new_root, NULL, false);
+            _BTreeMapNode *new_root = _BTreeMap_new_node(this, NULL, false);
             this->root = new_root;
 
             BTreeMapEntryPos entry_pos = {
@@ -1611,6 +2286,9 @@ static void _BTreeMap_fix_overflow_up(BTreeMap *this, _BTreeMapNode *node)
             right->parent = new_root;
 
             _BTreeMap_remove_entry_at(this, &separator_pos);
+
+            _BTreeMap_update_child_len(this, new_root, 0);
+            _BTreeMap_update_child_len(this, new_root, 1);
             break;
         }
         else
@@ -1623,10 +2301,11 @@ static void _BTreeMap_fix_overflow_up(BTreeMap *this, _BTreeMapNode *node)
                 .kv_idx = child_pos.child_idx,
             };
             _BTreeMap_insert_entry_at(this, &separator, &entry_pos);
-            parent->children[child_pos.child_idx + 1] = right;
-
             _BTreeMap_remove_entry_at(this, &separator_pos);
 
+            _BTreeMap_insert_child_at(this, right, BTreeMapChildPos_new(parent, child_pos.child_idx + 1));
+            _BTreeMap_update_child_len(this, parent, child_pos.child_idx);
+
             current = parent;
         }
     }
@@ -1651,6 +2330,7 @@ void BTreeMap_insert(BTreeMap *this, const void *key, const void *value)
     else
     {
         _BTreeMap_insert_entry_at(this, &new_entry, &result.go_down);
+        _BTreeMap_update_ancestor_lens(this, result.go_down.node, 1);
 
         this->length += 1;
 
@@ -1671,13 +2351,17 @@ static void _BTreeMap_borrow(const BTreeMap *this, BTreeMapEntryPos from_pos, BT
     if (!from_pos.node->is_leaf)
     {
         _BTreeMapNode *from_child = BTreeMapChildPos_to_child(from_child_pos);
+        _BTreeMap_remove_child_at(this, from_child_pos);
         _BTreeMap_insert_child_at(this, from_child, to_child_pos);
-        _BTreeMap_remove_child_at(from_child_pos);
     }
+
+    _BTreeMap_update_child_len(this, separator_pos.node, separator_pos.kv_idx);
+    _BTreeMap_update_child_len(this, separator_pos.node, separator_pos.kv_idx + 1);
 }
 
 static void _BTreeMap_merge(const BTreeMap *this, _BTreeMapNode *left, _BTreeMapNode *right, BTreeMapEntryPos separator_pos)
 {
+    size_t left_child_count = left->key_count + 1;
     BTreeMapEntryPos left_last_entry = BTreeMapEntryPos_new(left, left->key_count);
 
     BTreeMapEntry separator = BTreeMapEntryPos_to_entry(separator_pos, this);
@@ -1686,24 +2370,25 @@ static void _BTreeMap_merge(const BTreeMap *this, _BTreeMapNode *left, _BTreeMap
 
     BTreeMapEntryPos right_first_entry = BTreeMapEntryPos_new(right, 0);
     _BTreeMap_move_entries(this, right_first_entry, left_last_entry);
-    left->key_count++;
+    left->key_count += right->key_count;
 
     if (!left->is_leaf)
     {
-        _BTreeMap_move_children(BTreeMapChildPos_new(right, 0), BTreeMapChildPos_new(left, left->key_count + 1));
+        _BTreeMap_move_children(this, BTreeMapChildPos_new(right, 0), BTreeMapChildPos_new(left, left_child_count));
     }
 
-    free(right);
+    _BTreeMap_free_node(this, right);
 
     _BTreeMap_remove_entry_at(this, &separator_pos);
-    _BTreeMap_remove_child_at(BTreeMapChildPos_new(separator_pos.node, separator_pos.kv_idx + 1));
+    _BTreeMap_remove_child_at(this, BTreeMapChildPos_new(separator_pos.node, separator_pos.kv_idx + 1));
+    _BTreeMap_update_child_len(this, separator_pos.node, separator_pos.kv_idx);
 }
 
 static void _BTreeMap_fix_underflow_up(BTreeMap *this, _BTreeMapNode *node)
 {
     _BTreeMapNode *current = node;
 
-    while (current->key_count < BTREEMAP_MINIMUM_KEY_COUNT)
+    while (current->key_count < this->layout.min_key_count)
     {
         bool is_root = current->parent == NULL;
         if (is_root)
@@ -1715,7 +2400,7 @@ static void _BTreeMap_fix_underflow_up(BTreeMap *this, _BTreeMapNode *node)
                 this->root = this->root->children[0];
                 this->root->parent = NULL;
 
-                free(old_root);
+                _BTreeMap_free_node(this, old_root);
             }
 
             break;
@@ -1725,9 +2410,9 @@ static void _BTreeMap_fix_underflow_up(BTreeMap *this, _BTreeMapNode *node)
         size_t child_idx = _BTreeMapNode_child_pos(parent, current).child_idx;
 
         bool has_left_sibling = child_idx > 0;
-        bool has_right_sibling = child_idx < parent->key_count + 1;
+        bool has_right_sibling = child_idx < parent->key_count;
 
-        if (has_left_sibling && parent->children[child_idx - 1]->key_count > BTREEMAP_MINIMUM_KEY_COUNT)
+        if (has_left_sibling && parent->children[child_idx - 1]->key_count > this->layout.min_key_count)
         {
             _BTreeMapNode *left = parent->children[child_idx - 1];
             size_t separator_idx = child_idx - 1;
@@ -1742,7 +2427,7 @@ static void _BTreeMap_fix_underflow_up(BTreeMap *this, _BTreeMapNode *node)
 
             break;
         }
-        else if (has_right_sibling && parent->children[child_idx + 1]->key_count > BTREEMAP_MINIMUM_KEY_COUNT)
+        else if (has_right_sibling && parent->children[child_idx + 1]->key_count > this->layout.min_key_count)
         {
             _BTreeMapNode *right = parent->children[child_idx + 1];
             size_t separator_idx = child_idx;
@@ -1792,3986 +2477,15760 @@ void BTreeMap_remove(BTreeMap *this, const void *key)
         _swap(entry.key, pred.key, this->key_props.size);
         _swap(entry.value, pred.value, this->value_props.size);
 
+        if (this->key_props.prefix != NULL)
+        {
+            SWAP(_BTreeMap_prefixes(this, entry_pos.node)[entry_pos.kv_idx], _BTreeMap_prefixes(this, pred_pos.node)[pred_pos.kv_idx]);
+        }
+
         entry_pos = pred_pos;
     }
 
     _BTreeMap_drop_entry_at(this, &entry_pos);
     _BTreeMap_remove_entry_at(this, &entry_pos);
+    _BTreeMap_update_ancestor_lens(this, entry_pos.node, -1);
 
     this->length -= 1;
 
     _BTreeMap_fix_underflow_up(this, entry_pos.node);
 }
 
-void BTreeMap_new(BTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
+// Nodes hold between t - 1 and 2 * t - 1 entries, larger nodes make the tree shallower at the cost of longer shifts
+void BTreeMap_with_branching_factor(BTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props, size_t t)
 {
+    assert(t >= BTREEMAP_MINIMUM_T);
+    assert(key_props->kind == BTREEMAP_KEY_KIND_OPAQUE ||
+           key_props->size == (key_props->kind == BTREEMAP_KEY_KIND_I32 || key_props->kind == BTREEMAP_KEY_KIND_U32 ? 4 : 8));
+    assert(key_props->prefix == NULL || key_props->kind == BTREEMAP_KEY_KIND_OPAQUE);
+
     this->key_props = *key_props;
     this->value_props = *value_props;
 
+    _BTreeMapLayout *layout = &this->layout;
+    layout->min_key_count = t - 1;
+    layout->max_key_count = 2 * t - 1;
+    layout->prefixes_offset = ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_BTreeMapNode)) + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * key_props->size);
+    layout->values_offset = layout->prefixes_offset + (key_props->prefix != NULL ? ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * sizeof(uint64_t)) : 0);
+    layout->children_offset = layout->values_offset + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * value_props->size);
+    layout->leaf_size = layout->children_offset;
+    layout->internal_size = ROUND_SIZE_UP_TO_MAX_ALIGN(layout->children_offset + (layout->max_key_count + 1) * sizeof(_BTreeMapNode *));
+    layout->has_order_statistics = false;
+    layout->child_lens_offset = layout->internal_size;
+
+    this->pool = malloc(sizeof(*this->pool));
+    _BTreeMapNodePool_new(this->pool);
+
     this->length = 0;
-    this->root = malloc(_BTreeMap_node_size(this));
-    _BTreeMapNode_new(this->root, NULL, true);
+    this->root = _BTreeMap_new_node(this, NULL, true);
 }
 
-void BTreeMap_drop(BTreeMap *this)
+static size_t _BTreeMap_default_branching_factor(const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
 {
-    if (this->length > 0)
-    {
-        BTreeMapEntryPos current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this), 0);
-
-        while (current.node != NULL)
-        {
-            _BTreeMap_drop_entry_at(this, &current);
-            current = _BTreeMap_next_inorder(this, &current);
-        }
-    }
+    size_t entry_size = key_props->size + value_props->size + (key_props->prefix != NULL ? sizeof(uint64_t) : 0);
+    entry_size = MAX(entry_size, 1);
+    size_t t = (BTREEMAP_TARGET_NODE_SIZE / entry_size + 1) / 2;
+    t = MAX(t, BTREEMAP_MINIMUM_T);
+    t = MIN(t, BTREEMAP_MAXIMUM_T);
 
-    free(this->root);
+    return t;
 }
 
-// [BTreeMapRangeIter]
-
-typedef struct
+void BTreeMap_new(BTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
 {
-    const BTreeMap *map;
-    BTreeMapEntryPos current;
-    BTreeMapEntryPos current_back;
-    BTreeMapEntry buffer;
-    bool is_done;
-} BTreeMapRangeIter;
+    BTreeMap_with_branching_factor(this, key_props, value_props, _BTreeMap_default_branching_factor(key_props, value_props));
+}
 
-void BTreeMapRangeIter_new(BTreeMapRangeIter *this, const BTreeMap *map, const RangeBound *start, const RangeBound *end)
+// A prefix for keys ordered bytewise, with a proper prefix first: the first 8 bytes read big-endian, zero padded
+uint64_t BTreeMap_bytes_prefix(const void *bytes, size_t len)
 {
-    this->map = map;
-
-    BTreeMapEntryPos lower_bound = _BTreeMap_lower_bound(this->map, start);
-    BTreeMapEntryPos upper_bound = _BTreeMap_upper_bound(this->map, end);
+    uint64_t prefix = 0;
 
-    if (lower_bound.node == NULL || upper_bound.node == NULL)
-    {
-        this->is_done = true;
-    }
-    else
+    for (size_t i = 0; i < 8; i++)
     {
-        this->is_done = false;
-        this->current = lower_bound;
-        this->current_back = upper_bound;
+        prefix = (prefix << 8) | (i < len ? ((const uint8_t *)bytes)[i] : 0);
     }
+
+    return prefix;
 }
 
-BTreeMapEntry *BTreeMapRangeIter_next(BTreeMapRangeIter *this)
+size_t BTreeMap_branching_factor(const BTreeMap *this)
 {
-    if (this->is_done)
-    {
-        return NULL;
-    }
+    return this->layout.min_key_count + 1;
+}
 
-    bool is_last = this->current.node == this->current_back.node && this->current.kv_idx == this->current_back.kv_idx;
+// Makes internal nodes track how many entries each child holds, which BTreeMap_nth, BTreeMap_rank and
+// BTreeMap_range_len need. Must be called while the map is still empty.
+void BTreeMap_enable_order_statistics(BTreeMap *this)
+{
+    assert(this->length == 0 && this->root->is_leaf);
 
-    if (is_last)
-    {
-        this->is_done = true;
-        this->buffer = BTreeMapEntryPos_to_entry(this->current, this->map);
-        return &this->buffer;
-    }
-    else
-    {
-        this->buffer = BTreeMapEntryPos_to_entry(this->current, this->map);
-        this->current = _BTreeMap_next_inorder(this->map, &this->current);
-        return &this->buffer;
-    }
+    this->layout.has_order_statistics = true;
+    this->layout.internal_size = ROUND_SIZE_UP_TO_MAX_ALIGN(this->layout.child_lens_offset + (this->layout.max_key_count + 1) * sizeof(size_t));
 }
 
-void *BTreeMapRangeIter_next_back(BTreeMapRangeIter *this)
+// Entry at index in key order, or an entry of NULLs if index is out of bounds
+BTreeMapEntry BTreeMap_nth(const BTreeMap *this, size_t index)
 {
-    if (this->is_done)
+    assert(this->layout.has_order_statistics);
+
+    if (index >= this->length)
     {
-        return NULL;
+        return _BTreeMapEntry_new(NULL, NULL);
     }
 
-    bool is_last = this->current.node == this->current_back.node && this->current.kv_idx == this->current_back.kv_idx;
+    _BTreeMapNode *current = this->root;
 
-    if (is_last)
+    while (!current->is_leaf)
     {
-        this->is_done = true;
-        this->buffer = BTreeMapEntryPos_to_entry(this->current_back, this->map);
-        return &this->buffer;
-    }
-    else
-    {
-        this->buffer = BTreeMapEntryPos_to_entry(this->current_back, this->map);
-        this->current_back = _BTreeMap_previous_inorder(this->map, &this->current_back);
-        return &this->buffer;
+        const size_t *child_lens = _BTreeMap_child_lens(this, current);
+        size_t i = 0;
+
+        for (; index >= child_lens[i]; i++)
+        {
+            index -= child_lens[i];
+
+            if (index == 0)
+            {
+                return BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new(current, i), this);
+            }
+
+            index -= 1;
+        }
+
+        current = current->children[i];
     }
-}
 
-void BTreeMapRangeIter_drop(BTreeMapRangeIter *this)
-{
+    return BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new(current, index), this);
 }
 
-BTreeMapRangeIter BTreeMap_range(const BTreeMap *this, const RangeBound *start, const RangeBound *end)
+static size_t _BTreeMap_rank(const BTreeMap *this, const void *key, bool *found)
 {
-    BTreeMapRangeIter iter;
-    BTreeMapRangeIter_new(&iter, this, start, end);
+    assert(this->layout.has_order_statistics);
 
-    return iter;
-}
+    _BTreeMapNode *current = this->root;
+    size_t rank = 0;
 
-// [BTreeSet]
+    while (true)
+    {
+        size_t idx = _BTreeMap_search_node(this, current, key, found);
+        rank += idx;
 
-typedef struct
-{
-    size_t size;
-    CmpFn cmp;
-    DropFn drop;
-} BTreeSetElementProps;
+        if (current->is_leaf)
+        {
+            return rank;
+        }
 
-typedef struct
-{
-    BTreeMap *map;
-} BTreeSet;
+        // the children left of the key (or of the subtree to descend into) are all smaller
+        const size_t *child_lens = _BTreeMap_child_lens(this, current);
+        size_t smaller_children = *found ? idx + 1 : idx;
 
-void BTreeSet_new(BTreeSet *this, const BTreeSetElementProps *element_props)
-{
-    this->map = malloc(sizeof(*this->map));
+        for (size_t i = 0; i < smaller_children; i++)
+        {
+            rank += child_lens[i];
+        }
 
-    BTreeMapKeyProps key_props = {
-        .size = element_props->size,
-        .cmp = element_props->cmp,
-        .drop = element_props->drop,
-    };
-    BTreeMapValueProps value_props = {
-        .size = sizeof(uint8_t),
-    };
-    BTreeMap_new(this->map, &key_props, &value_props);
-}
+        if (*found)
+        {
+            return rank;
+        }
 
-bool BTreeSet_contains(const BTreeSet *this, const void *element)
-{
-    return BTreeMap_get(this->map, element) == NULL ? false : true;
+        current = current->children[idx];
+    }
 }
 
-size_t BTreeSet_len(const BTreeSet *this)
+// Number of keys less than key
+size_t BTreeMap_rank(const BTreeMap *this, const void *key)
 {
-    return BTreeMap_len(this->map);
+    bool found;
+    return _BTreeMap_rank(this, key, &found);
 }
 
-void BTreeSet_drop(BTreeSet *this)
+// Number of keys between the bounds
+size_t BTreeMap_range_len(const BTreeMap *this, const RangeBound *start, const RangeBound *end)
 {
-    BTreeMap_drop(this->map);
-    free(this->map);
+    bool found;
+    size_t before_start = 0;
+    size_t up_to_end = this->length;
+
+    if (start->kind != RANGE_BOUND_KIND_UNBOUND)
+    {
+        before_start = _BTreeMap_rank(this, start->kind == RANGE_BOUND_KIND_INCLUDED ? start->included.value : start->excluded.value, &found);
+        before_start += found && start->kind == RANGE_BOUND_KIND_EXCLUDED;
+    }
+
+    if (end->kind != RANGE_BOUND_KIND_UNBOUND)
+    {
+        up_to_end = _BTreeMap_rank(this, end->kind == RANGE_BOUND_KIND_INCLUDED ? end->included.value : end->excluded.value, &found);
+        up_to_end += found && end->kind == RANGE_BOUND_KIND_INCLUDED;
+    }
+
+    return up_to_end > before_start ? up_to_end - before_start : 0;
 }
 
-void BTreeSet_insert(BTreeSet *this, const void *element)
+void BTreeMap_drop(BTreeMap *this)
 {
-    uint8_t i = 0;
-    BTreeMap_insert(this->map, element, &i);
+    if (this->length > 0)
+    {
+        BTreeMapEntryPos current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this), 0);
+
+        while (current.node != NULL)
+        {
+            _BTreeMap_drop_entry_at(this, &current);
+            current = _BTreeMap_next_inorder(this, &current);
+        }
+    }
+
+    _BTreeMapNodePool_drop(this->pool);
+    free(this->pool);
 }
 
-void BTreeSet_remove(BTreeSet *this, const void *element)
+// Moves all nodes into one contiguous block in breadth-first order, so that searches and scans touch neighbouring
+// memory. This also gives the memory of freed nodes back.
+void BTreeMap_compact(BTreeMap *this)
 {
-    BTreeMap_remove(this->map, element);
-}
+    Vec order;
+    Vec_new(&order, sizeof(_BTreeMapNode *), NULL);
+    Vec_push(&order, &this->root);
 
-// [BTreeSetRangeIter]
+    size_t size = 0;
 
-typedef struct
-{
-    BTreeMapRangeIter *iter;
-} BTreeSetRangeIter;
+    for (size_t i = 0; i < Vec_len(&order); i++)
+    {
+        _BTreeMapNode *node = *(_BTreeMapNode **)Vec_get(&order, i);
+        size += node->is_leaf ? this->layout.leaf_size : this->layout.internal_size;
 
-void BTreeSetRangeIter_new(BTreeSetRangeIter *this, const BTreeSet *set, const RangeBound *start, const RangeBound *end)
-{
-    this->iter = malloc(sizeof(*this->iter));
-    BTreeMapRangeIter_new(this->iter, set->map, start, end);
-}
+        for (size_t c = 0; !node->is_leaf && c < node->key_count + 1; c++)
+        {
+            Vec_push(&order, &node->children[c]);
+        }
+    }
 
-void *BTreeSetRangeIter_next(BTreeSetRangeIter *this)
-{
-    BTreeMapEntry *next = BTreeMapRangeIter_next(this->iter);
+    _BTreeMapNodePool pool;
+    _BTreeMapNodePool_new(&pool);
+    _BTreeMapNodePool_add_chunk(&pool, size);
 
-    return next == NULL ? NULL : next->key;
-}
+    for (size_t i = 0; i < Vec_len(&order); i++)
+    {
+        _BTreeMapNode **slot = Vec_get_mut(&order, i);
+        _BTreeMapNode *node = *slot;
+        size_t node_size = node->is_leaf ? this->layout.leaf_size : this->layout.internal_size;
 
-void *BTreeSetRangeIter_next_back(BTreeSetRangeIter *this)
-{
-    BTreeMapEntry *next = BTreeMapRangeIter_next_back(this->iter);
+        *slot = _BTreeMapNodePool_alloc(&pool, node_size, node->is_leaf);
+        memcpy(*slot, node, node_size);
+        (*slot)->children = node->is_leaf ? NULL : (_BTreeMapNode **)((uint8_t *)*slot + this->layout.children_offset);
+    }
 
-    return next == NULL ? NULL : next->key;
+    // in breadth-first order the children of every node follow those of the nodes before it
+    size_t next_child = 1;
+
+    for (size_t i = 0; i < Vec_len(&order); i++)
+    {
+        _BTreeMapNode *node = *(_BTreeMapNode **)Vec_get(&order, i);
+
+        for (size_t c = 0; !node->is_leaf && c < node->key_count + 1; c++)
+        {
+            node->children[c] = *(_BTreeMapNode **)Vec_get(&order, next_child++);
+            node->children[c]->parent = node;
+        }
+    }
+
+    this->root = *(_BTreeMapNode **)Vec_get(&order, 0);
+    this->root->parent = NULL;
+
+    _BTreeMapNodePool_drop(this->pool);
+    *this->pool = pool;
+
+    Vec_drop(&order);
 }
 
-void BTreeSetRangeIter_drop(BTreeSetRangeIter *this)
+// Appends entries in ascending key order to an empty map, filling nodes from left to right without searching
+typedef struct
 {
-    BTreeMapRangeIter_drop(this->iter);
-}
+    BTreeMap *map;
+    _BTreeMapNode *leaf;
+    const void *previous_key;
+} _BTreeMapBulkBuilder;
 
-BTreeSetRangeIter BTreeSet_range(const BTreeSet *this, const RangeBound *start, const RangeBound *end)
+static void _BTreeMapBulkBuilder_new(_BTreeMapBulkBuilder *this, BTreeMap *map)
 {
-    BTreeSetRangeIter iter;
-    BTreeSetRangeIter_new(&iter, this, start, end);
+    assert(map->length == 0);
 
-    return iter;
+    this->map = map;
+    this->leaf = map->root;
+    this->previous_key = NULL;
 }
 
-// [BTreeSetUnionIter]
-
-typedef enum
+static void _BTreeMapBulkBuilder_push(_BTreeMapBulkBuilder *this, const void *key, const void *value)
 {
-    BTREE_SET_UNION_ITER_SIDE_A,
-    BTREE_SET_UNION_ITER_SIDE_B,
-} BTreeSetUnionIterSide;
+    BTreeMap *map = this->map;
 
-typedef struct
-{
-    const BTreeSet *a;
-    const BTreeSet *b;
-    BTreeMapEntryPos current_a;
-    bool a_is_done;
-    BTreeMapEntryPos current_b;
-    bool b_is_done;
-} BTreeSetUnionIter;
+    // a node holding max_key_count keys is one that is about to split, so built nodes stop one key short of it
+    const size_t fill = map->layout.max_key_count - 1;
 
-void BTreeSetUnionIter_new(BTreeSetUnionIter *this, const BTreeSet *a, const BTreeSet *b)
-{
-    this->a = a;
-    this->b = b;
+    assert(this->previous_key == NULL || map->key_props.cmp(this->previous_key, key) < 0);
 
-    if (BTreeSet_len(this->a) == 0)
-    {
-        this->a_is_done = true;
-    }
-    else
-    {
-        this->current_a = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
-        this->a_is_done = false;
-    }
+    BTreeMapEntry entry = _BTreeMapEntry_new((void *)key, (void *)value);
+    BTreeMapEntryPos pos;
 
-    if (BTreeSet_len(this->b) == 0)
+    if (this->leaf->key_count < fill)
     {
-        this->a_is_done = true;
+        pos = BTreeMapEntryPos_new(this->leaf, this->leaf->key_count);
+        _BTreeMap_insert_entry_at(map, &entry, &pos);
     }
     else
     {
-        this->current_b = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->b->map), 0);
-        this->b_is_done = false;
+        // the entry becomes the last key of the lowest ancestor with room, and a new right spine grows below it
+        _BTreeMapNode *open = this->leaf->parent;
+        size_t height = 1;
+
+        while (open != NULL && open->key_count >= fill)
+        {
+            open = open->parent;
+            height++;
+        }
+
+        if (open == NULL)
+        {
+            open = _BTreeMap_new_node(map, NULL, false);
+            open->children[0] = map->root;
+            map->root->parent = open;
+            map->root = open;
+        }
+
+        pos = BTreeMapEntryPos_new(open, open->key_count);
+        _BTreeMap_insert_entry_at(map, &entry, &pos);
+
+        _BTreeMapNode *parent = open;
+
+        for (size_t level = height; level > 0; level--)
+        {
+            _BTreeMapNode *child = _BTreeMap_new_node(map, parent, level == 1);
+            parent->children[parent->key_count] = child;
+            parent = child;
+        }
+
+        this->leaf = parent;
     }
+
+    this->previous_key = BTreeMapEntryPos_to_entry(pos, map).key;
+    map->length++;
 }
 
-void *BTreeSetUnionIter_next(BTreeSetUnionIter *this)
+// Moves the last count entries (and children) of the left sibling of parent->children[child_idx] into it
+static void _BTreeMap_bulk_steal_left(const BTreeMap *this, _BTreeMapNode *parent, size_t child_idx, size_t count)
 {
-    if (this->a_is_done && this->b_is_done)
+    _BTreeMapNode *left = parent->children[child_idx - 1];
+    _BTreeMapNode *right = parent->children[child_idx];
+    BTreeMapEntryPos separator_pos = BTreeMapEntryPos_new(parent, child_idx - 1);
+
+    _BTreeMap_move_entries(this, BTreeMapEntryPos_new(right, 0), BTreeMapEntryPos_new(right, count));
+
+    BTreeMapEntry separator = BTreeMapEntryPos_to_entry(separator_pos, this);
+    BTreeMapEntryPos separator_dest = BTreeMapEntryPos_new(right, count - 1);
+    _BTreeMap_replace_entry_at(this, &separator, &separator_dest);
+
+    _BTreeMap_move_entries(this, BTreeMapEntryPos_new(left, left->key_count - count + 1), BTreeMapEntryPos_new(right, 0));
+
+    BTreeMapEntry new_separator = BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new(left, left->key_count - count), this);
+    _BTreeMap_replace_entry_at(this, &new_separator, &separator_pos);
+
+    if (!left->is_leaf)
     {
-        return NULL;
+        _BTreeMap_move_children(this, BTreeMapChildPos_new(right, 0), BTreeMapChildPos_new(right, count));
+        _BTreeMap_move_children(this, BTreeMapChildPos_new(left, left->key_count - count + 1), BTreeMapChildPos_new(right, 0));
     }
 
-    BTreeSetUnionIterSide should_advance;
+    left->key_count -= count;
+    right->key_count += count;
+}
 
-    if (this->a_is_done)
+static size_t _BTreeMap_recount(const BTreeMap *this, _BTreeMapNode *node)
+{
+    if (node->is_leaf)
     {
-        should_advance = BTREE_SET_UNION_ITER_SIDE_B;
+        return node->key_count;
     }
-    else if (this->b_is_done)
+
+    size_t *child_lens = _BTreeMap_child_lens(this, node);
+    size_t len = node->key_count;
+
+    for (size_t i = 0; i < node->key_count + 1; i++)
     {
-        should_advance = BTREE_SET_UNION_ITER_SIDE_A;
+        child_lens[i] = _BTreeMap_recount(this, node->children[i]);
+        len += child_lens[i];
     }
-    else
-    {
-        BTreeMapEntry current_a = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
-        BTreeMapEntry current_b = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
 
-        int_fast8_t result = this->a->map->key_props.cmp(current_a.key, current_b.key);
+    return len;
+}
 
-        if (result == 0)
-        {
-            this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
-            this->b_is_done = this->current_b.node == NULL ? true : false;
+static void _BTreeMapBulkBuilder_finish(_BTreeMapBulkBuilder *this)
+{
+    const BTreeMap *map = this->map;
 
-            should_advance = BTREE_SET_UNION_ITER_SIDE_A;
-        }
-        else
+    // every node left of the right spine is full, so the spine can top its nodes up from their left siblings
+    for (_BTreeMapNode *current = map->root; !current->is_leaf; current = current->children[current->key_count])
+    {
+        _BTreeMapNode *last = current->children[current->key_count];
+
+        if (last->key_count < map->layout.min_key_count)
         {
-            should_advance = result > 0 ? BTREE_SET_UNION_ITER_SIDE_B : BTREE_SET_UNION_ITER_SIDE_A;
+            _BTreeMap_bulk_steal_left(map, current, current->key_count, map->layout.min_key_count - last->key_count);
         }
     }
 
-    BTreeMapEntry current;
-
-    if (should_advance == BTREE_SET_UNION_ITER_SIDE_A)
-    {
-        current = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
-        this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
-        this->a_is_done = this->current_a.node == NULL ? true : false;
-    }
-    else
+    if (map->layout.has_order_statistics)
     {
-        current = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
-        this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
-        this->b_is_done = this->current_b.node == NULL ? true : false;
+        _BTreeMap_recount(map, map->root);
     }
-
-    return current.key;
 }
 
-void BTreeSetUnionIter_drop(BTreeSetUnionIter *this)
+// Builds a map from an iterator of BTreeMapEntry pointers with strictly ascending keys in O(n), taking ownership
+// of the keys and values
+void BTreeMap_from_sorted_iter(BTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props, Iterator *iter)
 {
-}
+    BTreeMap_new(this, key_props, value_props);
 
-BTreeSetUnionIter BTreeSet_union(const BTreeSet *this, const BTreeSet *other)
-{
-    BTreeSetUnionIter iter;
-    BTreeSetUnionIter_new(&iter, this, other);
+    _BTreeMapBulkBuilder builder;
+    _BTreeMapBulkBuilder_new(&builder, this);
 
-    return iter;
-}
+    for (BTreeMapEntry *entry = Iterator_next(iter); entry != NULL; entry = Iterator_next(iter))
+    {
+        _BTreeMapBulkBuilder_push(&builder, entry->key, entry->value);
+    }
 
-// [BTreeSetIntersectionIter]
+    _BTreeMapBulkBuilder_finish(&builder);
+}
 
-typedef enum
-{
-    BTREE_SET_INTERSECTION_ITER_SIDE_A,
-    BTREE_SET_INTERSECTION_ITER_SIDE_B,
-} BTreeSetIntersectionIterSide;
+// [BTreeMapRangeIter]
 
 typedef struct
 {
-    const BTreeSet *a;
-    const BTreeSet *b;
+    const BTreeMap *map;
     BTreeMapEntryPos current;
+    BTreeMapEntryPos current_back;
+    BTreeMapEntry buffer;
     bool is_done;
-} BTreeSetIntersectionIter;
+} BTreeMapRangeIter;
 
-void BTreeSetIntersectionIter_new(BTreeSetIntersectionIter *this, const BTreeSet *a, const BTreeSet *b)
+void BTreeMapRangeIter_new(BTreeMapRangeIter *this, const BTreeMap *map, const RangeBound *start, const RangeBound *end)
 {
-    this->a = a;
-    this->b = b;
+    this->map = map;
 
-    if (BTreeSet_len(this->a) == 0 || BTreeSet_len(this->b) == 0)
+    BTreeMapEntryPos lower_bound = _BTreeMap_lower_bound(this->map, start);
+    BTreeMapEntryPos upper_bound = _BTreeMap_upper_bound(this->map, end);
+
+    if (lower_bound.node == NULL || upper_bound.node == NULL)
+    {
+        this->is_done = true;
+    }
+    else if (map->key_props.cmp(BTreeMapEntryPos_to_entry(lower_bound, map).key, BTreeMapEntryPos_to_entry(upper_bound, map).key) > 0)
     {
+        // no key falls between the bounds
         this->is_done = true;
     }
     else
     {
         this->is_done = false;
-        this->current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
+        this->current = lower_bound;
+        this->current_back = upper_bound;
     }
 }
 
-void *BTreeSetIntersectionIter_next(BTreeSetIntersectionIter *this)
+BTreeMapEntry *BTreeMapRangeIter_next(BTreeMapRangeIter *this)
 {
     if (this->is_done)
     {
         return NULL;
     }
 
-    BTreeSetIntersectionIterSide current_side = BTREE_SET_INTERSECTION_ITER_SIDE_A;
-    BTreeMapEntryPos current = this->current;
-    const BTreeSet *current_set = this->a;
-    const BTreeSet *other_set = this->b;
-
-    while (current.node != NULL)
-    {
-        BTreeMapEntry current_entry = BTreeMapEntryPos_to_entry(current, current_set->map);
-        _BTreeMapFindResult result = _BTreeMap_find((BTreeMap *)other_set->map, current_entry.key);
-
-        if (result.kind == GET_RESULT_KIND_FOUND)
-        {
-            current = current_side == BTREE_SET_INTERSECTION_ITER_SIDE_A ? current : result.found;
-            break;
-        }
-        else
-        {
-            if (result.go_down.kv_idx < result.go_down.node->key_count)
-            {
-                current = result.go_down;
-            }
-            else
-            {
-                current = _BTreeMap_next_inorder(this->a->map, &this->current);
-            }
-
-            if (current_side == BTREE_SET_INTERSECTION_ITER_SIDE_A)
-            {
-                current_side = BTREE_SET_INTERSECTION_ITER_SIDE_B;
-                current_set = this->b;
-                other_set = this->a;
-            }
-            else
-            {
-                current_side = BTREE_SET_INTERSECTION_ITER_SIDE_A;
-                current_set = this->a;
-                other_set = this->b;
-            }
-        }
-    }
-
-    if (current.node == NULL)
-    {
-        this->is_done = true;
-        return NULL;
-    }
-    else
-    {
-        this->current = _BTreeMap_next_inorder(this->a->map, &current);
-        BTreeMapEntry current_entry = BTreeMapEntryPos_to_entry(current, this->a->map);
-        return current_entry.key;
-    }
-}
-
-void BTreeSetIntersectionIter_drop(BTreeSetIntersectionIter *this)
-{
-}
-
-BTreeSetIntersectionIter BTreeSet_intersection(const BTreeSet *this, const BTreeSet *other)
-{
-    BTreeSetIntersectionIter iter;
-    BTreeSetIntersectionIter_new(&iter, this, other);
-
-    return iter;
-}
-
-// [BTreeSetDifferenceIter]
-
-typedef struct
-{
-    const BTreeSet *a;
-    const BTreeSet *b;
-    BTreeMapEntryPos current;
-    bool is_done;
-} BTreeSetDifferenceIter;
-
-void BTreeSetDifferenceIter_new(BTreeSetDifferenceIter *this, const BTreeSet *a, const BTreeSet *b)
-{
-    this->a = a;
-    this->b = b;
+    bool is_last = this->current.node == this->current_back.node && this->current.kv_idx == this->current_back.kv_idx;
 
-    if (BTreeSet_len(this->a) == 0)
+    if (is_last)
     {
         this->is_done = true;
+        this->buffer = BTreeMapEntryPos_to_entry(this->current, this->map);
+        return &this->buffer;
     }
     else
     {
-        this->current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
-        this->is_done = false;
+        this->buffer = BTreeMapEntryPos_to_entry(this->current, this->map);
+        this->current = _BTreeMap_next_inorder(this->map, &this->current);
+        return &this->buffer;
     }
 }
 
-void *BTreeSetDifferenceIter_next(BTreeSetDifferenceIter *this)
+void *BTreeMapRangeIter_next_back(BTreeMapRangeIter *this)
 {
     if (this->is_done)
     {
         return NULL;
     }
 
-    BTreeMapEntryPos current = this->current;
-    BTreeMapEntry current_entry = {};
-
-    while (current.node != NULL)
-    {
-        current_entry = BTreeMapEntryPos_to_entry(current, this->a->map);
-        _BTreeMapFindResult result = _BTreeMap_find(this->b->map, current_entry.key);
-
-        if (result.kind != GET_RESULT_KIND_FOUND)
-        {
-            break;
-        }
-
-        current = _BTreeMap_next_inorder(this->a->map, &current);
-    }
+    bool is_last = this->current.node == this->current_back.node && this->current.kv_idx == this->current_back.kv_idx;
 
-    if (current.node == NULL)
+    if (is_last)
     {
         this->is_done = true;
-        return NULL;
+        this->buffer = BTreeMapEntryPos_to_entry(this->current_back, this->map);
+        return &this->buffer;
     }
     else
     {
-        this->current = _BTreeMap_next_inorder(this->a->map, &current);
-        return current_entry.key;
+        this->buffer = BTreeMapEntryPos_to_entry(this->current_back, this->map);
+        this->current_back = _BTreeMap_previous_inorder(this->map, &this->current_back);
+        return &this->buffer;
     }
 }
 
-void BTreeSetDifferenceIter_drop(BTreeSetDifferenceIter *this)
+void BTreeMapRangeIter_drop(BTreeMapRangeIter *this)
 {
 }
 
-BTreeSetDifferenceIter BTreeSet_difference(const BTreeSet *this, const BTreeSet *other)
+static size_t _BTreeMapNode_depth(const _BTreeMapNode *this)
 {
-    BTreeSetDifferenceIter iter;
-    BTreeSetDifferenceIter_new(&iter, this, other);
-
-    return iter;
-}
-
-// [BTreeSetSymmetricDifferenceIter]
+    size_t depth = 0;
 
-typedef enum
-{
-    BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_A,
-    BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_B,
-} BTreeSetSymmetricDifferenceIterSide;
+    for (; this->parent != NULL; this = this->parent)
+    {
+        depth++;
+    }
 
-typedef struct
-{
-    const BTreeSet *a;
-    const BTreeSet *b;
-    BTreeMapEntryPos current_a;
-    bool a_is_done;
-    BTreeMapEntryPos current_b;
-    bool b_is_done;
-} BTreeSetSymmetricDifferenceIter;
+    return depth;
+}
 
-void BTreeSetSymmetricDifferenceIter_new(BTreeSetSymmetricDifferenceIter *this, const BTreeSet *a, const BTreeSet *b)
+static const _BTreeMapNode *_BTreeMapNode_ancestor(const _BTreeMapNode *this, size_t levels)
 {
-    this->a = a;
-    this->b = b;
-
-    if (BTreeSet_len(this->a) == 0)
-    {
-        this->a_is_done = true;
-    }
-    else
+    for (size_t i = 0; i < levels; i++)
     {
-        this->current_a = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
-        this->a_is_done = false;
+        this = this->parent;
     }
 
-    if (BTreeSet_len(this->b) == 0)
-    {
-        this->a_is_done = true;
-    }
-    else
-    {
-        this->current_b = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->b->map), 0);
-        this->b_is_done = false;
-    }
+    return this;
 }
 
-void *BTreeSetSymmetricDifferenceIter_next(BTreeSetSymmetricDifferenceIter *this)
+Iterator BTreeMapRangeIter_iter(BTreeMapRangeIter *this);
+
+bool BTreeMapRangeIter_split(BTreeMapRangeIter *this, LinkedIterator *right)
 {
-    if (this->a_is_done && this->b_is_done)
+    bool is_last = this->current.node == this->current_back.node && this->current.kv_idx == this->current_back.kv_idx;
+
+    if (this->is_done || is_last)
     {
-        return NULL;
+        return false;
     }
 
-    BTreeSetSymmetricDifferenceIterSide should_advance;
+    // Split at an entry of the lowest node that contains both ends of the range. Every entry between the
+    // subtrees holding current and current_back is a candidate, and the middle one roughly halves the range.
 
-    while (true)
-    {
-        if (this->a_is_done)
-        {
-            should_advance = BTREE_SET_UNION_ITER_SIDE_B;
-        }
-        else if (this->b_is_done)
-        {
-            should_advance = BTREE_SET_UNION_ITER_SIDE_A;
-        }
-        else
-        {
-            BTreeMapEntry current_a = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
-            BTreeMapEntry current_b = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
+    size_t depth = _BTreeMapNode_depth(this->current.node);
+    size_t depth_back = _BTreeMapNode_depth(this->current_back.node);
+    size_t common_depth = MIN(depth, depth_back);
 
-            int_fast8_t result = this->a->map->key_props.cmp(current_a.key, current_b.key);
+    const _BTreeMapNode *front = _BTreeMapNode_ancestor(this->current.node, depth - common_depth);
+    const _BTreeMapNode *back = _BTreeMapNode_ancestor(this->current_back.node, depth_back - common_depth);
+    const _BTreeMapNode *front_child = depth > common_depth ? _BTreeMapNode_ancestor(this->current.node, depth - common_depth - 1) : NULL;
+    const _BTreeMapNode *back_child = depth_back > common_depth ? _BTreeMapNode_ancestor(this->current_back.node, depth_back - common_depth - 1) : NULL;
 
-            if (result == 0)
-            {
-                this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
-                this->a_is_done = this->current_a.node == NULL;
+    while (front != back)
+    {
+        front_child = front;
+        back_child = back;
+        front = front->parent;
+        back = back->parent;
+    }
 
-                this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
-                this->b_is_done = this->current_b.node == NULL;
+    _BTreeMapNode *common = (_BTreeMapNode *)front;
 
-                continue;
-            }
-            else
-            {
-                should_advance = result > 0 ? BTREE_SET_UNION_ITER_SIDE_B : BTREE_SET_UNION_ITER_SIDE_A;
-            }
-        }
+    size_t first = this->current.node == common ? this->current.kv_idx : _BTreeMapNode_child_pos(common, (_BTreeMapNode *)front_child).child_idx;
+    size_t last = this->current_back.node == common ? this->current_back.kv_idx : _BTreeMapNode_child_pos(common, (_BTreeMapNode *)back_child).child_idx - 1;
 
-        break;
+    if (first == SIZE_MAX || last == SIZE_MAX || first > last)
+    {
+        return false;
     }
 
-    BTreeMapEntry current;
+    BTreeMapEntryPos separator = BTreeMapEntryPos_new(common, first + (last - first + 1) / 2);
 
-    if (should_advance == BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_A)
-    {
-        current = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
-        this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
-        this->a_is_done = this->current_a.node == NULL ? true : false;
-    }
-    else
+    if (separator.node == this->current.node && separator.kv_idx == this->current.kv_idx)
     {
-        current = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
-        this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
-        this->b_is_done = this->current_b.node == NULL ? true : false;
+        // the left half would be empty, keep only the first entry in it
+        separator = _BTreeMap_next_inorder(this->map, &separator);
     }
 
-    return current.key;
+    BTreeMapRangeIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)BTreeMapRangeIter_drop, NULL);
+    other->map = this->map;
+    other->is_done = false;
+    other->current = separator;
+    other->current_back = this->current_back;
+
+    this->current_back = _BTreeMap_previous_inorder(this->map, &separator);
+
+    *right = (LinkedIterator){
+        .iter = BTreeMapRangeIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+
+    return true;
 }
 
-void BTreeSetSymmetricDifferenceIter_drop(BTreeSetSymmetricDifferenceIter *this)
+Iterator BTreeMapRangeIter_iter(BTreeMapRangeIter *this)
 {
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)BTreeMapRangeIter_next,
+            .next_back = (IteratorNextBackFn)BTreeMapRangeIter_next_back,
+            .split = (IteratorSplitFn)BTreeMapRangeIter_split,
+        });
 }
 
-BTreeSetSymmetricDifferenceIter BTreeSet_symmetric_difference(const BTreeSet *this, const BTreeSet *other)
+BTreeMapRangeIter BTreeMap_range(const BTreeMap *this, const RangeBound *start, const RangeBound *end)
 {
-    BTreeSetSymmetricDifferenceIter iter;
-    BTreeSetSymmetricDifferenceIter_new(&iter, this, other);
+    BTreeMapRangeIter iter;
+    BTreeMapRangeIter_new(&iter, this, start, end);
 
     return iter;
 }
 
-// [LinkedList]
-
-#include <stddef.h>
-
-typedef struct _LinkedListNode
-{
-    struct _LinkedListNode *next;
-    struct _LinkedListNode *previous;
-} LinkedListNode;
+// [BTreeSet]
 
 typedef struct
 {
-    size_t element_size;
+    size_t size;
+    CmpFn cmp;
     DropFn drop;
-} LinkedListElementProps;
+} BTreeSetElementProps;
 
 typedef struct
 {
-    size_t length;
-    LinkedListNode *head;
-    LinkedListNode *tail;
-    LinkedListElementProps element_props;
-} LinkedList;
+    BTreeMap *map;
+} BTreeSet;
 
-static void *_LinkedListNode_get_data(LinkedListNode *this)
+void BTreeSet_new(BTreeSet *this, const BTreeSetElementProps *element_props)
 {
-    return (void *)((uintptr_t)(this) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this)));
-}
+    this->map = malloc(sizeof(*this->map));
 
-static void _LinkedList_drop_element(LinkedList *this, void *element)
-{
-    if (this->element_props.drop)
-    {
-        this->element_props.drop(element);
-    }
+    BTreeMapKeyProps key_props = {
+        .size = element_props->size,
+        .cmp = element_props->cmp,
+        .drop = element_props->drop,
+    };
+    BTreeMapValueProps value_props = {
+        .size = sizeof(uint8_t),
+    };
+    BTreeMap_new(this->map, &key_props, &value_props);
 }
 
-void LinkedList_new(LinkedList *this, const LinkedListElementProps *element_props)
+bool BTreeSet_contains(const BTreeSet *this, const void *element)
 {
-    this->element_props = *element_props;
-
-    this->length = 0;
-    this->head = NULL;
-    this->tail = NULL;
+    return BTreeMap_get(this->map, element) == NULL ? false : true;
 }
 
-size_t LinkedList_len(const LinkedList *this)
+size_t BTreeSet_len(const BTreeSet *this)
 {
-    return this->length;
+    return BTreeMap_len(this->map);
 }
 
-static void _LinkedList_insert_after(LinkedList *this, LinkedListNode *position, LinkedListNode *new_node)
+void BTreeSet_drop(BTreeSet *this)
 {
-    bool insert_at_head = position == NULL;
-    if (insert_at_head)
-    {
-        new_node->previous = NULL;
-
-        bool list_is_empty = this->head == NULL;
-        if (list_is_empty)
-        {
-            new_node->next = NULL;
-
-            this->head = new_node;
-            this->tail = new_node;
-        }
-        else
-        {
-            new_node->next = this->head;
-            this->head->previous = new_node;
-            this->head = new_node;
-        }
-    }
-    else
-    {
-        new_node->next = position->next;
-        new_node->previous = position;
-
-        bool insert_after_tail = position->next == NULL;
-        if (insert_after_tail)
-        {
-            this->tail = new_node;
-        }
-        else
-        {
-            position->next->previous = new_node;
-        }
-
-        position->next = new_node;
-    }
-
-    this->length++;
+    BTreeMap_drop(this->map);
+    free(this->map);
 }
 
-static void _LinkedList_remove(LinkedList *this, LinkedListNode *position)
+void BTreeSet_insert(BTreeSet *this, const void *element)
 {
-    if (position->previous)
-    {
-        position->previous->next = position->next;
-    }
-    else
-    {
-        this->head = position->next;
-    }
-
-    if (position->next)
-    {
-        position->next->previous = position->previous;
-    }
-    else
-    {
-        this->tail = position->previous;
-    }
-
-    _LinkedList_drop_element(this, _LinkedListNode_get_data(position));
-    free(position);
-
-    this->length--;
+    uint8_t i = 0;
+    BTreeMap_insert(this->map, element, &i);
 }
 
-void LinkedList_push_front(LinkedList *this, const void *value)
+void BTreeSet_remove(BTreeSet *this, const void *element)
 {
-    LinkedListNode *new_node = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(LinkedListNode)) + this->element_props.element_size);
-
-    memcpy(_LinkedListNode_get_data(new_node), value, this->element_props.element_size);
-
-    _LinkedList_insert_after(this, NULL, new_node);
+    BTreeMap_remove(this->map, element);
 }
 
-void LinkedList_push_back(LinkedList *this, const void *value)
+// Builds a set from an iterator of strictly ascending elements in O(n), taking ownership of them
+void BTreeSet_from_sorted_iter(BTreeSet *this, const BTreeSetElementProps *element_props, Iterator *iter)
 {
-    LinkedListNode *new_node = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(LinkedListNode)) + this->element_props.element_size);
+    BTreeSet_new(this, element_props);
 
-    memcpy(_LinkedListNode_get_data(new_node), value, this->element_props.element_size);
+    _BTreeMapBulkBuilder builder;
+    _BTreeMapBulkBuilder_new(&builder, this->map);
 
-    _LinkedList_insert_after(this, this->tail, new_node);
-}
+    uint8_t i = 0;
 
-void LinkedList_pop_front(LinkedList *this)
-{
-    if (this->head != NULL)
+    for (void *element = Iterator_next(iter); element != NULL; element = Iterator_next(iter))
     {
-        _LinkedList_remove(this, this->head);
+        _BTreeMapBulkBuilder_push(&builder, element, &i);
     }
-}
 
-void LinkedList_pop_back(LinkedList *this)
-{
-    if (this->tail != NULL)
-    {
-        _LinkedList_remove(this, this->tail);
-    }
+    _BTreeMapBulkBuilder_finish(&builder);
 }
 
-void *LinkedList_front(LinkedList *this)
+// [BTreeSetRangeIter]
+
+typedef struct
 {
-    if (this->head == NULL)
-    {
-        return NULL;
-    }
-    else
-    {
-        return _LinkedListNode_get_data(this->head);
-    }
-}
+    BTreeMapRangeIter *iter;
+} BTreeSetRangeIter;
 
-void *LinkedList_back(LinkedList *this)
+void BTreeSetRangeIter_new(BTreeSetRangeIter *this, const BTreeSet *set, const RangeBound *start, const RangeBound *end)
 {
-    if (this->tail == NULL)
-    {
-        return NULL;
-    }
-    else
-    {
-        return _LinkedListNode_get_data(this->tail);
-    }
+    this->iter = malloc(sizeof(*this->iter));
+    BTreeMapRangeIter_new(this->iter, set->map, start, end);
 }
 
-void LinkedList_drop(LinkedList *this)
+void *BTreeSetRangeIter_next(BTreeSetRangeIter *this)
 {
-    for (LinkedListNode *current = this->head; current != NULL;)
-    {
-        _LinkedList_drop_element(this, _LinkedListNode_get_data(current));
+    BTreeMapEntry *next = BTreeMapRangeIter_next(this->iter);
 
-        LinkedListNode *next = current->next;
-        free(current);
-        current = next;
-    }
+    return next == NULL ? NULL : next->key;
 }
 
-// [VecDeque]
-
-typedef struct
+void *BTreeSetRangeIter_next_back(BTreeSetRangeIter *this)
 {
-    size_t size;
-    DropFn drop;
-} VecDequeElementProps;
+    BTreeMapEntry *next = BTreeMapRangeIter_next_back(this->iter);
 
-typedef struct
-{
-    size_t length;
-    size_t capacity;
-    void *data;
-    size_t head;
-    VecDequeElementProps element_props;
-} VecDeque;
+    return next == NULL ? NULL : next->key;
+}
 
-void VecDeque_new(VecDeque *this, const VecDequeElementProps *element_props)
+void BTreeSetRangeIter_drop(BTreeSetRangeIter *this)
 {
-    this->element_props = *element_props;
-
-    this->length = 0;
-    this->capacity = 0;
-    this->data = NULL;
+    BTreeMapRangeIter_drop(this->iter);
 }
 
-size_t VecDeque_len(const VecDeque *this)
+BTreeSetRangeIter BTreeSet_range(const BTreeSet *this, const RangeBound *start, const RangeBound *end)
 {
-    return this->length;
+    BTreeSetRangeIter iter;
+    BTreeSetRangeIter_new(&iter, this, start, end);
+
+    return iter;
 }
 
-size_t VecDeque_capacity(const VecDeque *this)
+// [BTreeSetUnionIter]
+
+typedef enum
 {
-    return this->capacity;
-}
+    BTREE_SET_UNION_ITER_SIDE_A,
+    BTREE_SET_UNION_ITER_SIDE_B,
+} BTreeSetUnionIterSide;
 
-static uint8_t *_VecDeque_get(const VecDeque *this, size_t index)
+typedef struct
 {
-    return (uint8_t *)(this->data) + (index * this->element_props.size);
-}
+    const BTreeSet *a;
+    const BTreeSet *b;
+    BTreeMapEntryPos current_a;
+    bool a_is_done;
+    BTreeMapEntryPos current_b;
+    bool b_is_done;
+} BTreeSetUnionIter;
 
-void *VecDeque_front(VecDeque *this)
+void BTreeSetUnionIter_new(BTreeSetUnionIter *this, const BTreeSet *a, const BTreeSet *b)
 {
-    if (this->length > 0)
+    this->a = a;
+    this->b = b;
+
+    if (BTreeSet_len(this->a) == 0)
     {
-        return _VecDeque_get(this, this->head);
+        this->a_is_done = true;
     }
     else
     {
-        return NULL;
+        this->current_a = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
+        this->a_is_done = false;
     }
-}
 
-void *VecDeque_back(VecDeque *this)
-{
-    if (this->length > 0)
+    if (BTreeSet_len(this->b) == 0)
     {
-        size_t tail_index = (this->head + this->length - 1) % this->capacity;
-        return _VecDeque_get(this, tail_index);
+        this->b_is_done = true;
     }
     else
     {
-        return NULL;
+        this->current_b = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->b->map), 0);
+        this->b_is_done = false;
     }
 }
 
-static void _VecDeque_grow_buffer(VecDeque *this)
+void *BTreeSetUnionIter_next(BTreeSetUnionIter *this)
 {
-    assert(this->length == this->capacity);
-
-    size_t new_capacity = this->capacity ? this->capacity * 2 : 10;
-    void *new_data = malloc(new_capacity * this->element_props.size);
-
-    if (this->capacity)
+    if (this->a_is_done && this->b_is_done)
     {
-        size_t right = this->capacity - this->head;
-        memcpy(new_data, VecDeque_front(this), right * this->element_props.size);
-
-        size_t left = this->capacity - right;
-        if (left > 0)
-        {
-            memcpy(new_data + (right * this->element_props.size), this->data, left * this->element_props.size);
-        }
-
-        free(this->data);
+        return NULL;
     }
 
-    this->data = new_data;
-    this->capacity = new_capacity;
-    this->head = 0;
-}
+    BTreeSetUnionIterSide should_advance;
 
-void VecDeque_push_back(VecDeque *this, const void *value)
-{
-    if (this->length == this->capacity)
+    if (this->a_is_done)
     {
-        _VecDeque_grow_buffer(this);
+        should_advance = BTREE_SET_UNION_ITER_SIDE_B;
     }
-
-    size_t insert_index = (this->head + this->length) % this->capacity;
-    memcpy(_VecDeque_get(this, insert_index), value, this->element_props.size);
-
-    this->length++;
-}
-
-void VecDeque_push_front(VecDeque *this, const void *value)
-{
-    if (this->length == this->capacity)
+    else if (this->b_is_done)
     {
-        _VecDeque_grow_buffer(this);
+        should_advance = BTREE_SET_UNION_ITER_SIDE_A;
     }
+    else
+    {
+        BTreeMapEntry current_a = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
+        BTreeMapEntry current_b = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
 
-    this->head = (this->head + this->capacity - 1) % this->capacity;
-    memcpy(_VecDeque_get(this, this->head), value, this->element_props.size);
+        int_fast8_t result = this->a->map->key_props.cmp(current_a.key, current_b.key);
 
-    this->length++;
-}
+        if (result == 0)
+        {
+            this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
+            this->b_is_done = this->current_b.node == NULL ? true : false;
 
-void VecDeque_pop_back(VecDeque *this)
-{
-    if (this->length > 0)
-    {
-        if (this->element_props.drop != NULL)
+            should_advance = BTREE_SET_UNION_ITER_SIDE_A;
+        }
+        else
         {
-            this->element_props.drop(VecDeque_back(this));
+            should_advance = result > 0 ? BTREE_SET_UNION_ITER_SIDE_B : BTREE_SET_UNION_ITER_SIDE_A;
         }
-
-        this->length--;
-    }
-}
-
-void VecDeque_pop_front(VecDeque *this)
-{
-    if (this->length > 0)
-    {
-        this->element_props.drop(VecDeque_front(this));
-        this->head = (this->head + 1) % this->capacity;
-        this->length--;
-    }
-}
-
-void VecDeque_clear(VecDeque *this)
-{
-    while (this->length > 0)
-    {
-        VecDeque_pop_back(this);
     }
-}
 
-void VecDeque_shrink_to_fit(VecDeque *this)
-{
-    if (this->length == this->capacity)
-    {
-        return;
-    }
+    BTreeMapEntry current;
 
-    if (this->length == 0)
+    if (should_advance == BTREE_SET_UNION_ITER_SIDE_A)
     {
-        free(this->data);
-        this->data = NULL;
-        this->capacity = 0;
+        current = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
+        this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
+        this->a_is_done = this->current_a.node == NULL ? true : false;
     }
     else
     {
-        void *new_data = malloc(this->length * this->element_props.size);
-
-        size_t right = MIN(this->length, this->capacity - this->head);
-        memcpy(new_data, VecDeque_front(this), right * this->element_props.size);
-
-        size_t left = this->length - right;
-        if (left > 0)
-        {
-            memcpy((uint8_t *)(new_data) + (right * this->element_props.size), this->data, left * this->element_props.size);
-        }
-
-        free(this->data);
-
-        this->data = new_data;
-        this->capacity = this->length;
+        current = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
+        this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
+        this->b_is_done = this->current_b.node == NULL ? true : false;
     }
 
-    this->head = 0;
+    return current.key;
 }
 
-void VecDeque_drop(VecDeque *this)
+void BTreeSetUnionIter_drop(BTreeSetUnionIter *this)
 {
-    VecDeque_clear(this);
-    free(this->data);
 }
 
-// [BinaryHeap]
+BTreeSetUnionIter BTreeSet_union(const BTreeSet *this, const BTreeSet *other)
+{
+    BTreeSetUnionIter iter;
+    BTreeSetUnionIter_new(&iter, this, other);
 
-#define PARENT(i) ((i - 1) / 2)
-#define LEFT(i) ((2 * i) + 1)
-#define RIGHT(i) (LEFT(i) + 1)
+    return iter;
+}
 
-typedef struct
-{
-    size_t size;
-    DropFn drop;
-    CmpFn cmp;
-} BinaryHeapElementProps;
+// [BTreeSetIntersectionIter]
 
-typedef struct
+typedef enum
 {
-    Vec *buffer;
-    BinaryHeapElementProps element_props;
-} BinaryHeap;
+    BTREE_SET_INTERSECTION_ITER_SIDE_A,
+    BTREE_SET_INTERSECTION_ITER_SIDE_B,
+} BTreeSetIntersectionIterSide;
 
-void BinaryHeap_new(BinaryHeap *this, const BinaryHeapElementProps *element_props)
+typedef struct
 {
-    this->element_props = *element_props;
-
-    this->buffer = malloc(sizeof(*this->buffer));
-
-    VecElementOps ops;
-    ops.drop = this->element_props.drop;
-    Vec_new(this->buffer, this->element_props.size, &ops);
-}
+    const BTreeSet *a;
+    const BTreeSet *b;
+    BTreeMapEntryPos current;
+    bool is_done;
+} BTreeSetIntersectionIter;
 
-static void _BinaryHeap_swap(const BinaryHeap *this, size_t idx_a, size_t idx_b)
+void BTreeSetIntersectionIter_new(BTreeSetIntersectionIter *this, const BTreeSet *a, const BTreeSet *b)
 {
-    uint8_t tmp[this->element_props.size];
+    this->a = a;
+    this->b = b;
 
-    memcpy(tmp, Vec_get(this->buffer, idx_a), this->element_props.size);
-    memcpy(Vec_get_mut(this->buffer, idx_a), Vec_get(this->buffer, idx_b), this->element_props.size);
-    memcpy(Vec_get_mut(this->buffer, idx_b), tmp, this->element_props.size);
+    if (BTreeSet_len(this->a) == 0 || BTreeSet_len(this->b) == 0)
+    {
+        this->is_done = true;
+    }
+    else
+    {
+        this->is_done = false;
+        this->current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
+    }
 }
 
-static void _BinaryHeap_sift_up(BinaryHeap *this, size_t i)
+void *BTreeSetIntersectionIter_next(BTreeSetIntersectionIter *this)
 {
-    while (i > 0)
+    if (this->is_done)
     {
-        size_t parent = PARENT(i);
-
-        if (this->element_props.cmp(Vec_get(this->buffer, i), Vec_get(this->buffer, parent)) <= 0)
-        {
-            break;
-        }
-
-        _BinaryHeap_swap(this, i, parent);
-        i = parent;
+        return NULL;
     }
-}
 
-static void _BinaryHeap_sift_down(BinaryHeap *this, size_t i)
-{
-    size_t length = Vec_len(this->buffer);
+    BTreeSetIntersectionIterSide current_side = BTREE_SET_INTERSECTION_ITER_SIDE_A;
+    BTreeMapEntryPos current = this->current;
+    const BTreeSet *current_set = this->a;
+    const BTreeSet *other_set = this->b;
 
-    while (true)
+    while (current.node != NULL)
     {
-        size_t left = LEFT(i);
-        size_t right = RIGHT(i);
-
-        size_t largest = i;
+        BTreeMapEntry current_entry = BTreeMapEntryPos_to_entry(current, current_set->map);
+        _BTreeMapFindResult result = _BTreeMap_find((BTreeMap *)other_set->map, current_entry.key);
 
-        if (left < length && this->element_props.cmp(Vec_get(this->buffer, left), Vec_get(this->buffer, largest)) > 0)
+        if (result.kind == GET_RESULT_KIND_FOUND)
         {
-            largest = left;
+            current = current_side == BTREE_SET_INTERSECTION_ITER_SIDE_A ? current : result.found;
+            break;
         }
-
-        if (right < length && this->element_props.cmp(Vec_get(this->buffer, right), Vec_get(this->buffer, largest)) > 0)
+        else
         {
-            largest = right;
-        }
+            if (result.go_down.kv_idx < result.go_down.node->key_count)
+            {
+                current = result.go_down;
+            }
+            else
+            {
+                current = _BTreeMap_next_inorder(this->a->map, &this->current);
+            }
 
-        if (largest == i)
-        {
-            break;
+            if (current_side == BTREE_SET_INTERSECTION_ITER_SIDE_A)
+            {
+                current_side = BTREE_SET_INTERSECTION_ITER_SIDE_B;
+                current_set = this->b;
+                other_set = this->a;
+            }
+            else
+            {
+                current_side = BTREE_SET_INTERSECTION_ITER_SIDE_A;
+                current_set = this->a;
+                other_set = this->b;
+            }
         }
-
-        _BinaryHeap_swap(this, i, largest);
-        i = largest;
     }
-}
 
-const void *BinaryHeap_peek(const BinaryHeap *this)
-{
-    if (Vec_len(this->buffer) == 0)
+    if (current.node == NULL)
     {
+        this->is_done = true;
         return NULL;
     }
     else
     {
-        return Vec_get(this->buffer, 0);
+        this->current = _BTreeMap_next_inorder(this->a->map, &current);
+        BTreeMapEntry current_entry = BTreeMapEntryPos_to_entry(current, this->a->map);
+        return current_entry.key;
     }
 }
 
-void *BinaryHeap_peek_mut(BinaryHeap *this)
+void BTreeSetIntersectionIter_drop(BTreeSetIntersectionIter *this)
 {
-    return (void *)BinaryHeap_peek(this);
 }
 
-void BinaryHeap_push(BinaryHeap *this, const void *value)
+BTreeSetIntersectionIter BTreeSet_intersection(const BTreeSet *this, const BTreeSet *other)
 {
-    Vec_push(this->buffer, value);
+    BTreeSetIntersectionIter iter;
+    BTreeSetIntersectionIter_new(&iter, this, other);
 
-    _BinaryHeap_sift_up(this, Vec_len(this->buffer) - 1);
+    return iter;
 }
 
-void BinaryHeap_pop(BinaryHeap *this)
+// [BTreeSetDifferenceIter]
+
+typedef struct
 {
-    if (Vec_len(this->buffer) == 0)
-    {
-        return;
-    }
+    const BTreeSet *a;
+    const BTreeSet *b;
+    BTreeMapEntryPos current;
+    bool is_done;
+} BTreeSetDifferenceIter;
 
-    _BinaryHeap_swap(this, 0, Vec_len(this->buffer) - 1);
-    Vec_pop(this->buffer);
+void BTreeSetDifferenceIter_new(BTreeSetDifferenceIter *this, const BTreeSet *a, const BTreeSet *b)
+{
+    this->a = a;
+    this->b = b;
 
-    if (Vec_len(this->buffer) > 0)
+    if (BTreeSet_len(this->a) == 0)
+    {
+        this->is_done = true;
+    }
+    else
     {
-        _BinaryHeap_sift_down(this, 0);
+        this->current = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
+        this->is_done = false;
     }
 }
 
-size_t BinaryHeap_len(const BinaryHeap *this)
+void *BTreeSetDifferenceIter_next(BTreeSetDifferenceIter *this)
 {
-    return Vec_len(this->buffer);
-}
+    if (this->is_done)
+    {
+        return NULL;
+    }
 
-void BinaryHeap_drop(BinaryHeap *this)
-{
-    Vec_drop(this->buffer);
-    free(this->buffer);
-}
+    BTreeMapEntryPos current = this->current;
+    BTreeMapEntry current_entry = {};
 
-// [Hasher]
+    while (current.node != NULL)
+    {
+        current_entry = BTreeMapEntryPos_to_entry(current, this->a->map);
+        _BTreeMapFindResult result = _BTreeMap_find(this->b->map, current_entry.key);
 
-typedef void (*HasherResetFn)(void *this);
-typedef void (*HasherWriteFn)(void *this, const void *data, size_t length);
-typedef uint64_t (*HasherFinishFn)(const void *this);
-
-typedef struct
-{
-    size_t size;
-    HasherResetFn reset;
-    HasherWriteFn write;
-    HasherFinishFn finish;
-    DropFn drop;
-} HasherProps;
-
-typedef struct
-{
-    void *concrete_hasher;
-    HasherProps props;
-} Hasher;
+        if (result.kind != GET_RESULT_KIND_FOUND)
+        {
+            break;
+        }
 
-void Hasher_new(Hasher *this, const HasherProps *props, const void *concrete_hasher)
-{
-    this->props = *props;
+        current = _BTreeMap_next_inorder(this->a->map, &current);
+    }
 
-    this->concrete_hasher = malloc(this->props.size);
-    memcpy(this->concrete_hasher, concrete_hasher, this->props.size);
+    if (current.node == NULL)
+    {
+        this->is_done = true;
+        return NULL;
+    }
+    else
+    {
+        this->current = _BTreeMap_next_inorder(this->a->map, &current);
+        return current_entry.key;
+    }
 }
 
-void Hasher_reset(Hasher *this)
+void BTreeSetDifferenceIter_drop(BTreeSetDifferenceIter *this)
 {
-    this->props.reset(this->concrete_hasher);
 }
 
-void Hasher_write(Hasher *this, const void *data, size_t length)
+BTreeSetDifferenceIter BTreeSet_difference(const BTreeSet *this, const BTreeSet *other)
 {
-    this->props.write(this->concrete_hasher, data, length);
-}
+    BTreeSetDifferenceIter iter;
+    BTreeSetDifferenceIter_new(&iter, this, other);
 
-uint64_t Hasher_finish(const Hasher *this)
-{
-    return this->props.finish(this->concrete_hasher);
+    return iter;
 }
 
-void Hasher_drop(Hasher *this)
-{
-    if (this->props.drop != NULL)
-    {
-        this->props.drop(this->concrete_hasher);
-    }
-
-    free(this->concrete_hasher);
-}
+// [BTreeSetSymmetricDifferenceIter]
 
-// [SimpleHasher]
+typedef enum
+{
+    BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_A,
+    BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_B,
+} BTreeSetSymmetricDifferenceIterSide;
 
 typedef struct
 {
-    uint64_t state;
-} SimpleHasher;
+    const BTreeSet *a;
+    const BTreeSet *b;
+    BTreeMapEntryPos current_a;
+    bool a_is_done;
+    BTreeMapEntryPos current_b;
+    bool b_is_done;
+} BTreeSetSymmetricDifferenceIter;
 
-void SimpleHasher_reset(SimpleHasher *this)
+void BTreeSetSymmetricDifferenceIter_new(BTreeSetSymmetricDifferenceIter *this, const BTreeSet *a, const BTreeSet *b)
 {
-    this->state = 0;
-}
+    this->a = a;
+    this->b = b;
 
-void SimpleHasher_write(SimpleHasher *this, const void *data, size_t length)
-{
-    const uint8_t *bytes = data;
+    if (BTreeSet_len(this->a) == 0)
+    {
+        this->a_is_done = true;
+    }
+    else
+    {
+        this->current_a = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->a->map), 0);
+        this->a_is_done = false;
+    }
 
-    for (size_t i = 0; i < length; i++)
+    if (BTreeSet_len(this->b) == 0)
     {
-        this->state += bytes[i];
+        this->b_is_done = true;
+    }
+    else
+    {
+        this->current_b = BTreeMapEntryPos_new(_BTreeMap_leftmost(this->b->map), 0);
+        this->b_is_done = false;
     }
 }
 
-uint64_t SimpleHasher_finish(const SimpleHasher *this)
+void *BTreeSetSymmetricDifferenceIter_next(BTreeSetSymmetricDifferenceIter *this)
 {
-    return this->state;
-}
+    if (this->a_is_done && this->b_is_done)
+    {
+        return NULL;
+    }
 
-// [HashMap]
+    BTreeSetSymmetricDifferenceIterSide should_advance;
 
-typedef void (*HashFn)(const void *key, Hasher *hasher);
+    while (true)
+    {
+        if (this->a_is_done)
+        {
+            should_advance = BTREE_SET_UNION_ITER_SIDE_B;
+        }
+        else if (this->b_is_done)
+        {
+            should_advance = BTREE_SET_UNION_ITER_SIDE_A;
+        }
+        else
+        {
+            BTreeMapEntry current_a = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
+            BTreeMapEntry current_b = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
 
-typedef struct
-{
-    bool is_empty;
-    size_t probe_length;
-} _HashMapEntry;
+            int_fast8_t result = this->a->map->key_props.cmp(current_a.key, current_b.key);
 
-typedef struct
-{
-    size_t size;
-    EqFn eq;
-    HashFn hash;
-    DropFn drop;
-} HashMapKeyProps;
+            if (result == 0)
+            {
+                this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
+                this->a_is_done = this->current_a.node == NULL;
 
-typedef struct
-{
-    size_t size;
-    DropFn drop;
-} HashMapValueProps;
+                this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
+                this->b_is_done = this->current_b.node == NULL;
 
-typedef struct
-{
-    size_t length;
-    size_t capacity;
-    void *entries;
-    HashMapKeyProps key_props;
-    HashMapValueProps value_props;
-    Hasher hasher;
-} HashMap;
+                continue;
+            }
+            else
+            {
+                should_advance = result > 0 ? BTREE_SET_UNION_ITER_SIDE_B : BTREE_SET_UNION_ITER_SIDE_A;
+            }
+        }
 
-void *_HashMapEntry_key(_HashMapEntry *this)
-{
-    return (uint8_t *)(this) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_HashMapEntry));
-}
+        break;
+    }
 
-void *_HashMapEntry_value(_HashMapEntry *this, const HashMap *map)
-{
-    return (uint8_t *)(_HashMapEntry_key(this)) + ROUND_SIZE_UP_TO_MAX_ALIGN(map->key_props.size);
-}
+    BTreeMapEntry current;
 
-void _HashMapEntry_new(_HashMapEntry *this, const void *key, const void *value, const HashMap *map)
-{
-    memcpy(_HashMapEntry_key(this), key, map->key_props.size);
-    memcpy(_HashMapEntry_value(this, map), value, map->value_props.size);
+    if (should_advance == BTREE_SET_SYMMETRIC_DIFFERENCE_ITER_SIDE_A)
+    {
+        current = BTreeMapEntryPos_to_entry(this->current_a, this->a->map);
+        this->current_a = _BTreeMap_next_inorder(this->a->map, &this->current_a);
+        this->a_is_done = this->current_a.node == NULL ? true : false;
+    }
+    else
+    {
+        current = BTreeMapEntryPos_to_entry(this->current_b, this->b->map);
+        this->current_b = _BTreeMap_next_inorder(this->b->map, &this->current_b);
+        this->b_is_done = this->current_b.node == NULL ? true : false;
+    }
 
-    this->is_empty = false;
-    this->probe_length = 0;
+    return current.key;
 }
 
-size_t _HashMap_entry_size(const HashMap *this)
+void BTreeSetSymmetricDifferenceIter_drop(BTreeSetSymmetricDifferenceIter *this)
 {
-    return ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_HashMapEntry)) + ROUND_SIZE_UP_TO_MAX_ALIGN(this->key_props.size) + ROUND_SIZE_UP_TO_MAX_ALIGN(this->value_props.size);
 }
 
-_HashMapEntry *_HashMap_entry_at(const HashMap *this, size_t i)
+BTreeSetSymmetricDifferenceIter BTreeSet_symmetric_difference(const BTreeSet *this, const BTreeSet *other)
 {
-    return (_HashMapEntry *)((uint8_t *)(this->entries) + (i * _HashMap_entry_size(this)));
+    BTreeSetSymmetricDifferenceIter iter;
+    BTreeSetSymmetricDifferenceIter_new(&iter, this, other);
+
+    return iter;
 }
 
-void HashMap_with_capacity_and_hasher(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props, size_t capacity, const Hasher *hasher)
+// [BTreeSetMerge]
+
+// Galloping pays off once one side is this many times larger than the other
+#define BTREESET_GALLOP_RATIO 16
+
+// First position at or after from whose key is not less than key, found by climbing only as far as needed and
+// descending again, so the cost grows with the log of the distance rather than the size of the map
+static BTreeMapEntryPos _BTreeMap_seek(const BTreeMap *this, BTreeMapEntryPos from, const void *key)
 {
-    this->key_props = *key_props;
-    this->value_props = *value_props;
-    this->hasher = *hasher;
+    _BTreeMapNode *node = from.node;
+    BTreeMapEntryPos candidate = BTreeMapEntryPos_new(NULL, 0);
 
-    this->length = 0;
+    while (node->parent != NULL)
+    {
+        _BTreeMapNode *parent = node->parent;
+        size_t child_idx = _BTreeMapNode_child_pos(parent, node).child_idx;
 
-    this->capacity = capacity;
-    const size_t entry_size = _HashMap_entry_size(this);
-    this->entries = malloc(this->capacity * entry_size);
+        if (child_idx < parent->key_count)
+        {
+            BTreeMapEntryPos upper = BTreeMapEntryPos_new(parent, child_idx);
 
-    for (size_t i = 0; i < this->capacity; i++)
+            if (this->key_props.cmp(key, BTreeMapEntryPos_to_entry(upper, this).key) <= 0)
+            {
+                candidate = upper;
+                break;
+            }
+        }
+
+        node = parent;
+    }
+
+    while (true)
     {
-        _HashMap_entry_at(this, i)->is_empty = true;
+        bool found;
+        size_t idx = _BTreeMap_search_node(this, node, key, &found);
+
+        if (idx < node->key_count)
+        {
+            candidate = BTreeMapEntryPos_new(node, idx);
+        }
+
+        if (found || node->is_leaf)
+        {
+            return candidate;
+        }
+
+        node = node->children[idx];
     }
 }
 
-size_t HashMap_len(const HashMap *this)
+static BTreeMapEntryPos _BTreeSet_first(const BTreeSet *this)
 {
-    return this->length;
+    return BTreeMapEntryPos_new(BTreeSet_len(this) == 0 ? NULL : _BTreeMap_leftmost(this->map), 0);
 }
 
-size_t HashMap_capacity(const HashMap *this)
+typedef struct
 {
-    return this->capacity;
-}
-
-void HashMap_insert(HashMap *this, void *key, void *value);
+    bool only_a;
+    bool both;
+    bool only_b;
+} _BTreeSetMergeKeep;
 
-static void _HashMap_grow(HashMap *this)
+// Walks this and other in order and bulk builds result from the elements kept. When nothing only in other is kept and
+// other is much larger, this is walked alone and other is only sought into.
+static void _BTreeSet_merge_into(const BTreeSet *this, const BTreeSet *other, _BTreeSetMergeKeep keep, BTreeSet *result)
 {
-    void *old_entries = this->entries;
-    size_t old_length = this->length;
+    const BTreeMap *a = this->map;
+    const BTreeMap *b = other->map;
+    CmpFn cmp = a->key_props.cmp;
 
-    HashMap_with_capacity_and_hasher(this, &this->key_props, &this->value_props, this->capacity * 2, &this->hasher);
+    BTreeSetElementProps element_props = {
+        .size = a->key_props.size,
+        .cmp = a->key_props.cmp,
+    };
+    BTreeSet_new(result, &element_props);
+    result->map->key_props.kind = a->key_props.kind;
 
-    size_t i = 0;
+    _BTreeMapBulkBuilder builder;
+    _BTreeMapBulkBuilder_new(&builder, result->map);
+    uint8_t value = 0;
 
-    while (old_length > 0)
+    BTreeMapEntryPos pos_a = _BTreeSet_first(this);
+    BTreeMapEntryPos pos_b = _BTreeSet_first(other);
+
+    bool should_gallop = !keep.only_b && b->length / BTREESET_GALLOP_RATIO > a->length;
+
+    if (!should_gallop && !keep.only_a && !keep.only_b && a->length / BTREESET_GALLOP_RATIO > b->length)
     {
-        _HashMapEntry *entry = (_HashMapEntry *)((uint8_t *)(old_entries) + (i * _HashMap_entry_size(this)));
+        // an intersection is symmetric, gallop through the larger set with the smaller one
+        SWAP(a, b);
+        SWAP(pos_a, pos_b);
+        should_gallop = true;
+    }
 
-        if (!entry->is_empty)
+    while (pos_a.node != NULL && pos_b.node != NULL)
+    {
+        void *key_a = BTreeMapEntryPos_to_entry(pos_a, a).key;
+
+        if (should_gallop)
         {
-            HashMap_insert(this, _HashMapEntry_key(entry), _HashMapEntry_value(entry, this));
-            old_length--;
+            pos_b = _BTreeMap_seek(b, pos_b, key_a);
+
+            if (pos_b.node == NULL)
+            {
+                break;
+            }
+        }
+
+        void *key_b = BTreeMapEntryPos_to_entry(pos_b, b).key;
+        int32_t ordering = cmp(key_a, key_b);
+
+        if (ordering < 0)
+        {
+            if (keep.only_a)
+            {
+                _BTreeMapBulkBuilder_push(&builder, key_a, &value);
+            }
+
+            pos_a = _BTreeMap_next_inorder(a, &pos_a);
+        }
+        else if (ordering > 0)
+        {
+            if (keep.only_b)
+            {
+                _BTreeMapBulkBuilder_push(&builder, key_b, &value);
+            }
+
+            pos_b = _BTreeMap_next_inorder(b, &pos_b);
+        }
+        else
+        {
+            if (keep.both)
+            {
+                _BTreeMapBulkBuilder_push(&builder, key_a, &value);
+            }
+
+            pos_a = _BTreeMap_next_inorder(a, &pos_a);
+            pos_b = _BTreeMap_next_inorder(b, &pos_b);
         }
     }
 
-    free(old_entries);
+    for (; keep.only_a && pos_a.node != NULL; pos_a = _BTreeMap_next_inorder(a, &pos_a))
+    {
+        _BTreeMapBulkBuilder_push(&builder, BTreeMapEntryPos_to_entry(pos_a, a).key, &value);
+    }
+
+    for (; keep.only_b && pos_b.node != NULL; pos_b = _BTreeMap_next_inorder(b, &pos_b))
+    {
+        _BTreeMapBulkBuilder_push(&builder, BTreeMapEntryPos_to_entry(pos_b, b).key, &value);
+    }
+
+    _BTreeMapBulkBuilder_finish(&builder);
 }
 
-static float _HashMap_load_factor(const HashMap *this)
+// The *_into operations build result as a new set in O(n + m). Its elements are bitwise copies of the elements of
+// this and other, so result does not drop them and must not outlive them if they own resources.
+
+void BTreeSet_union_into(const BTreeSet *this, const BTreeSet *other, BTreeSet *result)
 {
-    return this->length / (float)(this->capacity);
+    _BTreeSet_merge_into(this, other, (_BTreeSetMergeKeep){.only_a = true, .both = true, .only_b = true}, result);
 }
 
-static void _HashMap_swap(const HashMap *this, _HashMapEntry *a, _HashMapEntry *b)
+// Runs in O(m log(n / m)) when one set is much smaller than the other
+void BTreeSet_intersection_into(const BTreeSet *this, const BTreeSet *other, BTreeSet *result)
 {
-    const size_t entry_size = _HashMap_entry_size(this);
-    uint8_t tmp[entry_size];
+    _BTreeSet_merge_into(this, other, (_BTreeSetMergeKeep){.both = true}, result);
+}
 
-    memcpy(tmp, a, entry_size);
-    memcpy(a, b, entry_size);
-    memcpy(b, tmp, entry_size);
+// Runs in O(m log(n / m)) when this is much smaller than other
+void BTreeSet_difference_into(const BTreeSet *this, const BTreeSet *other, BTreeSet *result)
+{
+    _BTreeSet_merge_into(this, other, (_BTreeSetMergeKeep){.only_a = true}, result);
 }
 
-void HashMap_insert(HashMap *this, void *key, void *value)
+void BTreeSet_symmetric_difference_into(const BTreeSet *this, const BTreeSet *other, BTreeSet *result)
 {
-    if (_HashMap_load_factor(this) > 0.7)
-    {
-        _HashMap_grow(this);
-    }
+    _BTreeSet_merge_into(this, other, (_BTreeSetMergeKeep){.only_a = true, .only_b = true}, result);
+}
 
-    Hasher_reset(&this->hasher);
-    this->key_props.hash(key, &this->hasher);
+// [BPlusTreeMap]
 
-    size_t slot = Hasher_finish(&this->hasher) % this->capacity;
+// Entries live in the leaves only, which are linked to their neighbours so ranges are walked without climbing the tree.
+// Internal nodes hold copies of keys: the separator before child i is the smallest key in the subtree of child i.
+typedef struct __BPlusTreeMapNode
+{
+    struct __BPlusTreeMapNode *parent;
+    bool is_leaf;
+    size_t key_count;
+    struct __BPlusTreeMapNode *prev;
+    struct __BPlusTreeMapNode *next;
+} _BPlusTreeMapNode;
 
-    uint8_t entry_buffer[_HashMap_entry_size(this)];
-    _HashMapEntry *entry = (_HashMapEntry *)entry_buffer;
+typedef struct
+{
+    _BPlusTreeMapNode *root;
+    size_t length;
+    BTreeMapKeyProps key_props;
+    BTreeMapValueProps value_props;
+    _BTreeMapLayout layout;
+} BPlusTreeMap;
 
-    _HashMapEntry_new(entry, key, value, this);
+static uint8_t *_BPlusTreeMapNode_keys(const _BPlusTreeMapNode *this)
+{
+    return (uint8_t *)this + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this));
+}
 
-    while (true)
-    {
-        _HashMapEntry *current_entry = _HashMap_entry_at(this, slot);
+static void *_BPlusTreeMap_key_at(const BPlusTreeMap *this, const _BPlusTreeMapNode *node, size_t idx)
+{
+    return _BPlusTreeMapNode_keys(node) + idx * this->key_props.size;
+}
 
-        if (current_entry->is_empty)
-        {
-            memcpy(current_entry, entry, _HashMap_entry_size(this));
-            this->length++;
-            break;
-        }
+static void *_BPlusTreeMap_value_at(const BPlusTreeMap *this, const _BPlusTreeMapNode *leaf, size_t idx)
+{
+    return (uint8_t *)leaf + this->layout.values_offset + idx * this->value_props.size;
+}
 
-        if (this->key_props.eq(_HashMapEntry_key(entry), _HashMapEntry_key(current_entry)))
-        {
-            if (this->key_props.drop != NULL)
-            {
-                this->key_props.drop(_HashMapEntry_key(current_entry));
-            }
+static _BPlusTreeMapNode **_BPlusTreeMap_children(const BPlusTreeMap *this, const _BPlusTreeMapNode *node)
+{
+    return (_BPlusTreeMapNode **)((uint8_t *)node + this->layout.children_offset);
+}
 
-            if (this->value_props.drop != NULL)
-            {
-                this->value_props.drop(_HashMapEntry_value(current_entry, this));
-            }
+static _BPlusTreeMapNode *_BPlusTreeMap_new_node(const BPlusTreeMap *this, _BPlusTreeMapNode *parent, bool is_leaf)
+{
+    _BPlusTreeMapNode *node = malloc(is_leaf ? this->layout.leaf_size : this->layout.internal_size);
 
-            memcpy(_HashMapEntry_value(current_entry, this), _HashMapEntry_value(entry, this), ROUND_SIZE_UP_TO_MAX_ALIGN(this->value_props.size));
-            break;
-        }
+    node->parent = parent;
+    node->is_leaf = is_leaf;
+    node->key_count = 0;
+    node->prev = NULL;
+    node->next = NULL;
 
-        if (current_entry->probe_length < entry->probe_length)
+    return node;
+}
+
+static size_t _BPlusTreeMap_child_idx(const BPlusTreeMap *this, const _BPlusTreeMapNode *parent, const _BPlusTreeMapNode *child)
+{
+    _BPlusTreeMapNode **children = _BPlusTreeMap_children(this, parent);
+
+    for (size_t i = 0; i < parent->key_count + 1; i++)
+    {
+        if (children[i] == child)
         {
-            _HashMap_swap(this, entry, current_entry);
+            return i;
         }
+    }
 
-        slot = (slot + 1) % this->capacity;
-        entry->probe_length++;
+    return SIZE_MAX;
+}
+
+// Index of the child of an internal node whose subtree may hold key
+static size_t _BPlusTreeMap_search_children(const BPlusTreeMap *this, const _BPlusTreeMapNode *node, const void *key)
+{
+    bool found;
+    size_t idx = _BTreeMap_search_keys(&this->key_props, _BPlusTreeMapNode_keys(node), node->key_count, key, &found);
+
+    return found ? idx + 1 : idx;
+}
+
+static _BPlusTreeMapNode *_BPlusTreeMap_find_leaf(const BPlusTreeMap *this, const void *key)
+{
+    _BPlusTreeMapNode *current = this->root;
+
+    while (!current->is_leaf)
+    {
+        current = _BPlusTreeMap_children(this, current)[_BPlusTreeMap_search_children(this, current, key)];
     }
+
+    return current;
 }
 
-void HashMap_with_hasher(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props, const Hasher *hasher)
+static void _BPlusTreeMap_set_children(const BPlusTreeMap *this, _BPlusTreeMapNode *node, size_t from, size_t count)
 {
-    const size_t INITIAL_CAPACITY = 16;
-    HashMap_with_capacity_and_hasher(this, key_props, value_props, INITIAL_CAPACITY, hasher);
+    _BPlusTreeMapNode **children = _BPlusTreeMap_children(this, node);
+
+    for (size_t i = from; i < from + count; i++)
+    {
+        children[i]->parent = node;
+    }
 }
 
-void HashMap_new(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props)
+void BPlusTreeMap_with_branching_factor(BPlusTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props, size_t t)
 {
-    HasherProps props = {
-        .size = sizeof(SimpleHasher),
-        .reset = (HasherResetFn)SimpleHasher_reset,
-        .write = (HasherWriteFn)SimpleHasher_write,
-        .finish = (HasherFinishFn)SimpleHasher_finish,
-    };
-    SimpleHasher hasher = {};
+    assert(t >= BTREEMAP_MINIMUM_T);
 
-    Hasher _hasher;
-    Hasher_new(&_hasher, &props, &hasher);
+    this->key_props = *key_props;
+    this->value_props = *value_props;
 
-    HashMap_with_hasher(this, key_props, value_props, &_hasher);
+    _BTreeMapLayout *layout = &this->layout;
+    layout->min_key_count = t - 1;
+    layout->max_key_count = 2 * t - 1;
+    layout->values_offset = ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_BPlusTreeMapNode)) + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * key_props->size);
+    layout->children_offset = layout->values_offset;
+    layout->leaf_size = layout->values_offset + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * value_props->size);
+    layout->internal_size = layout->children_offset + (layout->max_key_count + 1) * sizeof(_BPlusTreeMapNode *);
+
+    this->length = 0;
+    this->root = _BPlusTreeMap_new_node(this, NULL, true);
 }
 
-size_t _HashMap_get_entry(HashMap *this, void *key)
+void BPlusTreeMap_new(BPlusTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
 {
-    size_t result = SIZE_MAX;
+    BPlusTreeMap_with_branching_factor(this, key_props, value_props, _BTreeMap_default_branching_factor(key_props, value_props));
+}
 
-    Hasher_reset(&this->hasher);
-    this->key_props.hash(key, &this->hasher);
+size_t BPlusTreeMap_len(const BPlusTreeMap *this)
+{
+    return this->length;
+}
 
-    size_t slot = Hasher_finish(&this->hasher) % this->capacity;
-    size_t probe_length = 0;
+const void *BPlusTreeMap_get(const BPlusTreeMap *this, const void *key)
+{
+    _BPlusTreeMapNode *leaf = _BPlusTreeMap_find_leaf(this, key);
 
-    while (true)
+    bool found;
+    size_t idx = _BTreeMap_search_keys(&this->key_props, _BPlusTreeMapNode_keys(leaf), leaf->key_count, key, &found);
+
+    return found ? _BPlusTreeMap_value_at(this, leaf, idx) : NULL;
+}
+
+// Inserts separator and the child to its right into an internal node, at separator index idx
+static void _BPlusTreeMap_insert_separator(const BPlusTreeMap *this, _BPlusTreeMapNode *node, size_t idx, const void *separator, _BPlusTreeMapNode *child)
+{
+    size_t key_size = this->key_props.size;
+    _BPlusTreeMapNode **children = _BPlusTreeMap_children(this, node);
+
+    memmove(_BPlusTreeMap_key_at(this, node, idx + 1), _BPlusTreeMap_key_at(this, node, idx), (node->key_count - idx) * key_size);
+    memcpy(_BPlusTreeMap_key_at(this, node, idx), separator, key_size);
+
+    memmove(&children[idx + 2], &children[idx + 1], (node->key_count - idx) * sizeof(children[0]));
+    children[idx + 1] = child;
+    child->parent = node;
+
+    node->key_count++;
+}
+
+// Removes the separator at idx and the child to its right from an internal node
+static void _BPlusTreeMap_remove_separator(const BPlusTreeMap *this, _BPlusTreeMapNode *node, size_t idx)
+{
+    size_t key_size = this->key_props.size;
+    _BPlusTreeMapNode **children = _BPlusTreeMap_children(this, node);
+
+    memmove(_BPlusTreeMap_key_at(this, node, idx), _BPlusTreeMap_key_at(this, node, idx + 1), (node->key_count - idx - 1) * key_size);
+    memmove(&children[idx + 1], &children[idx + 2], (node->key_count - idx - 1) * sizeof(children[0]));
+
+    node->key_count--;
+}
+
+static void _BPlusTreeMap_fix_overflow_up(BPlusTreeMap *this, _BPlusTreeMapNode *node)
+{
+    size_t key_size = this->key_props.size;
+    _BPlusTreeMapNode *current = node;
+
+    while (current->key_count == this->layout.max_key_count)
     {
-        _HashMapEntry *slot_entry = _HashMap_entry_at(this, slot);
+        _BPlusTreeMapNode *right = _BPlusTreeMap_new_node(this, current->parent, current->is_leaf);
 
-        if (slot_entry->is_empty)
+        uint8_t separator[key_size];
+
+        if (current->is_leaf)
         {
-            break;
+            // the right leaf keeps its first key, a copy of it goes up
+            size_t left_count = (current->key_count + 1) / 2;
+            right->key_count = current->key_count - left_count;
+
+            memcpy(_BPlusTreeMap_key_at(this, right, 0), _BPlusTreeMap_key_at(this, current, left_count), right->key_count * key_size);
+            memcpy(_BPlusTreeMap_value_at(this, right, 0), _BPlusTreeMap_value_at(this, current, left_count), right->key_count * this->value_props.size);
+            current->key_count = left_count;
+
+            right->prev = current;
+            right->next = current->next;
+            if (current->next != NULL)
+            {
+                current->next->prev = right;
+            }
+            current->next = right;
+
+            memcpy(separator, _BPlusTreeMap_key_at(this, right, 0), key_size);
         }
+        else
+        {
+            // the middle separator moves up
+            size_t separator_idx = current->key_count / 2;
+            right->key_count = current->key_count - separator_idx - 1;
 
-        if (this->key_props.eq(key, _HashMapEntry_key(slot_entry)))
+            memcpy(separator, _BPlusTreeMap_key_at(this, current, separator_idx), key_size);
+            memcpy(_BPlusTreeMap_key_at(this, right, 0), _BPlusTreeMap_key_at(this, current, separator_idx + 1), right->key_count * key_size);
+            memcpy(_BPlusTreeMap_children(this, right), &_BPlusTreeMap_children(this, current)[separator_idx + 1], (right->key_count + 1) * sizeof(_BPlusTreeMapNode *));
+            _BPlusTreeMap_set_children(this, right, 0, right->key_count + 1);
+
+            current->key_count = separator_idx;
+        }
+
+        if (current->parent == NULL)
         {
-            result = slot;
-            break;
+            _BPlusTreeMapNode *new_root = _BPlusTreeMap_new_node(this, NULL, false);
+            _BPlusTreeMap_children(this, new_root)[0] = current;
+            current->parent = new_root;
+            this->root = new_root;
         }
 
-        if (slot_entry->probe_length < probe_length)
+        _BPlusTreeMapNode *parent = current->parent;
+        _BPlusTreeMap_insert_separator(this, parent, _BPlusTreeMap_child_idx(this, parent, current), separator, right);
+
+        current = parent;
+    }
+}
+
+void BPlusTreeMap_insert(BPlusTreeMap *this, const void *key, const void *value)
+{
+    _BPlusTreeMapNode *leaf = _BPlusTreeMap_find_leaf(this, key);
+
+    bool found;
+    size_t idx = _BTreeMap_search_keys(&this->key_props, _BPlusTreeMapNode_keys(leaf), leaf->key_count, key, &found);
+
+    void *leaf_key = _BPlusTreeMap_key_at(this, leaf, idx);
+    void *leaf_value = _BPlusTreeMap_value_at(this, leaf, idx);
+
+    if (found)
+    {
+        // the old key stays, separators may still refer to its bytes
+        if (this->key_props.drop != NULL)
         {
-            break;
+            this->key_props.drop((void *)key);
         }
 
-        slot = (slot + 1) % this->capacity;
-        probe_length++;
+        if (this->value_props.drop != NULL)
+        {
+            this->value_props.drop(leaf_value);
+        }
+
+        memcpy(leaf_value, value, this->value_props.size);
+        return;
     }
 
-    return result;
+    memmove(_BPlusTreeMap_key_at(this, leaf, idx + 1), leaf_key, (leaf->key_count - idx) * this->key_props.size);
+    memmove(_BPlusTreeMap_value_at(this, leaf, idx + 1), leaf_value, (leaf->key_count - idx) * this->value_props.size);
+    memcpy(leaf_key, key, this->key_props.size);
+    memcpy(leaf_value, value, this->value_props.size);
+    leaf->key_count++;
+
+    this->length += 1;
+
+    _BPlusTreeMap_fix_overflow_up(this, leaf);
 }
 
-void *HashMap_get(HashMap *this, void *key)
+static void _BPlusTreeMap_merge(BPlusTreeMap *this, _BPlusTreeMapNode *parent, size_t separator_idx)
 {
-    size_t result = _HashMap_get_entry(this, key);
+    size_t key_size = this->key_props.size;
+    _BPlusTreeMapNode **children = _BPlusTreeMap_children(this, parent);
+    _BPlusTreeMapNode *left = children[separator_idx];
+    _BPlusTreeMapNode *right = children[separator_idx + 1];
 
-    if (result != SIZE_MAX)
+    if (left->is_leaf)
     {
-        return _HashMapEntry_value(_HashMap_entry_at(this, result), this);
+        memcpy(_BPlusTreeMap_key_at(this, left, left->key_count), _BPlusTreeMap_key_at(this, right, 0), right->key_count * key_size);
+        memcpy(_BPlusTreeMap_value_at(this, left, left->key_count), _BPlusTreeMap_value_at(this, right, 0), right->key_count * this->value_props.size);
+
+        left->next = right->next;
+        if (right->next != NULL)
+        {
+            right->next->prev = left;
+        }
     }
     else
     {
-        return NULL;
+        // the separator comes down between the children of both nodes
+        memcpy(_BPlusTreeMap_key_at(this, left, left->key_count), _BPlusTreeMap_key_at(this, parent, separator_idx), key_size);
+        left->key_count++;
+
+        memcpy(_BPlusTreeMap_key_at(this, left, left->key_count), _BPlusTreeMap_key_at(this, right, 0), right->key_count * key_size);
+        memcpy(&_BPlusTreeMap_children(this, left)[left->key_count], _BPlusTreeMap_children(this, right), (right->key_count + 1) * sizeof(_BPlusTreeMapNode *));
+        _BPlusTreeMap_set_children(this, left, left->key_count, right->key_count + 1);
     }
+
+    left->key_count += right->key_count;
+    free(right);
+
+    _BPlusTreeMap_remove_separator(this, parent, separator_idx);
 }
 
-void HashMap_remove(HashMap *this, void *key)
+// Moves one entry (or child) from the sibling next to current through the separator at separator_idx
+static void _BPlusTreeMap_borrow(BPlusTreeMap *this, _BPlusTreeMapNode *parent, size_t separator_idx, bool from_left)
 {
-    size_t slot = _HashMap_get_entry(this, key);
-    if (slot == SIZE_MAX)
+    size_t key_size = this->key_props.size;
+    size_t value_size = this->value_props.size;
+    _BPlusTreeMapNode **siblings = _BPlusTreeMap_children(this, parent);
+    _BPlusTreeMapNode *left = siblings[separator_idx];
+    _BPlusTreeMapNode *right = siblings[separator_idx + 1];
+    void *separator = _BPlusTreeMap_key_at(this, parent, separator_idx);
+
+    if (left->is_leaf)
     {
+        if (from_left)
+        {
+            memmove(_BPlusTreeMap_key_at(this, right, 1), _BPlusTreeMap_key_at(this, right, 0), right->key_count * key_size);
+            memmove(_BPlusTreeMap_value_at(this, right, 1), _BPlusTreeMap_value_at(this, right, 0), right->key_count * value_size);
+            memcpy(_BPlusTreeMap_key_at(this, right, 0), _BPlusTreeMap_key_at(this, left, left->key_count - 1), key_size);
+            memcpy(_BPlusTreeMap_value_at(this, right, 0), _BPlusTreeMap_value_at(this, left, left->key_count - 1), value_size);
+            left->key_count--;
+            right->key_count++;
+        }
+        else
+        {
+            memcpy(_BPlusTreeMap_key_at(this, left, left->key_count), _BPlusTreeMap_key_at(this, right, 0), key_size);
+            memcpy(_BPlusTreeMap_value_at(this, left, left->key_count), _BPlusTreeMap_value_at(this, right, 0), value_size);
+            memmove(_BPlusTreeMap_key_at(this, right, 0), _BPlusTreeMap_key_at(this, right, 1), (right->key_count - 1) * key_size);
+            memmove(_BPlusTreeMap_value_at(this, right, 0), _BPlusTreeMap_value_at(this, right, 1), (right->key_count - 1) * value_size);
+            left->key_count++;
+            right->key_count--;
+        }
+
+        memcpy(separator, _BPlusTreeMap_key_at(this, right, 0), key_size);
         return;
     }
 
-    this->key_props.drop(_HashMapEntry_key(_HashMap_entry_at(this, slot)));
+    _BPlusTreeMapNode **left_children = _BPlusTreeMap_children(this, left);
+    _BPlusTreeMapNode **right_children = _BPlusTreeMap_children(this, right);
 
-    if (this->value_props.drop)
+    if (from_left)
     {
-        this->value_props.drop(_HashMapEntry_value(_HashMap_entry_at(this, slot), this));
-    }
-
-    this->length--;
+        memmove(_BPlusTreeMap_key_at(this, right, 1), _BPlusTreeMap_key_at(this, right, 0), right->key_count * key_size);
+        memmove(&right_children[1], &right_children[0], (right->key_count + 1) * sizeof(right_children[0]));
 
-    size_t next_slot = (slot + 1) % this->capacity;
+        memcpy(_BPlusTreeMap_key_at(this, right, 0), separator, key_size);
+        right_children[0] = left_children[left->key_count];
+        right_children[0]->parent = right;
 
-    while (true)
+        memcpy(separator, _BPlusTreeMap_key_at(this, left, left->key_count - 1), key_size);
+        left->key_count--;
+        right->key_count++;
+    }
+    else
     {
-        _HashMapEntry *entry = _HashMap_entry_at(this, slot);
-        _HashMapEntry *next_entry = _HashMap_entry_at(this, next_slot);
-
-        if (next_entry->is_empty || next_entry->probe_length == 0)
-        {
-            entry->is_empty = true;
-            break;
-        }
+        memcpy(_BPlusTreeMap_key_at(this, left, left->key_count), separator, key_size);
+        left_children[left->key_count + 1] = right_children[0];
+        left_children[left->key_count + 1]->parent = left;
 
-        memcpy(entry, next_entry, _HashMap_entry_size(this));
-        entry->probe_length--;
+        memcpy(separator, _BPlusTreeMap_key_at(this, right, 0), key_size);
+        memmove(_BPlusTreeMap_key_at(this, right, 0), _BPlusTreeMap_key_at(this, right, 1), (right->key_count - 1) * key_size);
+        memmove(&right_children[0], &right_children[1], right->key_count * sizeof(right_children[0]));
 
-        slot = next_slot;
-        next_slot = (next_slot + 1) % this->capacity;
+        left->key_count++;
+        right->key_count--;
     }
 }
 
-void HashMap_drop(HashMap *this)
+static void _BPlusTreeMap_fix_underflow_up(BPlusTreeMap *this, _BPlusTreeMapNode *node)
 {
-    for (size_t i = 0; i < this->capacity; i++)
+    _BPlusTreeMapNode *current = node;
+
+    while (current->key_count < this->layout.min_key_count)
     {
-        _HashMapEntry *entry = _HashMap_entry_at(this, i);
+        _BPlusTreeMapNode *parent = current->parent;
 
-        if (!entry->is_empty)
+        if (parent == NULL)
         {
-            this->key_props.drop(_HashMapEntry_key(entry));
-
-            if (this->value_props.drop != NULL)
+            if (!current->is_leaf && current->key_count == 0)
             {
-                this->value_props.drop(_HashMapEntry_value(entry, this));
+                this->root = _BPlusTreeMap_children(this, current)[0];
+                this->root->parent = NULL;
+                free(current);
             }
+
+            break;
         }
-    }
 
-    Hasher_drop(&this->hasher);
+        _BPlusTreeMapNode **siblings = _BPlusTreeMap_children(this, parent);
+        size_t child_idx = _BPlusTreeMap_child_idx(this, parent, current);
 
-    free(this->entries);
-}
+        bool has_left_sibling = child_idx > 0;
+        bool has_right_sibling = child_idx < parent->key_count;
 
-// [HashSet]
+        if (has_left_sibling && siblings[child_idx - 1]->key_count > this->layout.min_key_count)
+        {
+            _BPlusTreeMap_borrow(this, parent, child_idx - 1, true);
+            break;
+        }
+        else if (has_right_sibling && siblings[child_idx + 1]->key_count > this->layout.min_key_count)
+        {
+            _BPlusTreeMap_borrow(this, parent, child_idx, false);
+            break;
+        }
+        else
+        {
+            _BPlusTreeMap_merge(this, parent, has_left_sibling ? child_idx - 1 : child_idx);
+            current = parent;
+        }
+    }
+}
 
-typedef struct
+// Separators that copied a removed key would compare against freed memory, replace them by the next smallest key
+static void _BPlusTreeMap_replace_separators(BPlusTreeMap *this, const void *key)
 {
-    size_t size;
-    EqFn eq;
-    HashFn hash;
-    DropFn drop;
-} HashSetElementProps;
+    _BPlusTreeMapNode *current = this->root;
 
-typedef struct
-{
-    HashMap *map;
-} HashSet;
+    while (!current->is_leaf)
+    {
+        size_t idx = _BPlusTreeMap_search_children(this, current, key);
+        _BPlusTreeMapNode *child = _BPlusTreeMap_children(this, current)[idx];
 
-void HashSet_with_capacity_and_hasher(HashSet *this, const HashSetElementProps *element_props, size_t capacity, const Hasher *hasher)
-{
-    this->map = malloc(sizeof(*this->map));
+        if (idx > 0 && this->key_props.cmp(key, _BPlusTreeMap_key_at(this, current, idx - 1)) == 0)
+        {
+            _BPlusTreeMapNode *leftmost = child;
 
-    HashMapKeyProps key_props = {
-        .size = element_props->size,
-        .eq = element_props->eq,
-        .hash = element_props->hash,
-        .drop = element_props->drop,
-    };
-    HashMapValueProps value_props = {
-        .size = sizeof(uint8_t),
-    };
-    HashMap_with_capacity_and_hasher(this->map, &key_props, &value_props, capacity, hasher);
-}
+            while (!leftmost->is_leaf)
+            {
+                leftmost = _BPlusTreeMap_children(this, leftmost)[0];
+            }
 
-void HashSet_with_hasher(HashSet *this, const HashSetElementProps *element_props, const Hasher *hasher)
-{
-    this->map = malloc(sizeof(*this->map));
+            memcpy(_BPlusTreeMap_key_at(this, current, idx - 1), _BPlusTreeMap_key_at(this, leftmost, 0), this->key_props.size);
+        }
 
-    HashMapKeyProps key_props = {
-        .size = element_props->size,
-        .eq = element_props->eq,
-        .hash = element_props->hash,
-        .drop = element_props->drop,
-    };
-    HashMapValueProps value_props = {
-        .size = sizeof(uint8_t),
-    };
-    HashMap_with_hasher(this->map, &key_props, &value_props, hasher);
+        current = child;
+    }
 }
 
-void HashSet_new(HashSet *this, const HashSetElementProps *element_props)
+void BPlusTreeMap_remove(BPlusTreeMap *this, const void *key)
 {
-    this->map = malloc(sizeof(*this->map));
-
-    HashMapKeyProps key_props = {
-        .size = element_props->size,
-        .eq = element_props->eq,
-        .hash = element_props->hash,
-        .drop = element_props->drop,
-    };
-    HashMapValueProps value_props = {
-        .size = sizeof(uint8_t),
-    };
-    HashMap_new(this->map, &key_props, &value_props);
-}
+    _BPlusTreeMapNode *leaf = _BPlusTreeMap_find_leaf(this, key);
 
-void HashSet_insert(HashSet *this, void *element)
-{
-    uint8_t i = 0;
-    HashMap_insert(this->map, element, &i);
-}
+    bool found;
+    size_t idx = _BTreeMap_search_keys(&this->key_props, _BPlusTreeMapNode_keys(leaf), leaf->key_count, key, &found);
 
-size_t HashSet_len(const HashSet *this)
-{
-    return HashMap_len(this->map);
-}
+    if (!found)
+    {
+        return;
+    }
 
-size_t HashSet_capacity(const HashSet *this)
-{
-    return HashMap_capacity(this->map);
-}
+    uint8_t removed_key[this->key_props.size];
+    memcpy(removed_key, _BPlusTreeMap_key_at(this, leaf, idx), this->key_props.size);
 
-bool HashSet_contains(const HashSet *this, void *element)
-{
-    return HashMap_get(this->map, element) == NULL ? false : true;
-}
+    if (this->value_props.drop != NULL)
+    {
+        this->value_props.drop(_BPlusTreeMap_value_at(this, leaf, idx));
+    }
 
-// [HashSetUnionIter]
+    memmove(_BPlusTreeMap_key_at(this, leaf, idx), _BPlusTreeMap_key_at(this, leaf, idx + 1), (leaf->key_count - idx - 1) * this->key_props.size);
+    memmove(_BPlusTreeMap_value_at(this, leaf, idx), _BPlusTreeMap_value_at(this, leaf, idx + 1), (leaf->key_count - idx - 1) * this->value_props.size);
+    leaf->key_count--;
 
-typedef enum
-{
-    HASH_SET_UNION_ITER_PHASE_A,
-    HASH_SET_UNION_ITER_PHASE_B,
-    HASH_SET_UNION_ITER_PHASE_DONE,
-} HashSetUnionIterPhase;
+    this->length -= 1;
 
-typedef struct
-{
-    const HashSet *a;
-    const HashSet *b;
-    HashSetUnionIterPhase phase;
-    size_t current;
-} HashSetUnionIter;
+    _BPlusTreeMap_fix_underflow_up(this, leaf);
 
-void HashSetUnionIter_new(HashSetUnionIter *this, const HashSet *a, const HashSet *b)
-{
-    this->a = a;
-    this->b = b;
+    // only the first key of a leaf can have been copied into a separator
+    if (idx == 0 && this->length > 0)
+    {
+        _BPlusTreeMap_replace_separators(this, removed_key);
+    }
 
-    this->phase = HASH_SET_UNION_ITER_PHASE_A;
-    this->current = 0;
+    if (this->key_props.drop != NULL)
+    {
+        this->key_props.drop(removed_key);
+    }
 }
 
-void *HashSetUnionIter_next(HashSetUnionIter *this)
+static _BPlusTreeMapNode *_BPlusTreeMap_leftmost(const BPlusTreeMap *this)
 {
-    if (this->phase == HASH_SET_UNION_ITER_PHASE_DONE)
-    {
-        return NULL;
-    }
+    _BPlusTreeMapNode *current = this->root;
 
-    if (this->phase == HASH_SET_UNION_ITER_PHASE_A)
+    while (!current->is_leaf)
     {
-        size_t i;
-        for (i = this->current; i < HashSet_capacity(this->a); i++)
-        {
-            _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+        current = _BPlusTreeMap_children(this, current)[0];
+    }
 
-            if (!entry->is_empty)
-            {
-                break;
-            }
-        }
+    return current;
+}
 
-        if (i == HashSet_capacity(this->a))
-        {
-            this->phase = HASH_SET_UNION_ITER_PHASE_B;
-            this->current = 0;
-        }
-        else
+static void _BPlusTreeMap_free_nodes(const BPlusTreeMap *this, _BPlusTreeMapNode *node)
+{
+    if (!node->is_leaf)
+    {
+        for (size_t i = 0; i < node->key_count + 1; i++)
         {
-            this->current = i + 1;
-            return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+            _BPlusTreeMap_free_nodes(this, _BPlusTreeMap_children(this, node)[i]);
         }
     }
 
-    if (this->phase == HASH_SET_UNION_ITER_PHASE_B)
+    free(node);
+}
+
+void BPlusTreeMap_drop(BPlusTreeMap *this)
+{
+    for (_BPlusTreeMapNode *leaf = _BPlusTreeMap_leftmost(this); leaf != NULL; leaf = leaf->next)
     {
-        size_t i;
-        for (i = this->current; i < HashSet_capacity(this->b); i++)
+        for (size_t i = 0; i < leaf->key_count; i++)
         {
-            _HashMapEntry *entry = _HashMap_entry_at(this->b->map, i);
-
-            if (!entry->is_empty && !HashSet_contains(this->a, _HashMapEntry_key(entry)))
+            if (this->key_props.drop != NULL)
             {
-                break;
+                this->key_props.drop(_BPlusTreeMap_key_at(this, leaf, i));
             }
-        }
 
-        if (i == HashSet_capacity(this->b))
-        {
-            this->phase = HASH_SET_UNION_ITER_PHASE_DONE;
-        }
-        else
-        {
-            this->current = i + 1;
-            return _HashMapEntry_key(_HashMap_entry_at(this->b->map, i));
+            if (this->value_props.drop != NULL)
+            {
+                this->value_props.drop(_BPlusTreeMap_value_at(this, leaf, i));
+            }
         }
     }
 
-    return NULL;
-}
-
-void HashSetUnionIter_drop(HashSetUnionIter *this)
-{
+    _BPlusTreeMap_free_nodes(this, this->root);
 }
 
-// [HashSetIntersectionIter]
+// [BPlusTreeMapRangeIter]
 
 typedef struct
 {
-    const HashSet *a;
-    const HashSet *b;
-    size_t current;
+    const BPlusTreeMap *map;
+    _BPlusTreeMapNode *leaf;
+    size_t idx;
+    _BPlusTreeMapNode *leaf_back;
+    size_t idx_back;
+    BTreeMapEntry buffer;
     bool is_done;
-} HashSetIntersectionIter;
+} BPlusTreeMapRangeIter;
 
-void HashSetIntersectionIter_new(HashSetIntersectionIter *this, const HashSet *a, const HashSet *b)
+void BPlusTreeMapRangeIter_new(BPlusTreeMapRangeIter *this, const BPlusTreeMap *map, const RangeBound *start, const RangeBound *end)
 {
-    this->a = a;
-    this->b = b;
-
-    this->current = 0;
+    this->map = map;
     this->is_done = false;
-}
 
-void *HashSetIntersectionIter_next(HashSetIntersectionIter *this)
-{
-    if (this->is_done)
+    if (start->kind == RANGE_BOUND_KIND_UNBOUND)
     {
-        return NULL;
+        this->leaf = _BPlusTreeMap_leftmost(map);
+        this->idx = 0;
     }
+    else
+    {
+        const void *key = start->kind == RANGE_BOUND_KIND_INCLUDED ? start->included.value : start->excluded.value;
+        this->leaf = _BPlusTreeMap_find_leaf(map, key);
 
-    size_t i;
-    for (i = this->current; i < HashSet_capacity(this->a); i++)
+        bool found;
+        this->idx = _BTreeMap_search_keys(&map->key_props, _BPlusTreeMapNode_keys(this->leaf), this->leaf->key_count, key, &found);
+
+        if (found && start->kind == RANGE_BOUND_KIND_EXCLUDED)
+        {
+            this->idx++;
+        }
+    }
+
+    if (this->idx >= this->leaf->key_count)
     {
-        _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+        this->leaf = this->leaf->next;
+        this->idx = 0;
+    }
 
-        if (!entry->is_empty && HashSet_contains(this->b, _HashMapEntry_key(entry)))
+    if (end->kind == RANGE_BOUND_KIND_UNBOUND)
+    {
+        this->leaf_back = map->root;
+
+        while (!this->leaf_back->is_leaf)
         {
-            break;
+            this->leaf_back = _BPlusTreeMap_children(map, this->leaf_back)[this->leaf_back->key_count];
         }
+
+        this->idx_back = this->leaf_back->key_count;
     }
+    else
+    {
+        const void *key = end->kind == RANGE_BOUND_KIND_INCLUDED ? end->included.value : end->excluded.value;
+        this->leaf_back = _BPlusTreeMap_find_leaf(map, key);
 
-    if (i == HashSet_capacity(this->b))
+        bool found;
+        this->idx_back = _BTreeMap_search_keys(&map->key_props, _BPlusTreeMapNode_keys(this->leaf_back), this->leaf_back->key_count, key, &found);
+
+        if (found && end->kind == RANGE_BOUND_KIND_INCLUDED)
+        {
+            this->idx_back++;
+        }
+    }
+
+    // idx_back is one past the last entry, move it into the previous leaf when that is before the first entry
+    if (this->idx_back == 0)
+    {
+        this->leaf_back = this->leaf_back->prev;
+        this->idx_back = this->leaf_back == NULL ? 0 : this->leaf_back->key_count;
+    }
+
+    if (this->leaf == NULL || this->leaf_back == NULL || this->leaf->key_count == 0)
     {
         this->is_done = true;
-        return NULL;
     }
-    else
+    else if (map->key_props.cmp(_BPlusTreeMap_key_at(map, this->leaf, this->idx), _BPlusTreeMap_key_at(map, this->leaf_back, this->idx_back - 1)) > 0)
     {
-        this->current = i + 1;
-        return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+        // no key falls between the bounds
+        this->is_done = true;
     }
 }
 
-void HashSetIntersectionIter_drop(HashSetIntersectionIter *this)
+static bool _BPlusTreeMapRangeIter_is_last(const BPlusTreeMapRangeIter *this)
 {
+    return this->leaf == this->leaf_back && this->idx + 1 == this->idx_back;
 }
 
-// [HashSetDifferenceIter]
-
-typedef struct
+BTreeMapEntry *BPlusTreeMapRangeIter_next(BPlusTreeMapRangeIter *this)
 {
-    const HashSet *a;
-    const HashSet *b;
-    size_t current;
-    bool is_done;
-} HashSetDifferenceIter;
+    if (this->is_done)
+    {
+        return NULL;
+    }
 
-void HashSetDifferenceIter_new(HashSetDifferenceIter *this, const HashSet *a, const HashSet *b)
-{
-    this->a = a;
-    this->b = b;
+    this->is_done = _BPlusTreeMapRangeIter_is_last(this);
+    this->buffer = _BTreeMapEntry_new(_BPlusTreeMap_key_at(this->map, this->leaf, this->idx), _BPlusTreeMap_value_at(this->map, this->leaf, this->idx));
 
-    this->current = 0;
-    this->is_done = false;
+    this->idx++;
+
+    if (this->idx == this->leaf->key_count && !this->is_done)
+    {
+        this->leaf = this->leaf->next;
+        this->idx = 0;
+    }
+
+    return &this->buffer;
 }
 
-void *HashSetDifferenceIter_next(HashSetDifferenceIter *this)
+BTreeMapEntry *BPlusTreeMapRangeIter_next_back(BPlusTreeMapRangeIter *this)
 {
     if (this->is_done)
     {
         return NULL;
     }
 
-    size_t i;
-    for (i = this->current; i < HashSet_capacity(this->a); i++)
-    {
-        _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
-
-        if (!entry->is_empty && !HashSet_contains(this->b, _HashMapEntry_key(entry)))
-        {
-            break;
-        }
-    }
+    this->is_done = _BPlusTreeMapRangeIter_is_last(this);
+    this->idx_back--;
+    this->buffer = _BTreeMapEntry_new(_BPlusTreeMap_key_at(this->map, this->leaf_back, this->idx_back), _BPlusTreeMap_value_at(this->map, this->leaf_back, this->idx_back));
 
-    if (i == HashSet_capacity(this->b))
-    {
-        this->is_done = true;
-        return NULL;
-    }
-    else
+    if (this->idx_back == 0 && !this->is_done)
     {
-        this->current = i + 1;
-        return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+        this->leaf_back = this->leaf_back->prev;
+        this->idx_back = this->leaf_back->key_count;
     }
+
+    return &this->buffer;
 }
 
-void HashSetDifferenceIter_drop(HashSetDifferenceIter *this)
+void BPlusTreeMapRangeIter_drop(BPlusTreeMapRangeIter *this)
 {
 }
 
-// [HashSetSymmetricDifferenceIter]
+Iterator BPlusTreeMapRangeIter_iter(BPlusTreeMapRangeIter *this)
+{
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)BPlusTreeMapRangeIter_next,
+            .next_back = (IteratorNextBackFn)BPlusTreeMapRangeIter_next_back,
+        });
+}
 
-typedef enum
+BPlusTreeMapRangeIter BPlusTreeMap_range(const BPlusTreeMap *this, const RangeBound *start, const RangeBound *end)
 {
-    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A,
-    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B,
-    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE,
-} HashSetSymmetricDifferenceIterPhase;
+    BPlusTreeMapRangeIter iter;
+    BPlusTreeMapRangeIter_new(&iter, this, start, end);
+
+    return iter;
+}
+
+// [PersistentBTreeMap]
+
+#include <stdatomic.h>
+
+// Nodes are shared between versions and never point back to their parent. Each counts the versions and nodes that
+// refer to it, and is only modified while that count is one; otherwise the writer copies it first.
+typedef struct __PersistentBTreeMapNode
+{
+    atomic_size_t ref_count;
+    bool is_leaf;
+    size_t key_count;
+} _PersistentBTreeMapNode;
 
 typedef struct
 {
-    const HashSet *a;
-    const HashSet *b;
-    HashSetSymmetricDifferenceIterPhase phase;
-    size_t current;
-} HashSetSymmetricDifferenceIter;
+    _PersistentBTreeMapNode *root;
+    size_t length;
+    size_t height;
+    BTreeMapKeyProps key_props;
+    BTreeMapValueProps value_props;
+    _BTreeMapLayout layout;
+} PersistentBTreeMap;
 
-void HashSetSymmetricDifferenceIter_new(HashSetSymmetricDifferenceIter *this, const HashSet *a, const HashSet *b)
+static uint8_t *_PersistentBTreeMap_key_at(const PersistentBTreeMap *this, const _PersistentBTreeMapNode *node, size_t idx)
 {
-    this->a = a;
-    this->b = b;
+    return (uint8_t *)node + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*node)) + idx * this->key_props.size;
+}
 
-    this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A;
-    this->current = 0;
+static uint8_t *_PersistentBTreeMap_value_at(const PersistentBTreeMap *this, const _PersistentBTreeMapNode *node, size_t idx)
+{
+    return (uint8_t *)node + this->layout.values_offset + idx * this->value_props.size;
 }
 
-void *HashSetSymmetricDifferenceIter_next(HashSetSymmetricDifferenceIter *this)
+static _PersistentBTreeMapNode **_PersistentBTreeMap_children(const PersistentBTreeMap *this, const _PersistentBTreeMapNode *node)
 {
-    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE)
-    {
-        return NULL;
-    }
+    return (_PersistentBTreeMapNode **)((uint8_t *)node + this->layout.children_offset);
+}
 
-    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A)
-    {
-        size_t i;
-        for (i = this->current; i < HashSet_capacity(this->a); i++)
-        {
-            _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+static _PersistentBTreeMapNode *_PersistentBTreeMap_new_node(const PersistentBTreeMap *this, bool is_leaf)
+{
+    _PersistentBTreeMapNode *node = malloc(is_leaf ? this->layout.leaf_size : this->layout.internal_size);
 
-            if (!entry->is_empty && !HashSet_contains(this->b, _HashMapEntry_key(entry)))
-            {
-                break;
-            }
-        }
+    atomic_init(&node->ref_count, 1);
+    node->is_leaf = is_leaf;
+    node->key_count = 0;
 
-        if (i == HashSet_capacity(this->a))
-        {
-            this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B;
-            this->current = 0;
-        }
-        else
-        {
-            this->current = i + 1;
-            return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
-        }
-    }
+    return node;
+}
 
-    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B)
+static void _PersistentBTreeMap_release(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node)
+{
+    if (atomic_fetch_sub_explicit(&node->ref_count, 1, memory_order_acq_rel) != 1)
     {
-        size_t i;
-        for (i = this->current; i < HashSet_capacity(this->b); i++)
-        {
-            _HashMapEntry *entry = _HashMap_entry_at(this->b->map, i);
-
-            if (!entry->is_empty && !HashSet_contains(this->a, _HashMapEntry_key(entry)))
-            {
-                break;
-            }
-        }
+        return;
+    }
 
-        if (i == HashSet_capacity(this->b))
-        {
-            this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE;
-        }
-        else
-        {
-            this->current = i + 1;
-            return _HashMapEntry_key(_HashMap_entry_at(this->b->map, i));
-        }
+    for (size_t i = 0; !node->is_leaf && i < node->key_count + 1; i++)
+    {
+        _PersistentBTreeMap_release(this, _PersistentBTreeMap_children(this, node)[i]);
     }
 
-    return NULL;
+    free(node);
 }
 
-void HashSetSymmetricDifferenceIter_drop(HashSetSymmetricDifferenceIter *this)
+// Makes the node in slot exclusive to this version, copying it if other versions share it
+static _PersistentBTreeMapNode *_PersistentBTreeMap_make_mut(const PersistentBTreeMap *this, _PersistentBTreeMapNode **slot)
 {
-}
+    _PersistentBTreeMapNode *node = *slot;
 
-HashSetUnionIter HashSet_union(const HashSet *this, const HashSet *other)
-{
-    HashSetUnionIter iter;
-    HashSetUnionIter_new(&iter, this, other);
+    if (atomic_load_explicit(&node->ref_count, memory_order_acquire) == 1)
+    {
+        return node;
+    }
 
-    return iter;
-}
+    _PersistentBTreeMapNode *copy = malloc(node->is_leaf ? this->layout.leaf_size : this->layout.internal_size);
+    memcpy(copy, node, node->is_leaf ? this->layout.leaf_size : this->layout.internal_size);
+    atomic_init(&copy->ref_count, 1);
 
-HashSetIntersectionIter HashSet_intersection(const HashSet *this, const HashSet *other)
-{
-    HashSetIntersectionIter iter;
-    HashSetIntersectionIter_new(&iter, this, other);
+    for (size_t i = 0; !copy->is_leaf && i < copy->key_count + 1; i++)
+    {
+        atomic_fetch_add_explicit(&_PersistentBTreeMap_children(this, copy)[i]->ref_count, 1, memory_order_relaxed);
+    }
 
-    return iter;
+    _PersistentBTreeMap_release(this, node);
+
+    *slot = copy;
+    return copy;
 }
 
-HashSetDifferenceIter HashSet_difference(const HashSet *this, const HashSet *other)
+// Entries of shared nodes are copied bitwise into new versions, so keys and values must not own resources
+void PersistentBTreeMap_with_branching_factor(PersistentBTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props, size_t t)
 {
-    HashSetDifferenceIter iter;
-    HashSetDifferenceIter_new(&iter, this, other);
+    assert(t >= BTREEMAP_MINIMUM_T);
+    assert(key_props->drop == NULL && value_props->drop == NULL);
 
-    return iter;
-}
+    this->key_props = *key_props;
+    this->value_props = *value_props;
 
-HashSetSymmetricDifferenceIter HashSet_symmetric_difference(const HashSet *this, const HashSet *other)
-{
-    HashSetSymmetricDifferenceIter iter;
-    HashSetSymmetricDifferenceIter_new(&iter, this, other);
+    _BTreeMapLayout *layout = &this->layout;
+    layout->min_key_count = t - 1;
+    layout->max_key_count = 2 * t - 1;
+    layout->values_offset = ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_PersistentBTreeMapNode)) + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * key_props->size);
+    layout->children_offset = layout->values_offset + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * value_props->size);
+    layout->leaf_size = layout->children_offset;
+    layout->internal_size = layout->children_offset + (layout->max_key_count + 1) * sizeof(_PersistentBTreeMapNode *);
 
-    return iter;
+    this->length = 0;
+    this->height = 1;
+    this->root = _PersistentBTreeMap_new_node(this, true);
 }
 
-void HashSet_remove(HashSet *this, void *element)
+void PersistentBTreeMap_new(PersistentBTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
 {
-    HashMap_remove(this->map, element);
+    PersistentBTreeMap_with_branching_factor(this, key_props, value_props, _BTreeMap_default_branching_factor(key_props, value_props));
 }
 
-void HashSet_drop(HashSet *this)
+// O(1): the snapshot shares every node with this until either of them is modified
+void PersistentBTreeMap_snapshot(const PersistentBTreeMap *this, PersistentBTreeMap *snapshot)
 {
-    HashMap_drop(this->map);
-    free(this->map);
+    atomic_fetch_add_explicit(&this->root->ref_count, 1, memory_order_relaxed);
+    *snapshot = *this;
 }
 
-// [Str]
-
-typedef struct
-{
-    uint8_t *ptr;
-    size_t len;
-} Str;
-
-Str Str_from_cstr(const char *cstr)
+size_t PersistentBTreeMap_len(const PersistentBTreeMap *this)
 {
-    Str result = {
-        .ptr = (uint8_t *)cstr,
-        .len = strlen(cstr),
-    };
-    return result;
+    return this->length;
 }
 
-// [StrSearcher]
-
-typedef enum
-{
-    SEARCH_STEP_MATCH,
-    SEARCH_STEP_REJECT,
-    SEARCH_STEP_DONE,
-} SearchStepKind;
-
-typedef struct
+const void *PersistentBTreeMap_get(const PersistentBTreeMap *this, const void *key)
 {
-    SearchStepKind kind;
+    const _PersistentBTreeMapNode *current = this->root;
 
-    union
+    while (true)
     {
-        struct
+        bool found;
+        size_t idx = _BTreeMap_search_keys(&this->key_props, _PersistentBTreeMap_key_at(this, current, 0), current->key_count, key, &found);
+
+        if (found)
         {
-            size_t start;
-            size_t end;
-        } match;
+            return _PersistentBTreeMap_value_at(this, current, idx);
+        }
 
-        struct
+        if (current->is_leaf)
         {
-            size_t start;
-            size_t end;
-        } reject;
-    };
-} SearchStep;
+            return NULL;
+        }
 
-typedef struct
+        current = _PersistentBTreeMap_children(this, current)[idx];
+    }
+}
+
+static void _PersistentBTreeMap_insert_entry(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx, const void *key, const void *value)
 {
-    Str haystack;
-    Str needle;
-    size_t position;
-} StrSearcher;
+    size_t to_move = node->key_count - idx;
 
-static void StrSearcher_new(StrSearcher *this, Str haystack, Str needle)
+    memmove(_PersistentBTreeMap_key_at(this, node, idx + 1), _PersistentBTreeMap_key_at(this, node, idx), to_move * this->key_props.size);
+    memmove(_PersistentBTreeMap_value_at(this, node, idx + 1), _PersistentBTreeMap_value_at(this, node, idx), to_move * this->value_props.size);
+    memcpy(_PersistentBTreeMap_key_at(this, node, idx), key, this->key_props.size);
+    memcpy(_PersistentBTreeMap_value_at(this, node, idx), value, this->value_props.size);
+
+    node->key_count++;
+}
+
+static void _PersistentBTreeMap_remove_entry(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
 {
-    this->haystack = haystack;
-    this->needle = needle;
+    size_t to_move = node->key_count - idx - 1;
 
-    this->position = 0;
+    memmove(_PersistentBTreeMap_key_at(this, node, idx), _PersistentBTreeMap_key_at(this, node, idx + 1), to_move * this->key_props.size);
+    memmove(_PersistentBTreeMap_value_at(this, node, idx), _PersistentBTreeMap_value_at(this, node, idx + 1), to_move * this->value_props.size);
+
+    node->key_count--;
 }
 
-static Str StrSearcher_haystack(const StrSearcher *this)
+// Inserts child to the right of the entry at idx, which has just been inserted
+static void _PersistentBTreeMap_insert_child(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx, _PersistentBTreeMapNode *child)
 {
-    Str result = {
-        .ptr = this->haystack.ptr,
-        .len = this->haystack.len,
-    };
-    return result;
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
+
+    memmove(&children[idx + 2], &children[idx + 1], (node->key_count - idx - 1) * sizeof(children[0]));
+    children[idx + 1] = child;
 }
 
-static const uint8_t *_StrSearcher_find_str(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len)
+// Removes the child at idx; the entry next to it has already been removed
+static void _PersistentBTreeMap_remove_child(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
 {
-    if (needle_len == 0)
-        return haystack;
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
 
-    if (needle_len > haystack_len)
-        return NULL;
+    memmove(&children[idx], &children[idx + 1], (node->key_count + 1 - idx) * sizeof(children[0]));
+}
+
+// Splits the full (and exclusive) child at idx of node around its median, which moves up into node
+static void _PersistentBTreeMap_split_child(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
+{
+    _PersistentBTreeMapNode *left = _PersistentBTreeMap_children(this, node)[idx];
+    _PersistentBTreeMapNode *right = _PersistentBTreeMap_new_node(this, left->is_leaf);
+    size_t median = left->key_count / 2;
 
-    const uint8_t *end = haystack + (haystack_len - needle_len) + 1;
+    right->key_count = left->key_count - median - 1;
+    memcpy(_PersistentBTreeMap_key_at(this, right, 0), _PersistentBTreeMap_key_at(this, left, median + 1), right->key_count * this->key_props.size);
+    memcpy(_PersistentBTreeMap_value_at(this, right, 0), _PersistentBTreeMap_value_at(this, left, median + 1), right->key_count * this->value_props.size);
 
-    for (const uint8_t *h = haystack; h < end; h++)
+    if (!left->is_leaf)
     {
-        if (memcmp(h, needle, needle_len) == 0)
-            return h;
+        memcpy(_PersistentBTreeMap_children(this, right), &_PersistentBTreeMap_children(this, left)[median + 1], (right->key_count + 1) * sizeof(_PersistentBTreeMapNode *));
     }
 
-    return NULL;
+    _PersistentBTreeMap_insert_entry(this, node, idx, _PersistentBTreeMap_key_at(this, left, median), _PersistentBTreeMap_value_at(this, left, median));
+    _PersistentBTreeMap_insert_child(this, node, idx, right);
+
+    left->key_count = median;
 }
 
-static SearchStep StrSearcher_next(StrSearcher *this)
+// Copies only the nodes on the path from the root to key that are shared with other versions
+void PersistentBTreeMap_insert(PersistentBTreeMap *this, const void *key, const void *value)
 {
-    SearchStep result;
+    _PersistentBTreeMapNode *current = _PersistentBTreeMap_make_mut(this, &this->root);
 
-    if (this->position == this->haystack.len)
+    if (current->key_count == this->layout.max_key_count)
     {
-        result.kind = SEARCH_STEP_DONE;
-        return result;
-    }
+        _PersistentBTreeMapNode *new_root = _PersistentBTreeMap_new_node(this, false);
+        _PersistentBTreeMap_children(this, new_root)[0] = current;
+        _PersistentBTreeMap_split_child(this, new_root, 0);
 
-    const uint8_t *match = _StrSearcher_find_str(this->haystack.ptr + this->position, this->haystack.len - this->position, this->needle.ptr, this->needle.len);
+        this->root = new_root;
+        this->height++;
+        current = new_root;
+    }
 
-    if (match == NULL)
+    while (true)
     {
-        result.kind = SEARCH_STEP_REJECT;
-        result.reject.start = this->position;
-        result.reject.end = this->haystack.len;
+        bool found;
+        size_t idx = _BTreeMap_search_keys(&this->key_props, _PersistentBTreeMap_key_at(this, current, 0), current->key_count, key, &found);
 
-        this->position = this->haystack.len;
+        if (found)
+        {
+            memcpy(_PersistentBTreeMap_value_at(this, current, idx), value, this->value_props.size);
+            return;
+        }
 
-        return result;
-    }
+        if (current->is_leaf)
+        {
+            _PersistentBTreeMap_insert_entry(this, current, idx, key, value);
+            this->length++;
+            return;
+        }
 
-    size_t match_start = match - this->haystack.ptr;
-    size_t match_end = match_start + this->needle.len;
+        _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, current);
+        _PersistentBTreeMapNode *child = _PersistentBTreeMap_make_mut(this, &children[idx]);
 
-    if (match_start > this->position)
-    {
-        // There's a rejection region before the match
+        // split full nodes on the way down so there is always room for the separator of a split below
+        if (child->key_count == this->layout.max_key_count)
+        {
+            _PersistentBTreeMap_split_child(this, current, idx);
 
-        result.kind = SEARCH_STEP_REJECT;
-        result.reject.start = this->position;
-        result.reject.end = match_start;
+            int32_t ordering = this->key_props.cmp(key, _PersistentBTreeMap_key_at(this, current, idx));
 
-        this->position = match_start;
+            if (ordering == 0)
+            {
+                memcpy(_PersistentBTreeMap_value_at(this, current, idx), value, this->value_props.size);
+                return;
+            }
 
-        return result;
+            child = children[ordering > 0 ? idx + 1 : idx];
+        }
+
+        current = child;
     }
-    else
-    {
-        result.kind = SEARCH_STEP_MATCH;
-        result.match.start = this->position;
-        result.match.end = match_end;
+}
 
-        this->position = match_end;
+// Moves the last entry of the left sibling of the child at idx through the separator into the child
+static void _PersistentBTreeMap_rotate_right(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
+{
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
+    _PersistentBTreeMapNode *left = children[idx - 1];
+    _PersistentBTreeMapNode *child = children[idx];
 
-        return result;
+    _PersistentBTreeMap_insert_entry(this, child, 0, _PersistentBTreeMap_key_at(this, node, idx - 1), _PersistentBTreeMap_value_at(this, node, idx - 1));
+
+    memcpy(_PersistentBTreeMap_key_at(this, node, idx - 1), _PersistentBTreeMap_key_at(this, left, left->key_count - 1), this->key_props.size);
+    memcpy(_PersistentBTreeMap_value_at(this, node, idx - 1), _PersistentBTreeMap_value_at(this, left, left->key_count - 1), this->value_props.size);
+
+    if (!child->is_leaf)
+    {
+        _PersistentBTreeMapNode **child_children = _PersistentBTreeMap_children(this, child);
+        memmove(&child_children[1], &child_children[0], child->key_count * sizeof(child_children[0]));
+        child_children[0] = _PersistentBTreeMap_children(this, left)[left->key_count];
     }
+
+    left->key_count--;
 }
 
-static void StrSearcher_drop(StrSearcher *this)
+// Moves the first entry of the right sibling of the child at idx through the separator into the child
+static void _PersistentBTreeMap_rotate_left(const PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
 {
-}
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
+    _PersistentBTreeMapNode *child = children[idx];
+    _PersistentBTreeMapNode *right = children[idx + 1];
 
-// [MatchesIterator]
+    _PersistentBTreeMap_insert_entry(this, child, child->key_count, _PersistentBTreeMap_key_at(this, node, idx), _PersistentBTreeMap_value_at(this, node, idx));
 
-typedef struct
-{
-    size_t start;
-    size_t end;
-} Match;
+    memcpy(_PersistentBTreeMap_key_at(this, node, idx), _PersistentBTreeMap_key_at(this, right, 0), this->key_props.size);
+    memcpy(_PersistentBTreeMap_value_at(this, node, idx), _PersistentBTreeMap_value_at(this, right, 0), this->value_props.size);
 
-typedef struct
-{
-    StrSearcher searcher;
-    bool is_done;
-    Match current;
-} MatchesIterator;
+    if (!child->is_leaf)
+    {
+        _PersistentBTreeMapNode **right_children = _PersistentBTreeMap_children(this, right);
+        _PersistentBTreeMap_children(this, child)[child->key_count] = right_children[0];
+        memmove(&right_children[0], &right_children[1], right->key_count * sizeof(right_children[0]));
+    }
 
-void MatchesIterator_new(MatchesIterator *this, const StrSearcher *searcher)
-{
-    memcpy(&this->searcher, searcher, sizeof(StrSearcher));
-    this->is_done = false;
+    _PersistentBTreeMap_remove_entry(this, right, 0);
 }
 
-void *MatchesIterator_next(MatchesIterator *this)
+// Merges the child at idx + 1 and the separator at idx into the child at idx
+static void _PersistentBTreeMap_merge_children(PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
 {
-    if (this->is_done)
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
+    _PersistentBTreeMapNode *left = children[idx];
+    _PersistentBTreeMapNode *right = children[idx + 1];
+
+    _PersistentBTreeMap_insert_entry(this, left, left->key_count, _PersistentBTreeMap_key_at(this, node, idx), _PersistentBTreeMap_value_at(this, node, idx));
+
+    memcpy(_PersistentBTreeMap_key_at(this, left, left->key_count), _PersistentBTreeMap_key_at(this, right, 0), right->key_count * this->key_props.size);
+    memcpy(_PersistentBTreeMap_value_at(this, left, left->key_count), _PersistentBTreeMap_value_at(this, right, 0), right->key_count * this->value_props.size);
+
+    if (!left->is_leaf)
     {
-        return NULL;
+        // the children change owner, so their counts stay as they are
+        memcpy(&_PersistentBTreeMap_children(this, left)[left->key_count], _PersistentBTreeMap_children(this, right), (right->key_count + 1) * sizeof(_PersistentBTreeMapNode *));
     }
 
-    while (true)
-    {
-        SearchStep step = StrSearcher_next(&this->searcher);
+    left->key_count += right->key_count;
+    free(right);
 
-        if (step.kind == SEARCH_STEP_DONE)
-        {
-            this->is_done = true;
-            return NULL;
-        }
+    _PersistentBTreeMap_remove_entry(this, node, idx);
+    _PersistentBTreeMap_remove_child(this, node, idx + 1);
 
-        if (step.kind == SEARCH_STEP_MATCH)
-        {
-            this->current.start = step.match.start;
-            this->current.end = step.match.end;
-            return &this->current;
-        }
+    if (node == this->root && node->key_count == 0)
+    {
+        this->root = left;
+        this->height--;
+        free(node);
     }
 }
 
-void MatchesIterator_drop(MatchesIterator *this)
+// Makes sure the child at idx is exclusive and holds more than the minimum number of keys, so that removing one
+// below it needs no fix up on the way back. Returns the child that now covers the keys of the old one.
+static _PersistentBTreeMapNode *_PersistentBTreeMap_prepare_child(PersistentBTreeMap *this, _PersistentBTreeMapNode *node, size_t idx)
 {
-    StrSearcher_drop(&this->searcher);
-}
+    _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, node);
+    _PersistentBTreeMapNode *child = _PersistentBTreeMap_make_mut(this, &children[idx]);
 
-// [SplitIterator]
+    if (child->key_count > this->layout.min_key_count)
+    {
+        return child;
+    }
 
-typedef struct
-{
-    StrSearcher searcher;
-    size_t last_end;
-    bool is_done;
-    Str current;
-} SplitIterator;
+    if (idx > 0 && children[idx - 1]->key_count > this->layout.min_key_count)
+    {
+        _PersistentBTreeMap_make_mut(this, &children[idx - 1]);
+        _PersistentBTreeMap_rotate_right(this, node, idx);
+        return child;
+    }
 
-void SplitIterator_new(SplitIterator *this, const StrSearcher *searcher)
-{
-    memcpy(&this->searcher, searcher, sizeof(StrSearcher));
-    this->last_end = 0;
-    this->is_done = false;
+    if (idx < node->key_count && children[idx + 1]->key_count > this->layout.min_key_count)
+    {
+        _PersistentBTreeMap_make_mut(this, &children[idx + 1]);
+        _PersistentBTreeMap_rotate_left(this, node, idx);
+        return child;
+    }
+
+    size_t left_idx = idx < node->key_count ? idx : idx - 1;
+    _PersistentBTreeMap_make_mut(this, &children[left_idx]);
+    _PersistentBTreeMap_make_mut(this, &children[left_idx + 1]);
+
+    _PersistentBTreeMapNode *merged = children[left_idx];
+    _PersistentBTreeMap_merge_children(this, node, left_idx);
+
+    return merged;
 }
 
-void *SplitIterator_next(SplitIterator *this)
+void PersistentBTreeMap_remove(PersistentBTreeMap *this, const void *key)
 {
-    if (this->is_done)
+    if (PersistentBTreeMap_get(this, key) == NULL)
     {
-        return NULL;
+        return;
     }
 
+    // the key being looked for changes to the predecessor once that replaces the removed entry
+    uint8_t target[this->key_props.size];
+    memcpy(target, key, this->key_props.size);
+
+    _PersistentBTreeMapNode *current = _PersistentBTreeMap_make_mut(this, &this->root);
+
     while (true)
     {
-        SearchStep step = StrSearcher_next(&this->searcher);
+        bool found;
+        size_t idx = _BTreeMap_search_keys(&this->key_props, _PersistentBTreeMap_key_at(this, current, 0), current->key_count, target, &found);
 
-        if (step.kind == SEARCH_STEP_MATCH)
+        if (current->is_leaf)
         {
-            size_t start = this->last_end;
-            size_t end = step.match.start;
-
-            this->last_end = step.match.end;
-
-            this->current.ptr = StrSearcher_haystack(&this->searcher).ptr + start;
-            this->current.len = end - start;
+            assert(found);
+            _PersistentBTreeMap_remove_entry(this, current, idx);
+            this->length--;
+            return;
+        }
 
-            return &this->current;
+        if (!found)
+        {
+            current = _PersistentBTreeMap_prepare_child(this, current, idx);
+            continue;
         }
 
-        if (step.kind == SEARCH_STEP_DONE)
+        _PersistentBTreeMapNode **children = _PersistentBTreeMap_children(this, current);
+
+        if (children[idx]->key_count > this->layout.min_key_count || children[idx + 1]->key_count > this->layout.min_key_count)
         {
-            size_t start = this->last_end;
-            size_t end = StrSearcher_haystack(&this->searcher).len;
+            // replace the entry by its predecessor (or successor), which is then removed from the leaf below
+            bool use_left = children[idx]->key_count > this->layout.min_key_count;
+            _PersistentBTreeMapNode *child = _PersistentBTreeMap_make_mut(this, &children[use_left ? idx : idx + 1]);
+            const _PersistentBTreeMapNode *leaf = child;
 
-            this->is_done = true;
+            while (!leaf->is_leaf)
+            {
+                leaf = _PersistentBTreeMap_children(this, leaf)[use_left ? leaf->key_count : 0];
+            }
 
-            this->current.ptr = StrSearcher_haystack(&this->searcher).ptr + start;
-            this->current.len = end - start;
+            size_t leaf_idx = use_left ? leaf->key_count - 1 : 0;
+            memcpy(_PersistentBTreeMap_key_at(this, current, idx), _PersistentBTreeMap_key_at(this, leaf, leaf_idx), this->key_props.size);
+            memcpy(_PersistentBTreeMap_value_at(this, current, idx), _PersistentBTreeMap_value_at(this, leaf, leaf_idx), this->value_props.size);
+            memcpy(target, _PersistentBTreeMap_key_at(this, leaf, leaf_idx), this->key_props.size);
 
-            return &this->current;
+            current = child;
+        }
+        else
+        {
+            // both neighbours are minimal, merge them around the entry and remove it from the merged node
+            _PersistentBTreeMap_make_mut(this, &children[idx]);
+            _PersistentBTreeMap_make_mut(this, &children[idx + 1]);
+
+            _PersistentBTreeMapNode *merged = children[idx];
+            _PersistentBTreeMap_merge_children(this, current, idx);
+
+            current = merged;
         }
     }
 }
 
-void SplitIterator_drop(SplitIterator *this)
+void PersistentBTreeMap_drop(PersistentBTreeMap *this)
 {
-    StrSearcher_drop(&this->searcher);
+    _PersistentBTreeMap_release(this, this->root);
 }
 
-// [String]
+// [PersistentBTreeMapRangeIter]
 
 typedef struct
 {
-    Vec *buffer;
-} String;
+    const _PersistentBTreeMapNode *node;
+    size_t idx;
+} _PersistentBTreeMapFrame;
 
-void String_new(String *this)
+// Walks the version it was created from with a stack of positions instead of parent pointers. The map (or
+// snapshot) must outlive the iterator but can be read concurrently by any number of iterators without locks.
+typedef struct
 {
-    this->buffer = malloc(sizeof(Vec));
-
-    VecElementOps element_ops = {};
-    Vec_new(this->buffer, sizeof(uint8_t), &element_ops);
-}
+    const PersistentBTreeMap *map;
+    _PersistentBTreeMapFrame *stack;
+    size_t depth;
+    RangeBound end;
+    BTreeMapEntry buffer;
+} PersistentBTreeMapRangeIter;
 
-void String_insert_str(String *this, size_t i, Str str)
+static void _PersistentBTreeMapRangeIter_push_leftmost(PersistentBTreeMapRangeIter *this, const _PersistentBTreeMapNode *node)
 {
-    if (str.len == 0)
+    while (true)
     {
-        return;
-    }
+        this->stack[this->depth++] = (_PersistentBTreeMapFrame){.node = node, .idx = 0};
 
-    size_t spare_length = Vec_capacity(this->buffer) - Vec_len(this->buffer);
-
-    if (str.len > spare_length)
-    {
-        size_t additional = str.len - spare_length;
-        Vec_reserve(this->buffer, additional);
-    }
+        if (node->is_leaf)
+        {
+            break;
+        }
 
-    if (i != Vec_len(this->buffer))
-    {
-        memmove(Vec_get_mut(this->buffer, i + str.len), Vec_get(this->buffer, i), Vec_len(this->buffer) - i);
+        node = _PersistentBTreeMap_children(this->map, node)[0];
     }
-
-    memcpy(Vec_get_mut(this->buffer, i), str.ptr, str.len);
-
-    Vec_set_len(this->buffer, Vec_len(this->buffer) + str.len);
-}
-
-Str String_as_str(String *this)
-{
-    Str result = {
-        .ptr = Vec_get_mut(this->buffer, 0),
-        .len = Vec_len(this->buffer),
-    };
-    return result;
 }
 
-void String_push_str(String *this, Str str)
+void PersistentBTreeMapRangeIter_new(PersistentBTreeMapRangeIter *this, const PersistentBTreeMap *map, const RangeBound *start, const RangeBound *end)
 {
-    String_insert_str(this, Vec_len(this->buffer), str);
-}
+    this->map = map;
+    this->stack = malloc(map->height * sizeof(*this->stack));
+    this->depth = 0;
+    this->end = *end;
 
-size_t String_find_str(String *this, Str needle)
-{
-    StrSearcher searcher;
-    StrSearcher_new(&searcher, String_as_str(this), needle);
+    if (start->kind == RANGE_BOUND_KIND_UNBOUND)
+    {
+        _PersistentBTreeMapRangeIter_push_leftmost(this, map->root);
+        return;
+    }
 
-    size_t result = SIZE_MAX;
+    const void *key = start->kind == RANGE_BOUND_KIND_INCLUDED ? start->included.value : start->excluded.value;
+    const _PersistentBTreeMapNode *current = map->root;
 
     while (true)
     {
-        SearchStep step = StrSearcher_next(&searcher);
+        bool found;
+        size_t idx = _BTreeMap_search_keys(&map->key_props, _PersistentBTreeMap_key_at(map, current, 0), current->key_count, key, &found);
 
-        if (step.kind == SEARCH_STEP_DONE)
+        if (found && start->kind == RANGE_BOUND_KIND_EXCLUDED)
         {
+            this->stack[this->depth++] = (_PersistentBTreeMapFrame){.node = current, .idx = idx + 1};
+
+            if (!current->is_leaf)
+            {
+                _PersistentBTreeMapRangeIter_push_leftmost(this, _PersistentBTreeMap_children(map, current)[idx + 1]);
+            }
+
             break;
         }
 
-        if (step.kind == SEARCH_STEP_MATCH)
+        this->stack[this->depth++] = (_PersistentBTreeMapFrame){.node = current, .idx = idx};
+
+        if (found || current->is_leaf)
         {
-            result = step.match.start;
             break;
         }
-    }
 
-    return result;
+        current = _PersistentBTreeMap_children(map, current)[idx];
+    }
 }
 
-String String_replace_str(String *this, Str from, Str to)
+BTreeMapEntry *PersistentBTreeMapRangeIter_next(PersistentBTreeMapRangeIter *this)
 {
-    StrSearcher searcher;
-    StrSearcher_new(&searcher, String_as_str(this), from);
-
-    String result;
-    String_new(&result);
-
-    while (true)
+    while (this->depth > 0)
     {
-        SearchStep step = StrSearcher_next(&searcher);
+        _PersistentBTreeMapFrame *top = &this->stack[this->depth - 1];
 
-        if (step.kind == SEARCH_STEP_MATCH)
+        if (top->idx == top->node->key_count)
         {
-            String_push_str(&result, to);
+            this->depth--;
+            continue;
         }
-        else if (step.kind == SEARCH_STEP_REJECT)
+
+        const _PersistentBTreeMapNode *node = top->node;
+        size_t idx = top->idx++;
+
+        this->buffer = _BTreeMapEntry_new(_PersistentBTreeMap_key_at(this->map, node, idx), _PersistentBTreeMap_value_at(this->map, node, idx));
+
+        if (this->end.kind != RANGE_BOUND_KIND_UNBOUND)
         {
-            Str str = {
-                .ptr = Vec_get_mut(this->buffer, 0) + step.reject.start,
-                .len = step.reject.end - step.reject.start,
-            };
-            String_push_str(&result, str);
+            bool is_included = this->end.kind == RANGE_BOUND_KIND_INCLUDED;
+            int32_t ordering = this->map->key_props.cmp(this->buffer.key, is_included ? this->end.included.value : this->end.excluded.value);
+
+            if (ordering > 0 || (ordering == 0 && !is_included))
+            {
+                this->depth = 0;
+                return NULL;
+            }
         }
-        else if (step.kind == SEARCH_STEP_DONE)
+
+        if (!node->is_leaf)
         {
-            break;
+            _PersistentBTreeMapRangeIter_push_leftmost(this, _PersistentBTreeMap_children(this->map, node)[idx + 1]);
         }
+
+        return &this->buffer;
     }
 
-    return result;
+    return NULL;
 }
 
-MatchesIterator String_matches_str(String *this, Str needle)
+void PersistentBTreeMapRangeIter_drop(PersistentBTreeMapRangeIter *this)
 {
-    StrSearcher searcher;
-    StrSearcher_new(&searcher, String_as_str(this), needle);
-
-    MatchesIterator matches;
-    MatchesIterator_new(&matches, &searcher);
-
-    return matches;
+    free(this->stack);
 }
 
-SplitIterator String_split_str(String *this, Str separator)
+Iterator PersistentBTreeMapRangeIter_iter(PersistentBTreeMapRangeIter *this)
 {
-    StrSearcher searcher;
-    StrSearcher_new(&searcher, String_as_str(this), separator);
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)PersistentBTreeMapRangeIter_next,
+        });
+}
 
-    SplitIterator split;
-    SplitIterator_new(&split, &searcher);
+PersistentBTreeMapRangeIter PersistentBTreeMap_range(const PersistentBTreeMap *this, const RangeBound *start, const RangeBound *end)
+{
+    PersistentBTreeMapRangeIter iter;
+    PersistentBTreeMapRangeIter_new(&iter, this, start, end);
 
-    return split;
+    return iter;
 }
 
-void String_from(String *this, Str str)
+// [ConcurrentBTreeMap]
+
+#include <threads.h>
+
+// A B+ tree (entries in the leaves, leaves linked left to right) with optimistic lock coupling. Every node carries a
+// version that writers bump twice around their change (odd multiples of two mean locked). Readers never write to shared
+// memory: they read a node, then check its version is unchanged and restart from the root if it is not.
+//
+// Nodes are never merged or freed before the map is dropped, so an optimistic reader can always dereference a pointer it
+// has validated. Removal leaves underfull (even empty) leaves behind, which only costs space. A split only moves entries
+// to a new right sibling, so walking the next links still visits every entry present for the whole walk.
+//
+// Everything a reader may race with a writer on (key counts, links, children, keys and values) is only accessed through
+// relaxed atomics. A racing reader may see a mix of old and new data, but never undefined behaviour, and validation
+// rejects the mix. is_leaf is written before a node is reachable and never changes.
+typedef struct __ConcurrentBTreeMapNode
 {
-    String_new(this);
+    atomic_uint_fast64_t version;
+    bool is_leaf;
+    atomic_size_t key_count;
+    _Atomic(struct __ConcurrentBTreeMapNode *) next;
+} _ConcurrentBTreeMapNode;
 
-    String_insert_str(this, 0, str);
-}
+#define CONCURRENT_BTREEMAP_LOCKED 2
 
-void String_reserve(String *this, size_t additional)
+// Keys and values are read while other threads may be overwriting them and are copied out rather than borrowed, so
+// they must not own resources. Keys must be of one of the integer kinds: searches compare keys before knowing whether
+// they were read consistently, which is harmless for integers but not for an arbitrary cmp
+typedef struct
 {
-    Vec_reserve(this->buffer, additional);
-}
+    _Atomic(_ConcurrentBTreeMapNode *) root;
+    atomic_size_t length;
+    BTreeMapKeyProps key_props;
+    BTreeMapValueProps value_props;
+    _BTreeMapLayout layout;
+} ConcurrentBTreeMap;
 
-size_t String_len(const String *this)
+static uint8_t *_ConcurrentBTreeMap_key_at(const ConcurrentBTreeMap *this, const _ConcurrentBTreeMapNode *node, size_t idx)
 {
-    return Vec_len(this->buffer);
+    return (uint8_t *)node + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*node)) + idx * this->key_props.size;
 }
 
-uint8_t String_get(const String *this, size_t i)
+static uint8_t *_ConcurrentBTreeMap_value_at(const ConcurrentBTreeMap *this, const _ConcurrentBTreeMapNode *leaf, size_t idx)
 {
-    return *(uint8_t *)Vec_get(this->buffer, i);
+    return (uint8_t *)leaf + this->layout.values_offset + idx * this->value_props.size;
 }
 
-size_t String_capacity(const String *this)
+static _Atomic(_ConcurrentBTreeMapNode *) *_ConcurrentBTreeMap_children(const ConcurrentBTreeMap *this, const _ConcurrentBTreeMapNode *node)
 {
-    return Vec_capacity(this->buffer);
+    return (_Atomic(_ConcurrentBTreeMapNode *) *)((uint8_t *)node + this->layout.children_offset);
 }
 
-void String_truncate(String *this, size_t len)
+static _ConcurrentBTreeMapNode *_ConcurrentBTreeMap_child(const ConcurrentBTreeMap *this, const _ConcurrentBTreeMapNode *node, size_t idx)
 {
-    Vec_truncate(this->buffer, len);
+    return atomic_load_explicit(&_ConcurrentBTreeMap_children(this, node)[idx], memory_order_relaxed);
 }
 
-void String_shrink_to_fit(String *this)
-{
-    Vec_shrink_to_fit(this->buffer);
-}
+#define _CONCURRENT_BTREEMAP_COPY(type, dst, src, size)                                                   \
+    do                                                                                                    \
+    {                                                                                                     \
+        _Atomic(type) *_dst = (_Atomic(type) *)(dst);                                                     \
+        _Atomic(type) *_src = (_Atomic(type) *)(src);                                                     \
+        size_t _n = (size) / sizeof(type);                                                                \
+        bool _is_backwards = (void *)_dst > (void *)_src;                                                 \
+                                                                                                          \
+        for (size_t _k = 0; _k < _n; _k++)                                                                \
+        {                                                                                                 \
+            size_t _i = _is_backwards ? _n - 1 - _k : _k;                                                 \
+            atomic_store_explicit(&_dst[_i], atomic_load_explicit(&_src[_i], memory_order_relaxed),       \
+                                  memory_order_relaxed);                                                  \
+        }                                                                                                 \
+    } while (false)
 
-void String_clear(String *this)
+// memmove through relaxed atomics, in the widest unit the addresses and size allow. Used for every access to keys and
+// values in nodes, whether reading them out, writing them in or moving them within a node
+static void _ConcurrentBTreeMap_copy(void *dst, const void *src, size_t size)
 {
-    Vec_clear(this->buffer);
-}
+    uintptr_t bits = (uintptr_t)dst | (uintptr_t)src | size;
 
-void String_drop(String *this)
-{
-    Vec_drop(this->buffer);
-    free(this->buffer);
+    if (bits % sizeof(uint64_t) == 0)
+    {
+        _CONCURRENT_BTREEMAP_COPY(uint64_t, dst, src, size);
+    }
+    else if (bits % sizeof(uint32_t) == 0)
+    {
+        _CONCURRENT_BTREEMAP_COPY(uint32_t, dst, src, size);
+    }
+    else
+    {
+        _CONCURRENT_BTREEMAP_COPY(uint8_t, dst, src, size);
+    }
 }
 
-// [Regex]
-
-#include <stdint.h>
-
-typedef enum
-{
-    TOKEN_KIND_LITERAL,
-    TOKEN_KIND_CONCATENATION,
-    TOKEN_KIND_ALTERNATION,
-    TOKEN_KIND_ZERO_OR_ONE,
-    TOKEN_KIND_LAZY_ZERO_OR_ONE,
-    TOKEN_KIND_ZERO_OR_MORE,
-    TOKEN_KIND_LAZY_ZERO_OR_MORE,
-    TOKEN_KIND_ONE_OR_MORE,
-    TOKEN_KIND_LAZY_ONE_OR_MORE,
-    TOKEN_KIND_LEFT_PARENS,
-    TOKEN_KIND_RIGHT_PARENS,
-} TokenKind;
-
-typedef struct
+// Reads size bytes of keys or values out of a node into memory private to the reader
+static void _ConcurrentBTreeMap_load(void *dst, const void *src, size_t size)
 {
-    TokenKind kind;
-
-    union
+    if (((uintptr_t)src | size) % sizeof(uint64_t) == 0)
     {
-        struct
+        for (size_t i = 0; i < size / sizeof(uint64_t); i++)
         {
-            uint8_t c;
-        } literal;
-    };
-} Token;
-
-typedef enum
-{
-    STATE_KIND_LITERAL,
-    STATE_KIND_SPLIT,
-    STATE_KIND_TAG,
-    STATE_KIND_MATCH,
-} StateKind;
+            uint64_t word = atomic_load_explicit((_Atomic(uint64_t) *)src + i, memory_order_relaxed);
+            memcpy((uint8_t *)dst + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            ((uint8_t *)dst)[i] = atomic_load_explicit((_Atomic(uint8_t) *)src + i, memory_order_relaxed);
+        }
+    }
+}
 
-typedef struct _State
+// Moves count children of src starting at from to dst starting at to, the two ranges possibly overlapping
+static void _ConcurrentBTreeMap_move_children(const ConcurrentBTreeMap *this, _ConcurrentBTreeMapNode *dst, size_t to, const _ConcurrentBTreeMapNode *src, size_t from, size_t count)
 {
-    StateKind kind;
+    _Atomic(_ConcurrentBTreeMapNode *) *dst_children = _ConcurrentBTreeMap_children(this, dst) + to;
+    _Atomic(_ConcurrentBTreeMapNode *) *src_children = _ConcurrentBTreeMap_children(this, src) + from;
+    bool is_backwards = dst_children > src_children;
 
-    union
+    for (size_t k = 0; k < count; k++)
     {
-        struct
-        {
-            uint8_t c;
-            struct _State *out;
-        } literal;
+        size_t i = is_backwards ? count - 1 - k : k;
+        atomic_store_explicit(&dst_children[i], atomic_load_explicit(&src_children[i], memory_order_relaxed), memory_order_relaxed);
+    }
+}
 
-        struct
-        {
-            struct _State *out1;
-            struct _State *out2;
-        } split;
+static _ConcurrentBTreeMapNode *_ConcurrentBTreeMap_new_node(const ConcurrentBTreeMap *this, bool is_leaf)
+{
+    _ConcurrentBTreeMapNode *node = malloc(is_leaf ? this->layout.leaf_size : this->layout.internal_size);
 
-        struct
-        {
-            size_t id;
-            bool is_start;
-            struct _State *out;
-        } tag;
-    };
-} State;
+    atomic_init(&node->version, 0);
+    node->is_leaf = is_leaf;
+    atomic_init(&node->key_count, 0);
+    atomic_init(&node->next, NULL);
 
-typedef State **OutList;
+    return node;
+}
 
-OutList OutList_new(State **out)
+// Waits for writers to leave the node and returns the version to validate against
+static uint_fast64_t _ConcurrentBTreeMapNode_read_lock(const _ConcurrentBTreeMapNode *this)
 {
-    *out = NULL;
-    return out;
+    uint_fast64_t version;
+
+    while ((version = atomic_load_explicit(&((_ConcurrentBTreeMapNode *)this)->version, memory_order_acquire)) & CONCURRENT_BTREEMAP_LOCKED)
+    {
+        thrd_yield();
+    }
+
+    return version;
 }
 
-OutList OutList_append(OutList this, OutList other)
+// Whether nothing was written to the node since version was read, i.e. whether what was read in between is consistent
+static bool _ConcurrentBTreeMapNode_validate(const _ConcurrentBTreeMapNode *this, uint_fast64_t version)
 {
-    OutList current;
-    for (current = this; *current != NULL; current = (OutList)*current)
-        ;
-
-    *current = (State *)other;
+    atomic_thread_fence(memory_order_acquire);
 
-    return this;
+    return atomic_load_explicit(&((_ConcurrentBTreeMapNode *)this)->version, memory_order_relaxed) == version;
 }
 
-void OutList_patch(OutList this, State *to)
+// Locks the node for writing if it is still at version
+static bool _ConcurrentBTreeMapNode_upgrade(_ConcurrentBTreeMapNode *this, uint_fast64_t version)
 {
-    for (OutList current = this; current != NULL;)
+    if (!atomic_compare_exchange_strong_explicit(&this->version, &version, version + CONCURRENT_BTREEMAP_LOCKED, memory_order_acquire, memory_order_relaxed))
     {
-        OutList next = (OutList)*current;
-        *current = to;
-        current = next;
+        return false;
     }
+
+    // keeps the writes that follow from becoming visible before the locked version: a reader that sees any of them
+    // then also sees the version change when it validates
+    atomic_thread_fence(memory_order_release);
+
+    return true;
 }
 
-typedef struct
+static void _ConcurrentBTreeMapNode_unlock(_ConcurrentBTreeMapNode *this)
 {
-    State *start;
-    OutList out_list;
-} Fragment;
+    atomic_fetch_add_explicit(&this->version, CONCURRENT_BTREEMAP_LOCKED, memory_order_release);
+}
 
-typedef struct
+void ConcurrentBTreeMap_with_branching_factor(ConcurrentBTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props, size_t t)
 {
-    Vec states;
-    State *start;
-    size_t tag_count;
-    size_t match_idx;
-} NFA;
+    assert(t >= BTREEMAP_MINIMUM_T);
+    assert(key_props->kind != BTREEMAP_KEY_KIND_OPAQUE);
+    assert(key_props->drop == NULL && value_props->drop == NULL);
 
-bool NFA_can_start_expr(const Token *token)
-{
-    switch (token->kind)
-    {
-    case TOKEN_KIND_LITERAL:
-    case TOKEN_KIND_LEFT_PARENS:
-        return true;
+    this->key_props = *key_props;
+    this->value_props = *value_props;
 
+    _BTreeMapLayout *layout = &this->layout;
+    layout->min_key_count = 0;
+    layout->max_key_count = 2 * t - 1;
+    layout->values_offset = ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_ConcurrentBTreeMapNode)) + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * key_props->size);
+    layout->children_offset = layout->values_offset;
+    layout->leaf_size = layout->values_offset + ROUND_SIZE_UP_TO_MAX_ALIGN(layout->max_key_count * value_props->size);
+    layout->internal_size = layout->children_offset + (layout->max_key_count + 1) * sizeof(_ConcurrentBTreeMapNode *);
+
+    atomic_init(&this->length, 0);
+    atomic_init(&this->root, _ConcurrentBTreeMap_new_node(this, true));
+}
+
+void ConcurrentBTreeMap_new(ConcurrentBTreeMap *this, const BTreeMapKeyProps *key_props, const BTreeMapValueProps *value_props)
+{
+    ConcurrentBTreeMap_with_branching_factor(this, key_props, value_props, _BTreeMap_default_branching_factor(key_props, value_props));
+}
+
+size_t ConcurrentBTreeMap_len(const ConcurrentBTreeMap *this)
+{
+    return atomic_load_explicit(&((ConcurrentBTreeMap *)this)->length, memory_order_relaxed);
+}
+
+// _BTREEMAP_INTEGER_SEARCH over keys that may be written concurrently: the halving reads single keys through relaxed
+// atomics and the last few keys are copied out the same way before they are counted
+#define _CONCURRENT_BTREEMAP_SEARCH(type, count_less, keys_ptr, count, key_ptr, found, result)                  \
+    do                                                                                                          \
+    {                                                                                                           \
+        _Atomic(type) *_keys = (_Atomic(type) *)(keys_ptr);                                                     \
+        const type _key = *(const type *)(key_ptr);                                                             \
+        size_t _base = 0;                                                                                       \
+        size_t _n = (count);                                                                                    \
+                                                                                                                \
+        while (_n > BTREEMAP_LINEAR_SEARCH_THRESHOLD)                                                           \
+        {                                                                                                       \
+            size_t _half = _n / 2;                                                                              \
+            _base = atomic_load_explicit(&_keys[_base + _half - 1], memory_order_relaxed) < _key ? _base + _half \
+                                                                                                 : _base;        \
+            _n -= _half;                                                                                        \
+        }                                                                                                       \
+                                                                                                                \
+        type _tail[BTREEMAP_LINEAR_SEARCH_THRESHOLD] = {0};                                                     \
+        for (size_t _i = 0; _i < _n; _i++)                                                                      \
+        {                                                                                                       \
+            _tail[_i] = atomic_load_explicit(&_keys[_base + _i], memory_order_relaxed);                         \
+        }                                                                                                       \
+                                                                                                                \
+        size_t _less = count_less(_tail, _n, _key);                                                             \
+        (result) = _base + _less;                                                                               \
+        *(found) = _less < _n && _tail[_less] == _key;                                                          \
+    } while (false)
+
+// Lower bound of key in the node. The key count is clamped and the keys read through relaxed atomics since they may be
+// read mid-write, so the result means nothing until the node is validated
+static size_t _ConcurrentBTreeMap_search(const ConcurrentBTreeMap *this, const _ConcurrentBTreeMapNode *node, const void *key, bool *found)
+{
+    size_t key_count = atomic_load_explicit(&((_ConcurrentBTreeMapNode *)node)->key_count, memory_order_relaxed);
+    key_count = MIN(key_count, this->layout.max_key_count);
+
+    const uint8_t *keys = _ConcurrentBTreeMap_key_at(this, node, 0);
+    size_t result;
+
+    switch (this->key_props.kind)
+    {
+    case BTREEMAP_KEY_KIND_I32:
+        _CONCURRENT_BTREEMAP_SEARCH(int32_t, _BTreeMap_count_less_i32, keys, key_count, key, found, result);
+        break;
+    case BTREEMAP_KEY_KIND_U32:
+        _CONCURRENT_BTREEMAP_SEARCH(uint32_t, _BTreeMap_count_less_u32, keys, key_count, key, found, result);
+        break;
+    case BTREEMAP_KEY_KIND_I64:
+        _CONCURRENT_BTREEMAP_SEARCH(int64_t, _BTreeMap_count_less_i64, keys, key_count, key, found, result);
+        break;
     default:
-        return false;
+        _CONCURRENT_BTREEMAP_SEARCH(uint64_t, _BTreeMap_count_less_u64, keys, key_count, key, found, result);
+        break;
     }
+
+    return result;
 }
 
-bool NFA_can_end_expr(const Token *token)
+// Descends optimistically to the leaf that may hold key. Returns NULL when a version check failed and the caller has to
+// restart, otherwise the leaf with the version it was read at, already validated against its parent.
+static _ConcurrentBTreeMapNode *_ConcurrentBTreeMap_find_leaf(const ConcurrentBTreeMap *this, const void *key, uint_fast64_t *version)
 {
-    switch (token->kind)
-    {
-    case TOKEN_KIND_LITERAL:
-    case TOKEN_KIND_RIGHT_PARENS:
-    case TOKEN_KIND_ZERO_OR_ONE:
-    case TOKEN_KIND_LAZY_ZERO_OR_ONE:
-    case TOKEN_KIND_ZERO_OR_MORE:
-    case TOKEN_KIND_LAZY_ZERO_OR_MORE:
-    case TOKEN_KIND_ONE_OR_MORE:
-    case TOKEN_KIND_LAZY_ONE_OR_MORE:
-        return true;
+    _ConcurrentBTreeMapNode *node = atomic_load_explicit(&((ConcurrentBTreeMap *)this)->root, memory_order_acquire);
+    uint_fast64_t node_version = _ConcurrentBTreeMapNode_read_lock(node);
 
-    default:
-        return false;
+    // a root split after the load leaves node covering only the left half of the keys
+    if (node != atomic_load_explicit(&((ConcurrentBTreeMap *)this)->root, memory_order_acquire))
+    {
+        return NULL;
     }
-}
 
-size_t NFA_get_oper_precedence(const Token *token)
-{
-    switch (token->kind)
+    while (!node->is_leaf)
     {
-    case TOKEN_KIND_ZERO_OR_ONE:
-    case TOKEN_KIND_LAZY_ZERO_OR_ONE:
-    case TOKEN_KIND_ZERO_OR_MORE:
-    case TOKEN_KIND_LAZY_ZERO_OR_MORE:
-    case TOKEN_KIND_ONE_OR_MORE:
-    case TOKEN_KIND_LAZY_ONE_OR_MORE:
-        return 3;
+        bool found;
+        size_t idx = _ConcurrentBTreeMap_search(this, node, key, &found);
+        _ConcurrentBTreeMapNode *child = _ConcurrentBTreeMap_child(this, node, found ? idx + 1 : idx);
 
-    case TOKEN_KIND_CONCATENATION:
-        return 2;
+        // the child pointer may only be followed once the parent is known to be unchanged
+        if (!_ConcurrentBTreeMapNode_validate(node, node_version))
+        {
+            return NULL;
+        }
 
-    case TOKEN_KIND_ALTERNATION:
-        return 1;
+        uint_fast64_t child_version = _ConcurrentBTreeMapNode_read_lock(child);
 
-    default:
-        assert(false);
-        return 0;
+        // and the parent must still be unchanged once the child's version is known, or the child may have split since
+        if (!_ConcurrentBTreeMapNode_validate(node, node_version))
+        {
+            return NULL;
+        }
+
+        node = child;
+        node_version = child_version;
     }
+
+    *version = node_version;
+    return node;
 }
 
-Vec NFA_to_postfix(Vec *tokens)
+// Copies the value for key into value and returns whether the key was present
+bool ConcurrentBTreeMap_get(const ConcurrentBTreeMap *this, const void *key, void *value)
 {
-    VecDeque stack;
-    VecDeque_new(&stack, &(VecDequeElementProps){.size = sizeof(Token)});
+    while (true)
+    {
+        uint_fast64_t version;
+        _ConcurrentBTreeMapNode *leaf = _ConcurrentBTreeMap_find_leaf(this, key, &version);
 
-    Vec postfix;
-    Vec_new(&postfix, sizeof(Token), &(VecElementOps){});
+        if (leaf == NULL)
+        {
+            continue;
+        }
 
-    for (size_t i = 0; i < Vec_len(tokens); i++)
-    {
-        const Token *token = Vec_get(tokens, i);
+        bool found;
+        size_t idx = _ConcurrentBTreeMap_search(this, leaf, key, &found);
 
-        switch (token->kind)
+        // only handed to the caller once known to be consistent
+        uint64_t copy[this->value_props.size / sizeof(uint64_t) + 1];
+
+        if (found)
         {
-        case TOKEN_KIND_LITERAL:
-            Vec_push(&postfix, token);
-            break;
+            _ConcurrentBTreeMap_load(copy, _ConcurrentBTreeMap_value_at(this, leaf, idx), this->value_props.size);
+        }
 
-        case TOKEN_KIND_LEFT_PARENS:
+        if (!_ConcurrentBTreeMapNode_validate(leaf, version))
         {
-            Vec_push(&postfix, token);
-            VecDeque_push_back(&stack, token);
+            continue;
         }
-        break;
 
-        case TOKEN_KIND_RIGHT_PARENS:
+        if (found)
         {
-            const Token *back = VecDeque_back(&stack);
+            memcpy(value, copy, this->value_props.size);
+        }
 
-            while (back != NULL && back->kind != TOKEN_KIND_LEFT_PARENS)
-            {
-                Vec_push(&postfix, back);
+        return found;
+    }
+}
 
-                VecDeque_pop_back(&stack);
-                back = VecDeque_back(&stack);
-            }
+// Splits the full, write locked node in half and inserts the separator into the write locked parent, or into a new
+// root when parent is NULL
+static void _ConcurrentBTreeMap_split(ConcurrentBTreeMap *this, _ConcurrentBTreeMapNode *parent, _ConcurrentBTreeMapNode *node)
+{
+    size_t key_size = this->key_props.size;
+    _ConcurrentBTreeMapNode *right = _ConcurrentBTreeMap_new_node(this, node->is_leaf);
+    size_t key_count = atomic_load_explicit(&node->key_count, memory_order_relaxed);
+    size_t left_count = key_count / 2;
+    size_t right_count;
 
-            VecDeque_pop_back(&stack);
+    // leaves keep every key and copy the first one of the right half up, internal nodes move their median up
+    uint64_t separator;
 
-            Vec_push(&postfix, token);
-        }
-        break;
+    if (node->is_leaf)
+    {
+        right_count = key_count - left_count;
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, right, 0), _ConcurrentBTreeMap_key_at(this, node, left_count), right_count * key_size);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_value_at(this, right, 0), _ConcurrentBTreeMap_value_at(this, node, left_count), right_count * this->value_props.size);
+        _ConcurrentBTreeMap_copy(&separator, _ConcurrentBTreeMap_key_at(this, right, 0), key_size);
 
-        default:
-        {
-            for (const Token *back = VecDeque_back(&stack); back != NULL && back->kind != TOKEN_KIND_LEFT_PARENS; back = VecDeque_back(&stack))
-            {
-                if ((NFA_get_oper_precedence(back) < NFA_get_oper_precedence(token)))
-                {
-                    break;
-                }
+        atomic_store_explicit(&right->next, atomic_load_explicit(&node->next, memory_order_relaxed), memory_order_relaxed);
+    }
+    else
+    {
+        right_count = key_count - left_count - 1;
+        _ConcurrentBTreeMap_copy(&separator, _ConcurrentBTreeMap_key_at(this, node, left_count), key_size);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, right, 0), _ConcurrentBTreeMap_key_at(this, node, left_count + 1), right_count * key_size);
+        _ConcurrentBTreeMap_move_children(this, right, 0, node, left_count + 1, right_count + 1);
+    }
 
-                Vec_push(&postfix, back);
+    atomic_store_explicit(&right->key_count, right_count, memory_order_relaxed);
 
-                VecDeque_pop_back(&stack);
-            }
+    // right is unreachable until it is linked in below, under the locks of node and parent
+    atomic_store_explicit(&node->key_count, left_count, memory_order_relaxed);
 
-            VecDeque_push_back(&stack, token);
-        }
-        }
+    if (node->is_leaf)
+    {
+        atomic_store_explicit(&node->next, right, memory_order_relaxed);
     }
 
-    for (const Token *back = VecDeque_back(&stack); back != NULL; back = VecDeque_back(&stack))
+    if (parent == NULL)
     {
-        Vec_push(&postfix, back);
+        _ConcurrentBTreeMapNode *root = _ConcurrentBTreeMap_new_node(this, false);
+        atomic_store_explicit(&root->key_count, 1, memory_order_relaxed);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, root, 0), &separator, key_size);
+        atomic_store_explicit(&_ConcurrentBTreeMap_children(this, root)[0], node, memory_order_relaxed);
+        atomic_store_explicit(&_ConcurrentBTreeMap_children(this, root)[1], right, memory_order_relaxed);
 
-        VecDeque_pop_back(&stack);
+        atomic_store_explicit(&this->root, root, memory_order_release);
+        return;
     }
 
-    VecDeque_drop(&stack);
+    bool found;
+    size_t idx = _ConcurrentBTreeMap_search(this, parent, &separator, &found);
+    size_t parent_key_count = atomic_load_explicit(&parent->key_count, memory_order_relaxed);
 
-    return postfix;
+    _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, parent, idx + 1), _ConcurrentBTreeMap_key_at(this, parent, idx), (parent_key_count - idx) * key_size);
+    _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, parent, idx), &separator, key_size);
+    _ConcurrentBTreeMap_move_children(this, parent, idx + 2, parent, idx + 1, parent_key_count - idx);
+    atomic_store_explicit(&_ConcurrentBTreeMap_children(this, parent)[idx + 1], right, memory_order_relaxed);
+
+    atomic_store_explicit(&parent->key_count, parent_key_count + 1, memory_order_relaxed);
 }
 
-Vec NFA_tokenize(const String *regex)
+// Locks node and its parent (if any) at the versions they were read at and splits node. Returns false when either
+// changed in the meantime; the caller restarts from the root in both cases.
+static bool _ConcurrentBTreeMap_try_split(ConcurrentBTreeMap *this, _ConcurrentBTreeMapNode *parent, uint_fast64_t parent_version, _ConcurrentBTreeMapNode *node, uint_fast64_t version)
 {
-    Vec tokens;
-    Vec_new(&tokens, sizeof(Token), &(VecElementOps){});
+    if (parent != NULL && !_ConcurrentBTreeMapNode_upgrade(parent, parent_version))
+    {
+        return false;
+    }
 
-    for (size_t i = 0; i < String_len(regex); i++)
+    if (!_ConcurrentBTreeMapNode_upgrade(node, version))
     {
-        switch (String_get(regex, i))
+        if (parent != NULL)
         {
-        case '|':
-            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ALTERNATION});
-            break;
+            _ConcurrentBTreeMapNode_unlock(parent);
+        }
 
-        case '?':
-        {
-            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+        return false;
+    }
 
-            if (is_lazy)
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ZERO_OR_ONE});
-                i += 1;
-            }
-            else
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ZERO_OR_ONE});
-            }
-        }
-        break;
+    // only a split of the root replaces it, and that would have changed its version
+    assert(parent != NULL || node == atomic_load_explicit(&this->root, memory_order_relaxed));
 
-        case '*':
-        {
-            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+    _ConcurrentBTreeMap_split(this, parent, node);
 
-            if (is_lazy)
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ZERO_OR_MORE});
-                i += 1;
-            }
-            else
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ZERO_OR_MORE});
-            }
-        }
-        break;
+    _ConcurrentBTreeMapNode_unlock(node);
 
-        case '+':
-        {
-            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+    if (parent != NULL)
+    {
+        _ConcurrentBTreeMapNode_unlock(parent);
+    }
 
-            if (is_lazy)
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ONE_OR_MORE});
-                i += 1;
-            }
-            else
-            {
-                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ONE_OR_MORE});
-            }
-        }
-        break;
+    return true;
+}
 
-        case '(':
-            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LEFT_PARENS});
-            break;
+// Inserts the entry, overwriting the value when the key is already present. Full nodes met on the way down are split
+// eagerly, so a split never has to propagate further up than the parent it holds.
+void ConcurrentBTreeMap_insert(ConcurrentBTreeMap *this, const void *key, const void *value)
+{
+restart:;
+    _ConcurrentBTreeMapNode *node = atomic_load_explicit(&this->root, memory_order_acquire);
+    uint_fast64_t version = _ConcurrentBTreeMapNode_read_lock(node);
 
-        case ')':
-            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_RIGHT_PARENS});
-            break;
+    if (node != atomic_load_explicit(&this->root, memory_order_acquire))
+    {
+        goto restart;
+    }
 
-        case '\\':
-        {
-            i += 1;
+    _ConcurrentBTreeMapNode *parent = NULL;
+    uint_fast64_t parent_version = 0;
 
-            Vec_push(
-                &tokens,
-                &(Token){
-                    .kind = TOKEN_KIND_LITERAL,
-                    .literal = {
-                        .c = String_get(regex, i),
-                    },
-                });
+    while (true)
+    {
+        if (atomic_load_explicit(&node->key_count, memory_order_relaxed) == this->layout.max_key_count)
+        {
+            _ConcurrentBTreeMap_try_split(this, parent, parent_version, node, version);
+            goto restart;
         }
-        break;
 
-        default:
+        if (parent != NULL && !_ConcurrentBTreeMapNode_validate(parent, parent_version))
         {
-            Vec_push(
-                &tokens,
-                &(Token){
-                    .kind = TOKEN_KIND_LITERAL,
-                    .literal = {
-                        .c = String_get(regex, i),
-                    },
-                });
+            goto restart;
         }
+
+        if (node->is_leaf)
+        {
+            break;
         }
-    }
 
-    // insert concatenation markers
+        bool found;
+        size_t idx = _ConcurrentBTreeMap_search(this, node, key, &found);
+        _ConcurrentBTreeMapNode *child = _ConcurrentBTreeMap_child(this, node, found ? idx + 1 : idx);
 
-    for (size_t i = 1; i < Vec_len(&tokens); i++)
-    {
-        if (NFA_can_end_expr(Vec_get(&tokens, i - 1)) && NFA_can_start_expr(Vec_get(&tokens, i)))
+        if (!_ConcurrentBTreeMapNode_validate(node, version))
         {
-            Vec_insert(&tokens, i, &(Token){.kind = TOKEN_KIND_CONCATENATION});
-            i += 1;
+            goto restart;
         }
-    }
 
-    Vec postfix = NFA_to_postfix(&tokens);
+        parent = node;
+        parent_version = version;
+        node = child;
+        version = _ConcurrentBTreeMapNode_read_lock(node);
+    }
 
-    Vec_drop(&tokens);
+    if (!_ConcurrentBTreeMapNode_upgrade(node, version))
+    {
+        goto restart;
+    }
 
-    return postfix;
-}
+    bool found;
+    size_t idx = _ConcurrentBTreeMap_search(this, node, key, &found);
 
-NFA NFA_from_str(const String *str)
-{
-    Vec tokens = NFA_tokenize(str);
+    if (!found)
+    {
+        size_t key_count = atomic_load_explicit(&node->key_count, memory_order_relaxed);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, node, idx + 1), _ConcurrentBTreeMap_key_at(this, node, idx), (key_count - idx) * this->key_props.size);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_value_at(this, node, idx + 1), _ConcurrentBTreeMap_value_at(this, node, idx), (key_count - idx) * this->value_props.size);
+        _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, node, idx), key, this->key_props.size);
+        atomic_store_explicit(&node->key_count, key_count + 1, memory_order_relaxed);
 
-    Vec states;
-    Vec_with_capacity(&states, sizeof(State), &(VecElementOps){}, Vec_len(&tokens) + 1);
+        atomic_fetch_add_explicit(&this->length, 1, memory_order_relaxed);
+    }
 
-    VecDeque fragment_stack;
-    VecDeque_new(&fragment_stack, &(VecDequeElementProps){.size = sizeof(Fragment)});
+    _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_value_at(this, node, idx), value, this->value_props.size);
 
-    size_t tag_count = 0;
+    _ConcurrentBTreeMapNode_unlock(node);
+}
 
-    for (size_t i = 0; i < Vec_len(&tokens); i++)
+// Returns whether the key was present; only its leaf is locked
+bool ConcurrentBTreeMap_remove(ConcurrentBTreeMap *this, const void *key)
+{
+    while (true)
     {
-        const Token *token = Vec_get(&tokens, i);
+        uint_fast64_t version;
+        _ConcurrentBTreeMapNode *leaf = _ConcurrentBTreeMap_find_leaf(this, key, &version);
 
-        switch (token->kind)
-        {
-        case TOKEN_KIND_LITERAL:
+        if (leaf == NULL || !_ConcurrentBTreeMapNode_upgrade(leaf, version))
         {
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_LITERAL,
-                    .literal = {
-                        .c = token->literal.c,
-                    },
-                });
+            continue;
+        }
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+        bool found;
+        size_t idx = _ConcurrentBTreeMap_search(this, leaf, key, &found);
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_new((State **)&new->literal.out),
-                });
+        if (found)
+        {
+            size_t key_count = atomic_load_explicit(&leaf->key_count, memory_order_relaxed);
+            size_t to_move = key_count - idx - 1;
+            _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_key_at(this, leaf, idx), _ConcurrentBTreeMap_key_at(this, leaf, idx + 1), to_move * this->key_props.size);
+            _ConcurrentBTreeMap_copy(_ConcurrentBTreeMap_value_at(this, leaf, idx), _ConcurrentBTreeMap_value_at(this, leaf, idx + 1), to_move * this->value_props.size);
+            atomic_store_explicit(&leaf->key_count, key_count - 1, memory_order_relaxed);
+
+            atomic_fetch_sub_explicit(&this->length, 1, memory_order_relaxed);
         }
-        break;
 
-        case TOKEN_KIND_LEFT_PARENS:
-        {
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_TAG,
-                    .tag = {
-                        .id = tag_count,
-                        .is_start = true,
-                    },
-                });
+        _ConcurrentBTreeMapNode_unlock(leaf);
 
-            tag_count += 1;
+        return found;
+    }
+}
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+// Copies up to max_count entries with keys in start.. into the keys and values arrays, in order, and returns how many
+// were copied. Every entry copied was present at some point during the scan, but the scan is not a snapshot. Slots past
+// the returned count may have been overwritten with entries read inconsistently.
+size_t ConcurrentBTreeMap_scan(const ConcurrentBTreeMap *this, const RangeBound *start, size_t max_count, void *keys, void *values)
+{
+    size_t key_size = this->key_props.size;
+    size_t value_size = this->value_props.size;
+    size_t count = 0;
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_new((State **)&new->tag.out),
-                });
-        }
-        break;
+    // a restart resumes after the last key copied
+    uint8_t cursor[key_size];
+    bool is_bounded = start->kind != RANGE_BOUND_KIND_UNBOUND;
+    bool is_excluded = start->kind == RANGE_BOUND_KIND_EXCLUDED;
 
-        case TOKEN_KIND_RIGHT_PARENS:
-        {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+    if (is_bounded)
+    {
+        memcpy(cursor, is_excluded ? start->excluded.value : start->included.value, key_size);
+    }
 
-            Fragment start_tag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+restart:
+    while (count < max_count)
+    {
+        uint_fast64_t version;
+        _ConcurrentBTreeMapNode *leaf;
 
-            OutList_patch(start_tag.out_list, frag.start);
+        if (is_bounded)
+        {
+            leaf = _ConcurrentBTreeMap_find_leaf(this, cursor, &version);
+        }
+        else
+        {
+            leaf = atomic_load_explicit(&((ConcurrentBTreeMap *)this)->root, memory_order_acquire);
+            version = _ConcurrentBTreeMapNode_read_lock(leaf);
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_TAG,
-                    .tag = {
-                        .id = start_tag.start->tag.id,
-                        .is_start = false,
-                    },
-                });
+            if (leaf != atomic_load_explicit(&((ConcurrentBTreeMap *)this)->root, memory_order_acquire))
+            {
+                goto restart;
+            }
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+            while (!leaf->is_leaf)
+            {
+                _ConcurrentBTreeMapNode *child = _ConcurrentBTreeMap_child(this, leaf, 0);
 
-            OutList_patch(frag.out_list, new);
+                if (!_ConcurrentBTreeMapNode_validate(leaf, version))
+                {
+                    goto restart;
+                }
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = start_tag.start,
-                    .out_list = OutList_new((State **)&new->tag.out),
-                });
+                leaf = child;
+                version = _ConcurrentBTreeMapNode_read_lock(leaf);
+            }
         }
-        break;
 
-        case TOKEN_KIND_CONCATENATION:
+        if (leaf == NULL)
         {
-            Fragment frag2 = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            continue;
+        }
 
-            Fragment frag1 = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+        while (leaf != NULL && count < max_count)
+        {
+            size_t idx = 0;
+            size_t key_count = atomic_load_explicit(&leaf->key_count, memory_order_relaxed);
+            key_count = MIN(key_count, this->layout.max_key_count);
 
-            OutList_patch(frag1.out_list, frag2.start);
+            if (is_bounded)
+            {
+                bool found;
+                idx = _ConcurrentBTreeMap_search(this, leaf, cursor, &found);
+                idx += found && is_excluded;
+            }
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = frag1.start,
-                    .out_list = frag2.out_list,
-                });
-        }
-        break;
+            size_t copied = idx < key_count ? key_count - idx : 0;
+            copied = MIN(copied, max_count - count);
 
-        case TOKEN_KIND_ALTERNATION:
-        {
-            Fragment frag2 = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            _ConcurrentBTreeMap_load((uint8_t *)keys + count * key_size, _ConcurrentBTreeMap_key_at(this, leaf, idx), copied * key_size);
+            _ConcurrentBTreeMap_load((uint8_t *)values + count * value_size, _ConcurrentBTreeMap_value_at(this, leaf, idx), copied * value_size);
 
-            Fragment frag1 = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            _ConcurrentBTreeMapNode *next = atomic_load_explicit(&leaf->next, memory_order_relaxed);
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out1 = frag1.start,
-                        .out2 = frag2.start,
-                    },
-                });
+            if (!_ConcurrentBTreeMapNode_validate(leaf, version))
+            {
+                goto restart;
+            }
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+            count += copied;
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_append(frag1.out_list, frag2.out_list),
-                });
+            if (copied > 0)
+            {
+                memcpy(cursor, (uint8_t *)keys + (count - 1) * key_size, key_size);
+                is_bounded = true;
+                is_excluded = true;
+            }
+
+            leaf = next;
+            version = leaf == NULL ? 0 : _ConcurrentBTreeMapNode_read_lock(leaf);
         }
+
         break;
+    }
 
-        case TOKEN_KIND_ZERO_OR_ONE:
-        {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+    return count;
+}
 
-            Vec_push(
-                &states,
-                &(State){
+static void _ConcurrentBTreeMap_free_node(ConcurrentBTreeMap *this, _ConcurrentBTreeMapNode *node)
+{
+    for (size_t i = 0; !node->is_leaf && i < atomic_load(&node->key_count) + 1; i++)
+    {
+        _ConcurrentBTreeMap_free_node(this, _ConcurrentBTreeMap_child(this, node, i));
+    }
+
+    free(node);
+}
+
+// Not thread safe, no other thread may use the map any more
+void ConcurrentBTreeMap_drop(ConcurrentBTreeMap *this)
+{
+    _ConcurrentBTreeMap_free_node(this, atomic_load(&this->root));
+}
+
+// [LinkedList]
+
+#include <stddef.h>
+
+typedef struct _LinkedListNode
+{
+    struct _LinkedListNode *next;
+    struct _LinkedListNode *previous;
+} LinkedListNode;
+
+typedef struct
+{
+    size_t element_size;
+    DropFn drop;
+} LinkedListElementProps;
+
+typedef struct
+{
+    size_t length;
+    LinkedListNode *head;
+    LinkedListNode *tail;
+    LinkedListElementProps element_props;
+    // intrusive lists link nodes embedded in caller-owned structs, never allocating, dropping or freeing them
+    bool is_intrusive;
+} LinkedList;
+
+static void *_LinkedListNode_get_data(LinkedListNode *this)
+{
+    return (void *)((uintptr_t)(this) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this)));
+}
+
+static void _LinkedList_drop_element(LinkedList *this, void *element)
+{
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(element);
+    }
+}
+
+void LinkedList_new(LinkedList *this, const LinkedListElementProps *element_props)
+{
+    this->element_props = *element_props;
+    this->is_intrusive = false;
+
+    this->length = 0;
+    this->head = NULL;
+    this->tail = NULL;
+}
+
+void LinkedList_new_intrusive(LinkedList *this)
+{
+    LinkedList_new(this, &(LinkedListElementProps){0});
+    this->is_intrusive = true;
+}
+
+size_t LinkedList_len(const LinkedList *this)
+{
+    return this->length;
+}
+
+static void _LinkedList_insert_after(LinkedList *this, LinkedListNode *position, LinkedListNode *new_node)
+{
+    bool insert_at_head = position == NULL;
+    if (insert_at_head)
+    {
+        new_node->previous = NULL;
+
+        bool list_is_empty = this->head == NULL;
+        if (list_is_empty)
+        {
+            new_node->next = NULL;
+
+            this->head = new_node;
+            this->tail = new_node;
+        }
+        else
+        {
+            new_node->next = this->head;
+            this->head->previous = new_node;
+            this->head = new_node;
+        }
+    }
+    else
+    {
+        new_node->next = position->next;
+        new_node->previous = position;
+
+        bool insert_after_tail = position->next == NULL;
+        if (insert_after_tail)
+        {
+            this->tail = new_node;
+        }
+        else
+        {
+            position->next->previous = new_node;
+        }
+
+        position->next = new_node;
+    }
+
+    this->length++;
+}
+
+static void _LinkedList_unlink(LinkedList *this, LinkedListNode *position)
+{
+    if (position->previous)
+    {
+        position->previous->next = position->next;
+    }
+    else
+    {
+        this->head = position->next;
+    }
+
+    if (position->next)
+    {
+        position->next->previous = position->previous;
+    }
+    else
+    {
+        this->tail = position->previous;
+    }
+
+    this->length--;
+}
+
+static void _LinkedList_remove(LinkedList *this, LinkedListNode *position)
+{
+    _LinkedList_unlink(this, position);
+
+    if (!this->is_intrusive)
+    {
+        _LinkedList_drop_element(this, _LinkedListNode_get_data(position));
+        free(position);
+    }
+}
+
+static LinkedListNode *_LinkedList_new_node(LinkedList *this, const void *value)
+{
+    assert(!this->is_intrusive);
+
+    LinkedListNode *new_node = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(LinkedListNode)) + this->element_props.element_size);
+
+    memcpy(_LinkedListNode_get_data(new_node), value, this->element_props.element_size);
+
+    return new_node;
+}
+
+void LinkedList_push_front(LinkedList *this, const void *value)
+{
+    _LinkedList_insert_after(this, NULL, _LinkedList_new_node(this, value));
+}
+
+void LinkedList_push_back(LinkedList *this, const void *value)
+{
+    _LinkedList_insert_after(this, this->tail, _LinkedList_new_node(this, value));
+}
+
+// The *_node functions link and unlink nodes without copying, allocating or freeing. On an intrusive list the nodes
+// are embedded in the caller's structs, on an owning list they must come from a list with the same element props
+void LinkedList_push_front_node(LinkedList *this, LinkedListNode *node)
+{
+    _LinkedList_insert_after(this, NULL, node);
+}
+
+void LinkedList_push_back_node(LinkedList *this, LinkedListNode *node)
+{
+    _LinkedList_insert_after(this, this->tail, node);
+}
+
+// Unlinks a node of this list in O(1), the caller takes ownership of it
+void LinkedList_unlink_node(LinkedList *this, LinkedListNode *node)
+{
+    _LinkedList_unlink(this, node);
+}
+
+LinkedListNode *LinkedList_front_node(LinkedList *this)
+{
+    return this->head;
+}
+
+LinkedListNode *LinkedList_back_node(LinkedList *this)
+{
+    return this->tail;
+}
+
+void LinkedList_pop_front(LinkedList *this)
+{
+    if (this->head != NULL)
+    {
+        _LinkedList_remove(this, this->head);
+    }
+}
+
+void LinkedList_pop_back(LinkedList *this)
+{
+    if (this->tail != NULL)
+    {
+        _LinkedList_remove(this, this->tail);
+    }
+}
+
+void *LinkedList_front(LinkedList *this)
+{
+    if (this->head == NULL)
+    {
+        return NULL;
+    }
+    else
+    {
+        return _LinkedListNode_get_data(this->head);
+    }
+}
+
+void *LinkedList_back(LinkedList *this)
+{
+    if (this->tail == NULL)
+    {
+        return NULL;
+    }
+    else
+    {
+        return _LinkedListNode_get_data(this->tail);
+    }
+}
+
+void LinkedList_drop(LinkedList *this)
+{
+    if (this->is_intrusive)
+    {
+        return;
+    }
+
+    for (LinkedListNode *current = this->head; current != NULL;)
+    {
+        _LinkedList_drop_element(this, _LinkedListNode_get_data(current));
+
+        LinkedListNode *next = current->next;
+        free(current);
+        current = next;
+    }
+}
+
+// Moves every node of other after position (or to the front when position is NULL) in O(1), leaving other empty
+static void _LinkedList_splice_after(LinkedList *this, LinkedListNode *position, LinkedList *other)
+{
+    assert(this->is_intrusive == other->is_intrusive && this->element_props.element_size == other->element_props.element_size);
+
+    if (other->head == NULL)
+    {
+        return;
+    }
+
+    LinkedListNode *next = position ? position->next : this->head;
+
+    other->head->previous = position;
+    other->tail->next = next;
+
+    if (position)
+    {
+        position->next = other->head;
+    }
+    else
+    {
+        this->head = other->head;
+    }
+
+    if (next)
+    {
+        next->previous = other->tail;
+    }
+    else
+    {
+        this->tail = other->tail;
+    }
+
+    this->length += other->length;
+
+    other->length = 0;
+    other->head = NULL;
+    other->tail = NULL;
+}
+
+// Moves the nodes after position (all of them when position is NULL) into other, which is initialized by this
+// function. kept is the number of nodes up to and including position, so that no walk is needed to count them
+static void _LinkedList_split_after(LinkedList *this, LinkedListNode *position, size_t kept, LinkedList *other)
+{
+    *other = *this;
+    other->length = this->length - kept;
+    other->head = position ? position->next : this->head;
+
+    if (other->head == NULL)
+    {
+        other->tail = NULL;
+        return;
+    }
+
+    other->head->previous = NULL;
+
+    this->length = kept;
+    this->tail = position;
+
+    if (position)
+    {
+        position->next = NULL;
+    }
+    else
+    {
+        this->head = NULL;
+    }
+}
+
+// Moves all elements of other to the back of this list in O(1), leaving other empty
+void LinkedList_append(LinkedList *this, LinkedList *other)
+{
+    _LinkedList_splice_after(this, this->tail, other);
+}
+
+// Moves the elements from index at onwards into other, which is initialized by this function. Walks from whichever end
+// is closer to at
+void LinkedList_split_off(LinkedList *this, size_t at, LinkedList *other)
+{
+    assert(at <= this->length);
+
+    LinkedListNode *position = NULL;
+
+    if (at <= this->length / 2)
+    {
+        for (size_t i = 0; i < at; i++)
+        {
+            position = position ? position->next : this->head;
+        }
+    }
+    else
+    {
+        position = this->tail;
+        for (size_t i = this->length; i > at; i--)
+        {
+            position = position->previous;
+        }
+    }
+
+    _LinkedList_split_after(this, position, at, other);
+}
+
+// [LinkedListCursor]
+
+// A cursor points at a node or at the "ghost" position between the tail and the head, where current is NULL. Moving
+// past either end lands on the ghost, and moving again wraps around to the other end. index is the position of current,
+// or the length of the list on the ghost
+typedef struct
+{
+    LinkedList *list;
+    LinkedListNode *current;
+    size_t index;
+} LinkedListCursor;
+
+LinkedListCursor LinkedList_cursor_front(LinkedList *this)
+{
+    return (LinkedListCursor){.list = this, .current = this->head, .index = 0};
+}
+
+LinkedListCursor LinkedList_cursor_back(LinkedList *this)
+{
+    return (LinkedListCursor){.list = this, .current = this->tail, .index = this->tail ? this->length - 1 : 0};
+}
+
+size_t LinkedListCursor_index(const LinkedListCursor *this)
+{
+    return this->index;
+}
+
+LinkedListNode *LinkedListCursor_current_node(const LinkedListCursor *this)
+{
+    return this->current;
+}
+
+// Returns the current element of an owning list, NULL on the ghost
+void *LinkedListCursor_current(const LinkedListCursor *this)
+{
+    assert(!this->list->is_intrusive);
+
+    if (this->current == NULL)
+    {
+        return NULL;
+    }
+
+    return _LinkedListNode_get_data(this->current);
+}
+
+void LinkedListCursor_move_next(LinkedListCursor *this)
+{
+    if (this->current == NULL)
+    {
+        this->current = this->list->head;
+        this->index = 0;
+    }
+    else
+    {
+        this->current = this->current->next;
+        this->index++;
+    }
+}
+
+void LinkedListCursor_move_prev(LinkedListCursor *this)
+{
+    if (this->current == NULL)
+    {
+        this->current = this->list->tail;
+        this->index = this->current ? this->list->length - 1 : 0;
+    }
+    else
+    {
+        this->current = this->current->previous;
+        this->index = this->current ? this->index - 1 : this->list->length;
+    }
+}
+
+// Links node after the current one, or at the front on the ghost. The cursor keeps pointing at the same node
+void LinkedListCursor_insert_node_after(LinkedListCursor *this, LinkedListNode *node)
+{
+    _LinkedList_insert_after(this->list, this->current, node);
+
+    if (this->current == NULL)
+    {
+        this->index++;
+    }
+}
+
+// Links node before the current one, or at the back on the ghost. The cursor keeps pointing at the same node
+void LinkedListCursor_insert_node_before(LinkedListCursor *this, LinkedListNode *node)
+{
+    _LinkedList_insert_after(this->list, this->current ? this->current->previous : this->list->tail, node);
+    this->index++;
+}
+
+void LinkedListCursor_insert_after(LinkedListCursor *this, const void *value)
+{
+    LinkedListCursor_insert_node_after(this, _LinkedList_new_node(this->list, value));
+}
+
+void LinkedListCursor_insert_before(LinkedListCursor *this, const void *value)
+{
+    LinkedListCursor_insert_node_before(this, _LinkedList_new_node(this->list, value));
+}
+
+// Unlinks the current node and moves to the next one, the caller takes ownership of the returned node. Returns NULL on
+// the ghost
+LinkedListNode *LinkedListCursor_remove_current_node(LinkedListCursor *this)
+{
+    LinkedListNode *node = this->current;
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    this->current = node->next;
+    _LinkedList_unlink(this->list, node);
+
+    return node;
+}
+
+// Drops and frees the current element of an owning list, or unlinks the current node of an intrusive one, and moves
+// to the next one. Does nothing on the ghost
+void LinkedListCursor_remove_current(LinkedListCursor *this)
+{
+    LinkedListNode *node = this->current;
+    if (node == NULL)
+    {
+        return;
+    }
+
+    this->current = node->next;
+    _LinkedList_remove(this->list, node);
+}
+
+// Moves all elements of other after the current one (to the front on the ghost) in O(1), leaving other empty
+void LinkedListCursor_splice_after(LinkedListCursor *this, LinkedList *other)
+{
+    size_t other_length = other->length;
+    _LinkedList_splice_after(this->list, this->current, other);
+
+    if (this->current == NULL)
+    {
+        this->index += other_length;
+    }
+}
+
+// Moves all elements of other before the current one (to the back on the ghost) in O(1), leaving other empty
+void LinkedListCursor_splice_before(LinkedListCursor *this, LinkedList *other)
+{
+    size_t other_length = other->length;
+    _LinkedList_splice_after(this->list, this->current ? this->current->previous : this->list->tail, other);
+    this->index += other_length;
+}
+
+// Moves the elements after the current one (all of them on the ghost) into other, which is initialized by this
+// function, in O(1)
+void LinkedListCursor_split_after(LinkedListCursor *this, LinkedList *other)
+{
+    size_t kept = this->current ? this->index + 1 : 0;
+    _LinkedList_split_after(this->list, this->current, kept, other);
+
+    if (this->current == NULL)
+    {
+        this->index = 0;
+    }
+}
+
+// [UnrolledLinkedList]
+
+// Each node stores up to `capacity` elements in the window [start, start + count) of its data array, so queue workloads
+// allocate once per chunk instead of once per element and traversal walks contiguous memory
+#define UNROLLED_LINKED_LIST_MINIMUM_CAPACITY 4
+#define UNROLLED_LINKED_LIST_MAXIMUM_CAPACITY 64
+
+#define UNROLLED_LINKED_LIST_TARGET_NODE_SIZE 512
+
+typedef struct _UnrolledLinkedListNode
+{
+    struct _UnrolledLinkedListNode *next;
+    struct _UnrolledLinkedListNode *previous;
+    uint16_t start;
+    uint16_t count;
+} UnrolledLinkedListNode;
+
+typedef struct
+{
+    size_t length;
+    size_t capacity;
+    UnrolledLinkedListNode *head;
+    UnrolledLinkedListNode *tail;
+    LinkedListElementProps element_props;
+} UnrolledLinkedList;
+
+static void *_UnrolledLinkedListNode_get_data(UnrolledLinkedListNode *this)
+{
+    return (void *)((uintptr_t)(this) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this)));
+}
+
+static void *_UnrolledLinkedList_element(const UnrolledLinkedList *this, UnrolledLinkedListNode *node, size_t index)
+{
+    return (uint8_t *)_UnrolledLinkedListNode_get_data(node) + (node->start + index) * this->element_props.element_size;
+}
+
+static void _UnrolledLinkedList_drop_element(UnrolledLinkedList *this, void *element)
+{
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(element);
+    }
+}
+
+void UnrolledLinkedList_with_capacity(UnrolledLinkedList *this, const LinkedListElementProps *element_props, size_t capacity)
+{
+    assert(capacity >= UNROLLED_LINKED_LIST_MINIMUM_CAPACITY && capacity <= UINT16_MAX);
+
+    this->element_props = *element_props;
+    this->capacity = capacity;
+
+    this->length = 0;
+    this->head = NULL;
+    this->tail = NULL;
+}
+
+void UnrolledLinkedList_new(UnrolledLinkedList *this, const LinkedListElementProps *element_props)
+{
+    size_t element_size = MAX(element_props->element_size, 1);
+    size_t capacity = UNROLLED_LINKED_LIST_TARGET_NODE_SIZE / element_size;
+    capacity = MAX(capacity, UNROLLED_LINKED_LIST_MINIMUM_CAPACITY);
+    capacity = MIN(capacity, UNROLLED_LINKED_LIST_MAXIMUM_CAPACITY);
+
+    UnrolledLinkedList_with_capacity(this, element_props, capacity);
+}
+
+size_t UnrolledLinkedList_len(const UnrolledLinkedList *this)
+{
+    return this->length;
+}
+
+static UnrolledLinkedListNode *_UnrolledLinkedList_new_node(UnrolledLinkedList *this, size_t start)
+{
+    UnrolledLinkedListNode *node = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(UnrolledLinkedListNode)) + this->capacity * this->element_props.element_size);
+    node->start = start;
+    node->count = 0;
+
+    return node;
+}
+
+// Links `new_node` after `position`, or at the head when `position` is NULL
+static void _UnrolledLinkedList_link_after(UnrolledLinkedList *this, UnrolledLinkedListNode *position, UnrolledLinkedListNode *new_node)
+{
+    new_node->previous = position;
+    new_node->next = position ? position->next : this->head;
+
+    if (new_node->next)
+    {
+        new_node->next->previous = new_node;
+    }
+    else
+    {
+        this->tail = new_node;
+    }
+
+    if (position)
+    {
+        position->next = new_node;
+    }
+    else
+    {
+        this->head = new_node;
+    }
+}
+
+static void _UnrolledLinkedList_unlink(UnrolledLinkedList *this, UnrolledLinkedListNode *node)
+{
+    if (node->previous)
+    {
+        node->previous->next = node->next;
+    }
+    else
+    {
+        this->head = node->next;
+    }
+
+    if (node->next)
+    {
+        node->next->previous = node->previous;
+    }
+    else
+    {
+        this->tail = node->previous;
+    }
+
+    free(node);
+}
+
+// Moves the elements of a node so that its window begins at `start`
+static void _UnrolledLinkedList_shift_window(UnrolledLinkedList *this, UnrolledLinkedListNode *node, size_t start)
+{
+    uint8_t *data = _UnrolledLinkedListNode_get_data(node);
+    size_t element_size = this->element_props.element_size;
+
+    memmove(data + start * element_size, data + node->start * element_size, node->count * element_size);
+    node->start = start;
+}
+
+void UnrolledLinkedList_push_front(UnrolledLinkedList *this, const void *value)
+{
+    UnrolledLinkedListNode *node = this->head;
+    if (node == NULL || node->count == this->capacity)
+    {
+        // A fresh head node is filled from the back so that further push_front calls stay O(1)
+        node = _UnrolledLinkedList_new_node(this, this->capacity);
+        _UnrolledLinkedList_link_after(this, NULL, node);
+    }
+    else if (node->start == 0)
+    {
+        _UnrolledLinkedList_shift_window(this, node, this->capacity - node->count);
+    }
+
+    node->start--;
+    node->count++;
+    memcpy(_UnrolledLinkedList_element(this, node, 0), value, this->element_props.element_size);
+
+    this->length++;
+}
+
+void UnrolledLinkedList_push_back(UnrolledLinkedList *this, const void *value)
+{
+    UnrolledLinkedListNode *node = this->tail;
+    if (node == NULL || node->count == this->capacity)
+    {
+        node = _UnrolledLinkedList_new_node(this, 0);
+        _UnrolledLinkedList_link_after(this, this->tail, node);
+    }
+    else if (node->start + node->count == this->capacity)
+    {
+        _UnrolledLinkedList_shift_window(this, node, 0);
+    }
+
+    node->count++;
+    memcpy(_UnrolledLinkedList_element(this, node, node->count - 1), value, this->element_props.element_size);
+
+    this->length++;
+}
+
+void UnrolledLinkedList_pop_front(UnrolledLinkedList *this)
+{
+    UnrolledLinkedListNode *node = this->head;
+    if (node == NULL)
+    {
+        return;
+    }
+
+    _UnrolledLinkedList_drop_element(this, _UnrolledLinkedList_element(this, node, 0));
+    node->start++;
+    node->count--;
+    this->length--;
+
+    if (node->count == 0)
+    {
+        _UnrolledLinkedList_unlink(this, node);
+    }
+}
+
+void UnrolledLinkedList_pop_back(UnrolledLinkedList *this)
+{
+    UnrolledLinkedListNode *node = this->tail;
+    if (node == NULL)
+    {
+        return;
+    }
+
+    _UnrolledLinkedList_drop_element(this, _UnrolledLinkedList_element(this, node, node->count - 1));
+    node->count--;
+    this->length--;
+
+    if (node->count == 0)
+    {
+        _UnrolledLinkedList_unlink(this, node);
+    }
+}
+
+void *UnrolledLinkedList_front(UnrolledLinkedList *this)
+{
+    if (this->head == NULL)
+    {
+        return NULL;
+    }
+    else
+    {
+        return _UnrolledLinkedList_element(this, this->head, 0);
+    }
+}
+
+void *UnrolledLinkedList_back(UnrolledLinkedList *this)
+{
+    if (this->tail == NULL)
+    {
+        return NULL;
+    }
+    else
+    {
+        return _UnrolledLinkedList_element(this, this->tail, this->tail->count - 1);
+    }
+}
+
+void UnrolledLinkedList_drop(UnrolledLinkedList *this)
+{
+    for (UnrolledLinkedListNode *current = this->head; current != NULL;)
+    {
+        for (size_t i = 0; i < current->count; i++)
+        {
+            _UnrolledLinkedList_drop_element(this, _UnrolledLinkedList_element(this, current, i));
+        }
+
+        UnrolledLinkedListNode *next = current->next;
+        free(current);
+        current = next;
+    }
+}
+
+// Inserts before the element at `*index` of `*node` (`*index` may equal the node's count), splitting the node in half
+// when it is full. On return `*node` and `*index` locate the inserted element
+static void _UnrolledLinkedList_insert_at(UnrolledLinkedList *this, UnrolledLinkedListNode **node, size_t *index, const void *value)
+{
+    UnrolledLinkedListNode *current = *node;
+    size_t position = *index;
+    size_t element_size = this->element_props.element_size;
+
+    if (current->count == this->capacity)
+    {
+        size_t half = this->capacity / 2;
+
+        UnrolledLinkedListNode *sibling = _UnrolledLinkedList_new_node(this, 0);
+        memcpy(_UnrolledLinkedListNode_get_data(sibling), _UnrolledLinkedList_element(this, current, half), (current->count - half) * element_size);
+        sibling->count = current->count - half;
+        current->count = half;
+        _UnrolledLinkedList_link_after(this, current, sibling);
+
+        if (position > half)
+        {
+            current = sibling;
+            position -= half;
+        }
+    }
+
+    if (current->start + current->count == this->capacity)
+    {
+        _UnrolledLinkedList_shift_window(this, current, 0);
+    }
+
+    uint8_t *slot = _UnrolledLinkedList_element(this, current, position);
+    memmove(slot + element_size, slot, (current->count - position) * element_size);
+    memcpy(slot, value, element_size);
+    current->count++;
+
+    this->length++;
+
+    *node = current;
+    *index = position;
+}
+
+// Removes the element at `*index` of `*node`, merging the node with its successor when both have become sparse. On
+// return `*node` and `*index` locate the element that followed the removed one, `*node` is NULL if there is none
+static void _UnrolledLinkedList_remove_at(UnrolledLinkedList *this, UnrolledLinkedListNode **node, size_t *index)
+{
+    UnrolledLinkedListNode *current = *node;
+    size_t position = *index;
+    size_t element_size = this->element_props.element_size;
+
+    uint8_t *slot = _UnrolledLinkedList_element(this, current, position);
+    _UnrolledLinkedList_drop_element(this, slot);
+    memmove(slot, slot + element_size, (current->count - position - 1) * element_size);
+    current->count--;
+
+    this->length--;
+
+    if (current->count == 0)
+    {
+        *node = current->next;
+        *index = 0;
+
+        _UnrolledLinkedList_unlink(this, current);
+        return;
+    }
+
+    UnrolledLinkedListNode *next = current->next;
+    if (next != NULL && current->count + next->count <= this->capacity / 2)
+    {
+        _UnrolledLinkedList_shift_window(this, current, 0);
+        memcpy(_UnrolledLinkedList_element(this, current, current->count), _UnrolledLinkedList_element(this, next, 0), next->count * element_size);
+        current->count += next->count;
+
+        _UnrolledLinkedList_unlink(this, next);
+    }
+
+    if (position == current->count)
+    {
+        *node = current->next;
+        *index = 0;
+    }
+    else
+    {
+        *node = current;
+        *index = position;
+    }
+}
+
+// [UnrolledLinkedListIter]
+
+typedef struct
+{
+    UnrolledLinkedList *list;
+    UnrolledLinkedListNode *front;
+    size_t front_index;
+    UnrolledLinkedListNode *back;
+    size_t back_index;
+    size_t remaining;
+} UnrolledLinkedListIter;
+
+void UnrolledLinkedListIter_new(UnrolledLinkedListIter *this, UnrolledLinkedList *list)
+{
+    this->list = list;
+    this->front = list->head;
+    this->front_index = 0;
+    this->back = list->tail;
+    this->back_index = list->tail ? list->tail->count : 0;
+    this->remaining = list->length;
+}
+
+void *UnrolledLinkedListIter_next(UnrolledLinkedListIter *this)
+{
+    if (this->remaining == 0)
+    {
+        return NULL;
+    }
+
+    if (this->front_index == this->front->count)
+    {
+        this->front = this->front->next;
+        this->front_index = 0;
+    }
+
+    void *element = _UnrolledLinkedList_element(this->list, this->front, this->front_index);
+    this->front_index++;
+    this->remaining--;
+
+    return element;
+}
+
+void *UnrolledLinkedListIter_next_back(UnrolledLinkedListIter *this)
+{
+    if (this->remaining == 0)
+    {
+        return NULL;
+    }
+
+    if (this->back_index == 0)
+    {
+        this->back = this->back->previous;
+        this->back_index = this->back->count;
+    }
+
+    this->back_index--;
+    this->remaining--;
+
+    return _UnrolledLinkedList_element(this->list, this->back, this->back_index);
+}
+
+size_t UnrolledLinkedListIter_len(const UnrolledLinkedListIter *this)
+{
+    return this->remaining;
+}
+
+UnrolledLinkedListIter UnrolledLinkedList_iter(UnrolledLinkedList *this)
+{
+    UnrolledLinkedListIter iter;
+    UnrolledLinkedListIter_new(&iter, this);
+
+    return iter;
+}
+
+Iterator UnrolledLinkedListIter_iter(UnrolledLinkedListIter *this)
+{
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)UnrolledLinkedListIter_next,
+            .next_back = (IteratorNextBackFn)UnrolledLinkedListIter_next_back,
+            .len = (IteratorLenFn)UnrolledLinkedListIter_len,
+        });
+}
+
+// [UnrolledLinkedListCursor]
+
+// A cursor points at an element or at the "ghost" position between the tail and the head, where `node` is NULL.
+// Moving past either end lands on the ghost, and moving again wraps around to the other end
+typedef struct
+{
+    UnrolledLinkedList *list;
+    UnrolledLinkedListNode *node;
+    size_t index;
+} UnrolledLinkedListCursor;
+
+UnrolledLinkedListCursor UnrolledLinkedList_cursor_front(UnrolledLinkedList *this)
+{
+    return (UnrolledLinkedListCursor){.list = this, .node = this->head, .index = 0};
+}
+
+UnrolledLinkedListCursor UnrolledLinkedList_cursor_back(UnrolledLinkedList *this)
+{
+    return (UnrolledLinkedListCursor){.list = this, .node = this->tail, .index = this->tail ? this->tail->count - 1 : 0};
+}
+
+void *UnrolledLinkedListCursor_current(const UnrolledLinkedListCursor *this)
+{
+    if (this->node == NULL)
+    {
+        return NULL;
+    }
+
+    return _UnrolledLinkedList_element(this->list, this->node, this->index);
+}
+
+void UnrolledLinkedListCursor_move_next(UnrolledLinkedListCursor *this)
+{
+    if (this->node == NULL)
+    {
+        this->node = this->list->head;
+        this->index = 0;
+    }
+    else if (this->index + 1 < this->node->count)
+    {
+        this->index++;
+    }
+    else
+    {
+        this->node = this->node->next;
+        this->index = 0;
+    }
+}
+
+void UnrolledLinkedListCursor_move_prev(UnrolledLinkedListCursor *this)
+{
+    if (this->node == NULL)
+    {
+        this->node = this->list->tail;
+        this->index = this->node ? this->node->count - 1 : 0;
+    }
+    else if (this->index > 0)
+    {
+        this->index--;
+    }
+    else
+    {
+        this->node = this->node->previous;
+        this->index = this->node ? this->node->count - 1 : 0;
+    }
+}
+
+// Inserts before the current element, or at the back when the cursor is on the ghost. The cursor keeps pointing at the
+// same element
+void UnrolledLinkedListCursor_insert_before(UnrolledLinkedListCursor *this, const void *value)
+{
+    if (this->node == NULL)
+    {
+        UnrolledLinkedList_push_back(this->list, value);
+        return;
+    }
+
+    _UnrolledLinkedList_insert_at(this->list, &this->node, &this->index, value);
+    UnrolledLinkedListCursor_move_next(this);
+}
+
+// Inserts after the current element, or at the front when the cursor is on the ghost. The cursor keeps pointing at the
+// same element
+void UnrolledLinkedListCursor_insert_after(UnrolledLinkedListCursor *this, const void *value)
+{
+    if (this->node == NULL)
+    {
+        UnrolledLinkedList_push_front(this->list, value);
+        return;
+    }
+
+    this->index++;
+    _UnrolledLinkedList_insert_at(this->list, &this->node, &this->index, value);
+    UnrolledLinkedListCursor_move_prev(this);
+}
+
+// Drops the current element and moves the cursor to the element that followed it. Does nothing on the ghost
+void UnrolledLinkedListCursor_remove_current(UnrolledLinkedListCursor *this)
+{
+    if (this->node == NULL)
+    {
+        return;
+    }
+
+    _UnrolledLinkedList_remove_at(this->list, &this->node, &this->index);
+}
+
+// [VecDeque]
+
+// The capacity is always zero or a power of two, so ring indices wrap with a mask instead of a division
+#define VEC_DEQUE_MINIMUM_CAPACITY 8
+
+typedef struct
+{
+    size_t size;
+    DropFn drop;
+} VecDequeElementProps;
+
+typedef struct
+{
+    size_t length;
+    size_t capacity;
+    void *data;
+    size_t head;
+    VecDequeElementProps element_props;
+} VecDeque;
+
+// The elements in order as at most two contiguous runs, second_len is 0 unless the elements wrap around the buffer
+typedef struct
+{
+    void *first;
+    size_t first_len;
+    void *second;
+    size_t second_len;
+} VecDequeSlices;
+
+void VecDeque_new(VecDeque *this, const VecDequeElementProps *element_props)
+{
+    this->element_props = *element_props;
+
+    this->length = 0;
+    this->capacity = 0;
+    this->data = NULL;
+    this->head = 0;
+}
+
+size_t VecDeque_len(const VecDeque *this)
+{
+    return this->length;
+}
+
+size_t VecDeque_capacity(const VecDeque *this)
+{
+    return this->capacity;
+}
+
+static size_t _VecDeque_wrap(const VecDeque *this, size_t index)
+{
+    return index & (this->capacity - 1);
+}
+
+static uint8_t *_VecDeque_get(const VecDeque *this, size_t index)
+{
+    return (uint8_t *)(this->data) + (index * this->element_props.size);
+}
+
+void *VecDeque_get(const VecDeque *this, size_t index)
+{
+    if (index < this->length)
+    {
+        return _VecDeque_get(this, _VecDeque_wrap(this, this->head + index));
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+void *VecDeque_front(VecDeque *this)
+{
+    if (this->length > 0)
+    {
+        return _VecDeque_get(this, this->head);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+void *VecDeque_back(VecDeque *this)
+{
+    if (this->length > 0)
+    {
+        size_t tail_index = _VecDeque_wrap(this, this->head + this->length - 1);
+        return _VecDeque_get(this, tail_index);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+// Splits count elements starting at the ring index start into the run up to the end of the buffer and the wrapped rest
+static VecDequeSlices _VecDeque_slices(const VecDeque *this, size_t start, size_t count)
+{
+    size_t first_len = MIN(count, this->capacity - start);
+
+    return (VecDequeSlices){
+        .first = _VecDeque_get(this, start),
+        .first_len = first_len,
+        .second = this->data,
+        .second_len = count - first_len,
+    };
+}
+
+VecDequeSlices VecDeque_as_slices(const VecDeque *this)
+{
+    if (this->length == 0)
+    {
+        return (VecDequeSlices){0};
+    }
+
+    return _VecDeque_slices(this, this->head, this->length);
+}
+
+// Moves the elements into a new buffer of new_capacity, unwrapped so that head is 0
+static void _VecDeque_set_capacity(VecDeque *this, size_t new_capacity)
+{
+    void *new_data = new_capacity > 0 ? malloc(new_capacity * this->element_props.size) : NULL;
+
+    VecDequeSlices slices = VecDeque_as_slices(this);
+    if (slices.first_len > 0)
+    {
+        memcpy(new_data, slices.first, slices.first_len * this->element_props.size);
+    }
+    if (slices.second_len > 0)
+    {
+        memcpy((uint8_t *)(new_data) + (slices.first_len * this->element_props.size), slices.second, slices.second_len * this->element_props.size);
+    }
+
+    free(this->data);
+
+    this->data = new_data;
+    this->capacity = new_capacity;
+    this->head = 0;
+}
+
+void VecDeque_reserve(VecDeque *this, size_t additional)
+{
+    size_t required = this->length + additional;
+    if (required <= this->capacity)
+    {
+        return;
+    }
+
+    size_t new_capacity = this->capacity ? this->capacity : VEC_DEQUE_MINIMUM_CAPACITY;
+    while (new_capacity < required)
+    {
+        new_capacity *= 2;
+    }
+
+    _VecDeque_set_capacity(this, new_capacity);
+}
+
+void VecDeque_push_back(VecDeque *this, const void *value)
+{
+    if (this->length == this->capacity)
+    {
+        VecDeque_reserve(this, 1);
+    }
+
+    size_t insert_index = _VecDeque_wrap(this, this->head + this->length);
+    memcpy(_VecDeque_get(this, insert_index), value, this->element_props.size);
+
+    this->length++;
+}
+
+void VecDeque_push_front(VecDeque *this, const void *value)
+{
+    if (this->length == this->capacity)
+    {
+        VecDeque_reserve(this, 1);
+    }
+
+    this->head = _VecDeque_wrap(this, this->head - 1);
+    memcpy(_VecDeque_get(this, this->head), value, this->element_props.size);
+
+    this->length++;
+}
+
+// Copies count elements from values to the back with at most two memcpys
+void VecDeque_extend(VecDeque *this, const void *values, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    VecDeque_reserve(this, count);
+
+    VecDequeSlices slices = _VecDeque_slices(this, _VecDeque_wrap(this, this->head + this->length), count);
+    memcpy(slices.first, values, slices.first_len * this->element_props.size);
+    memcpy(slices.second, (const uint8_t *)(values) + (slices.first_len * this->element_props.size), slices.second_len * this->element_props.size);
+
+    this->length += count;
+}
+
+void VecDeque_pop_back(VecDeque *this)
+{
+    if (this->length > 0)
+    {
+        if (this->element_props.drop != NULL)
+        {
+            this->element_props.drop(VecDeque_back(this));
+        }
+
+        this->length--;
+    }
+}
+
+void VecDeque_pop_front(VecDeque *this)
+{
+    if (this->length > 0)
+    {
+        if (this->element_props.drop != NULL)
+        {
+            this->element_props.drop(VecDeque_front(this));
+        }
+
+        this->head = _VecDeque_wrap(this, this->head + 1);
+        this->length--;
+    }
+}
+
+// Removes up to count elements from the front and returns how many were removed. They are moved into out with at most
+// two memcpys, or dropped if out is NULL
+size_t VecDeque_drain_front(VecDeque *this, void *out, size_t count)
+{
+    count = MIN(count, this->length);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    VecDequeSlices slices = _VecDeque_slices(this, this->head, count);
+
+    if (out != NULL)
+    {
+        memcpy(out, slices.first, slices.first_len * this->element_props.size);
+        memcpy((uint8_t *)(out) + (slices.first_len * this->element_props.size), slices.second, slices.second_len * this->element_props.size);
+    }
+    else if (this->element_props.drop != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            this->element_props.drop(VecDeque_get(this, i));
+        }
+    }
+
+    this->head = _VecDeque_wrap(this, this->head + count);
+    this->length -= count;
+
+    return count;
+}
+
+void VecDeque_clear(VecDeque *this)
+{
+    VecDeque_drain_front(this, NULL, this->length);
+    this->head = 0;
+}
+
+// Shrinks the buffer to the smallest power of two that holds the elements
+void VecDeque_shrink_to_fit(VecDeque *this)
+{
+    size_t new_capacity = 0;
+    if (this->length > 0)
+    {
+        new_capacity = 1;
+        while (new_capacity < this->length)
+        {
+            new_capacity *= 2;
+        }
+    }
+
+    if (new_capacity < this->capacity)
+    {
+        _VecDeque_set_capacity(this, new_capacity);
+    }
+}
+
+void VecDeque_drop(VecDeque *this)
+{
+    VecDeque_clear(this);
+    free(this->data);
+}
+
+// [VecDequeIter]
+
+typedef struct
+{
+    const VecDeque *deque;
+    size_t start;
+    size_t end;
+} VecDequeIter;
+
+void VecDequeIter_new(VecDequeIter *this, const VecDeque *deque)
+{
+    this->deque = deque;
+    this->start = 0;
+    this->end = VecDeque_len(deque);
+}
+
+const void *VecDequeIter_next(VecDequeIter *this)
+{
+    if (this->start == this->end)
+    {
+        return NULL;
+    }
+
+    const void *element = VecDeque_get(this->deque, this->start);
+    this->start += 1;
+    return element;
+}
+
+const void *VecDequeIter_next_back(VecDequeIter *this)
+{
+    if (this->start == this->end)
+    {
+        return NULL;
+    }
+
+    this->end -= 1;
+    return VecDeque_get(this->deque, this->end);
+}
+
+size_t VecDequeIter_len(const VecDequeIter *this)
+{
+    return this->end - this->start;
+}
+
+void VecDequeIter_drop(VecDequeIter *this)
+{
+}
+
+Iterator VecDequeIter_iter(VecDequeIter *this);
+
+void VecDequeIter_split_at(VecDequeIter *this, size_t index, LinkedIterator *right)
+{
+    VecDequeIter *other = _IteratorSplit_new(sizeof(*other), (DropFn)VecDequeIter_drop, NULL);
+    other->deque = this->deque;
+    other->start = this->start + index;
+    other->end = this->end;
+
+    this->end = other->start;
+
+    *right = (LinkedIterator){
+        .iter = VecDequeIter_iter(other),
+        .drop = _IteratorSplit_drop,
+    };
+}
+
+VecDequeIter VecDeque_iter(const VecDeque *this)
+{
+    VecDequeIter iter;
+    VecDequeIter_new(&iter, this);
+
+    return iter;
+}
+
+Iterator VecDequeIter_iter(VecDequeIter *this)
+{
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)VecDequeIter_next,
+            .next_back = (IteratorNextBackFn)VecDequeIter_next_back,
+            .len = (IteratorLenFn)VecDequeIter_len,
+            .split_at = (IteratorSplitAtFn)VecDequeIter_split_at,
+        });
+}
+
+// [MpmcQueue]
+
+#include <stdatomic.h>
+
+// Bounded lock-free queue after Dmitry Vyukov's design: a power-of-two ring of slots, each carrying a sequence number
+// that tells producers and consumers whose turn it is, so a push or pop is one CAS on a shared position plus one
+// release store on the slot. Elements follow VecDeque's element model and are moved in and out by value
+//
+// The positions are padded to cache lines of their own, which takes a 64 byte aligned queue. Static and automatic
+// queues are, but malloc only promises 16 bytes: allocate queues (and structs holding them) with
+// aligned_alloc(_Alignof(MpmcQueue), ...). Misaligned, the two positions still never share a line, only their
+// neighbours
+
+#define MPMC_QUEUE_CACHE_LINE_SIZE 64
+
+typedef enum
+{
+    MPMC_QUEUE_MULTI = 0,
+    // promises that only one thread ever pushes, so the enqueue position is advanced with a plain store
+    MPMC_QUEUE_SINGLE_PRODUCER = 1,
+    // promises that only one thread ever pops, so the dequeue position is advanced with a plain store
+    MPMC_QUEUE_SINGLE_CONSUMER = 1 << 1,
+} MpmcQueueFlags;
+
+typedef struct
+{
+    uint8_t *slots;
+    size_t slot_size;
+    size_t mask;
+    MpmcQueueFlags flags;
+    VecDequeElementProps element_props;
+    // producers and consumers each get their own cache line
+    _Alignas(MPMC_QUEUE_CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(MPMC_QUEUE_CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+} MpmcQueue;
+
+static atomic_size_t *_MpmcQueue_sequence(const MpmcQueue *this, size_t pos)
+{
+    return (atomic_size_t *)(this->slots + (pos & this->mask) * this->slot_size);
+}
+
+static void *_MpmcQueue_element(const MpmcQueue *this, size_t pos)
+{
+    return this->slots + (pos & this->mask) * this->slot_size + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(atomic_size_t));
+}
+
+// The capacity is rounded up to a power of two
+void MpmcQueue_with_flags(MpmcQueue *this, const VecDequeElementProps *element_props, size_t capacity, MpmcQueueFlags flags)
+{
+    assert(capacity > 0);
+
+    size_t rounded = 1;
+    while (rounded < capacity)
+    {
+        rounded *= 2;
+    }
+
+    this->element_props = *element_props;
+    this->flags = flags;
+    this->mask = rounded - 1;
+    this->slot_size = ROUND_SIZE_UP_TO_MAX_ALIGN(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(atomic_size_t)) + element_props->size);
+    // so that the ring shares no cache line with other allocations
+    this->slots = aligned_alloc(MPMC_QUEUE_CACHE_LINE_SIZE, ROUND_SIZE_UP_TO_ALIGN(rounded * this->slot_size, MPMC_QUEUE_CACHE_LINE_SIZE));
+
+    for (size_t i = 0; i < rounded; i++)
+    {
+        atomic_init(_MpmcQueue_sequence(this, i), i);
+    }
+
+    atomic_init(&this->enqueue_pos, 0);
+    atomic_init(&this->dequeue_pos, 0);
+}
+
+void MpmcQueue_new(MpmcQueue *this, const VecDequeElementProps *element_props, size_t capacity)
+{
+    MpmcQueue_with_flags(this, element_props, capacity, MPMC_QUEUE_MULTI);
+}
+
+size_t MpmcQueue_capacity(const MpmcQueue *this)
+{
+    return this->mask + 1;
+}
+
+// Only a snapshot while other threads are pushing or popping
+size_t MpmcQueue_len(MpmcQueue *this)
+{
+    size_t dequeue_pos = atomic_load_explicit(&this->dequeue_pos, memory_order_relaxed);
+    size_t enqueue_pos = atomic_load_explicit(&this->enqueue_pos, memory_order_relaxed);
+
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+// Claims `*pos` for this thread. A slot is ready when its sequence is `*pos + lag`, returns false if it lags behind
+// that, which means the queue is full for producers (lag 0) or empty for consumers (lag 1)
+static bool _MpmcQueue_claim(MpmcQueue *this, atomic_size_t *position, size_t lag, bool is_single, size_t *pos)
+{
+    *pos = atomic_load_explicit(position, memory_order_relaxed);
+
+    for (;;)
+    {
+        size_t sequence = atomic_load_explicit(_MpmcQueue_sequence(this, *pos), memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(*pos + lag);
+
+        if (difference < 0)
+        {
+            return false;
+        }
+        else if (difference > 0)
+        {
+            // another thread claimed this position already
+            *pos = atomic_load_explicit(position, memory_order_relaxed);
+        }
+        else if (is_single)
+        {
+            atomic_store_explicit(position, *pos + 1, memory_order_relaxed);
+            return true;
+        }
+        else if (atomic_compare_exchange_weak_explicit(position, pos, *pos + 1, memory_order_relaxed, memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+// Copies value into the queue, returns false without blocking if it is full
+bool MpmcQueue_try_push(MpmcQueue *this, const void *value)
+{
+    size_t pos;
+    if (!_MpmcQueue_claim(this, &this->enqueue_pos, 0, this->flags & MPMC_QUEUE_SINGLE_PRODUCER, &pos))
+    {
+        return false;
+    }
+
+    memcpy(_MpmcQueue_element(this, pos), value, this->element_props.size);
+    atomic_store_explicit(_MpmcQueue_sequence(this, pos), pos + 1, memory_order_release);
+
+    return true;
+}
+
+// Moves the oldest element into value_out, returns false without blocking if the queue is empty
+bool MpmcQueue_try_pop(MpmcQueue *this, void *value_out)
+{
+    size_t pos;
+    if (!_MpmcQueue_claim(this, &this->dequeue_pos, 1, this->flags & MPMC_QUEUE_SINGLE_CONSUMER, &pos))
+    {
+        return false;
+    }
+
+    memcpy(value_out, _MpmcQueue_element(this, pos), this->element_props.size);
+    atomic_store_explicit(_MpmcQueue_sequence(this, pos), pos + this->mask + 1, memory_order_release);
+
+    return true;
+}
+
+// Must not race with pushes or pops, drops the elements still queued
+void MpmcQueue_drop(MpmcQueue *this)
+{
+    if (this->element_props.drop)
+    {
+        size_t enqueue_pos = atomic_load(&this->enqueue_pos);
+
+        for (size_t pos = atomic_load(&this->dequeue_pos); pos != enqueue_pos; pos++)
+        {
+            this->element_props.drop(_MpmcQueue_element(this, pos));
+        }
+    }
+
+    free(this->slots);
+}
+
+// [WorkStealingDeque]
+
+// Chase-Lev deque in the C11 formulation of Le, Pop, Cohen and Zappa Nardelli. The owner thread pushes and pops at the
+// bottom without locking, other threads steal from the top with a CAS. When it is full the owner copies the elements
+// to a buffer twice the size. Thieves may still be reading the old buffer, so retired buffers are freed only with the
+// deque
+//
+// As in that formulation, elements are read and written through relaxed atomics: each slot is a whole number of
+// words, copied word by word. A thief may read a slot the owner is overwriting, but then loses its CAS on top and
+// discards what it read
+
+#define WORK_STEALING_DEQUE_MINIMUM_CAPACITY 16
+
+typedef struct _WorkStealingDequeBuffer
+{
+    size_t capacity;
+    struct _WorkStealingDequeBuffer *retired;
+} _WorkStealingDequeBuffer;
+
+typedef struct
+{
+    VecDequeElementProps element_props;
+    _Atomic(_WorkStealingDequeBuffer *) buffer;
+    // thieves and the owner each get their own cache line, given the deque is allocated at that alignment as with
+    // MpmcQueue
+    _Alignas(MPMC_QUEUE_CACHE_LINE_SIZE) atomic_size_t top;
+    _Alignas(MPMC_QUEUE_CACHE_LINE_SIZE) atomic_size_t bottom;
+} WorkStealingDeque;
+
+typedef enum
+{
+    WORK_STEALING_DEQUE_STEAL_SUCCESS,
+    WORK_STEALING_DEQUE_STEAL_EMPTY,
+    // lost a race with the owner or another thief, the deque may still hold elements
+    WORK_STEALING_DEQUE_STEAL_RETRY,
+} WorkStealingDequeSteal;
+
+static size_t _WorkStealingDequeBuffer_slot_words(size_t element_size)
+{
+    return (element_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+static _Atomic(uint64_t) *_WorkStealingDequeBuffer_slot(_WorkStealingDequeBuffer *this, size_t element_size, size_t index)
+{
+    _Atomic(uint64_t) *data = (_Atomic(uint64_t) *)((uint8_t *)this + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*this)));
+    return data + (index & (this->capacity - 1)) * _WorkStealingDequeBuffer_slot_words(element_size);
+}
+
+// Only for when no other thread uses the deque
+static void *_WorkStealingDequeBuffer_get(_WorkStealingDequeBuffer *this, size_t element_size, size_t index)
+{
+    return (void *)_WorkStealingDequeBuffer_slot(this, element_size, index);
+}
+
+static void _WorkStealingDequeBuffer_load(_WorkStealingDequeBuffer *this, size_t element_size, size_t index, void *value_out)
+{
+    _Atomic(uint64_t) *slot = _WorkStealingDequeBuffer_slot(this, element_size, index);
+
+    for (size_t i = 0; i < element_size; i += sizeof(uint64_t))
+    {
+        uint64_t word = atomic_load_explicit(&slot[i / sizeof(uint64_t)], memory_order_relaxed);
+        size_t len = element_size - i;
+        memcpy((uint8_t *)value_out + i, &word, MIN(len, sizeof(uint64_t)));
+    }
+}
+
+static void _WorkStealingDequeBuffer_store(_WorkStealingDequeBuffer *this, size_t element_size, size_t index, const void *value)
+{
+    _Atomic(uint64_t) *slot = _WorkStealingDequeBuffer_slot(this, element_size, index);
+
+    for (size_t i = 0; i < element_size; i += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        size_t len = element_size - i;
+        memcpy(&word, (const uint8_t *)value + i, MIN(len, sizeof(uint64_t)));
+        atomic_store_explicit(&slot[i / sizeof(uint64_t)], word, memory_order_relaxed);
+    }
+}
+
+static _WorkStealingDequeBuffer *_WorkStealingDequeBuffer_new(size_t capacity, size_t element_size, _WorkStealingDequeBuffer *retired)
+{
+    size_t slot_size = _WorkStealingDequeBuffer_slot_words(element_size) * sizeof(uint64_t);
+    _WorkStealingDequeBuffer *buffer = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(*buffer)) + capacity * slot_size);
+    buffer->capacity = capacity;
+    buffer->retired = retired;
+
+    return buffer;
+}
+
+// The capacity is rounded up to a power of two
+void WorkStealingDeque_with_capacity(WorkStealingDeque *this, const VecDequeElementProps *element_props, size_t capacity)
+{
+    size_t rounded = WORK_STEALING_DEQUE_MINIMUM_CAPACITY;
+    while (rounded < capacity)
+    {
+        rounded *= 2;
+    }
+
+    this->element_props = *element_props;
+    atomic_init(&this->buffer, _WorkStealingDequeBuffer_new(rounded, element_props->size, NULL));
+    atomic_init(&this->top, 0);
+    atomic_init(&this->bottom, 0);
+}
+
+void WorkStealingDeque_new(WorkStealingDeque *this, const VecDequeElementProps *element_props)
+{
+    WorkStealingDeque_with_capacity(this, element_props, WORK_STEALING_DEQUE_MINIMUM_CAPACITY);
+}
+
+// Only a snapshot while other threads are stealing
+size_t WorkStealingDeque_len(WorkStealingDeque *this)
+{
+    size_t bottom = atomic_load_explicit(&this->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&this->top, memory_order_relaxed);
+
+    return (intptr_t)(bottom - top) > 0 ? bottom - top : 0;
+}
+
+// Owner only
+void WorkStealingDeque_push(WorkStealingDeque *this, const void *value)
+{
+    size_t element_size = this->element_props.size;
+    size_t bottom = atomic_load_explicit(&this->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&this->top, memory_order_acquire);
+    _WorkStealingDequeBuffer *buffer = atomic_load_explicit(&this->buffer, memory_order_relaxed);
+
+    if (bottom - top >= buffer->capacity)
+    {
+        _WorkStealingDequeBuffer *grown = _WorkStealingDequeBuffer_new(buffer->capacity * 2, element_size, buffer);
+        size_t slot_words = _WorkStealingDequeBuffer_slot_words(element_size);
+        for (size_t i = top; i != bottom; i++)
+        {
+            _Atomic(uint64_t) *from = _WorkStealingDequeBuffer_slot(buffer, element_size, i);
+            _Atomic(uint64_t) *to = _WorkStealingDequeBuffer_slot(grown, element_size, i);
+
+            for (size_t word = 0; word < slot_words; word++)
+            {
+                atomic_store_explicit(&to[word], atomic_load_explicit(&from[word], memory_order_relaxed), memory_order_relaxed);
+            }
+        }
+
+        atomic_store_explicit(&this->buffer, grown, memory_order_release);
+        buffer = grown;
+    }
+
+    _WorkStealingDequeBuffer_store(buffer, element_size, bottom, value);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&this->bottom, bottom + 1, memory_order_relaxed);
+}
+
+// Owner only, moves the most recently pushed element into value_out. Returns false if the deque is empty
+bool WorkStealingDeque_pop(WorkStealingDeque *this, void *value_out)
+{
+    size_t bottom = atomic_load_explicit(&this->bottom, memory_order_relaxed) - 1;
+    _WorkStealingDequeBuffer *buffer = atomic_load_explicit(&this->buffer, memory_order_relaxed);
+    atomic_store_explicit(&this->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t top = atomic_load_explicit(&this->top, memory_order_relaxed);
+
+    if ((intptr_t)(bottom - top) < 0)
+    {
+        atomic_store_explicit(&this->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+
+    bool is_taken = true;
+
+    // the last element may be stolen at the same time, whoever advances top gets it
+    if (bottom == top)
+    {
+        is_taken = atomic_compare_exchange_strong_explicit(&this->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&this->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    if (is_taken)
+    {
+        _WorkStealingDequeBuffer_load(buffer, this->element_props.size, bottom, value_out);
+    }
+
+    return is_taken;
+}
+
+// Any thread, moves the oldest element into value_out
+WorkStealingDequeSteal WorkStealingDeque_steal(WorkStealingDeque *this, void *value_out)
+{
+    size_t top = atomic_load_explicit(&this->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t bottom = atomic_load_explicit(&this->bottom, memory_order_acquire);
+
+    if ((intptr_t)(bottom - top) <= 0)
+    {
+        return WORK_STEALING_DEQUE_STEAL_EMPTY;
+    }
+
+    // The copy may be torn if the owner has wrapped around onto this slot, in which case top has moved on and the CAS
+    // below fails, so the copy is never used
+    _WorkStealingDequeBuffer *buffer = atomic_load_explicit(&this->buffer, memory_order_acquire);
+    _WorkStealingDequeBuffer_load(buffer, this->element_props.size, top, value_out);
+
+    if (!atomic_compare_exchange_strong_explicit(&this->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return WORK_STEALING_DEQUE_STEAL_RETRY;
+    }
+
+    return WORK_STEALING_DEQUE_STEAL_SUCCESS;
+}
+
+// Must not race with the owner or thieves, drops the elements left in the deque
+void WorkStealingDeque_drop(WorkStealingDeque *this)
+{
+    _WorkStealingDequeBuffer *buffer = atomic_load(&this->buffer);
+
+    if (this->element_props.drop)
+    {
+        size_t bottom = atomic_load(&this->bottom);
+
+        for (size_t i = atomic_load(&this->top); i != bottom; i++)
+        {
+            this->element_props.drop(_WorkStealingDequeBuffer_get(buffer, this->element_props.size, i));
+        }
+    }
+
+    while (buffer != NULL)
+    {
+        _WorkStealingDequeBuffer *retired = buffer->retired;
+        free(buffer);
+        buffer = retired;
+    }
+}
+
+// [ThreadPool]
+
+#include <threads.h>
+#include <stdatomic.h>
+
+typedef void (*ThreadPoolJobFn)(void *ctx);
+
+typedef struct _ThreadPool ThreadPool;
+
+typedef struct
+{
+    ThreadPoolJobFn fn;
+    void *ctx;
+    atomic_bool is_done;
+    // set for jobs whose owner blocks on the pool's has_finished condition instead of spinning
+    ThreadPool *notify;
+} ThreadPoolJob;
+
+typedef struct
+{
+    ThreadPool *pool;
+    size_t idx;
+    thrd_t thread;
+    // pushed and popped only by this worker, stolen from by the others
+    WorkStealingDeque jobs;
+} _ThreadPoolWorker;
+
+struct _ThreadPool
+{
+    _ThreadPoolWorker *workers;
+    size_t worker_count;
+    mtx_t lock;
+    cnd_t has_work;
+    cnd_t has_finished;
+    VecDeque injected;
+    atomic_size_t pending;
+    atomic_size_t sleeping;
+    atomic_bool is_shutdown;
+};
+
+static _Thread_local _ThreadPoolWorker *_ThreadPool_current_worker = NULL;
+
+static void _ThreadPoolJob_new(ThreadPoolJob *this, ThreadPoolJobFn fn, void *ctx)
+{
+    this->fn = fn;
+    this->ctx = ctx;
+    this->notify = NULL;
+    atomic_init(&this->is_done, false);
+}
+
+static void _ThreadPoolJob_run(ThreadPoolJob *this)
+{
+    // The owner may return as soon as is_done is set, so the job must not be touched after that
+    ThreadPool *notify = this->notify;
+
+    this->fn(this->ctx);
+
+    if (notify == NULL)
+    {
+        atomic_store_explicit(&this->is_done, true, memory_order_release);
+    }
+    else
+    {
+        mtx_lock(&notify->lock);
+        atomic_store_explicit(&this->is_done, true, memory_order_release);
+        cnd_broadcast(&notify->has_finished);
+        mtx_unlock(&notify->lock);
+    }
+}
+
+static bool _ThreadPoolJob_is_done(ThreadPoolJob *this)
+{
+    return atomic_load_explicit(&this->is_done, memory_order_acquire);
+}
+
+static void _ThreadPool_notify(ThreadPool *this)
+{
+    // sleeping is raised under the lock before a worker re-checks pending, so either the worker sees the new job
+    // or we see the sleeper and wake it up
+    if (atomic_load(&this->sleeping) > 0)
+    {
+        mtx_lock(&this->lock);
+        cnd_signal(&this->has_work);
+        mtx_unlock(&this->lock);
+    }
+}
+
+static void _ThreadPool_push(_ThreadPoolWorker *worker, ThreadPoolJob *job)
+{
+    WorkStealingDeque_push(&worker->jobs, &job);
+
+    atomic_fetch_add(&worker->pool->pending, 1);
+    _ThreadPool_notify(worker->pool);
+}
+
+static ThreadPoolJob *_ThreadPool_take_injected(ThreadPool *this)
+{
+    ThreadPoolJob *job = NULL;
+
+    mtx_lock(&this->lock);
+
+    if (VecDeque_len(&this->injected) > 0)
+    {
+        job = *(ThreadPoolJob **)VecDeque_front(&this->injected);
+        VecDeque_pop_front(&this->injected);
+    }
+
+    mtx_unlock(&this->lock);
+
+    return job;
+}
+
+static ThreadPoolJob *_ThreadPool_steal(_ThreadPoolWorker *victim)
+{
+    ThreadPoolJob *job;
+    WorkStealingDequeSteal result;
+
+    do
+    {
+        result = WorkStealingDeque_steal(&victim->jobs, &job);
+    } while (result == WORK_STEALING_DEQUE_STEAL_RETRY);
+
+    return result == WORK_STEALING_DEQUE_STEAL_SUCCESS ? job : NULL;
+}
+
+static ThreadPoolJob *_ThreadPool_find_job(ThreadPool *this, _ThreadPoolWorker *worker)
+{
+    if (atomic_load(&this->pending) == 0)
+    {
+        return NULL;
+    }
+
+    // Own jobs are taken newest first, stolen ones oldest first since those tend to be the largest
+    ThreadPoolJob *job = NULL;
+    if (!WorkStealingDeque_pop(&worker->jobs, &job))
+    {
+        job = NULL;
+    }
+
+    for (size_t i = 1; job == NULL && i < this->worker_count; i++)
+    {
+        job = _ThreadPool_steal(&this->workers[(worker->idx + i) % this->worker_count]);
+    }
+
+    if (job == NULL)
+    {
+        job = _ThreadPool_take_injected(this);
+    }
+
+    if (job != NULL)
+    {
+        atomic_fetch_sub(&this->pending, 1);
+    }
+
+    return job;
+}
+
+static int _ThreadPool_worker_main(void *arg)
+{
+    _ThreadPoolWorker *worker = arg;
+    ThreadPool *this = worker->pool;
+
+    _ThreadPool_current_worker = worker;
+
+    while (true)
+    {
+        ThreadPoolJob *job = _ThreadPool_find_job(this, worker);
+
+        if (job != NULL)
+        {
+            _ThreadPoolJob_run(job);
+            continue;
+        }
+
+        mtx_lock(&this->lock);
+        atomic_fetch_add(&this->sleeping, 1);
+
+        while (atomic_load(&this->pending) == 0 && !atomic_load(&this->is_shutdown))
+        {
+            cnd_wait(&this->has_work, &this->lock);
+        }
+
+        atomic_fetch_sub(&this->sleeping, 1);
+        bool is_shutdown = atomic_load(&this->is_shutdown);
+        mtx_unlock(&this->lock);
+
+        if (is_shutdown)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void ThreadPool_new(ThreadPool *this, size_t worker_count)
+{
+    this->worker_count = worker_count == 0 ? 1 : worker_count;
+    // at the alignment the deques' padding assumes, which malloc does not promise
+    size_t bytes = ROUND_SIZE_UP_TO_ALIGN(this->worker_count * sizeof(*this->workers), _Alignof(_ThreadPoolWorker));
+    this->workers = aligned_alloc(_Alignof(_ThreadPoolWorker), bytes);
+
+    mtx_init(&this->lock, mtx_plain);
+    cnd_init(&this->has_work);
+    cnd_init(&this->has_finished);
+    VecDeque_new(&this->injected, &(VecDequeElementProps){.size = sizeof(ThreadPoolJob *)});
+
+    atomic_init(&this->pending, 0);
+    atomic_init(&this->sleeping, 0);
+    atomic_init(&this->is_shutdown, false);
+
+    for (size_t i = 0; i < this->worker_count; i++)
+    {
+        _ThreadPoolWorker *worker = &this->workers[i];
+
+        worker->pool = this;
+        worker->idx = i;
+        WorkStealingDeque_new(&worker->jobs, &(VecDequeElementProps){.size = sizeof(ThreadPoolJob *)});
+    }
+
+    for (size_t i = 0; i < this->worker_count; i++)
+    {
+        thrd_create(&this->workers[i].thread, _ThreadPool_worker_main, &this->workers[i]);
+    }
+}
+
+size_t ThreadPool_worker_count(const ThreadPool *this)
+{
+    return this->worker_count;
+}
+
+// Runs fn on the pool and blocks until it returns. Called from a worker, fn simply runs in place.
+void ThreadPool_install(ThreadPool *this, ThreadPoolJobFn fn, void *ctx)
+{
+    if (_ThreadPool_current_worker != NULL && _ThreadPool_current_worker->pool == this)
+    {
+        fn(ctx);
+        return;
+    }
+
+    ThreadPoolJob job;
+    _ThreadPoolJob_new(&job, fn, ctx);
+    job.notify = this;
+
+    ThreadPoolJob *job_ptr = &job;
+
+    mtx_lock(&this->lock);
+    VecDeque_push_back(&this->injected, &job_ptr);
+    atomic_fetch_add(&this->pending, 1);
+    cnd_signal(&this->has_work);
+
+    while (!_ThreadPoolJob_is_done(&job))
+    {
+        cnd_wait(&this->has_finished, &this->lock);
+    }
+
+    mtx_unlock(&this->lock);
+}
+
+typedef struct
+{
+    ThreadPoolJobFn fn_a;
+    void *ctx_a;
+    ThreadPoolJobFn fn_b;
+    void *ctx_b;
+} _ThreadPoolJoin;
+
+static void _ThreadPool_join_in_worker(_ThreadPoolJoin *this)
+{
+    _ThreadPoolWorker *worker = _ThreadPool_current_worker;
+
+    ThreadPoolJob job_b;
+    _ThreadPoolJob_new(&job_b, this->fn_b, this->ctx_b);
+    _ThreadPool_push(worker, &job_b);
+
+    this->fn_a(this->ctx_a);
+
+    // job_b is either still on top of our own deque or has been stolen, keep busy until it is done
+    while (!_ThreadPoolJob_is_done(&job_b))
+    {
+        ThreadPoolJob *job = _ThreadPool_find_job(worker->pool, worker);
+
+        if (job != NULL)
+        {
+            _ThreadPoolJob_run(job);
+        }
+        else
+        {
+            thrd_yield();
+        }
+    }
+}
+
+// Runs fn_a and fn_b, potentially in parallel, and returns once both are done
+void ThreadPool_join(ThreadPool *this, ThreadPoolJobFn fn_a, void *ctx_a, ThreadPoolJobFn fn_b, void *ctx_b)
+{
+    _ThreadPoolJoin join = {
+        .fn_a = fn_a,
+        .ctx_a = ctx_a,
+        .fn_b = fn_b,
+        .ctx_b = ctx_b,
+    };
+
+    ThreadPool_install(this, (ThreadPoolJobFn)_ThreadPool_join_in_worker, &join);
+}
+
+void ThreadPool_drop(ThreadPool *this)
+{
+    mtx_lock(&this->lock);
+    atomic_store(&this->is_shutdown, true);
+    cnd_broadcast(&this->has_work);
+    mtx_unlock(&this->lock);
+
+    for (size_t i = 0; i < this->worker_count; i++)
+    {
+        thrd_join(this->workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < this->worker_count; i++)
+    {
+        WorkStealingDeque_drop(&this->workers[i].jobs);
+    }
+
+    free(this->workers);
+
+    VecDeque_drop(&this->injected);
+    cnd_destroy(&this->has_finished);
+    cnd_destroy(&this->has_work);
+    mtx_destroy(&this->lock);
+}
+
+// [ParIter]
+
+typedef void (*ParIterForEachFn)(void *ctx, const void *element);
+typedef void (*ParIterFoldFn)(void *ctx, void *accumulator, const void *element);
+typedef void (*ParIterCombineFn)(void *ctx, void *accumulator, const void *other);
+
+typedef struct
+{
+    size_t size;
+    const void *identity;
+    ParIterFoldFn fold;
+    ParIterCombineFn combine;
+} ParIterReduceProps;
+
+typedef struct
+{
+    Iterator iter;
+    ThreadPool *pool;
+    size_t min_len;
+} ParIter;
+
+typedef enum
+{
+    PAR_ITER_OP_KIND_FOR_EACH,
+    PAR_ITER_OP_KIND_REDUCE,
+    PAR_ITER_OP_KIND_COLLECT,
+} _ParIterOpKind;
+
+typedef struct
+{
+    _ParIterOpKind kind;
+    void *ctx;
+
+    union
+    {
+        struct
+        {
+            ParIterForEachFn fn;
+        } for_each;
+
+        struct
+        {
+            const ParIterReduceProps *props;
+        } reduce;
+
+        struct
+        {
+            Vec *out;
+            bool is_indexed;
+        } collect;
+    };
+} _ParIterOp;
+
+typedef struct
+{
+    const ParIter *par;
+    const _ParIterOp *op;
+    Iterator iter;
+    size_t splits;
+    const _ThreadPoolWorker *origin;
+
+    // reduce: accumulator, collect: the index of the first element in the output or the Vec of this part
+    void *accumulator;
+    size_t offset;
+} _ParIterTask;
+
+ParIter ParIter_new(Iterator iter, ThreadPool *pool)
+{
+    assert(iter.capabilities & ITERATOR_CAPABILITY_SPLIT_ITERATOR);
+
+    return (ParIter){
+        .iter = iter,
+        .pool = pool,
+        .min_len = 1,
+    };
+}
+
+// Parts of an exact size iterator are not split further once they would be shorter than min_len
+void ParIter_with_min_len(ParIter *this, size_t min_len)
+{
+    this->min_len = min_len == 0 ? 1 : min_len;
+}
+
+static void _ParIterTask_run_sequential(_ParIterTask *this)
+{
+    const _ParIterOp *op = this->op;
+    size_t i = this->offset;
+
+    for (const void *element = Iterator_next(&this->iter); element != NULL; element = Iterator_next(&this->iter))
+    {
+        switch (op->kind)
+        {
+        case PAR_ITER_OP_KIND_FOR_EACH:
+            op->for_each.fn(op->ctx, element);
+            break;
+        case PAR_ITER_OP_KIND_REDUCE:
+            op->reduce.props->fold(op->ctx, this->accumulator, element);
+            break;
+        case PAR_ITER_OP_KIND_COLLECT:
+            if (op->collect.is_indexed)
+            {
+                memcpy(Vec_get_mut(op->collect.out, i), element, op->collect.out->element_size);
+                i++;
+            }
+            else
+            {
+                Vec_push(this->accumulator, element);
+            }
+            break;
+        }
+    }
+}
+
+static bool _ParIterTask_should_split(const _ParIterTask *this)
+{
+    if (this->splits == 0)
+    {
+        return false;
+    }
+
+    if (this->iter.capabilities & ITERATOR_CAPABILITY_EXACT_SIZE_ITERATOR)
+    {
+        return Iterator_len(&this->iter) / 2 >= this->par->min_len;
+    }
+
+    return true;
+}
+
+static void _ParIterTask_run(_ParIterTask *this)
+{
+    // A part that was stolen by another worker is likely to be worth splitting again for the idle ones
+    if (this->origin != _ThreadPool_current_worker)
+    {
+        this->splits = MAX(this->splits, ThreadPool_worker_count(this->par->pool));
+        this->origin = _ThreadPool_current_worker;
+    }
+
+    LinkedIterator right_iter;
+
+    if (!_ParIterTask_should_split(this) || !Iterator_split(&this->iter, &right_iter))
+    {
+        _ParIterTask_run_sequential(this);
+        return;
+    }
+
+    const _ParIterOp *op = this->op;
+
+    this->splits /= 2;
+
+    _ParIterTask right = *this;
+    right.iter = right_iter.iter;
+
+    uint8_t right_accumulator[op->kind == PAR_ITER_OP_KIND_REDUCE ? op->reduce.props->size : 1];
+    Vec right_vec;
+
+    if (op->kind == PAR_ITER_OP_KIND_REDUCE)
+    {
+        memcpy(right_accumulator, op->reduce.props->identity, op->reduce.props->size);
+        right.accumulator = right_accumulator;
+    }
+    else if (op->kind == PAR_ITER_OP_KIND_COLLECT)
+    {
+        if (op->collect.is_indexed)
+        {
+            right.offset = this->offset + Iterator_len(&this->iter);
+        }
+        else
+        {
+            Vec_new(&right_vec, op->collect.out->element_size, NULL);
+            right.accumulator = &right_vec;
+        }
+    }
+
+    ThreadPool_join(this->par->pool, (ThreadPoolJobFn)_ParIterTask_run, this, (ThreadPoolJobFn)_ParIterTask_run, &right);
+
+    if (op->kind == PAR_ITER_OP_KIND_REDUCE)
+    {
+        op->reduce.props->combine(op->ctx, this->accumulator, right_accumulator);
+    }
+    else if (op->kind == PAR_ITER_OP_KIND_COLLECT && !op->collect.is_indexed)
+    {
+        Vec_append(this->accumulator, &right_vec);
+        Vec_drop(&right_vec);
+    }
+
+    LinkedIterator_drop(&right_iter);
+}
+
+static void _ParIter_run(ParIter *this, const _ParIterOp *op, void *accumulator)
+{
+    _ParIterTask task = {
+        .par = this,
+        .op = op,
+        .iter = this->iter,
+        .splits = ThreadPool_worker_count(this->pool),
+        .origin = NULL,
+        .accumulator = accumulator,
+        .offset = 0,
+    };
+
+    ThreadPool_install(this->pool, (ThreadPoolJobFn)_ParIterTask_run, &task);
+}
+
+// Calls fn on every element, in no particular order and potentially from several threads at once
+void ParIter_for_each(ParIter *this, ParIterForEachFn fn, void *ctx)
+{
+    _ParIterOp op = {
+        .kind = PAR_ITER_OP_KIND_FOR_EACH,
+        .ctx = ctx,
+        .for_each.fn = fn,
+    };
+
+    _ParIter_run(this, &op, NULL);
+}
+
+// Folds every part starting from a copy of identity and combines the parts in iteration order into result
+void ParIter_reduce(ParIter *this, const ParIterReduceProps *props, void *ctx, void *result)
+{
+    _ParIterOp op = {
+        .kind = PAR_ITER_OP_KIND_REDUCE,
+        .ctx = ctx,
+        .reduce.props = props,
+    };
+
+    memcpy(result, props->identity, props->size);
+
+    _ParIter_run(this, &op, result);
+}
+
+// Copies every element into a new Vec, keeping the iteration order
+void ParIter_collect(ParIter *this, Vec *out, size_t element_size)
+{
+    bool is_indexed = this->iter.capabilities & ITERATOR_CAPABILITY_INDEXED_SPLIT_ITERATOR;
+
+    _ParIterOp op = {
+        .kind = PAR_ITER_OP_KIND_COLLECT,
+        .collect = {
+            .out = out,
+            .is_indexed = is_indexed,
+        },
+    };
+
+    Vec_new(out, element_size, NULL);
+
+    if (is_indexed)
+    {
+        size_t len = Iterator_len(&this->iter);
+
+        Vec_reserve(out, len);
+        Vec_set_len(out, len);
+    }
+
+    _ParIter_run(this, &op, out);
+}
+
+void ParIter_drop(ParIter *this)
+{
+    Iterator_drop(&this->iter);
+}
+
+// [BinaryHeap]
+
+// A d-ary max-heap: the children of element i are d * i + 1 up to d * i + d. The elements sit after arity - 1 unused
+// slots in a buffer aligned to a cache line, so every group of siblings starts at a multiple of d slots. When d * size
+// divides the cache line size, e.g. 4-ary or 8-ary over 8 byte elements, choosing a child reads exactly one line
+#define BINARY_HEAP_CACHE_LINE_SIZE 64
+
+#define BINARY_HEAP_NO_POSITION SIZE_MAX
+
+typedef struct
+{
+    size_t size;
+    DropFn drop;
+    CmpFn cmp;
+} BinaryHeapElementProps;
+
+// Stable name for an element of a heap made with BinaryHeap_with_handles, valid until the element is popped or removed
+// after which it may be handed out again
+typedef size_t BinaryHeapHandle;
+
+typedef struct
+{
+    Vec *buffer;
+    BinaryHeapElementProps element_props;
+    size_t arity;
+    // with handles, every slot holds the element followed by its handle, and positions maps handles to heap indices
+    bool has_handles;
+    size_t slot_size;
+    size_t handle_offset;
+    Vec positions;
+    Vec free_handles;
+    // inverts the order so that the smallest element is on top, used by BinaryHeap_top_k
+    bool is_min;
+} BinaryHeap;
+
+static void *_BinaryHeap_get(const BinaryHeap *this, size_t i)
+{
+    return Vec_get_mut(this->buffer, this->arity - 1 + i);
+}
+
+static int_fast8_t _BinaryHeap_cmp(const BinaryHeap *this, const void *a, const void *b)
+{
+    return this->is_min ? this->element_props.cmp(b, a) : this->element_props.cmp(a, b);
+}
+
+static BinaryHeapHandle _BinaryHeap_handle_of(const BinaryHeap *this, const void *slot)
+{
+    BinaryHeapHandle handle;
+    memcpy(&handle, (const uint8_t *)slot + this->handle_offset, sizeof(handle));
+
+    return handle;
+}
+
+// Stores a slot at index i, keeping the position of its handle up to date
+static void _BinaryHeap_set(BinaryHeap *this, size_t i, const void *slot)
+{
+    memcpy(_BinaryHeap_get(this, i), slot, this->slot_size);
+
+    if (this->has_handles)
+    {
+        *(size_t *)Vec_get_mut(&this->positions, _BinaryHeap_handle_of(this, slot)) = i;
+    }
+}
+
+// Grows the buffer by doubling into cache line aligned allocations, the Vec never reallocates on its own
+static void _BinaryHeap_reserve(BinaryHeap *this, size_t additional)
+{
+    Vec *buffer = this->buffer;
+    size_t required = Vec_len(buffer) + additional;
+
+    if (required <= Vec_capacity(buffer))
+    {
+        return;
+    }
+
+    size_t new_capacity = MAX(Vec_capacity(buffer) * 2, required);
+    size_t bytes = ROUND_SIZE_UP_TO_ALIGN(new_capacity * this->slot_size, BINARY_HEAP_CACHE_LINE_SIZE);
+    void *data = aligned_alloc(BINARY_HEAP_CACHE_LINE_SIZE, bytes);
+
+    if (Vec_len(buffer) > 0)
+    {
+        memcpy(data, buffer->data, Vec_len(buffer) * this->slot_size);
+    }
+
+    free(buffer->data);
+    buffer->data = data;
+    buffer->capacity = bytes / this->slot_size;
+}
+
+static void _BinaryHeap_init(BinaryHeap *this, const BinaryHeapElementProps *element_props, size_t arity, bool has_handles)
+{
+    assert(arity >= 2 && element_props->size > 0);
+
+    this->element_props = *element_props;
+    this->arity = arity;
+    this->has_handles = has_handles;
+    this->is_min = false;
+    this->handle_offset = ROUND_SIZE_UP_TO_ALIGN(element_props->size, _Alignof(BinaryHeapHandle));
+    this->slot_size = has_handles ? ROUND_SIZE_UP_TO_MAX_ALIGN(this->handle_offset + sizeof(BinaryHeapHandle)) : element_props->size;
+
+    // elements are dropped by the heap, the Vec also holds the unused leading slots
+    this->buffer = malloc(sizeof(*this->buffer));
+    Vec_new(this->buffer, this->slot_size, NULL);
+
+    _BinaryHeap_reserve(this, arity - 1);
+    Vec_set_len(this->buffer, arity - 1);
+
+    Vec_new(&this->positions, sizeof(size_t), NULL);
+    Vec_new(&this->free_handles, sizeof(BinaryHeapHandle), NULL);
+}
+
+void BinaryHeap_with_arity(BinaryHeap *this, const BinaryHeapElementProps *element_props, size_t arity)
+{
+    _BinaryHeap_init(this, element_props, arity, false);
+}
+
+void BinaryHeap_new(BinaryHeap *this, const BinaryHeapElementProps *element_props)
+{
+    BinaryHeap_with_arity(this, element_props, 2);
+}
+
+// An addressable heap: pushing returns a handle through which the element can later be read, re-prioritized or
+// removed in O(log n)
+void BinaryHeap_with_handles(BinaryHeap *this, const BinaryHeapElementProps *element_props, size_t arity)
+{
+    _BinaryHeap_init(this, element_props, arity, true);
+}
+
+size_t BinaryHeap_len(const BinaryHeap *this)
+{
+    return Vec_len(this->buffer) - (this->arity - 1);
+}
+
+// Moves parents down into the hole at i until slot fits there, then stores slot in it
+static void _BinaryHeap_sift_up(BinaryHeap *this, size_t i, const void *slot)
+{
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / this->arity;
+        void *parent_slot = _BinaryHeap_get(this, parent);
+
+        if (_BinaryHeap_cmp(this, slot, parent_slot) <= 0)
+        {
+            break;
+        }
+
+        _BinaryHeap_set(this, i, parent_slot);
+        i = parent;
+    }
+
+    _BinaryHeap_set(this, i, slot);
+}
+
+// Moves the largest child up into the hole at i until slot fits there, then stores slot in it
+static void _BinaryHeap_sift_down(BinaryHeap *this, size_t i, const void *slot)
+{
+    size_t length = BinaryHeap_len(this);
+
+    while (true)
+    {
+        size_t first = this->arity * i + 1;
+        if (first >= length)
+        {
+            break;
+        }
+
+        size_t end = MIN(first + this->arity, length);
+        size_t largest = first;
+
+        for (size_t child = first + 1; child < end; child++)
+        {
+            if (_BinaryHeap_cmp(this, _BinaryHeap_get(this, child), _BinaryHeap_get(this, largest)) > 0)
+            {
+                largest = child;
+            }
+        }
+
+        void *largest_slot = _BinaryHeap_get(this, largest);
+        if (_BinaryHeap_cmp(this, largest_slot, slot) <= 0)
+        {
+            break;
+        }
+
+        _BinaryHeap_set(this, i, largest_slot);
+        i = largest;
+    }
+
+    _BinaryHeap_set(this, i, slot);
+}
+
+const void *BinaryHeap_peek(const BinaryHeap *this)
+{
+    if (BinaryHeap_len(this) == 0)
+    {
+        return NULL;
+    }
+    else
+    {
+        return _BinaryHeap_get(this, 0);
+    }
+}
+
+void *BinaryHeap_peek_mut(BinaryHeap *this)
+{
+    return (void *)BinaryHeap_peek(this);
+}
+
+BinaryHeapHandle BinaryHeap_push_with_handle(BinaryHeap *this, const void *value)
+{
+    assert(this->has_handles);
+
+    BinaryHeapHandle handle = Vec_len(&this->positions);
+    if (Vec_len(&this->free_handles) > 0)
+    {
+        handle = *(BinaryHeapHandle *)Vec_get(&this->free_handles, Vec_len(&this->free_handles) - 1);
+        Vec_pop(&this->free_handles);
+    }
+    else
+    {
+        size_t position = BINARY_HEAP_NO_POSITION;
+        Vec_push(&this->positions, &position);
+    }
+
+    uint8_t slot[this->slot_size];
+    memcpy(slot, value, this->element_props.size);
+    memcpy(slot + this->handle_offset, &handle, sizeof(handle));
+
+    _BinaryHeap_reserve(this, 1);
+
+    size_t i = BinaryHeap_len(this);
+    Vec_set_len(this->buffer, Vec_len(this->buffer) + 1);
+
+    _BinaryHeap_sift_up(this, i, slot);
+
+    return handle;
+}
+
+void BinaryHeap_push(BinaryHeap *this, const void *value)
+{
+    if (this->has_handles)
+    {
+        BinaryHeap_push_with_handle(this, value);
+        return;
+    }
+
+    _BinaryHeap_reserve(this, 1);
+
+    size_t i = BinaryHeap_len(this);
+    Vec_set_len(this->buffer, Vec_len(this->buffer) + 1);
+
+    _BinaryHeap_sift_up(this, i, value);
+}
+
+// Drops the element at index i and fills the hole with the last element
+static void _BinaryHeap_remove_at(BinaryHeap *this, size_t i)
+{
+    void *slot = _BinaryHeap_get(this, i);
+
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(slot);
+    }
+
+    if (this->has_handles)
+    {
+        BinaryHeapHandle handle = _BinaryHeap_handle_of(this, slot);
+        *(size_t *)Vec_get_mut(&this->positions, handle) = BINARY_HEAP_NO_POSITION;
+        Vec_push(&this->free_handles, &handle);
+    }
+
+    size_t last = BinaryHeap_len(this) - 1;
+    Vec_set_len(this->buffer, Vec_len(this->buffer) - 1);
+
+    // the last element is moved into the hole, its old slot stays untouched while sifting
+    if (i == last)
+    {
+        return;
+    }
+
+    void *last_slot = _BinaryHeap_get(this, last);
+    if (i > 0 && _BinaryHeap_cmp(this, last_slot, _BinaryHeap_get(this, (i - 1) / this->arity)) > 0)
+    {
+        _BinaryHeap_sift_up(this, i, last_slot);
+    }
+    else
+    {
+        _BinaryHeap_sift_down(this, i, last_slot);
+    }
+}
+
+void BinaryHeap_pop(BinaryHeap *this)
+{
+    if (BinaryHeap_len(this) > 0)
+    {
+        _BinaryHeap_remove_at(this, 0);
+    }
+}
+
+static size_t _BinaryHeap_position(const BinaryHeap *this, BinaryHeapHandle handle)
+{
+    assert(this->has_handles && handle < Vec_len(&this->positions));
+
+    size_t position = *(const size_t *)Vec_get(&this->positions, handle);
+    assert(position != BINARY_HEAP_NO_POSITION);
+
+    return position;
+}
+
+const void *BinaryHeap_get(const BinaryHeap *this, BinaryHeapHandle handle)
+{
+    return _BinaryHeap_get(this, _BinaryHeap_position(this, handle));
+}
+
+BinaryHeapHandle BinaryHeap_peek_handle(const BinaryHeap *this)
+{
+    assert(this->has_handles && BinaryHeap_len(this) > 0);
+
+    return _BinaryHeap_handle_of(this, _BinaryHeap_get(this, 0));
+}
+
+// Replaces the element of handle with a value that compares greater or equal, moving it towards the top
+void BinaryHeap_increase_key(BinaryHeap *this, BinaryHeapHandle handle, const void *value)
+{
+    size_t i = _BinaryHeap_position(this, handle);
+    uint8_t slot[this->slot_size];
+
+    assert(_BinaryHeap_cmp(this, value, _BinaryHeap_get(this, i)) >= 0);
+
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(_BinaryHeap_get(this, i));
+    }
+
+    memcpy(slot, value, this->element_props.size);
+    memcpy(slot + this->handle_offset, &handle, sizeof(handle));
+
+    _BinaryHeap_sift_up(this, i, slot);
+}
+
+// Replaces the element of handle with a value that compares less or equal, moving it towards the bottom
+void BinaryHeap_decrease_key(BinaryHeap *this, BinaryHeapHandle handle, const void *value)
+{
+    size_t i = _BinaryHeap_position(this, handle);
+    uint8_t slot[this->slot_size];
+
+    assert(_BinaryHeap_cmp(this, value, _BinaryHeap_get(this, i)) <= 0);
+
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(_BinaryHeap_get(this, i));
+    }
+
+    memcpy(slot, value, this->element_props.size);
+    memcpy(slot + this->handle_offset, &handle, sizeof(handle));
+
+    _BinaryHeap_sift_down(this, i, slot);
+}
+
+void BinaryHeap_remove(BinaryHeap *this, BinaryHeapHandle handle)
+{
+    _BinaryHeap_remove_at(this, _BinaryHeap_position(this, handle));
+}
+
+// Floyd's bottom-up heapify: sifting down every parent from the last one up is O(n) in total
+static void _BinaryHeap_heapify(BinaryHeap *this)
+{
+    size_t length = BinaryHeap_len(this);
+    if (length < 2)
+    {
+        return;
+    }
+
+    uint8_t slot[this->slot_size];
+
+    for (size_t i = (length - 2) / this->arity + 1; i > 0; i--)
+    {
+        memcpy(slot, _BinaryHeap_get(this, i - 1), this->slot_size);
+        _BinaryHeap_sift_down(this, i - 1, slot);
+    }
+}
+
+// Builds a heap out of the elements of vec in O(n), leaving vec empty. The elements are moved, so vec's element drop
+// should match element_props.drop
+void BinaryHeap_from_vec(BinaryHeap *this, const BinaryHeapElementProps *element_props, size_t arity, Vec *vec)
+{
+    assert(vec->element_size == element_props->size);
+
+    BinaryHeap_with_arity(this, element_props, arity);
+
+    size_t length = Vec_len(vec);
+    if (length > 0)
+    {
+        _BinaryHeap_reserve(this, length);
+        memcpy(_BinaryHeap_get(this, 0), Vec_get(vec, 0), length * this->slot_size);
+        Vec_set_len(this->buffer, Vec_len(this->buffer) + length);
+        Vec_set_len(vec, 0);
+    }
+
+    _BinaryHeap_heapify(this);
+}
+
+// Moves all elements of other into this heap, leaving other empty. Rebuilds the heap in O(n + m) when that is expected
+// to be cheaper than sifting up each of the m new elements
+void BinaryHeap_append(BinaryHeap *this, BinaryHeap *other)
+{
+    assert(!this->has_handles && !other->has_handles && this->slot_size == other->slot_size);
+
+    size_t length = BinaryHeap_len(this);
+    size_t other_length = BinaryHeap_len(other);
+    if (other_length == 0)
+    {
+        return;
+    }
+
+    _BinaryHeap_reserve(this, other_length);
+    memcpy(_BinaryHeap_get(this, length), _BinaryHeap_get(other, 0), other_length * this->slot_size);
+    Vec_set_len(other->buffer, other->arity - 1);
+
+    size_t log_length = 0;
+    for (size_t n = length; n > 1; n /= this->arity)
+    {
+        log_length++;
+    }
+
+    if (2 * (length + other_length) < other_length * log_length)
+    {
+        Vec_set_len(this->buffer, Vec_len(this->buffer) + other_length);
+        _BinaryHeap_heapify(this);
+        return;
+    }
+
+    uint8_t slot[this->slot_size];
+
+    for (size_t i = length; i < length + other_length; i++)
+    {
+        Vec_set_len(this->buffer, Vec_len(this->buffer) + 1);
+        memcpy(slot, _BinaryHeap_get(this, i), this->slot_size);
+        _BinaryHeap_sift_up(this, i, slot);
+    }
+}
+
+// Pushes value while keeping at most k elements: once full, value replaces the top if it compares less and is
+// otherwise dropped. Keeps the k smallest elements seen, which are the k largest under a reversed cmp
+void BinaryHeap_push_bounded(BinaryHeap *this, const void *value, size_t k)
+{
+    assert(!this->has_handles && k > 0);
+
+    if (BinaryHeap_len(this) < k)
+    {
+        BinaryHeap_push(this, value);
+        return;
+    }
+
+    void *top = _BinaryHeap_get(this, 0);
+
+    if (_BinaryHeap_cmp(this, value, top) >= 0)
+    {
+        if (this->element_props.drop)
+        {
+            this->element_props.drop((void *)value);
+        }
+
+        return;
+    }
+
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(top);
+    }
+
+    _BinaryHeap_sift_down(this, 0, value);
+}
+
+void BinaryHeap_drop(BinaryHeap *this)
+{
+    if (this->element_props.drop)
+    {
+        for (size_t i = 0; i < BinaryHeap_len(this); i++)
+        {
+            this->element_props.drop(_BinaryHeap_get(this, i));
+        }
+    }
+
+    Vec_drop(this->buffer);
+    free(this->buffer);
+
+    Vec_drop(&this->positions);
+    Vec_drop(&this->free_handles);
+}
+
+// Heapsorts the elements in place and hands the buffer over to out, sorted ascending by cmp. Consumes the heap
+void BinaryHeap_into_sorted_vec(BinaryHeap *this, Vec *out)
+{
+    size_t length = BinaryHeap_len(this);
+    uint8_t slot[this->slot_size];
+
+    // the top moves to the end of the shrinking heap, and the element it displaces sifts down from the root
+    for (size_t end = length; end > 1; end--)
+    {
+        memcpy(slot, _BinaryHeap_get(this, end - 1), this->slot_size);
+        memcpy(_BinaryHeap_get(this, end - 1), _BinaryHeap_get(this, 0), this->slot_size);
+        Vec_set_len(this->buffer, Vec_len(this->buffer) - 1);
+        _BinaryHeap_sift_down(this, 0, slot);
+    }
+
+    // the slots holding handles are narrowed down to the elements themselves
+    uint8_t *data = this->buffer->data;
+    for (size_t i = 0; i < length; i++)
+    {
+        memmove(data + i * this->element_props.size, data + (this->arity - 1 + i) * this->slot_size, this->element_props.size);
+    }
+
+    Vec_new(out, this->element_props.size, &(VecElementOps){.drop = this->element_props.drop});
+    out->data = data;
+    out->capacity = Vec_capacity(this->buffer) * this->slot_size / this->element_props.size;
+    out->length = length;
+
+    free(this->buffer);
+    Vec_drop(&this->positions);
+    Vec_drop(&this->free_handles);
+}
+
+// Collects copies of the k largest elements of iter into out, largest first, keeping only k elements at any time.
+// The copies are not dropped, so the elements must not own resources
+void BinaryHeap_top_k(const BinaryHeapElementProps *element_props, Iterator *iter, size_t k, Vec *out)
+{
+    if (k == 0)
+    {
+        Vec_new(out, element_props->size, NULL);
+        return;
+    }
+
+    BinaryHeap heap;
+    BinaryHeap_with_arity(&heap, &(BinaryHeapElementProps){.size = element_props->size, .cmp = element_props->cmp}, 4);
+    heap.is_min = true;
+
+    for (void *element = Iterator_next(iter); element != NULL; element = Iterator_next(iter))
+    {
+        BinaryHeap_push_bounded(&heap, element, k);
+    }
+
+    // sorted ascending in the inverted order, which is descending by cmp
+    BinaryHeap_into_sorted_vec(&heap, out);
+}
+
+// [TimerWheel]
+
+// A hierarchical timing wheel over integer ticks. Level l has 64 slots of 64^l ticks each, and a timer sits at the
+// level of the highest 6 bit group in which its deadline differs from the current tick. Reaching the start of a slot
+// above level 0 cascades its timers down, so each timer moves at most once per level, and a bitmap of occupied slots
+// per level lets advance skip straight to the next slot holding timers
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS ((64 + TIMER_WHEEL_SLOT_BITS - 1) / TIMER_WHEEL_SLOT_BITS)
+
+// Embedded in the caller's struct, which is recovered with CONTAINER_OF. The wheel never allocates or frees timers
+typedef struct
+{
+    LinkedListNode node;
+    uint64_t deadline;
+    // the intrusive slot list holding the timer, NULL once it expired or was cancelled
+    LinkedList *slot;
+} TimerWheelTimer;
+
+typedef struct
+{
+    uint64_t now;
+    size_t length;
+    LinkedList *slots;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+} TimerWheel;
+
+// Makes a timer that is not pending, so that cancelling it before it was ever inserted is harmless
+void TimerWheelTimer_new(TimerWheelTimer *this)
+{
+    this->slot = NULL;
+}
+
+void TimerWheel_new(TimerWheel *this, uint64_t now)
+{
+    this->now = now;
+    this->length = 0;
+    this->slots = malloc(TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS * sizeof(LinkedList));
+
+    for (size_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++)
+    {
+        LinkedList_new_intrusive(&this->slots[i]);
+    }
+
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        this->occupied[level] = 0;
+    }
+}
+
+size_t TimerWheel_len(const TimerWheel *this)
+{
+    return this->length;
+}
+
+uint64_t TimerWheel_now(const TimerWheel *this)
+{
+    return this->now;
+}
+
+// Start of the block of 64 slots that contains tick at the given level
+static uint64_t _TimerWheel_block_start(uint64_t tick, size_t level)
+{
+    size_t shift = (level + 1) * TIMER_WHEEL_SLOT_BITS;
+    return shift >= 64 ? 0 : tick >> shift << shift;
+}
+
+static size_t _TimerWheel_slot_index(uint64_t tick, size_t level)
+{
+    return (tick >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+// Links timer into the slot for tick, which must not be before now
+static void _TimerWheel_place(TimerWheel *this, TimerWheelTimer *timer, uint64_t tick)
+{
+    uint64_t differing = tick ^ this->now;
+    size_t level = differing == 0 ? 0 : (size_t)(63 - __builtin_clzll(differing)) / TIMER_WHEEL_SLOT_BITS;
+    size_t index = _TimerWheel_slot_index(tick, level);
+
+    timer->slot = &this->slots[level * TIMER_WHEEL_SLOTS + index];
+    LinkedList_push_back_node(timer->slot, &timer->node);
+    this->occupied[level] |= (uint64_t)1 << index;
+}
+
+// Schedules a timer that is not pending, made with TimerWheelTimer_new or already expired or cancelled. A deadline that is not after now is due on the next tick
+void TimerWheel_insert(TimerWheel *this, TimerWheelTimer *timer, uint64_t deadline)
+{
+    timer->deadline = deadline;
+    _TimerWheel_place(this, timer, deadline > this->now ? deadline : this->now + 1);
+    this->length++;
+}
+
+// Unschedules a pending timer in O(1). Returns false when the timer already expired or was cancelled
+bool TimerWheel_cancel(TimerWheel *this, TimerWheelTimer *timer)
+{
+    if (timer->slot == NULL)
+    {
+        return false;
+    }
+
+    LinkedList_unlink_node(timer->slot, &timer->node);
+
+    if (LinkedList_len(timer->slot) == 0)
+    {
+        size_t i = (size_t)(timer->slot - this->slots);
+        this->occupied[i / TIMER_WHEEL_SLOTS] &= ~((uint64_t)1 << (i % TIMER_WHEEL_SLOTS));
+    }
+
+    timer->slot = NULL;
+    this->length--;
+
+    return true;
+}
+
+// Earliest tick after now at which a slot holding timers starts, or now when the wheel is empty. A candidate at a lower
+// level always lies in the current block of the level above, so the first level with one wins
+static uint64_t _TimerWheel_next_event(const TimerWheel *this)
+{
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        size_t current = _TimerWheel_slot_index(this->now, level);
+        uint64_t later = current == TIMER_WHEEL_SLOTS - 1 ? 0 : this->occupied[level] & (~(uint64_t)0 << (current + 1));
+
+        if (later != 0)
+        {
+            uint64_t index = (uint64_t)__builtin_ctzll(later);
+            return _TimerWheel_block_start(this->now, level) | index << (level * TIMER_WHEEL_SLOT_BITS);
+        }
+    }
+
+    return this->now;
+}
+
+// Moves the whole slot list out of the wheel and clears its occupied bit
+static void _TimerWheel_take_slot(TimerWheel *this, size_t level, size_t index, LinkedList *out)
+{
+    LinkedList_new_intrusive(out);
+    LinkedList_append(out, &this->slots[level * TIMER_WHEEL_SLOTS + index]);
+    this->occupied[level] &= ~((uint64_t)1 << index);
+}
+
+// Moves every timer with a deadline up to now to the back of expired, an intrusive list, in deadline order. Timers with
+// the same deadline keep the order in which they were inserted unless they cascaded down from different slots
+void TimerWheel_advance(TimerWheel *this, uint64_t now, LinkedList *expired)
+{
+    assert(now >= this->now && expired->is_intrusive);
+
+    while (this->length > 0)
+    {
+        uint64_t tick = _TimerWheel_next_event(this);
+        if (tick == this->now || tick > now)
+        {
+            break;
+        }
+
+        this->now = tick;
+
+        // top down, since a higher slot can cascade into the lower slot starting at the same tick
+        for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            size_t index = _TimerWheel_slot_index(tick, level);
+            bool is_slot_start = (tick & (((uint64_t)1 << (level * TIMER_WHEEL_SLOT_BITS)) - 1)) == 0;
+
+            if (is_slot_start && (this->occupied[level] & ((uint64_t)1 << index)))
+            {
+                LinkedList cascading;
+                _TimerWheel_take_slot(this, level, index, &cascading);
+
+                while (LinkedList_len(&cascading) > 0)
+                {
+                    LinkedListNode *node = LinkedList_front_node(&cascading);
+                    LinkedList_unlink_node(&cascading, node);
+
+                    // a timer inserted with a deadline that already passed is due at this tick
+                    TimerWheelTimer *timer = CONTAINER_OF(node, TimerWheelTimer, node);
+                    _TimerWheel_place(this, timer, timer->deadline > tick ? timer->deadline : tick);
+                }
+            }
+        }
+
+        size_t index = _TimerWheel_slot_index(tick, 0);
+        if (this->occupied[0] & ((uint64_t)1 << index))
+        {
+            LinkedList due;
+            _TimerWheel_take_slot(this, 0, index, &due);
+
+            for (LinkedListNode *node = LinkedList_front_node(&due); node != NULL; node = node->next)
+            {
+                CONTAINER_OF(node, TimerWheelTimer, node)->slot = NULL;
+            }
+
+            this->length -= LinkedList_len(&due);
+            LinkedList_append(expired, &due);
+        }
+    }
+
+    this->now = now;
+}
+
+// Pending timers are forgotten, they belong to the caller
+void TimerWheel_drop(TimerWheel *this)
+{
+    free(this->slots);
+}
+
+// [RadixHeap]
+
+// A monotone min-priority queue over uint64_t keys: a pushed key must not be smaller than the last popped one. Bucket 0
+// holds keys equal to that last key and bucket b the keys whose highest bit differing from it is b - 1. Popping from an
+// empty bucket 0 finds the new minimum in the lowest non-empty bucket and spreads that bucket over lower ones, so every
+// element moves down at most 64 times and push and pop never compare keys against each other. Peeking leaves the buckets
+// as they are, so it does not raise the bound for pushes
+#define RADIX_HEAP_BUCKETS 65
+
+typedef struct
+{
+    size_t size;
+    DropFn drop;
+} RadixHeapElementProps;
+
+typedef struct
+{
+    // entries are the key followed by the value, padded to 8 bytes, so values must not need more alignment than that
+    Vec buckets[RADIX_HEAP_BUCKETS];
+    RadixHeapElementProps element_props;
+    uint64_t last;
+    size_t length;
+    // where peek found the minimum while bucket 0 was empty, kept up to date by pushes until the next pop. Bucket 0
+    // when there is none
+    size_t peeked_bucket;
+    size_t peeked_index;
+} RadixHeap;
+
+void RadixHeap_new(RadixHeap *this, const RadixHeapElementProps *element_props)
+{
+    this->element_props = *element_props;
+    this->last = 0;
+    this->length = 0;
+    this->peeked_bucket = 0;
+
+    size_t entry_size = sizeof(uint64_t) + ROUND_SIZE_UP_TO_ALIGN(element_props->size, sizeof(uint64_t));
+    for (size_t i = 0; i < RADIX_HEAP_BUCKETS; i++)
+    {
+        Vec_new(&this->buckets[i], entry_size, NULL);
+    }
+}
+
+size_t RadixHeap_len(const RadixHeap *this)
+{
+    return this->length;
+}
+
+static size_t _RadixHeap_bucket(const RadixHeap *this, uint64_t key)
+{
+    return key == this->last ? 0 : (size_t)(64 - __builtin_clzll(key ^ this->last));
+}
+
+void RadixHeap_push(RadixHeap *this, uint64_t key, const void *value)
+{
+    assert(key >= this->last);
+
+    size_t b = _RadixHeap_bucket(this, key);
+    Vec *bucket = &this->buckets[b];
+    uint8_t entry[bucket->element_size];
+    memcpy(entry, &key, sizeof(uint64_t));
+    memcpy(entry + sizeof(uint64_t), value, this->element_props.size);
+    Vec_push(bucket, entry);
+
+    if (this->peeked_bucket != 0 && key < *(const uint64_t *)Vec_get(&this->buckets[this->peeked_bucket], this->peeked_index))
+    {
+        this->peeked_bucket = b;
+        this->peeked_index = Vec_len(bucket) - 1;
+    }
+
+    this->length++;
+}
+
+// Refills bucket 0 from the lowest non-empty bucket, whose minimum is known if it was peeked at. Every key in bucket b
+// agrees with the new minimum above bit b - 1, so they all land in buckets below b
+static void _RadixHeap_refill(RadixHeap *this)
+{
+    size_t b = 1;
+    while (Vec_len(&this->buckets[b]) == 0)
+    {
+        b++;
+    }
+
+    Vec *bucket = &this->buckets[b];
+    uint64_t minimum = UINT64_MAX;
+
+    if (this->peeked_bucket == b)
+    {
+        minimum = *(const uint64_t *)Vec_get(bucket, this->peeked_index);
+    }
+    else
+    {
+        for (size_t i = 0; i < Vec_len(bucket); i++)
+        {
+            minimum = MIN(minimum, *(const uint64_t *)Vec_get(bucket, i));
+        }
+    }
+
+    this->last = minimum;
+
+    for (size_t i = 0; i < Vec_len(bucket); i++)
+    {
+        const void *entry = Vec_get(bucket, i);
+        Vec_push(&this->buckets[_RadixHeap_bucket(this, *(const uint64_t *)entry)], entry);
+    }
+
+    Vec_set_len(bucket, 0);
+}
+
+// Returns the value with the smallest key and stores that key in key, or NULL when the heap is empty. Not const, as
+// it remembers where the minimum is for the next peek. With bucket 0 empty, the first peek after a pop scans the
+// lowest non-empty bucket
+void *RadixHeap_peek(RadixHeap *this, uint64_t *key)
+{
+    if (this->length == 0)
+    {
+        return NULL;
+    }
+
+    if (Vec_len(&this->buckets[0]) > 0)
+    {
+        *key = this->last;
+        return (uint8_t *)Vec_get_mut(&this->buckets[0], Vec_len(&this->buckets[0]) - 1) + sizeof(uint64_t);
+    }
+
+    if (this->peeked_bucket == 0)
+    {
+        size_t b = 1;
+        while (Vec_len(&this->buckets[b]) == 0)
+        {
+            b++;
+        }
+
+        Vec *bucket = &this->buckets[b];
+        this->peeked_bucket = b;
+        this->peeked_index = 0;
+        for (size_t i = 1; i < Vec_len(bucket); i++)
+        {
+            if (*(const uint64_t *)Vec_get(bucket, i) < *(const uint64_t *)Vec_get(bucket, this->peeked_index))
+            {
+                this->peeked_index = i;
+            }
+        }
+    }
+
+    uint8_t *entry = Vec_get_mut(&this->buckets[this->peeked_bucket], this->peeked_index);
+    memcpy(key, entry, sizeof(uint64_t));
+    return entry + sizeof(uint64_t);
+}
+
+void RadixHeap_pop(RadixHeap *this)
+{
+    if (this->length == 0)
+    {
+        return;
+    }
+
+    if (Vec_len(&this->buckets[0]) == 0)
+    {
+        // of several entries with the smallest key, the one peeked at has to be popped. The refill moves the bucket's
+        // entries down in order, so the last one ends up on top of bucket 0
+        if (this->peeked_bucket != 0)
+        {
+            Vec *bucket = &this->buckets[this->peeked_bucket];
+            uint8_t *peeked = Vec_get_mut(bucket, this->peeked_index);
+            uint8_t *last = Vec_get_mut(bucket, Vec_len(bucket) - 1);
+            uint8_t entry[bucket->element_size];
+            memcpy(entry, peeked, bucket->element_size);
+            memcpy(peeked, last, bucket->element_size);
+            memcpy(last, entry, bucket->element_size);
+            this->peeked_index = Vec_len(bucket) - 1;
+        }
+
+        _RadixHeap_refill(this);
+        this->peeked_bucket = 0;
+    }
+
+    void *value = (uint8_t *)Vec_get_mut(&this->buckets[0], Vec_len(&this->buckets[0]) - 1) + sizeof(uint64_t);
+
+    if (this->element_props.drop)
+    {
+        this->element_props.drop(value);
+    }
+
+    Vec_set_len(&this->buckets[0], Vec_len(&this->buckets[0]) - 1);
+    this->length--;
+}
+
+void RadixHeap_drop(RadixHeap *this)
+{
+    for (size_t i = 0; i < RADIX_HEAP_BUCKETS; i++)
+    {
+        Vec *bucket = &this->buckets[i];
+        if (this->element_props.drop)
+        {
+            for (size_t j = 0; j < Vec_len(bucket); j++)
+            {
+                this->element_props.drop((uint8_t *)Vec_get_mut(bucket, j) + sizeof(uint64_t));
+            }
+        }
+
+        Vec_drop(bucket);
+    }
+}
+
+// [Hasher]
+
+typedef void (*HasherResetFn)(void *this);
+typedef void (*HasherWriteFn)(void *this, const void *data, size_t length);
+typedef uint64_t (*HasherFinishFn)(const void *this);
+
+typedef struct
+{
+    size_t size;
+    HasherResetFn reset;
+    HasherWriteFn write;
+    HasherFinishFn finish;
+    DropFn drop;
+} HasherProps;
+
+typedef struct
+{
+    void *concrete_hasher;
+    HasherProps props;
+} Hasher;
+
+void Hasher_new(Hasher *this, const HasherProps *props, const void *concrete_hasher)
+{
+    this->props = *props;
+
+    this->concrete_hasher = malloc(this->props.size);
+    memcpy(this->concrete_hasher, concrete_hasher, this->props.size);
+}
+
+void Hasher_reset(Hasher *this)
+{
+    this->props.reset(this->concrete_hasher);
+}
+
+void Hasher_write(Hasher *this, const void *data, size_t length)
+{
+    this->props.write(this->concrete_hasher, data, length);
+}
+
+uint64_t Hasher_finish(const Hasher *this)
+{
+    return this->props.finish(this->concrete_hasher);
+}
+
+void Hasher_drop(Hasher *this)
+{
+    if (this->props.drop != NULL)
+    {
+        this->props.drop(this->concrete_hasher);
+    }
+
+    free(this->concrete_hasher);
+}
+
+// [SimpleHasher]
+
+typedef struct
+{
+    uint64_t state;
+} SimpleHasher;
+
+void SimpleHasher_reset(SimpleHasher *this)
+{
+    this->state = 0;
+}
+
+void SimpleHasher_write(SimpleHasher *this, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        this->state += bytes[i];
+    }
+}
+
+uint64_t SimpleHasher_finish(const SimpleHasher *this)
+{
+    return this->state;
+}
+
+// [HashMap]
+
+typedef void (*HashFn)(const void *key, Hasher *hasher);
+
+typedef struct
+{
+    bool is_empty;
+    size_t probe_length;
+} _HashMapEntry;
+
+typedef struct
+{
+    size_t size;
+    EqFn eq;
+    HashFn hash;
+    DropFn drop;
+} HashMapKeyProps;
+
+typedef struct
+{
+    size_t size;
+    DropFn drop;
+} HashMapValueProps;
+
+typedef struct
+{
+    size_t length;
+    size_t capacity;
+    void *entries;
+    HashMapKeyProps key_props;
+    HashMapValueProps value_props;
+    Hasher hasher;
+} HashMap;
+
+void *_HashMapEntry_key(_HashMapEntry *this)
+{
+    return (uint8_t *)(this) + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_HashMapEntry));
+}
+
+void *_HashMapEntry_value(_HashMapEntry *this, const HashMap *map)
+{
+    return (uint8_t *)(_HashMapEntry_key(this)) + ROUND_SIZE_UP_TO_MAX_ALIGN(map->key_props.size);
+}
+
+void _HashMapEntry_new(_HashMapEntry *this, const void *key, const void *value, const HashMap *map)
+{
+    memcpy(_HashMapEntry_key(this), key, map->key_props.size);
+    memcpy(_HashMapEntry_value(this, map), value, map->value_props.size);
+
+    this->is_empty = false;
+    this->probe_length = 0;
+}
+
+size_t _HashMap_entry_size(const HashMap *this)
+{
+    return ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_HashMapEntry)) + ROUND_SIZE_UP_TO_MAX_ALIGN(this->key_props.size) + ROUND_SIZE_UP_TO_MAX_ALIGN(this->value_props.size);
+}
+
+_HashMapEntry *_HashMap_entry_at(const HashMap *this, size_t i)
+{
+    return (_HashMapEntry *)((uint8_t *)(this->entries) + (i * _HashMap_entry_size(this)));
+}
+
+void HashMap_with_capacity_and_hasher(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props, size_t capacity, const Hasher *hasher)
+{
+    this->key_props = *key_props;
+    this->value_props = *value_props;
+    this->hasher = *hasher;
+
+    this->length = 0;
+
+    this->capacity = capacity;
+    const size_t entry_size = _HashMap_entry_size(this);
+    this->entries = malloc(this->capacity * entry_size);
+
+    for (size_t i = 0; i < this->capacity; i++)
+    {
+        _HashMap_entry_at(this, i)->is_empty = true;
+    }
+}
+
+size_t HashMap_len(const HashMap *this)
+{
+    return this->length;
+}
+
+size_t HashMap_capacity(const HashMap *this)
+{
+    return this->capacity;
+}
+
+void HashMap_insert(HashMap *this, void *key, void *value);
+
+static void _HashMap_grow(HashMap *this)
+{
+    void *old_entries = this->entries;
+    size_t old_length = this->length;
+
+    HashMap_with_capacity_and_hasher(this, &this->key_props, &this->value_props, this->capacity * 2, &this->hasher);
+
+    size_t i = 0;
+
+    while (old_length > 0)
+    {
+        _HashMapEntry *entry = (_HashMapEntry *)((uint8_t *)(old_entries) + (i * _HashMap_entry_size(this)));
+
+        if (!entry->is_empty)
+        {
+            HashMap_insert(this, _HashMapEntry_key(entry), _HashMapEntry_value(entry, this));
+            old_length--;
+        }
+    }
+
+    free(old_entries);
+}
+
+static float _HashMap_load_factor(const HashMap *this)
+{
+    return this->length / (float)(this->capacity);
+}
+
+static void _HashMap_swap(const HashMap *this, _HashMapEntry *a, _HashMapEntry *b)
+{
+    const size_t entry_size = _HashMap_entry_size(this);
+    uint8_t tmp[entry_size];
+
+    memcpy(tmp, a, entry_size);
+    memcpy(a, b, entry_size);
+    memcpy(b, tmp, entry_size);
+}
+
+void HashMap_insert(HashMap *this, void *key, void *value)
+{
+    if (_HashMap_load_factor(this) > 0.7)
+    {
+        _HashMap_grow(this);
+    }
+
+    Hasher_reset(&this->hasher);
+    this->key_props.hash(key, &this->hasher);
+
+    size_t slot = Hasher_finish(&this->hasher) % this->capacity;
+
+    uint8_t entry_buffer[_HashMap_entry_size(this)];
+    _HashMapEntry *entry = (_HashMapEntry *)entry_buffer;
+
+    _HashMapEntry_new(entry, key, value, this);
+
+    while (true)
+    {
+        _HashMapEntry *current_entry = _HashMap_entry_at(this, slot);
+
+        if (current_entry->is_empty)
+        {
+            memcpy(current_entry, entry, _HashMap_entry_size(this));
+            this->length++;
+            break;
+        }
+
+        if (this->key_props.eq(_HashMapEntry_key(entry), _HashMapEntry_key(current_entry)))
+        {
+            if (this->key_props.drop != NULL)
+            {
+                this->key_props.drop(_HashMapEntry_key(current_entry));
+            }
+
+            if (this->value_props.drop != NULL)
+            {
+                this->value_props.drop(_HashMapEntry_value(current_entry, this));
+            }
+
+            memcpy(_HashMapEntry_value(current_entry, this), _HashMapEntry_value(entry, this), ROUND_SIZE_UP_TO_MAX_ALIGN(this->value_props.size));
+            break;
+        }
+
+        if (current_entry->probe_length < entry->probe_length)
+        {
+            _HashMap_swap(this, entry, current_entry);
+        }
+
+        slot = (slot + 1) % this->capacity;
+        entry->probe_length++;
+    }
+}
+
+void HashMap_with_hasher(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props, const Hasher *hasher)
+{
+    const size_t INITIAL_CAPACITY = 16;
+    HashMap_with_capacity_and_hasher(this, key_props, value_props, INITIAL_CAPACITY, hasher);
+}
+
+void HashMap_new(HashMap *this, const HashMapKeyProps *key_props, const HashMapValueProps *value_props)
+{
+    HasherProps props = {
+        .size = sizeof(SimpleHasher),
+        .reset = (HasherResetFn)SimpleHasher_reset,
+        .write = (HasherWriteFn)SimpleHasher_write,
+        .finish = (HasherFinishFn)SimpleHasher_finish,
+    };
+    SimpleHasher hasher = {};
+
+    Hasher _hasher;
+    Hasher_new(&_hasher, &props, &hasher);
+
+    HashMap_with_hasher(this, key_props, value_props, &_hasher);
+}
+
+size_t _HashMap_get_entry(HashMap *this, void *key)
+{
+    size_t result = SIZE_MAX;
+
+    Hasher_reset(&this->hasher);
+    this->key_props.hash(key, &this->hasher);
+
+    size_t slot = Hasher_finish(&this->hasher) % this->capacity;
+    size_t probe_length = 0;
+
+    while (true)
+    {
+        _HashMapEntry *slot_entry = _HashMap_entry_at(this, slot);
+
+        if (slot_entry->is_empty)
+        {
+            break;
+        }
+
+        if (this->key_props.eq(key, _HashMapEntry_key(slot_entry)))
+        {
+            result = slot;
+            break;
+        }
+
+        if (slot_entry->probe_length < probe_length)
+        {
+            break;
+        }
+
+        slot = (slot + 1) % this->capacity;
+        probe_length++;
+    }
+
+    return result;
+}
+
+void *HashMap_get(HashMap *this, void *key)
+{
+    size_t result = _HashMap_get_entry(this, key);
+
+    if (result != SIZE_MAX)
+    {
+        return _HashMapEntry_value(_HashMap_entry_at(this, result), this);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+void HashMap_remove(HashMap *this, void *key)
+{
+    size_t slot = _HashMap_get_entry(this, key);
+    if (slot == SIZE_MAX)
+    {
+        return;
+    }
+
+    this->key_props.drop(_HashMapEntry_key(_HashMap_entry_at(this, slot)));
+
+    if (this->value_props.drop)
+    {
+        this->value_props.drop(_HashMapEntry_value(_HashMap_entry_at(this, slot), this));
+    }
+
+    this->length--;
+
+    size_t next_slot = (slot + 1) % this->capacity;
+
+    while (true)
+    {
+        _HashMapEntry *entry = _HashMap_entry_at(this, slot);
+        _HashMapEntry *next_entry = _HashMap_entry_at(this, next_slot);
+
+        if (next_entry->is_empty || next_entry->probe_length == 0)
+        {
+            entry->is_empty = true;
+            break;
+        }
+
+        memcpy(entry, next_entry, _HashMap_entry_size(this));
+        entry->probe_length--;
+
+        slot = next_slot;
+        next_slot = (next_slot + 1) % this->capacity;
+    }
+}
+
+void HashMap_drop(HashMap *this)
+{
+    for (size_t i = 0; i < this->capacity; i++)
+    {
+        _HashMapEntry *entry = _HashMap_entry_at(this, i);
+
+        if (!entry->is_empty)
+        {
+            this->key_props.drop(_HashMapEntry_key(entry));
+
+            if (this->value_props.drop != NULL)
+            {
+                this->value_props.drop(_HashMapEntry_value(entry, this));
+            }
+        }
+    }
+
+    Hasher_drop(&this->hasher);
+
+    free(this->entries);
+}
+
+// [HashSet]
+
+typedef struct
+{
+    size_t size;
+    EqFn eq;
+    HashFn hash;
+    DropFn drop;
+} HashSetElementProps;
+
+typedef struct
+{
+    HashMap *map;
+} HashSet;
+
+void HashSet_with_capacity_and_hasher(HashSet *this, const HashSetElementProps *element_props, size_t capacity, const Hasher *hasher)
+{
+    this->map = malloc(sizeof(*this->map));
+
+    HashMapKeyProps key_props = {
+        .size = element_props->size,
+        .eq = element_props->eq,
+        .hash = element_props->hash,
+        .drop = element_props->drop,
+    };
+    HashMapValueProps value_props = {
+        .size = sizeof(uint8_t),
+    };
+    HashMap_with_capacity_and_hasher(this->map, &key_props, &value_props, capacity, hasher);
+}
+
+void HashSet_with_hasher(HashSet *this, const HashSetElementProps *element_props, const Hasher *hasher)
+{
+    this->map = malloc(sizeof(*this->map));
+
+    HashMapKeyProps key_props = {
+        .size = element_props->size,
+        .eq = element_props->eq,
+        .hash = element_props->hash,
+        .drop = element_props->drop,
+    };
+    HashMapValueProps value_props = {
+        .size = sizeof(uint8_t),
+    };
+    HashMap_with_hasher(this->map, &key_props, &value_props, hasher);
+}
+
+void HashSet_new(HashSet *this, const HashSetElementProps *element_props)
+{
+    this->map = malloc(sizeof(*this->map));
+
+    HashMapKeyProps key_props = {
+        .size = element_props->size,
+        .eq = element_props->eq,
+        .hash = element_props->hash,
+        .drop = element_props->drop,
+    };
+    HashMapValueProps value_props = {
+        .size = sizeof(uint8_t),
+    };
+    HashMap_new(this->map, &key_props, &value_props);
+}
+
+void HashSet_insert(HashSet *this, void *element)
+{
+    uint8_t i = 0;
+    HashMap_insert(this->map, element, &i);
+}
+
+size_t HashSet_len(const HashSet *this)
+{
+    return HashMap_len(this->map);
+}
+
+size_t HashSet_capacity(const HashSet *this)
+{
+    return HashMap_capacity(this->map);
+}
+
+bool HashSet_contains(const HashSet *this, void *element)
+{
+    return HashMap_get(this->map, element) == NULL ? false : true;
+}
+
+// [HashSetUnionIter]
+
+typedef enum
+{
+    HASH_SET_UNION_ITER_PHASE_A,
+    HASH_SET_UNION_ITER_PHASE_B,
+    HASH_SET_UNION_ITER_PHASE_DONE,
+} HashSetUnionIterPhase;
+
+typedef struct
+{
+    const HashSet *a;
+    const HashSet *b;
+    HashSetUnionIterPhase phase;
+    size_t current;
+} HashSetUnionIter;
+
+void HashSetUnionIter_new(HashSetUnionIter *this, const HashSet *a, const HashSet *b)
+{
+    this->a = a;
+    this->b = b;
+
+    this->phase = HASH_SET_UNION_ITER_PHASE_A;
+    this->current = 0;
+}
+
+void *HashSetUnionIter_next(HashSetUnionIter *this)
+{
+    if (this->phase == HASH_SET_UNION_ITER_PHASE_DONE)
+    {
+        return NULL;
+    }
+
+    if (this->phase == HASH_SET_UNION_ITER_PHASE_A)
+    {
+        size_t i;
+        for (i = this->current; i < HashSet_capacity(this->a); i++)
+        {
+            _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+
+            if (!entry->is_empty)
+            {
+                break;
+            }
+        }
+
+        if (i == HashSet_capacity(this->a))
+        {
+            this->phase = HASH_SET_UNION_ITER_PHASE_B;
+            this->current = 0;
+        }
+        else
+        {
+            this->current = i + 1;
+            return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+        }
+    }
+
+    if (this->phase == HASH_SET_UNION_ITER_PHASE_B)
+    {
+        size_t i;
+        for (i = this->current; i < HashSet_capacity(this->b); i++)
+        {
+            _HashMapEntry *entry = _HashMap_entry_at(this->b->map, i);
+
+            if (!entry->is_empty && !HashSet_contains(this->a, _HashMapEntry_key(entry)))
+            {
+                break;
+            }
+        }
+
+        if (i == HashSet_capacity(this->b))
+        {
+            this->phase = HASH_SET_UNION_ITER_PHASE_DONE;
+        }
+        else
+        {
+            this->current = i + 1;
+            return _HashMapEntry_key(_HashMap_entry_at(this->b->map, i));
+        }
+    }
+
+    return NULL;
+}
+
+void HashSetUnionIter_drop(HashSetUnionIter *this)
+{
+}
+
+// [HashSetIntersectionIter]
+
+typedef struct
+{
+    const HashSet *a;
+    const HashSet *b;
+    size_t current;
+    bool is_done;
+} HashSetIntersectionIter;
+
+void HashSetIntersectionIter_new(HashSetIntersectionIter *this, const HashSet *a, const HashSet *b)
+{
+    this->a = a;
+    this->b = b;
+
+    this->current = 0;
+    this->is_done = false;
+}
+
+void *HashSetIntersectionIter_next(HashSetIntersectionIter *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    size_t i;
+    for (i = this->current; i < HashSet_capacity(this->a); i++)
+    {
+        _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+
+        if (!entry->is_empty && HashSet_contains(this->b, _HashMapEntry_key(entry)))
+        {
+            break;
+        }
+    }
+
+    if (i == HashSet_capacity(this->b))
+    {
+        this->is_done = true;
+        return NULL;
+    }
+    else
+    {
+        this->current = i + 1;
+        return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+    }
+}
+
+void HashSetIntersectionIter_drop(HashSetIntersectionIter *this)
+{
+}
+
+// [HashSetDifferenceIter]
+
+typedef struct
+{
+    const HashSet *a;
+    const HashSet *b;
+    size_t current;
+    bool is_done;
+} HashSetDifferenceIter;
+
+void HashSetDifferenceIter_new(HashSetDifferenceIter *this, const HashSet *a, const HashSet *b)
+{
+    this->a = a;
+    this->b = b;
+
+    this->current = 0;
+    this->is_done = false;
+}
+
+void *HashSetDifferenceIter_next(HashSetDifferenceIter *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    size_t i;
+    for (i = this->current; i < HashSet_capacity(this->a); i++)
+    {
+        _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+
+        if (!entry->is_empty && !HashSet_contains(this->b, _HashMapEntry_key(entry)))
+        {
+            break;
+        }
+    }
+
+    if (i == HashSet_capacity(this->b))
+    {
+        this->is_done = true;
+        return NULL;
+    }
+    else
+    {
+        this->current = i + 1;
+        return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+    }
+}
+
+void HashSetDifferenceIter_drop(HashSetDifferenceIter *this)
+{
+}
+
+// [HashSetSymmetricDifferenceIter]
+
+typedef enum
+{
+    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A,
+    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B,
+    HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE,
+} HashSetSymmetricDifferenceIterPhase;
+
+typedef struct
+{
+    const HashSet *a;
+    const HashSet *b;
+    HashSetSymmetricDifferenceIterPhase phase;
+    size_t current;
+} HashSetSymmetricDifferenceIter;
+
+void HashSetSymmetricDifferenceIter_new(HashSetSymmetricDifferenceIter *this, const HashSet *a, const HashSet *b)
+{
+    this->a = a;
+    this->b = b;
+
+    this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A;
+    this->current = 0;
+}
+
+void *HashSetSymmetricDifferenceIter_next(HashSetSymmetricDifferenceIter *this)
+{
+    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE)
+    {
+        return NULL;
+    }
+
+    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_A)
+    {
+        size_t i;
+        for (i = this->current; i < HashSet_capacity(this->a); i++)
+        {
+            _HashMapEntry *entry = _HashMap_entry_at(this->a->map, i);
+
+            if (!entry->is_empty && !HashSet_contains(this->b, _HashMapEntry_key(entry)))
+            {
+                break;
+            }
+        }
+
+        if (i == HashSet_capacity(this->a))
+        {
+            this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B;
+            this->current = 0;
+        }
+        else
+        {
+            this->current = i + 1;
+            return _HashMapEntry_key(_HashMap_entry_at(this->a->map, i));
+        }
+    }
+
+    if (this->phase == HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_B)
+    {
+        size_t i;
+        for (i = this->current; i < HashSet_capacity(this->b); i++)
+        {
+            _HashMapEntry *entry = _HashMap_entry_at(this->b->map, i);
+
+            if (!entry->is_empty && !HashSet_contains(this->a, _HashMapEntry_key(entry)))
+            {
+                break;
+            }
+        }
+
+        if (i == HashSet_capacity(this->b))
+        {
+            this->phase = HASH_SET_SYMMETRIC_DIFFERENCE_ITER_PHASE_DONE;
+        }
+        else
+        {
+            this->current = i + 1;
+            return _HashMapEntry_key(_HashMap_entry_at(this->b->map, i));
+        }
+    }
+
+    return NULL;
+}
+
+void HashSetSymmetricDifferenceIter_drop(HashSetSymmetricDifferenceIter *this)
+{
+}
+
+HashSetUnionIter HashSet_union(const HashSet *this, const HashSet *other)
+{
+    HashSetUnionIter iter;
+    HashSetUnionIter_new(&iter, this, other);
+
+    return iter;
+}
+
+HashSetIntersectionIter HashSet_intersection(const HashSet *this, const HashSet *other)
+{
+    HashSetIntersectionIter iter;
+    HashSetIntersectionIter_new(&iter, this, other);
+
+    return iter;
+}
+
+HashSetDifferenceIter HashSet_difference(const HashSet *this, const HashSet *other)
+{
+    HashSetDifferenceIter iter;
+    HashSetDifferenceIter_new(&iter, this, other);
+
+    return iter;
+}
+
+HashSetSymmetricDifferenceIter HashSet_symmetric_difference(const HashSet *this, const HashSet *other)
+{
+    HashSetSymmetricDifferenceIter iter;
+    HashSetSymmetricDifferenceIter_new(&iter, this, other);
+
+    return iter;
+}
+
+void HashSet_remove(HashSet *this, void *element)
+{
+    HashMap_remove(this->map, element);
+}
+
+void HashSet_drop(HashSet *this)
+{
+    HashMap_drop(this->map);
+    free(this->map);
+}
+
+// [Str]
+
+typedef struct
+{
+    uint8_t *ptr;
+    size_t len;
+} Str;
+
+Str Str_from_cstr(const char *cstr)
+{
+    Str result = {
+        .ptr = (uint8_t *)cstr,
+        .len = strlen(cstr),
+    };
+    return result;
+}
+
+// [StrSearcher]
+
+typedef enum
+{
+    SEARCH_STEP_MATCH,
+    SEARCH_STEP_REJECT,
+    SEARCH_STEP_DONE,
+} SearchStepKind;
+
+typedef struct
+{
+    SearchStepKind kind;
+
+    union
+    {
+        struct
+        {
+            size_t start;
+            size_t end;
+        } match;
+
+        struct
+        {
+            size_t start;
+            size_t end;
+        } reject;
+    };
+} SearchStep;
+
+// Needles up to this length are found by filtering on their first and last byte, longer ones with Two-Way
+#define STR_SEARCHER_SHORT_NEEDLE_MAX 32
+
+typedef enum
+{
+    STR_SEARCHER_KIND_SHORT,
+    STR_SEARCHER_KIND_TWO_WAY,
+} StrSearcherKind;
+
+// Searches forward from position and backward from end, the two never overlapping
+typedef struct
+{
+    Str haystack;
+    Str needle;
+    size_t position;
+    size_t end;
+    StrSearcherKind kind;
+    // Two-Way: the critical factorizations needle[..crit_pos] needle[crit_pos..] for forward and at crit_pos_back for
+    // backward searches, and the needle's period. With a long period, period is only a safe shift past a mismatch in
+    // the half that is matched second
+    size_t crit_pos;
+    size_t crit_pos_back;
+    size_t period;
+    bool is_long_period;
+} StrSearcher;
+
+// Finds the start and period of the maximal suffix of needle, under the byte order or its reverse
+static void _StrSearcher_maximal_suffix(const uint8_t *needle, size_t needle_len, bool is_reversed, size_t *start, size_t *period)
+{
+    size_t left = 0;
+    size_t right = 1;
+    size_t offset = 0;
+    *period = 1;
+
+    while (right + offset < needle_len)
+    {
+        uint8_t a = needle[right + offset];
+        uint8_t b = needle[left + offset];
+
+        if (is_reversed ? a > b : a < b)
+        {
+            // the suffix at right is smaller, so the period grows to everything up to here
+            right += offset + 1;
+            offset = 0;
+            *period = right - left;
+        }
+        else if (a == b)
+        {
+            if (offset + 1 == *period)
+            {
+                right += offset + 1;
+                offset = 0;
+            }
+            else
+            {
+                offset++;
+            }
+        }
+        else
+        {
+            // the suffix at right is larger and becomes the new maximal suffix
+            left = right;
+            right++;
+            offset = 0;
+            *period = 1;
+        }
+    }
+
+    *start = left;
+}
+
+// The start of the maximal suffix of the reversed needle, counted from the needle's end, stopping early once the
+// period reaches the needle's known period
+static size_t _StrSearcher_reverse_maximal_suffix(const uint8_t *needle, size_t needle_len, size_t known_period, bool is_reversed)
+{
+    size_t left = 0;
+    size_t right = 1;
+    size_t offset = 0;
+    size_t period = 1;
+
+    while (right + offset < needle_len && period != known_period)
+    {
+        uint8_t a = needle[needle_len - 1 - right - offset];
+        uint8_t b = needle[needle_len - 1 - left - offset];
+
+        if (is_reversed ? a > b : a < b)
+        {
+            right += offset + 1;
+            offset = 0;
+            period = right - left;
+        }
+        else if (a == b)
+        {
+            if (offset + 1 == period)
+            {
+                right += offset + 1;
+                offset = 0;
+            }
+            else
+            {
+                offset++;
+            }
+        }
+        else
+        {
+            left = right;
+            right++;
+            offset = 0;
+            period = 1;
+        }
+    }
+
+    return left;
+}
+
+static void StrSearcher_new(StrSearcher *this, Str haystack, Str needle)
+{
+    this->haystack = haystack;
+    this->needle = needle;
+
+    this->position = 0;
+    this->end = haystack.len;
+
+    if (needle.len <= STR_SEARCHER_SHORT_NEEDLE_MAX)
+    {
+        this->kind = STR_SEARCHER_KIND_SHORT;
+        return;
+    }
+
+    this->kind = STR_SEARCHER_KIND_TWO_WAY;
+
+    // the later of the two maximal suffixes gives a critical factorization
+    size_t crit_pos, period, reversed_crit_pos, reversed_period;
+    _StrSearcher_maximal_suffix(needle.ptr, needle.len, false, &crit_pos, &period);
+    _StrSearcher_maximal_suffix(needle.ptr, needle.len, true, &reversed_crit_pos, &reversed_period);
+
+    if (reversed_crit_pos > crit_pos)
+    {
+        crit_pos = reversed_crit_pos;
+        period = reversed_period;
+    }
+
+    this->crit_pos = crit_pos;
+    this->is_long_period = memcmp(needle.ptr, needle.ptr + period, crit_pos) != 0;
+    this->period = this->is_long_period ? MAX(crit_pos, needle.len - crit_pos) + 1 : period;
+    this->crit_pos_back = crit_pos;
+
+    // with a short period the factorization found from the front does not necessarily work from the back
+    if (!this->is_long_period)
+    {
+        size_t suffix = _StrSearcher_reverse_maximal_suffix(needle.ptr, needle.len, period, false);
+        size_t reversed_suffix = _StrSearcher_reverse_maximal_suffix(needle.ptr, needle.len, period, true);
+        this->crit_pos_back = needle.len - MAX(suffix, reversed_suffix);
+    }
+}
+
+static Str StrSearcher_haystack(const StrSearcher *this)
+{
+    Str result = {
+        .ptr = this->haystack.ptr,
+        .len = this->haystack.len,
+    };
+    return result;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Returns the first offset at or after i at which both needle's first and last byte match, or SIZE_MAX. Compares 16
+// offsets at a time, and matching both bytes is rare outside of repetitive text. needle_len must be at least 2
+static size_t _StrSearcher_find_candidate(const uint8_t *haystack, size_t haystack_len, size_t i, const uint8_t *needle, size_t needle_len)
+{
+    size_t last = needle_len - 1;
+
+#if defined(__SSE2__)
+    __m128i first_bytes = _mm_set1_epi8((char)needle[0]);
+    __m128i last_bytes = _mm_set1_epi8((char)needle[last]);
+
+    for (; i + last + 16 <= haystack_len; i += 16)
+    {
+        __m128i firsts = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i lasts = _mm_loadu_si128((const __m128i *)(haystack + i + last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firsts, first_bytes), _mm_cmpeq_epi8(lasts, last_bytes)));
+
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    while (i + last < haystack_len)
+    {
+        const uint8_t *first = memchr(haystack + i, needle[0], haystack_len - last - i);
+        if (first == NULL)
+        {
+            break;
+        }
+
+        i = first - haystack;
+        if (haystack[i + last] == needle[last])
+        {
+            return i;
+        }
+
+        i++;
+    }
+
+    return SIZE_MAX;
+}
+
+static size_t _StrSearcher_find_short(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len)
+{
+    if (needle_len == 1)
+    {
+        const uint8_t *match = memchr(haystack, needle[0], haystack_len);
+        return match ? (size_t)(match - haystack) : SIZE_MAX;
+    }
+
+    size_t last = needle_len - 1;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // the same filter as _StrSearcher_find_candidate, checking every candidate of a block before loading the next
+    __m128i first_bytes = _mm_set1_epi8((char)needle[0]);
+    __m128i last_bytes = _mm_set1_epi8((char)needle[last]);
+
+    for (; i + last + 16 <= haystack_len; i += 16)
+    {
+        __m128i firsts = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i lasts = _mm_loadu_si128((const __m128i *)(haystack + i + last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firsts, first_bytes), _mm_cmpeq_epi8(lasts, last_bytes)));
+
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t candidate = i + __builtin_ctz(mask);
+            if (memcmp(haystack + candidate + 1, needle + 1, last - 1) == 0)
+            {
+                return candidate;
+            }
+        }
+    }
+#endif
+
+    i = _StrSearcher_find_candidate(haystack, haystack_len, i, needle, needle_len);
+    for (; i != SIZE_MAX; i = _StrSearcher_find_candidate(haystack, haystack_len, i + 1, needle, needle_len))
+    {
+        if (memcmp(haystack + i + 1, needle + 1, last - 1) == 0)
+        {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+// Crochemore-Perrin Two-Way: matches the right half of the needle left to right, then the left half right to left, and
+// shifts by the period on a mismatch in the left half. memory remembers a prefix known to match after such a shift when
+// the period is short, which keeps the search linear. Whenever nothing is remembered, the search skips ahead to the
+// next offset that matches the needle's first and last byte, which is still linear as the skipped bytes are scanned once
+static size_t _StrSearcher_find_two_way(const StrSearcher *this, size_t position)
+{
+    const uint8_t *haystack = this->haystack.ptr;
+    const uint8_t *needle = this->needle.ptr;
+    size_t needle_len = this->needle.len;
+    size_t memory = 0;
+
+    while (position + needle_len <= this->end)
+    {
+        bool is_candidate = haystack[position] == needle[0] && haystack[position + needle_len - 1] == needle[needle_len - 1];
+        if (memory == 0 && !is_candidate)
+        {
+            position = _StrSearcher_find_candidate(haystack, this->end, position, needle, needle_len);
+            if (position == SIZE_MAX)
+            {
+                break;
+            }
+        }
+
+        size_t i = this->is_long_period ? this->crit_pos : MAX(this->crit_pos, memory);
+        while (i < needle_len && needle[i] == haystack[position + i])
+        {
+            i++;
+        }
+
+        if (i < needle_len)
+        {
+            position += i - this->crit_pos + 1;
+            memory = 0;
+            continue;
+        }
+
+        size_t start = this->is_long_period ? 0 : memory;
+        size_t j = this->crit_pos;
+        while (j > start && needle[j - 1] == haystack[position + j - 1])
+        {
+            j--;
+        }
+
+        if (j > start)
+        {
+            position += this->period;
+            memory = this->is_long_period ? 0 : needle_len - this->period;
+            continue;
+        }
+
+        return position;
+    }
+
+    return SIZE_MAX;
+}
+
+// Returns the start of the first match at or after position and before end, or SIZE_MAX
+static size_t _StrSearcher_find(const StrSearcher *this, size_t position)
+{
+    if (this->needle.len == 0)
+    {
+        return position;
+    }
+
+    if (this->needle.len > this->end - position)
+    {
+        return SIZE_MAX;
+    }
+
+    if (this->kind == STR_SEARCHER_KIND_TWO_WAY)
+    {
+        return _StrSearcher_find_two_way(this, position);
+    }
+
+    size_t match = _StrSearcher_find_short(this->haystack.ptr + position, this->end - position, this->needle.ptr, this->needle.len);
+    return match == SIZE_MAX ? SIZE_MAX : position + match;
+}
+
+// Returns the last start at which both needle's first and last byte match and the needle fits in haystack_len, or
+// SIZE_MAX. The mirror image of _StrSearcher_find_candidate
+static size_t _StrSearcher_rfind_candidate(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len)
+{
+    if (needle_len > haystack_len)
+    {
+        return SIZE_MAX;
+    }
+
+    size_t last = needle_len - 1;
+    // candidates are the starts below i
+    size_t i = haystack_len - last;
+
+#if defined(__SSE2__)
+    __m128i first_bytes = _mm_set1_epi8((char)needle[0]);
+    __m128i last_bytes = _mm_set1_epi8((char)needle[last]);
+
+    for (; i >= 16; i -= 16)
+    {
+        __m128i firsts = _mm_loadu_si128((const __m128i *)(haystack + i - 16));
+        __m128i lasts = _mm_loadu_si128((const __m128i *)(haystack + i - 16 + last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firsts, first_bytes), _mm_cmpeq_epi8(lasts, last_bytes)));
+
+        if (mask != 0)
+        {
+            return i - 16 + (31 - __builtin_clz(mask));
+        }
+    }
+#endif
+
+    while (i > 0)
+    {
+        i--;
+        if (haystack[i] == needle[0] && haystack[i + last] == needle[last])
+        {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+static size_t _StrSearcher_rfind_short(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len)
+{
+    if (needle_len == 1)
+    {
+        // a single byte needle is its own first and last byte
+        return _StrSearcher_rfind_candidate(haystack, haystack_len, needle, needle_len);
+    }
+
+    size_t last = needle_len - 1;
+    // candidates are the starts below i
+    size_t i = haystack_len - last;
+
+#if defined(__SSE2__)
+    // the same filter as _StrSearcher_rfind_candidate, checking every candidate of a block before loading the previous
+    __m128i first_bytes = _mm_set1_epi8((char)needle[0]);
+    __m128i last_bytes = _mm_set1_epi8((char)needle[last]);
+
+    for (; i >= 16; i -= 16)
+    {
+        __m128i firsts = _mm_loadu_si128((const __m128i *)(haystack + i - 16));
+        __m128i lasts = _mm_loadu_si128((const __m128i *)(haystack + i - 16 + last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firsts, first_bytes), _mm_cmpeq_epi8(lasts, last_bytes)));
+
+        while (mask != 0)
+        {
+            unsigned bit = 31 - __builtin_clz(mask);
+            size_t candidate = i - 16 + bit;
+            if (memcmp(haystack + candidate + 1, needle + 1, last - 1) == 0)
+            {
+                return candidate;
+            }
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+
+    i = _StrSearcher_rfind_candidate(haystack, i + last, needle, needle_len);
+    for (; i != SIZE_MAX; i = _StrSearcher_rfind_candidate(haystack, i + last, needle, needle_len))
+    {
+        if (memcmp(haystack + i + 1, needle + 1, last - 1) == 0)
+        {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+// Two-Way backwards from end: matches the left half of the needle right to left, then the right half left to right.
+// memory_back is the length of a prefix known to match after a period shift, or needle_len when nothing is known, in
+// which case the search skips back to the previous offset matching the needle's first and last byte
+static size_t _StrSearcher_rfind_two_way(const StrSearcher *this, size_t end)
+{
+    const uint8_t *haystack = this->haystack.ptr;
+    const uint8_t *needle = this->needle.ptr;
+    size_t needle_len = this->needle.len;
+    size_t memory_back = needle_len;
+
+    while (end >= this->position + needle_len)
+    {
+        size_t start = end - needle_len;
+        bool is_candidate = haystack[start] == needle[0] && haystack[end - 1] == needle[needle_len - 1];
+        if (memory_back == needle_len && !is_candidate)
+        {
+            size_t candidate = _StrSearcher_rfind_candidate(haystack + this->position, end - this->position, needle, needle_len);
+            if (candidate == SIZE_MAX)
+            {
+                break;
+            }
+
+            start = this->position + candidate;
+            end = start + needle_len;
+        }
+
+        size_t i = this->is_long_period ? this->crit_pos_back : MIN(this->crit_pos_back, memory_back);
+        while (i > 0 && needle[i - 1] == haystack[start + i - 1])
+        {
+            i--;
+        }
+
+        if (i > 0)
+        {
+            end -= this->crit_pos_back - (i - 1);
+            memory_back = needle_len;
+            continue;
+        }
+
+        size_t needle_end = this->is_long_period ? needle_len : memory_back;
+        size_t j = this->crit_pos_back;
+        while (j < needle_end && needle[j] == haystack[start + j])
+        {
+            j++;
+        }
+
+        if (j < needle_end)
+        {
+            end -= this->period;
+            memory_back = this->is_long_period ? needle_len : this->period;
+            continue;
+        }
+
+        return start;
+    }
+
+    return SIZE_MAX;
+}
+
+// Returns the start of the last match that ends at or before end and starts at or after position, or SIZE_MAX
+static size_t _StrSearcher_rfind(const StrSearcher *this, size_t end)
+{
+    if (this->needle.len == 0)
+    {
+        return end;
+    }
+
+    if (this->needle.len > end - this->position)
+    {
+        return SIZE_MAX;
+    }
+
+    if (this->kind == STR_SEARCHER_KIND_TWO_WAY)
+    {
+        return _StrSearcher_rfind_two_way(this, end);
+    }
+
+    size_t match = _StrSearcher_rfind_short(this->haystack.ptr + this->position, end - this->position, this->needle.ptr, this->needle.len);
+    return match == SIZE_MAX ? SIZE_MAX : this->position + match;
+}
+
+static SearchStep StrSearcher_next(StrSearcher *this)
+{
+    SearchStep result;
+
+    if (this->position == this->end)
+    {
+        result.kind = SEARCH_STEP_DONE;
+        return result;
+    }
+
+    size_t match_start = _StrSearcher_find(this, this->position);
+
+    if (match_start == SIZE_MAX)
+    {
+        result.kind = SEARCH_STEP_REJECT;
+        result.reject.start = this->position;
+        result.reject.end = this->end;
+
+        this->position = this->end;
+
+        return result;
+    }
+
+    size_t match_end = match_start + this->needle.len;
+
+    if (match_start > this->position)
+    {
+        // There's a rejection region before the match
+
+        result.kind = SEARCH_STEP_REJECT;
+        result.reject.start = this->position;
+        result.reject.end = match_start;
+
+        this->position = match_start;
+
+        return result;
+    }
+    else
+    {
+        result.kind = SEARCH_STEP_MATCH;
+        result.match.start = this->position;
+        result.match.end = match_end;
+
+        this->position = match_end;
+
+        return result;
+    }
+}
+
+// Steps backwards from the end of the part not searched yet: a rejection after the last match comes before the match
+static SearchStep StrSearcher_next_back(StrSearcher *this)
+{
+    SearchStep result;
+
+    if (this->end == this->position)
+    {
+        result.kind = SEARCH_STEP_DONE;
+        return result;
+    }
+
+    size_t match_start = _StrSearcher_rfind(this, this->end);
+
+    if (match_start == SIZE_MAX)
+    {
+        result.kind = SEARCH_STEP_REJECT;
+        result.reject.start = this->position;
+        result.reject.end = this->end;
+
+        this->end = this->position;
+
+        return result;
+    }
+
+    size_t match_end = match_start + this->needle.len;
+
+    if (match_end < this->end)
+    {
+        result.kind = SEARCH_STEP_REJECT;
+        result.reject.start = match_end;
+        result.reject.end = this->end;
+
+        this->end = match_end;
+
+        return result;
+    }
+    else
+    {
+        result.kind = SEARCH_STEP_MATCH;
+        result.match.start = match_start;
+        result.match.end = match_end;
+
+        this->end = match_start;
+
+        return result;
+    }
+}
+
+static void StrSearcher_drop(StrSearcher *this)
+{
+}
+
+// [MatchesIterator]
+
+typedef struct
+{
+    size_t start;
+    size_t end;
+    // index of the matched needle, always 0 for a single needle
+    size_t pattern;
+} Match;
+
+typedef struct
+{
+    StrSearcher searcher;
+    bool is_done;
+    Match current;
+} MatchesIterator;
+
+void MatchesIterator_new(MatchesIterator *this, const StrSearcher *searcher)
+{
+    memcpy(&this->searcher, searcher, sizeof(StrSearcher));
+    this->is_done = false;
+}
+
+void *MatchesIterator_next(MatchesIterator *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next(&this->searcher);
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            this->is_done = true;
+            return NULL;
+        }
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            this->current.start = step.match.start;
+            this->current.end = step.match.end;
+            this->current.pattern = 0;
+            return &this->current;
+        }
+    }
+}
+
+void MatchesIterator_drop(MatchesIterator *this)
+{
+    StrSearcher_drop(&this->searcher);
+}
+
+// [AhoCorasick]
+
+// Compiles a set of non-empty needles into a trie with failure links, resolved into a dense DFA when that has at most
+// AHO_CORASICK_DENSE_MAX_TRANSITIONS transitions. The DFA has a column per byte class: every byte used by a needle has
+// its own class and all other bytes share class 0. Otherwise the search follows failure links, with only the root's
+// transitions, which are taken most often, kept in a table. Searches report the leftmost match, the longest one when
+// several start there, and the lowest pattern index for duplicate needles
+#define AHO_CORASICK_DENSE_MAX_TRANSITIONS (1 << 20)
+#define AHO_CORASICK_NO_PATTERN UINT32_MAX
+
+// With few patterns, a Teddy prefilter skips to offsets where up to the first 3 bytes of some pattern could match.
+// Patterns are spread over 8 buckets and a byte's mask has the bits of the buckets with a pattern holding that byte
+// there, so ANDing the masks of consecutive bytes rarely leaves a bit set by accident. On x86 the 16 byte pshufb scan
+// is compiled for SSSE3 whatever the build targets and chosen when the automaton is built if the CPU supports it
+#define AHO_CORASICK_TEDDY_MAX_PATTERNS 64
+#define AHO_CORASICK_TEDDY_MAX_FINGERPRINT 3
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define AHO_CORASICK_TEDDY_SSSE3
+#endif
+
+typedef struct
+{
+    uint32_t fail;
+    uint32_t depth;
+    // the pattern spelled by the path to this state, and the nearest state down the fail chain that spells one
+    uint32_t pattern;
+    uint32_t output_link;
+    uint32_t first_edge;
+} _AhoCorasickState;
+
+typedef struct
+{
+    uint32_t next;
+    uint32_t target;
+    uint8_t byte;
+} _AhoCorasickEdge;
+
+typedef struct
+{
+    Vec states;
+    Vec edges;
+    uint8_t byte_classes[256];
+    size_t class_count;
+    uint32_t *dense;
+    uint32_t root_transitions[256];
+    size_t pattern_count;
+    bool has_prefilter;
+    bool has_ssse3;
+    size_t fingerprint_len;
+    // bucket masks per fingerprint byte, exact for the scalar scan and split into low and high nibble tables for SIMD
+    uint8_t fingerprint_masks[AHO_CORASICK_TEDDY_MAX_FINGERPRINT][256];
+    uint8_t nibble_masks[AHO_CORASICK_TEDDY_MAX_FINGERPRINT][2][16];
+} AhoCorasick;
+
+static _AhoCorasickState *_AhoCorasick_state(const AhoCorasick *this, uint32_t state)
+{
+    return (_AhoCorasickState *)Vec_get(&this->states, state);
+}
+
+// Returns the trie child of state for byte, or AHO_CORASICK_NO_PATTERN when there is none
+static uint32_t _AhoCorasick_child(const AhoCorasick *this, uint32_t state, uint8_t byte)
+{
+    for (uint32_t e = _AhoCorasick_state(this, state)->first_edge; e != UINT32_MAX;)
+    {
+        const _AhoCorasickEdge *edge = Vec_get(&this->edges, e);
+        if (edge->byte == byte)
+        {
+            return edge->target;
+        }
+
+        e = edge->next;
+    }
+
+    return AHO_CORASICK_NO_PATTERN;
+}
+
+static uint32_t _AhoCorasick_add_state(AhoCorasick *this, uint32_t depth)
+{
+    _AhoCorasickState state = {
+        .fail = 0,
+        .depth = depth,
+        .pattern = AHO_CORASICK_NO_PATTERN,
+        .output_link = 0,
+        .first_edge = UINT32_MAX,
+    };
+    Vec_push(&this->states, &state);
+
+    return (uint32_t)(Vec_len(&this->states) - 1);
+}
+
+static void _AhoCorasick_build_prefilter(AhoCorasick *this, const Str *needles, size_t count)
+{
+    size_t shortest = SIZE_MAX;
+    for (size_t i = 0; i < count; i++)
+    {
+        shortest = MIN(shortest, needles[i].len);
+    }
+
+    this->has_prefilter = count <= AHO_CORASICK_TEDDY_MAX_PATTERNS;
+#if defined(AHO_CORASICK_TEDDY_SSSE3)
+    this->has_ssse3 = __builtin_cpu_supports("ssse3");
+#else
+    this->has_ssse3 = false;
+#endif
+    this->fingerprint_len = MIN(shortest, AHO_CORASICK_TEDDY_MAX_FINGERPRINT);
+    memset(this->fingerprint_masks, 0, sizeof(this->fingerprint_masks));
+    memset(this->nibble_masks, 0, sizeof(this->nibble_masks));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t bucket = (uint8_t)(1 << (i % 8));
+        for (size_t j = 0; j < this->fingerprint_len; j++)
+        {
+            uint8_t byte = needles[i].ptr[j];
+            this->fingerprint_masks[j][byte] |= bucket;
+            this->nibble_masks[j][0][byte & 0xf] |= bucket;
+            this->nibble_masks[j][1][byte >> 4] |= bucket;
+        }
+    }
+}
+
+void AhoCorasick_new(AhoCorasick *this, const Str *needles, size_t count)
+{
+    Vec_new(&this->states, sizeof(_AhoCorasickState), NULL);
+    Vec_new(&this->edges, sizeof(_AhoCorasickEdge), NULL);
+    this->pattern_count = count;
+
+    _AhoCorasick_add_state(this, 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(needles[i].len > 0);
+
+        uint32_t state = 0;
+        for (size_t j = 0; j < needles[i].len; j++)
+        {
+            uint32_t child = _AhoCorasick_child(this, state, needles[i].ptr[j]);
+            if (child == AHO_CORASICK_NO_PATTERN)
+            {
+                child = _AhoCorasick_add_state(this, (uint32_t)(j + 1));
+
+                _AhoCorasickEdge edge = {
+                    .next = _AhoCorasick_state(this, state)->first_edge,
+                    .target = child,
+                    .byte = needles[i].ptr[j],
+                };
+                Vec_push(&this->edges, &edge);
+                _AhoCorasick_state(this, state)->first_edge = (uint32_t)(Vec_len(&this->edges) - 1);
+            }
+
+            state = child;
+        }
+
+        if (_AhoCorasick_state(this, state)->pattern == AHO_CORASICK_NO_PATTERN)
+        {
+            _AhoCorasick_state(this, state)->pattern = (uint32_t)i;
+        }
+    }
+
+    // breadth first, so that every fail target is finished before the states that point to it
+    Vec order;
+    Vec_with_capacity(&order, sizeof(uint32_t), NULL, Vec_len(&this->states));
+    uint32_t root = 0;
+    Vec_push(&order, &root);
+
+    for (size_t i = 0; i < Vec_len(&order); i++)
+    {
+        uint32_t state = *(const uint32_t *)Vec_get(&order, i);
+
+        for (uint32_t e = _AhoCorasick_state(this, state)->first_edge; e != UINT32_MAX;)
+        {
+            _AhoCorasickEdge edge = *(const _AhoCorasickEdge *)Vec_get(&this->edges, e);
+            e = edge.next;
+
+            uint32_t fail = 0;
+            if (state != 0)
+            {
+                uint32_t candidate = _AhoCorasick_state(this, state)->fail;
+                while (candidate != 0 && _AhoCorasick_child(this, candidate, edge.byte) == AHO_CORASICK_NO_PATTERN)
+                {
+                    candidate = _AhoCorasick_state(this, candidate)->fail;
+                }
+
+                uint32_t child = _AhoCorasick_child(this, candidate, edge.byte);
+                fail = child == AHO_CORASICK_NO_PATTERN ? 0 : child;
+            }
+
+            _AhoCorasickState *target = _AhoCorasick_state(this, edge.target);
+            const _AhoCorasickState *fail_state = _AhoCorasick_state(this, fail);
+            target->fail = fail;
+            target->output_link = fail_state->pattern != AHO_CORASICK_NO_PATTERN ? fail : fail_state->output_link;
+
+            Vec_push(&order, &edge.target);
+        }
+    }
+
+    memset(this->byte_classes, 0, sizeof(this->byte_classes));
+    for (size_t i = 0; i < Vec_len(&this->edges); i++)
+    {
+        this->byte_classes[((const _AhoCorasickEdge *)Vec_get(&this->edges, i))->byte] = 1;
+    }
+
+    this->class_count = 1;
+    for (size_t byte = 0; byte < 256; byte++)
+    {
+        if (this->byte_classes[byte])
+        {
+            this->byte_classes[byte] = (uint8_t)this->class_count++;
+        }
+    }
+
+    for (size_t byte = 0; byte < 256; byte++)
+    {
+        uint32_t child = _AhoCorasick_child(this, 0, (uint8_t)byte);
+        this->root_transitions[byte] = child == AHO_CORASICK_NO_PATTERN ? 0 : child;
+    }
+
+    this->dense = NULL;
+    size_t state_count = Vec_len(&this->states);
+    if (state_count * this->class_count <= AHO_CORASICK_DENSE_MAX_TRANSITIONS)
+    {
+        this->dense = malloc(state_count * this->class_count * sizeof(uint32_t));
+
+        // every class but 0, which never has a trie edge, stands for a single byte
+        uint8_t class_bytes[256];
+        for (size_t byte = 0; byte < 256; byte++)
+        {
+            class_bytes[this->byte_classes[byte]] = (uint8_t)byte;
+        }
+
+        for (size_t i = 0; i < Vec_len(&order); i++)
+        {
+            uint32_t state = *(const uint32_t *)Vec_get(&order, i);
+            uint32_t fail = _AhoCorasick_state(this, state)->fail;
+
+            for (size_t class = 0; class < this->class_count; class++)
+            {
+                uint32_t child = class == 0 ? AHO_CORASICK_NO_PATTERN : _AhoCorasick_child(this, state, class_bytes[class]);
+                if (child == AHO_CORASICK_NO_PATTERN)
+                {
+                    child = state == 0 ? 0 : this->dense[fail * this->class_count + class];
+                }
+
+                this->dense[state * this->class_count + class] = child;
+            }
+        }
+    }
+
+    Vec_drop(&order);
+
+    _AhoCorasick_build_prefilter(this, needles, count);
+}
+
+size_t AhoCorasick_pattern_count(const AhoCorasick *this)
+{
+    return this->pattern_count;
+}
+
+static uint32_t _AhoCorasick_next_state(const AhoCorasick *this, uint32_t state, uint8_t byte)
+{
+    if (this->dense)
+    {
+        return this->dense[state * this->class_count + this->byte_classes[byte]];
+    }
+
+    while (state != 0)
+    {
+        uint32_t child = _AhoCorasick_child(this, state, byte);
+        if (child != AHO_CORASICK_NO_PATTERN)
+        {
+            return child;
+        }
+
+        state = _AhoCorasick_state(this, state)->fail;
+    }
+
+    return this->root_transitions[byte];
+}
+
+static size_t _AhoCorasick_next_candidate_scalar(const AhoCorasick *this, const uint8_t *haystack, size_t haystack_len, size_t i)
+{
+    size_t fingerprint_len = this->fingerprint_len;
+
+    for (; i + fingerprint_len <= haystack_len; i++)
+    {
+        uint8_t buckets = 0xff;
+        for (size_t j = 0; j < fingerprint_len; j++)
+        {
+            buckets &= this->fingerprint_masks[j][haystack[i + j]];
+        }
+
+        if (buckets != 0)
+        {
+            return i;
+        }
+    }
+
+    return haystack_len;
+}
+
+#if defined(AHO_CORASICK_TEDDY_SSSE3)
+__attribute__((target("ssse3"))) static size_t _AhoCorasick_next_candidate_ssse3(const AhoCorasick *this, const uint8_t *haystack, size_t haystack_len, size_t i)
+{
+    size_t fingerprint_len = this->fingerprint_len;
+    __m128i low_nibbles = _mm_set1_epi8(0xf);
+    __m128i low_masks[AHO_CORASICK_TEDDY_MAX_FINGERPRINT];
+    __m128i high_masks[AHO_CORASICK_TEDDY_MAX_FINGERPRINT];
+    for (size_t j = 0; j < fingerprint_len; j++)
+    {
+        low_masks[j] = _mm_loadu_si128((const __m128i *)this->nibble_masks[j][0]);
+        high_masks[j] = _mm_loadu_si128((const __m128i *)this->nibble_masks[j][1]);
+    }
+
+    for (; i + fingerprint_len - 1 + 16 <= haystack_len; i += 16)
+    {
+        __m128i buckets = _mm_set1_epi8(-1);
+        for (size_t j = 0; j < fingerprint_len; j++)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(haystack + i + j));
+            __m128i low = _mm_shuffle_epi8(low_masks[j], _mm_and_si128(bytes, low_nibbles));
+            __m128i high = _mm_shuffle_epi8(high_masks[j], _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles));
+            buckets = _mm_and_si128(buckets, _mm_and_si128(low, high));
+        }
+
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(buckets, _mm_setzero_si128())) & 0xffff;
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return _AhoCorasick_next_candidate_scalar(this, haystack, haystack_len, i);
+}
+#endif
+
+// Returns the first offset at or after i at which some pattern could start, or haystack_len
+static size_t _AhoCorasick_next_candidate(const AhoCorasick *this, const uint8_t *haystack, size_t haystack_len, size_t i)
+{
+#if defined(AHO_CORASICK_TEDDY_SSSE3)
+    if (this->has_ssse3)
+    {
+        return _AhoCorasick_next_candidate_ssse3(this, haystack, haystack_len, i);
+    }
+#endif
+
+    return _AhoCorasick_next_candidate_scalar(this, haystack, haystack_len, i);
+}
+
+// Finds the leftmost-longest match at or after position. Once a match is known, the scan only goes on while the
+// current state could still grow into a match starting no later, i.e. while its depth reaches back to the match start
+static bool _AhoCorasick_find(const AhoCorasick *this, Str haystack, size_t position, Match *out)
+{
+    bool is_found = false;
+    uint32_t state = 0;
+
+    for (size_t i = position; i < haystack.len; i++)
+    {
+        if (state == 0)
+        {
+            if (is_found)
+            {
+                break;
+            }
+
+            if (this->has_prefilter)
+            {
+                i = _AhoCorasick_next_candidate(this, haystack.ptr, haystack.len, i);
+                if (i == haystack.len)
+                {
+                    break;
+                }
+            }
+        }
+
+        state = _AhoCorasick_next_state(this, state, haystack.ptr[i]);
+        const _AhoCorasickState *current = _AhoCorasick_state(this, state);
+
+        if (is_found && i + 1 - current->depth > out->start)
+        {
+            break;
+        }
+
+        uint32_t output = current->pattern != AHO_CORASICK_NO_PATTERN ? state : current->output_link;
+        if (output != 0)
+        {
+            const _AhoCorasickState *matched = _AhoCorasick_state(this, output);
+            size_t start = i + 1 - matched->depth;
+
+            // a later end at the same start is a longer match
+            if (!is_found || start <= out->start)
+            {
+                out->start = start;
+                out->end = i + 1;
+                out->pattern = matched->pattern;
+                is_found = true;
+            }
+        }
+    }
+
+    return is_found;
+}
+
+void AhoCorasick_drop(AhoCorasick *this)
+{
+    Vec_drop(&this->states);
+    Vec_drop(&this->edges);
+    free(this->dense);
+}
+
+// [MultiStrSearcher]
+
+// Steps through a haystack like StrSearcher, with the needles of an AhoCorasick in a single pass. pattern is the index
+// of the needle of the last SEARCH_STEP_MATCH
+typedef struct
+{
+    const AhoCorasick *automaton;
+    Str haystack;
+    size_t position;
+    size_t pattern;
+    // the match found while producing the rejection in front of it, returned by the next step
+    bool has_pending;
+    Match pending;
+} MultiStrSearcher;
+
+void MultiStrSearcher_new(MultiStrSearcher *this, const AhoCorasick *automaton, Str haystack)
+{
+    this->automaton = automaton;
+    this->haystack = haystack;
+    this->position = 0;
+    this->pattern = 0;
+    this->has_pending = false;
+}
+
+Str MultiStrSearcher_haystack(const MultiStrSearcher *this)
+{
+    return this->haystack;
+}
+
+size_t MultiStrSearcher_pattern(const MultiStrSearcher *this)
+{
+    return this->pattern;
+}
+
+SearchStep MultiStrSearcher_next(MultiStrSearcher *this)
+{
+    SearchStep result;
+
+    if (!this->has_pending)
+    {
+        if (this->position == this->haystack.len)
+        {
+            result.kind = SEARCH_STEP_DONE;
+            return result;
+        }
+
+        if (!_AhoCorasick_find(this->automaton, this->haystack, this->position, &this->pending))
+        {
+            result.kind = SEARCH_STEP_REJECT;
+            result.reject.start = this->position;
+            result.reject.end = this->haystack.len;
+
+            this->position = this->haystack.len;
+
+            return result;
+        }
+
+        this->has_pending = true;
+
+        if (this->pending.start > this->position)
+        {
+            result.kind = SEARCH_STEP_REJECT;
+            result.reject.start = this->position;
+            result.reject.end = this->pending.start;
+
+            this->position = this->pending.start;
+
+            return result;
+        }
+    }
+
+    result.kind = SEARCH_STEP_MATCH;
+    result.match.start = this->pending.start;
+    result.match.end = this->pending.end;
+
+    this->pattern = this->pending.pattern;
+    this->position = this->pending.end;
+    this->has_pending = false;
+
+    return result;
+}
+
+void MultiStrSearcher_drop(MultiStrSearcher *this)
+{
+}
+
+// [MultiMatchesIterator]
+
+typedef struct
+{
+    MultiStrSearcher searcher;
+    bool is_done;
+    Match current;
+} MultiMatchesIterator;
+
+void MultiMatchesIterator_new(MultiMatchesIterator *this, const MultiStrSearcher *searcher)
+{
+    memcpy(&this->searcher, searcher, sizeof(MultiStrSearcher));
+    this->is_done = false;
+}
+
+void *MultiMatchesIterator_next(MultiMatchesIterator *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    while (true)
+    {
+        SearchStep step = MultiStrSearcher_next(&this->searcher);
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            this->is_done = true;
+            return NULL;
+        }
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            this->current.start = step.match.start;
+            this->current.end = step.match.end;
+            this->current.pattern = MultiStrSearcher_pattern(&this->searcher);
+            return &this->current;
+        }
+    }
+}
+
+void MultiMatchesIterator_drop(MultiMatchesIterator *this)
+{
+    MultiStrSearcher_drop(&this->searcher);
+}
+
+// [SplitIterator]
+
+// Yields the pieces between separators from the front with next and from the back with next_back
+typedef struct
+{
+    StrSearcher searcher;
+    size_t last_end;
+    size_t back_start;
+    bool is_done;
+    Str current;
+} SplitIterator;
+
+void SplitIterator_new(SplitIterator *this, const StrSearcher *searcher)
+{
+    memcpy(&this->searcher, searcher, sizeof(StrSearcher));
+    this->last_end = 0;
+    this->back_start = StrSearcher_haystack(searcher).len;
+    this->is_done = false;
+}
+
+static Str *_SplitIterator_piece(SplitIterator *this, size_t start, size_t end)
+{
+    this->current.ptr = StrSearcher_haystack(&this->searcher).ptr + start;
+    this->current.len = end - start;
+
+    return &this->current;
+}
+
+// The piece left between the last separators found from either end
+static Str *_SplitIterator_finish(SplitIterator *this)
+{
+    this->is_done = true;
+
+    return _SplitIterator_piece(this, this->last_end, this->back_start);
+}
+
+void *SplitIterator_next(SplitIterator *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next(&this->searcher);
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            size_t start = this->last_end;
+
+            this->last_end = step.match.end;
+
+            return _SplitIterator_piece(this, start, step.match.start);
+        }
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            return _SplitIterator_finish(this);
+        }
+    }
+}
+
+void *SplitIterator_next_back(SplitIterator *this)
+{
+    if (this->is_done)
+    {
+        return NULL;
+    }
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next_back(&this->searcher);
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            size_t end = this->back_start;
+
+            this->back_start = step.match.start;
+
+            return _SplitIterator_piece(this, step.match.end, end);
+        }
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            return _SplitIterator_finish(this);
+        }
+    }
+}
+
+void SplitIterator_drop(SplitIterator *this)
+{
+    StrSearcher_drop(&this->searcher);
+}
+
+Iterator SplitIterator_iter(SplitIterator *this)
+{
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)SplitIterator_next,
+            .next_back = (IteratorNextBackFn)SplitIterator_next_back,
+        });
+}
+
+// [RSplitIterator]
+
+// A SplitIterator running from the back
+typedef struct
+{
+    SplitIterator split;
+} RSplitIterator;
+
+void RSplitIterator_new(RSplitIterator *this, const StrSearcher *searcher)
+{
+    SplitIterator_new(&this->split, searcher);
+}
+
+void *RSplitIterator_next(RSplitIterator *this)
+{
+    return SplitIterator_next_back(&this->split);
+}
+
+void *RSplitIterator_next_back(RSplitIterator *this)
+{
+    return SplitIterator_next(&this->split);
+}
+
+void RSplitIterator_drop(RSplitIterator *this)
+{
+    SplitIterator_drop(&this->split);
+}
+
+// [RSplitNIterator]
+
+// Yields at most count pieces from the back, the last one being everything before the separators already split off
+typedef struct
+{
+    SplitIterator split;
+    size_t count;
+} RSplitNIterator;
+
+void RSplitNIterator_new(RSplitNIterator *this, const StrSearcher *searcher, size_t count)
+{
+    SplitIterator_new(&this->split, searcher);
+    this->count = count;
+}
+
+void *RSplitNIterator_next(RSplitNIterator *this)
+{
+    if (this->count == 0)
+    {
+        return NULL;
+    }
+
+    this->count--;
+
+    if (this->count == 0)
+    {
+        return this->split.is_done ? NULL : _SplitIterator_finish(&this->split);
+    }
+
+    return SplitIterator_next_back(&this->split);
+}
+
+void RSplitNIterator_drop(RSplitNIterator *this)
+{
+    SplitIterator_drop(&this->split);
+}
+
+// [String]
+
+typedef struct
+{
+    Vec *buffer;
+} String;
+
+void String_new(String *this)
+{
+    this->buffer = malloc(sizeof(Vec));
+
+    VecElementOps element_ops = {};
+    Vec_new(this->buffer, sizeof(uint8_t), &element_ops);
+}
+
+void String_insert_str(String *this, size_t i, Str str)
+{
+    if (str.len == 0)
+    {
+        return;
+    }
+
+    size_t spare_length = Vec_capacity(this->buffer) - Vec_len(this->buffer);
+
+    if (str.len > spare_length)
+    {
+        size_t additional = str.len - spare_length;
+        Vec_reserve(this->buffer, additional);
+    }
+
+    if (i != Vec_len(this->buffer))
+    {
+        memmove(Vec_get_mut(this->buffer, i + str.len), Vec_get(this->buffer, i), Vec_len(this->buffer) - i);
+    }
+
+    memcpy(Vec_get_mut(this->buffer, i), str.ptr, str.len);
+
+    Vec_set_len(this->buffer, Vec_len(this->buffer) + str.len);
+}
+
+Str String_as_str(String *this)
+{
+    Str result = {
+        .ptr = Vec_get_mut(this->buffer, 0),
+        .len = Vec_len(this->buffer),
+    };
+    return result;
+}
+
+void String_push_str(String *this, Str str)
+{
+    String_insert_str(this, Vec_len(this->buffer), str);
+}
+
+size_t String_find_str(String *this, Str needle)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), needle);
+
+    size_t result = SIZE_MAX;
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next(&searcher);
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            break;
+        }
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            result = step.match.start;
+            break;
+        }
+    }
+
+    return result;
+}
+
+// Returns the start of the last match of needle, or SIZE_MAX
+size_t String_rfind_str(String *this, Str needle)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), needle);
+
+    size_t result = SIZE_MAX;
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next_back(&searcher);
+
+        if (step.kind == SEARCH_STEP_DONE)
+        {
+            break;
+        }
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            result = step.match.start;
+            break;
+        }
+    }
+
+    return result;
+}
+
+String String_replace_str(String *this, Str from, Str to)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), from);
+
+    String result;
+    String_new(&result);
+
+    while (true)
+    {
+        SearchStep step = StrSearcher_next(&searcher);
+
+        if (step.kind == SEARCH_STEP_MATCH)
+        {
+            String_push_str(&result, to);
+        }
+        else if (step.kind == SEARCH_STEP_REJECT)
+        {
+            Str str = {
+                .ptr = Vec_get_mut(this->buffer, 0) + step.reject.start,
+                .len = step.reject.end - step.reject.start,
+            };
+            String_push_str(&result, str);
+        }
+        else if (step.kind == SEARCH_STEP_DONE)
+        {
+            break;
+        }
+    }
+
+    return result;
+}
+
+MatchesIterator String_matches_str(String *this, Str needle)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), needle);
+
+    MatchesIterator matches;
+    MatchesIterator_new(&matches, &searcher);
+
+    return matches;
+}
+
+// Matches every needle of automaton in one pass, see AhoCorasick for which of overlapping matches is reported
+MultiMatchesIterator String_matches_any(String *this, const AhoCorasick *automaton)
+{
+    MultiStrSearcher searcher;
+    MultiStrSearcher_new(&searcher, automaton, String_as_str(this));
+
+    MultiMatchesIterator matches;
+    MultiMatchesIterator_new(&matches, &searcher);
+
+    return matches;
+}
+
+SplitIterator String_split_str(String *this, Str separator)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), separator);
+
+    SplitIterator split;
+    SplitIterator_new(&split, &searcher);
+
+    return split;
+}
+
+RSplitIterator String_rsplit_str(String *this, Str separator)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), separator);
+
+    RSplitIterator split;
+    RSplitIterator_new(&split, &searcher);
+
+    return split;
+}
+
+// Splits off at most n - 1 pieces from the back, e.g. n = 2 separates the part after the last separator
+RSplitNIterator String_rsplitn_str(String *this, size_t n, Str separator)
+{
+    StrSearcher searcher;
+    StrSearcher_new(&searcher, String_as_str(this), separator);
+
+    RSplitNIterator split;
+    RSplitNIterator_new(&split, &searcher, n);
+
+    return split;
+}
+
+void String_from(String *this, Str str)
+{
+    String_new(this);
+
+    String_insert_str(this, 0, str);
+}
+
+void String_reserve(String *this, size_t additional)
+{
+    Vec_reserve(this->buffer, additional);
+}
+
+size_t String_len(const String *this)
+{
+    return Vec_len(this->buffer);
+}
+
+uint8_t String_get(const String *this, size_t i)
+{
+    return *(uint8_t *)Vec_get(this->buffer, i);
+}
+
+size_t String_capacity(const String *this)
+{
+    return Vec_capacity(this->buffer);
+}
+
+void String_truncate(String *this, size_t len)
+{
+    Vec_truncate(this->buffer, len);
+}
+
+void String_shrink_to_fit(String *this)
+{
+    Vec_shrink_to_fit(this->buffer);
+}
+
+void String_clear(String *this)
+{
+    Vec_clear(this->buffer);
+}
+
+void String_drop(String *this)
+{
+    Vec_drop(this->buffer);
+    free(this->buffer);
+}
+
+// [ArtMap]
+
+// An adaptive radix tree over byte strings. Inner nodes branch on one byte and grow through 4, 16, 48 and 256 children
+// as they fill up. Runs of bytes with a single child are compressed into the prefix of the node below them, of which
+// only the first ART_MAX_PREFIX_LEN bytes are stored: lookups skip the rest and compare the full key at the leaf.
+// A key that ends where a node's prefix does hangs off that node's terminal slot instead of a child.
+#define ART_MAX_PREFIX_LEN 10
+
+typedef enum
+{
+    ART_NODE_KIND_LEAF,
+    ART_NODE_KIND_4,
+    ART_NODE_KIND_16,
+    ART_NODE_KIND_48,
+    ART_NODE_KIND_256,
+} _ArtNodeKind;
+
+// Leaves hold their value and a copy of their key: [header][value][key bytes]
+typedef struct
+{
+    uint8_t kind;
+    size_t key_len;
+} _ArtLeaf;
+
+typedef struct
+{
+    uint8_t kind;
+    uint16_t child_count;
+    size_t prefix_len;
+    uint8_t prefix[ART_MAX_PREFIX_LEN];
+    _ArtLeaf *terminal;
+} _ArtNode;
+
+// Children are either _ArtNode or _ArtLeaf, told apart by the kind both start with
+typedef struct
+{
+    _ArtNode header;
+    uint8_t keys[4];
+    _ArtNode *children[4];
+} _ArtNode4;
+
+typedef struct
+{
+    _ArtNode header;
+    uint8_t keys[16];
+    _ArtNode *children[16];
+} _ArtNode16;
+
+// child_index holds slot + 1 into children, or 0 for no child
+typedef struct
+{
+    _ArtNode header;
+    uint8_t child_index[256];
+    _ArtNode *children[48];
+} _ArtNode48;
+
+typedef struct
+{
+    _ArtNode header;
+    _ArtNode *children[256];
+} _ArtNode256;
+
+typedef struct
+{
+    _ArtNode *root;
+    size_t length;
+    BTreeMapValueProps value_props;
+} ArtMap;
+
+typedef struct
+{
+    Str key;
+    void *value;
+} ArtMapEntry;
+
+static bool _ArtNode_is_leaf(const _ArtNode *this)
+{
+    return *(const uint8_t *)this == ART_NODE_KIND_LEAF;
+}
+
+static void *_ArtMap_leaf_value(const ArtMap *this, const _ArtLeaf *leaf)
+{
+    (void)this;
+    return (uint8_t *)leaf + ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_ArtLeaf));
+}
+
+static Str _ArtMap_leaf_key(const ArtMap *this, const _ArtLeaf *leaf)
+{
+    Str key = {
+        .ptr = (uint8_t *)_ArtMap_leaf_value(this, leaf) + this->value_props.size,
+        .len = leaf->key_len,
+    };
+    return key;
+}
+
+// Lexicographic, a proper prefix orders first
+static int32_t _ArtMap_compare_keys(Str a, Str b)
+{
+    int result = memcmp(a.ptr, b.ptr, MIN(a.len, b.len));
+
+    if (result != 0)
+    {
+        return result < 0 ? -1 : 1;
+    }
+
+    return a.len < b.len ? -1 : a.len > b.len;
+}
+
+static bool _ArtMap_leaf_matches(const ArtMap *this, const _ArtLeaf *leaf, Str key)
+{
+    return leaf->key_len == key.len && memcmp(_ArtMap_leaf_key(this, leaf).ptr, key.ptr, key.len) == 0;
+}
+
+static _ArtLeaf *_ArtMap_new_leaf(const ArtMap *this, Str key, const void *value)
+{
+    _ArtLeaf *leaf = malloc(ROUND_SIZE_UP_TO_MAX_ALIGN(sizeof(_ArtLeaf)) + this->value_props.size + key.len);
+
+    leaf->kind = ART_NODE_KIND_LEAF;
+    leaf->key_len = key.len;
+    memcpy(_ArtMap_leaf_value(this, leaf), value, this->value_props.size);
+    memcpy(_ArtMap_leaf_key(this, leaf).ptr, key.ptr, key.len);
+
+    return leaf;
+}
+
+static void _ArtMap_drop_leaf(const ArtMap *this, _ArtLeaf *leaf)
+{
+    if (this->value_props.drop != NULL)
+    {
+        this->value_props.drop(_ArtMap_leaf_value(this, leaf));
+    }
+
+    free(leaf);
+}
+
+static _ArtNode *_ArtMap_new_node(_ArtNodeKind kind)
+{
+    size_t sizes[] = {
+        [ART_NODE_KIND_4] = sizeof(_ArtNode4),
+        [ART_NODE_KIND_16] = sizeof(_ArtNode16),
+        [ART_NODE_KIND_48] = sizeof(_ArtNode48),
+        [ART_NODE_KIND_256] = sizeof(_ArtNode256),
+    };
+    _ArtNode *node = calloc(1, sizes[kind]);
+
+    node->kind = kind;
+
+    return node;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static _ArtNode **_ArtNode_find_child(_ArtNode *this, uint8_t byte)
+{
+    switch (this->kind)
+    {
+    case ART_NODE_KIND_4:
+    {
+        _ArtNode4 *node = (_ArtNode4 *)this;
+
+        for (size_t i = 0; i < this->child_count; i++)
+        {
+            if (node->keys[i] == byte)
+            {
+                return &node->children[i];
+            }
+        }
+
+        return NULL;
+    }
+    case ART_NODE_KIND_16:
+    {
+        _ArtNode16 *node = (_ArtNode16 *)this;
+
+#if defined(__SSE2__)
+        __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8((char)byte), _mm_loadu_si128((const __m128i *)node->keys));
+        unsigned mask = (unsigned)_mm_movemask_epi8(matches) & ((1u << this->child_count) - 1);
+
+        return mask != 0 ? &node->children[__builtin_ctz(mask)] : NULL;
+#else
+        for (size_t i = 0; i < this->child_count; i++)
+        {
+            if (node->keys[i] == byte)
+            {
+                return &node->children[i];
+            }
+        }
+
+        return NULL;
+#endif
+    }
+    case ART_NODE_KIND_48:
+    {
+        _ArtNode48 *node = (_ArtNode48 *)this;
+        uint8_t idx = node->child_index[byte];
+
+        return idx != 0 ? &node->children[idx - 1] : NULL;
+    }
+    default:
+    {
+        _ArtNode256 *node = (_ArtNode256 *)this;
+
+        return node->children[byte] != NULL ? &node->children[byte] : NULL;
+    }
+    }
+}
+
+// The child with the smallest byte at least from (0..=256), or NULL
+static _ArtNode *_ArtNode_next_child(const _ArtNode *this, int from, int *byte)
+{
+    switch (this->kind)
+    {
+    case ART_NODE_KIND_4:
+    case ART_NODE_KIND_16:
+    {
+        const uint8_t *keys = this->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)this)->keys : ((_ArtNode16 *)this)->keys;
+        _ArtNode *const *children = this->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)this)->children : ((_ArtNode16 *)this)->children;
+
+        for (size_t i = 0; i < this->child_count; i++)
+        {
+            if (keys[i] >= from)
+            {
+                *byte = keys[i];
+                return children[i];
+            }
+        }
+
+        return NULL;
+    }
+    case ART_NODE_KIND_48:
+    {
+        const _ArtNode48 *node = (const _ArtNode48 *)this;
+
+        for (int i = from; i < 256; i++)
+        {
+            if (node->child_index[i] != 0)
+            {
+                *byte = i;
+                return node->children[node->child_index[i] - 1];
+            }
+        }
+
+        return NULL;
+    }
+    default:
+    {
+        const _ArtNode256 *node = (const _ArtNode256 *)this;
+
+        for (int i = from; i < 256; i++)
+        {
+            if (node->children[i] != NULL)
+            {
+                *byte = i;
+                return node->children[i];
+            }
+        }
+
+        return NULL;
+    }
+    }
+}
+
+// Replaces the node in slot by a copy of it of another kind, with the same children
+static _ArtNode *_ArtNode_change_kind(_ArtNode **slot, _ArtNodeKind kind)
+{
+    _ArtNode *old = *slot;
+    _ArtNode *new = _ArtMap_new_node(kind);
+
+    *new = *old;
+    new->kind = kind;
+    new->child_count = 0;
+
+    int byte = 0;
+    for (_ArtNode *child = _ArtNode_next_child(old, 0, &byte); child != NULL; child = _ArtNode_next_child(old, byte + 1, &byte))
+    {
+        switch (kind)
+        {
+        case ART_NODE_KIND_4:
+            ((_ArtNode4 *)new)->keys[new->child_count] = byte;
+            ((_ArtNode4 *)new)->children[new->child_count] = child;
+            break;
+        case ART_NODE_KIND_16:
+            ((_ArtNode16 *)new)->keys[new->child_count] = byte;
+            ((_ArtNode16 *)new)->children[new->child_count] = child;
+            break;
+        case ART_NODE_KIND_48:
+            ((_ArtNode48 *)new)->child_index[byte] = new->child_count + 1;
+            ((_ArtNode48 *)new)->children[new->child_count] = child;
+            break;
+        default:
+            ((_ArtNode256 *)new)->children[byte] = child;
+            break;
+        }
+
+        new->child_count++;
+    }
+
+    free(old);
+
+    *slot = new;
+    return new;
+}
+
+// Index at which byte goes into the sorted keys of a node with up to 16 children
+static size_t _ArtNode_lower_bound(const uint8_t *keys, size_t count, uint8_t byte)
+{
+#if defined(__SSE2__)
+    if (count > 4)
+    {
+        // bytes are unsigned but SSE2 only compares signed ones, flipping the top bit maps one order onto the other
+        __m128i bias = _mm_set1_epi8((char)0x80);
+        __m128i lanes = _mm_xor_si128(_mm_loadu_si128((const __m128i *)keys), bias);
+        __m128i less = _mm_cmplt_epi8(lanes, _mm_xor_si128(_mm_set1_epi8((char)byte), bias));
+
+        return __builtin_popcount((unsigned)_mm_movemask_epi8(less) & ((1u << count) - 1));
+    }
+#endif
+
+    size_t i = 0;
+    while (i < count && keys[i] < byte)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+// Adds child under byte to the node in slot, growing it into the next kind when it is full
+static void _ArtNode_add_child(_ArtNode **slot, uint8_t byte, _ArtNode *child)
+{
+    _ArtNode *node = *slot;
+
+    if ((node->kind == ART_NODE_KIND_4 && node->child_count == 4) || (node->kind == ART_NODE_KIND_16 && node->child_count == 16) || (node->kind == ART_NODE_KIND_48 && node->child_count == 48))
+    {
+        node = _ArtNode_change_kind(slot, node->kind + 1);
+    }
+
+    switch (node->kind)
+    {
+    case ART_NODE_KIND_4:
+    case ART_NODE_KIND_16:
+    {
+        uint8_t *keys = node->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)node)->keys : ((_ArtNode16 *)node)->keys;
+        _ArtNode **children = node->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)node)->children : ((_ArtNode16 *)node)->children;
+        size_t idx = _ArtNode_lower_bound(keys, node->child_count, byte);
+
+        memmove(&keys[idx + 1], &keys[idx], node->child_count - idx);
+        memmove(&children[idx + 1], &children[idx], (node->child_count - idx) * sizeof(children[0]));
+        keys[idx] = byte;
+        children[idx] = child;
+        break;
+    }
+    case ART_NODE_KIND_48:
+    {
+        _ArtNode48 *node48 = (_ArtNode48 *)node;
+
+        // removals leave holes, so the first free slot is not necessarily at child_count
+        size_t free_slot = 0;
+        while (node48->children[free_slot] != NULL)
+        {
+            free_slot++;
+        }
+
+        node48->children[free_slot] = child;
+        node48->child_index[byte] = free_slot + 1;
+        break;
+    }
+    default:
+        ((_ArtNode256 *)node)->children[byte] = child;
+        break;
+    }
+
+    node->child_count++;
+}
+
+// Replaces the node in slot by what is left below it once it has no branching left: its terminal leaf, or its only
+// child, which then absorbs the node's prefix and the byte leading to it
+static void _ArtNode_collapse(_ArtNode **slot)
+{
+    _ArtNode *node = *slot;
+
+    if (node->child_count == 0)
+    {
+        *slot = (_ArtNode *)node->terminal;
+        free(node);
+        return;
+    }
+
+    if (node->child_count > 1 || node->terminal != NULL)
+    {
+        return;
+    }
+
+    int byte;
+    _ArtNode *child = _ArtNode_next_child(node, 0, &byte);
+
+    if (!_ArtNode_is_leaf(child))
+    {
+        uint8_t prefix[ART_MAX_PREFIX_LEN];
+        size_t stored = MIN(node->prefix_len, ART_MAX_PREFIX_LEN);
+        memcpy(prefix, node->prefix, stored);
+
+        if (stored < ART_MAX_PREFIX_LEN)
+        {
+            prefix[stored++] = byte;
+        }
+
+        size_t from_child = MIN(child->prefix_len, ART_MAX_PREFIX_LEN - stored);
+        memcpy(&prefix[stored], child->prefix, from_child);
+
+        child->prefix_len += node->prefix_len + 1;
+        memcpy(child->prefix, prefix, MIN(child->prefix_len, ART_MAX_PREFIX_LEN));
+    }
+
+    *slot = child;
+    free(node);
+}
+
+// Removes the child under byte from the node in slot, shrinking it into a smaller kind when it gets sparse
+static void _ArtNode_remove_child(_ArtNode **slot, uint8_t byte)
+{
+    _ArtNode *node = *slot;
+
+    switch (node->kind)
+    {
+    case ART_NODE_KIND_4:
+    case ART_NODE_KIND_16:
+    {
+        uint8_t *keys = node->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)node)->keys : ((_ArtNode16 *)node)->keys;
+        _ArtNode **children = node->kind == ART_NODE_KIND_4 ? ((_ArtNode4 *)node)->children : ((_ArtNode16 *)node)->children;
+        size_t idx = _ArtNode_lower_bound(keys, node->child_count, byte);
+
+        memmove(&keys[idx], &keys[idx + 1], node->child_count - idx - 1);
+        memmove(&children[idx], &children[idx + 1], (node->child_count - idx - 1) * sizeof(children[0]));
+        break;
+    }
+    case ART_NODE_KIND_48:
+    {
+        _ArtNode48 *node48 = (_ArtNode48 *)node;
+
+        node48->children[node48->child_index[byte] - 1] = NULL;
+        node48->child_index[byte] = 0;
+        break;
+    }
+    default:
+        ((_ArtNode256 *)node)->children[byte] = NULL;
+        break;
+    }
+
+    node->child_count--;
+
+    // shrink a little below the size the next kind holds, so alternating inserts and removals do not flip kinds
+    if ((node->kind == ART_NODE_KIND_16 && node->child_count == 3) || (node->kind == ART_NODE_KIND_48 && node->child_count == 12) || (node->kind == ART_NODE_KIND_256 && node->child_count == 37))
+    {
+        _ArtNode_change_kind(slot, node->kind - 1);
+    }
+
+    _ArtNode_collapse(slot);
+}
+
+// The leaf with the smallest key below node, which holds the full prefix of every node on the way to it
+static const _ArtLeaf *_ArtNode_minimum_leaf(const _ArtNode *this)
+{
+    while (!_ArtNode_is_leaf(this))
+    {
+        if (this->terminal != NULL)
+        {
+            return this->terminal;
+        }
+
+        int byte;
+        this = _ArtNode_next_child(this, 0, &byte);
+    }
+
+    return (const _ArtLeaf *)this;
+}
+
+// The full prefix of a node whose keys start at depth, which may only be partially stored in the node itself
+static const uint8_t *_ArtMap_node_prefix(const ArtMap *this, const _ArtNode *node, size_t depth)
+{
+    if (node->prefix_len <= ART_MAX_PREFIX_LEN)
+    {
+        return node->prefix;
+    }
+
+    return _ArtMap_leaf_key(this, _ArtNode_minimum_leaf(node)).ptr + depth;
+}
+
+void ArtMap_new(ArtMap *this, const BTreeMapValueProps *value_props)
+{
+    this->root = NULL;
+    this->length = 0;
+    this->value_props = *value_props;
+}
+
+size_t ArtMap_len(const ArtMap *this)
+{
+    return this->length;
+}
+
+void *ArtMap_get(const ArtMap *this, Str key)
+{
+    _ArtNode *current = this->root;
+    size_t depth = 0;
+
+    while (current != NULL)
+    {
+        if (_ArtNode_is_leaf(current))
+        {
+            return _ArtMap_leaf_matches(this, (_ArtLeaf *)current, key) ? _ArtMap_leaf_value(this, (_ArtLeaf *)current) : NULL;
+        }
+
+        // only the stored part of the prefix is checked here, the leaf compares the whole key
+        size_t stored = MIN(current->prefix_len, ART_MAX_PREFIX_LEN);
+
+        if (depth + current->prefix_len > key.len || memcmp(current->prefix, key.ptr + depth, stored) != 0)
+        {
+            return NULL;
+        }
+
+        depth += current->prefix_len;
+
+        if (depth == key.len)
+        {
+            _ArtLeaf *leaf = current->terminal;
+
+            return leaf != NULL && _ArtMap_leaf_matches(this, leaf, key) ? _ArtMap_leaf_value(this, leaf) : NULL;
+        }
+
+        _ArtNode **child = _ArtNode_find_child(current, key.ptr[depth]);
+
+        current = child != NULL ? *child : NULL;
+        depth++;
+    }
+
+    return NULL;
+}
+
+// Hangs leaf off node, which holds keys that agree with the leaf's up to depth
+static void _ArtMap_place_leaf(const ArtMap *this, _ArtNode **slot, size_t depth, _ArtLeaf *leaf)
+{
+    if (leaf->key_len == depth)
+    {
+        (*slot)->terminal = leaf;
+    }
+    else
+    {
+        _ArtNode_add_child(slot, _ArtMap_leaf_key(this, leaf).ptr[depth], (_ArtNode *)leaf);
+    }
+}
+
+static void _ArtMap_replace_value(const ArtMap *this, _ArtLeaf *leaf, const void *value)
+{
+    if (this->value_props.drop != NULL)
+    {
+        this->value_props.drop(_ArtMap_leaf_value(this, leaf));
+    }
+
+    memcpy(_ArtMap_leaf_value(this, leaf), value, this->value_props.size);
+}
+
+// Copies the key, the value is moved in. Replaces (and drops) the value of a key that is already present.
+void ArtMap_insert(ArtMap *this, Str key, const void *value)
+{
+    _ArtNode **slot = &this->root;
+    size_t depth = 0;
+
+    while (true)
+    {
+        _ArtNode *node = *slot;
+
+        if (node == NULL)
+        {
+            *slot = (_ArtNode *)_ArtMap_new_leaf(this, key, value);
+            this->length++;
+            return;
+        }
+
+        if (_ArtNode_is_leaf(node))
+        {
+            _ArtLeaf *leaf = (_ArtLeaf *)node;
+
+            if (_ArtMap_leaf_matches(this, leaf, key))
+            {
+                _ArtMap_replace_value(this, leaf, value);
+                return;
+            }
+
+            // both keys agree up to depth, branch where they stop agreeing
+            Str leaf_key = _ArtMap_leaf_key(this, leaf);
+            size_t common = 0;
+            while (depth + common < key.len && depth + common < leaf_key.len && key.ptr[depth + common] == leaf_key.ptr[depth + common])
+            {
+                common++;
+            }
+
+            _ArtNode *branch = _ArtMap_new_node(ART_NODE_KIND_4);
+            branch->prefix_len = common;
+            memcpy(branch->prefix, key.ptr + depth, MIN(common, ART_MAX_PREFIX_LEN));
+
+            *slot = branch;
+            _ArtMap_place_leaf(this, slot, depth + common, leaf);
+            _ArtMap_place_leaf(this, slot, depth + common, _ArtMap_new_leaf(this, key, value));
+
+            this->length++;
+            return;
+        }
+
+        if (node->prefix_len > 0)
+        {
+            const uint8_t *prefix = _ArtMap_node_prefix(this, node, depth);
+            size_t mismatch = 0;
+            while (mismatch < node->prefix_len && depth + mismatch < key.len && prefix[mismatch] == key.ptr[depth + mismatch])
+            {
+                mismatch++;
+            }
+
+            if (mismatch < node->prefix_len)
+            {
+                // split the prefix: a new node takes the agreeing part and the old one keeps what follows the byte
+                // it now hangs under
+                _ArtNode *branch = _ArtMap_new_node(ART_NODE_KIND_4);
+                branch->prefix_len = mismatch;
+                memcpy(branch->prefix, prefix, MIN(mismatch, ART_MAX_PREFIX_LEN));
+
+                uint8_t byte = prefix[mismatch];
+                node->prefix_len -= mismatch + 1;
+                memmove(node->prefix, prefix + mismatch + 1, MIN(node->prefix_len, ART_MAX_PREFIX_LEN));
+
+                *slot = branch;
+                _ArtNode_add_child(slot, byte, node);
+                _ArtMap_place_leaf(this, slot, depth + mismatch, _ArtMap_new_leaf(this, key, value));
+
+                this->length++;
+                return;
+            }
+
+            depth += node->prefix_len;
+        }
+
+        if (depth == key.len)
+        {
+            if (node->terminal != NULL)
+            {
+                _ArtMap_replace_value(this, node->terminal, value);
+            }
+            else
+            {
+                node->terminal = _ArtMap_new_leaf(this, key, value);
+                this->length++;
+            }
+
+            return;
+        }
+
+        _ArtNode **child = _ArtNode_find_child(node, key.ptr[depth]);
+
+        if (child == NULL)
+        {
+            _ArtNode_add_child(slot, key.ptr[depth], (_ArtNode *)_ArtMap_new_leaf(this, key, value));
+            this->length++;
+            return;
+        }
+
+        slot = child;
+        depth++;
+    }
+}
+
+void ArtMap_remove(ArtMap *this, Str key)
+{
+    _ArtNode **slot = &this->root;
+    size_t depth = 0;
+
+    while (*slot != NULL)
+    {
+        _ArtNode *node = *slot;
+
+        if (_ArtNode_is_leaf(node))
+        {
+            // only a leaf at the root is reached this way, others are removed from their parent below
+            if (_ArtMap_leaf_matches(this, (_ArtLeaf *)node, key))
+            {
+                _ArtMap_drop_leaf(this, (_ArtLeaf *)node);
+                *slot = NULL;
+                this->length--;
+            }
+
+            return;
+        }
+
+        size_t stored = MIN(node->prefix_len, ART_MAX_PREFIX_LEN);
+
+        if (depth + node->prefix_len > key.len || memcmp(node->prefix, key.ptr + depth, stored) != 0)
+        {
+            return;
+        }
+
+        depth += node->prefix_len;
+
+        if (depth == key.len)
+        {
+            if (node->terminal != NULL && _ArtMap_leaf_matches(this, node->terminal, key))
+            {
+                _ArtMap_drop_leaf(this, node->terminal);
+                node->terminal = NULL;
+                this->length--;
+
+                _ArtNode_collapse(slot);
+            }
+
+            return;
+        }
+
+        _ArtNode **child = _ArtNode_find_child(node, key.ptr[depth]);
+
+        if (child == NULL)
+        {
+            return;
+        }
+
+        if (_ArtNode_is_leaf(*child))
+        {
+            if (_ArtMap_leaf_matches(this, (_ArtLeaf *)*child, key))
+            {
+                _ArtMap_drop_leaf(this, (_ArtLeaf *)*child);
+                _ArtNode_remove_child(slot, key.ptr[depth]);
+                this->length--;
+            }
+
+            return;
+        }
+
+        slot = child;
+        depth++;
+    }
+}
+
+static void _ArtMap_drop_node(ArtMap *this, _ArtNode *node)
+{
+    if (_ArtNode_is_leaf(node))
+    {
+        _ArtMap_drop_leaf(this, (_ArtLeaf *)node);
+        return;
+    }
+
+    if (node->terminal != NULL)
+    {
+        _ArtMap_drop_leaf(this, node->terminal);
+    }
+
+    int byte = 0;
+    for (_ArtNode *child = _ArtNode_next_child(node, 0, &byte); child != NULL; child = _ArtNode_next_child(node, byte + 1, &byte))
+    {
+        _ArtMap_drop_node(this, child);
+    }
+
+    free(node);
+}
+
+void ArtMap_drop(ArtMap *this)
+{
+    if (this->root != NULL)
+    {
+        _ArtMap_drop_node(this, this->root);
+    }
+}
+
+// [ArtMapRangeIter]
+
+// next is the next byte whose child to visit, -1 while the node's terminal leaf (or the leaf itself) is still due
+typedef struct
+{
+    const _ArtNode *node;
+    int next;
+} _ArtMapFrame;
+
+typedef struct
+{
+    const ArtMap *map;
+    Vec stack;
+    RangeBound end;
+    ArtMapEntry buffer;
+} ArtMapRangeIter;
+
+static void _ArtMapRangeIter_push(ArtMapRangeIter *this, const _ArtNode *node, int next)
+{
+    _ArtMapFrame frame = {.node = node, .next = next};
+    Vec_push(&this->stack, &frame);
+}
+
+// Bounds hold a Str
+void ArtMapRangeIter_new(ArtMapRangeIter *this, const ArtMap *map, const RangeBound *start, const RangeBound *end)
+{
+    this->map = map;
+    this->end = *end;
+    Vec_new(&this->stack, sizeof(_ArtMapFrame), NULL);
+
+    if (map->root == NULL)
+    {
+        return;
+    }
+
+    if (start->kind == RANGE_BOUND_KIND_UNBOUND)
+    {
+        _ArtMapRangeIter_push(this, map->root, -1);
+        return;
+    }
+
+    bool is_included = start->kind == RANGE_BOUND_KIND_INCLUDED;
+    Str key = *(const Str *)(is_included ? start->included.value : start->excluded.value);
+    const _ArtNode *current = map->root;
+    size_t depth = 0;
+
+    // walk down along key, leaving behind the part of each node that orders after it
+    while (current != NULL)
+    {
+        if (_ArtNode_is_leaf(current))
+        {
+            int32_t ordering = _ArtMap_compare_keys(_ArtMap_leaf_key(map, (const _ArtLeaf *)current), key);
+
+            if (ordering > 0 || (ordering == 0 && is_included))
+            {
+                _ArtMapRangeIter_push(this, current, -1);
+            }
+
+            return;
+        }
+
+        const uint8_t *prefix = _ArtMap_node_prefix(map, current, depth);
+
+        for (size_t i = 0; i < current->prefix_len; i++)
+        {
+            // the subtree is entirely after key if key is a prefix of it or its first differing byte is larger
+            if (depth + i == key.len || prefix[i] > key.ptr[depth + i])
+            {
+                _ArtMapRangeIter_push(this, current, -1);
+                return;
+            }
+
+            if (prefix[i] < key.ptr[depth + i])
+            {
+                return;
+            }
+        }
+
+        depth += current->prefix_len;
+
+        if (depth == key.len)
+        {
+            _ArtMapRangeIter_push(this, current, is_included ? -1 : 0);
+            return;
+        }
+
+        // the terminal leaf is a proper prefix of key and orders before it
+        uint8_t byte = key.ptr[depth];
+        _ArtMapRangeIter_push(this, current, byte + 1);
+
+        _ArtNode **child = _ArtNode_find_child((_ArtNode *)current, byte);
+
+        current = child != NULL ? *child : NULL;
+        depth++;
+    }
+}
+
+ArtMapEntry *ArtMapRangeIter_next(ArtMapRangeIter *this)
+{
+    while (Vec_len(&this->stack) > 0)
+    {
+        _ArtMapFrame *top = Vec_get_mut(&this->stack, Vec_len(&this->stack) - 1);
+        const _ArtLeaf *leaf = NULL;
+
+        if (top->next == -1)
+        {
+            leaf = _ArtNode_is_leaf(top->node) ? (const _ArtLeaf *)top->node : top->node->terminal;
+            top->next = 0;
+        }
+        else
+        {
+            int byte;
+            const _ArtNode *child = _ArtNode_is_leaf(top->node) ? NULL : _ArtNode_next_child(top->node, top->next, &byte);
+
+            if (child == NULL)
+            {
+                Vec_pop(&this->stack);
+                continue;
+            }
+
+            top->next = byte + 1;
+            _ArtMapRangeIter_push(this, child, -1);
+        }
+
+        if (leaf == NULL)
+        {
+            continue;
+        }
+
+        Str key = _ArtMap_leaf_key(this->map, leaf);
+
+        if (this->end.kind != RANGE_BOUND_KIND_UNBOUND)
+        {
+            bool is_included = this->end.kind == RANGE_BOUND_KIND_INCLUDED;
+            int32_t ordering = _ArtMap_compare_keys(key, *(const Str *)(is_included ? this->end.included.value : this->end.excluded.value));
+
+            if (ordering > 0 || (ordering == 0 && !is_included))
+            {
+                Vec_clear(&this->stack);
+                return NULL;
+            }
+        }
+
+        this->buffer.key = key;
+        this->buffer.value = _ArtMap_leaf_value(this->map, leaf);
+
+        return &this->buffer;
+    }
+
+    return NULL;
+}
+
+void ArtMapRangeIter_drop(ArtMapRangeIter *this)
+{
+    Vec_drop(&this->stack);
+}
+
+Iterator ArtMapRangeIter_iter(ArtMapRangeIter *this)
+{
+    return Iterator_new(
+        this,
+        &(IteratorProps){
+            .next = (IteratorNextFn)ArtMapRangeIter_next,
+        });
+}
+
+ArtMapRangeIter ArtMap_range(const ArtMap *this, const RangeBound *start, const RangeBound *end)
+{
+    ArtMapRangeIter iter;
+    ArtMapRangeIter_new(&iter, this, start, end);
+
+    return iter;
+}
+
+// [Regex]
+
+#include <stdint.h>
+
+typedef enum
+{
+    TOKEN_KIND_LITERAL,
+    TOKEN_KIND_CONCATENATION,
+    TOKEN_KIND_ALTERNATION,
+    TOKEN_KIND_ZERO_OR_ONE,
+    TOKEN_KIND_LAZY_ZERO_OR_ONE,
+    TOKEN_KIND_ZERO_OR_MORE,
+    TOKEN_KIND_LAZY_ZERO_OR_MORE,
+    TOKEN_KIND_ONE_OR_MORE,
+    TOKEN_KIND_LAZY_ONE_OR_MORE,
+    TOKEN_KIND_LEFT_PARENS,
+    TOKEN_KIND_RIGHT_PARENS,
+} TokenKind;
+
+typedef struct
+{
+    TokenKind kind;
+
+    union
+    {
+        struct
+        {
+            uint8_t c;
+        } literal;
+    };
+} Token;
+
+typedef enum
+{
+    STATE_KIND_LITERAL,
+    STATE_KIND_SPLIT,
+    STATE_KIND_TAG,
+    STATE_KIND_MATCH,
+} StateKind;
+
+typedef struct _State
+{
+    StateKind kind;
+
+    union
+    {
+        struct
+        {
+            uint8_t c;
+            struct _State *out;
+        } literal;
+
+        struct
+        {
+            struct _State *out1;
+            struct _State *out2;
+        } split;
+
+        struct
+        {
+            size_t id;
+            bool is_start;
+            struct _State *out;
+        } tag;
+    };
+} State;
+
+typedef State **OutList;
+
+OutList OutList_new(State **out)
+{
+    *out = NULL;
+    return out;
+}
+
+OutList OutList_append(OutList this, OutList other)
+{
+    OutList current;
+    for (current = this; *current != NULL; current = (OutList)*current)
+        ;
+
+    *current = (State *)other;
+
+    return this;
+}
+
+void OutList_patch(OutList this, State *to)
+{
+    for (OutList current = this; current != NULL;)
+    {
+        OutList next = (OutList)*current;
+        *current = to;
+        current = next;
+    }
+}
+
+typedef struct
+{
+    State *start;
+    OutList out_list;
+} Fragment;
+
+typedef struct
+{
+    Vec states;
+    State *start;
+    size_t tag_count;
+    size_t match_idx;
+} NFA;
+
+bool NFA_can_start_expr(const Token *token)
+{
+    switch (token->kind)
+    {
+    case TOKEN_KIND_LITERAL:
+    case TOKEN_KIND_LEFT_PARENS:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool NFA_can_end_expr(const Token *token)
+{
+    switch (token->kind)
+    {
+    case TOKEN_KIND_LITERAL:
+    case TOKEN_KIND_RIGHT_PARENS:
+    case TOKEN_KIND_ZERO_OR_ONE:
+    case TOKEN_KIND_LAZY_ZERO_OR_ONE:
+    case TOKEN_KIND_ZERO_OR_MORE:
+    case TOKEN_KIND_LAZY_ZERO_OR_MORE:
+    case TOKEN_KIND_ONE_OR_MORE:
+    case TOKEN_KIND_LAZY_ONE_OR_MORE:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+size_t NFA_get_oper_precedence(const Token *token)
+{
+    switch (token->kind)
+    {
+    case TOKEN_KIND_ZERO_OR_ONE:
+    case TOKEN_KIND_LAZY_ZERO_OR_ONE:
+    case TOKEN_KIND_ZERO_OR_MORE:
+    case TOKEN_KIND_LAZY_ZERO_OR_MORE:
+    case TOKEN_KIND_ONE_OR_MORE:
+    case TOKEN_KIND_LAZY_ONE_OR_MORE:
+        return 3;
+
+    case TOKEN_KIND_CONCATENATION:
+        return 2;
+
+    case TOKEN_KIND_ALTERNATION:
+        return 1;
+
+    default:
+        assert(false);
+        return 0;
+    }
+}
+
+Vec NFA_to_postfix(Vec *tokens)
+{
+    VecDeque stack;
+    VecDeque_new(&stack, &(VecDequeElementProps){.size = sizeof(Token)});
+
+    Vec postfix;
+    Vec_new(&postfix, sizeof(Token), &(VecElementOps){});
+
+    for (size_t i = 0; i < Vec_len(tokens); i++)
+    {
+        const Token *token = Vec_get(tokens, i);
+
+        switch (token->kind)
+        {
+        case TOKEN_KIND_LITERAL:
+            Vec_push(&postfix, token);
+            break;
+
+        case TOKEN_KIND_LEFT_PARENS:
+        {
+            Vec_push(&postfix, token);
+            VecDeque_push_back(&stack, token);
+        }
+        break;
+
+        case TOKEN_KIND_RIGHT_PARENS:
+        {
+            const Token *back = VecDeque_back(&stack);
+
+            while (back != NULL && back->kind != TOKEN_KIND_LEFT_PARENS)
+            {
+                Vec_push(&postfix, back);
+
+                VecDeque_pop_back(&stack);
+                back = VecDeque_back(&stack);
+            }
+
+            VecDeque_pop_back(&stack);
+
+            Vec_push(&postfix, token);
+        }
+        break;
+
+        default:
+        {
+            for (const Token *back = VecDeque_back(&stack); back != NULL && back->kind != TOKEN_KIND_LEFT_PARENS; back = VecDeque_back(&stack))
+            {
+                if ((NFA_get_oper_precedence(back) < NFA_get_oper_precedence(token)))
+                {
+                    break;
+                }
+
+                Vec_push(&postfix, back);
+
+                VecDeque_pop_back(&stack);
+            }
+
+            VecDeque_push_back(&stack, token);
+        }
+        }
+    }
+
+    for (const Token *back = VecDeque_back(&stack); back != NULL; back = VecDeque_back(&stack))
+    {
+        Vec_push(&postfix, back);
+
+        VecDeque_pop_back(&stack);
+    }
+
+    VecDeque_drop(&stack);
+
+    return postfix;
+}
+
+Vec NFA_tokenize(const String *regex)
+{
+    Vec tokens;
+    Vec_new(&tokens, sizeof(Token), &(VecElementOps){});
+
+    for (size_t i = 0; i < String_len(regex); i++)
+    {
+        switch (String_get(regex, i))
+        {
+        case '|':
+            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ALTERNATION});
+            break;
+
+        case '?':
+        {
+            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+
+            if (is_lazy)
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ZERO_OR_ONE});
+                i += 1;
+            }
+            else
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ZERO_OR_ONE});
+            }
+        }
+        break;
+
+        case '*':
+        {
+            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+
+            if (is_lazy)
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ZERO_OR_MORE});
+                i += 1;
+            }
+            else
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ZERO_OR_MORE});
+            }
+        }
+        break;
+
+        case '+':
+        {
+            bool is_lazy = i + 1 < String_len(regex) && String_get(regex, i + 1) == '?';
+
+            if (is_lazy)
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LAZY_ONE_OR_MORE});
+                i += 1;
+            }
+            else
+            {
+                Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_ONE_OR_MORE});
+            }
+        }
+        break;
+
+        case '(':
+            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_LEFT_PARENS});
+            break;
+
+        case ')':
+            Vec_push(&tokens, &(Token){.kind = TOKEN_KIND_RIGHT_PARENS});
+            break;
+
+        case '\\':
+        {
+            i += 1;
+
+            Vec_push(
+                &tokens,
+                &(Token){
+                    .kind = TOKEN_KIND_LITERAL,
+                    .literal = {
+                        .c = String_get(regex, i),
+                    },
+                });
+        }
+        break;
+
+        default:
+        {
+            Vec_push(
+                &tokens,
+                &(Token){
+                    .kind = TOKEN_KIND_LITERAL,
+                    .literal = {
+                        .c = String_get(regex, i),
+                    },
+                });
+        }
+        }
+    }
+
+    // insert concatenation markers
+
+    for (size_t i = 1; i < Vec_len(&tokens); i++)
+    {
+        if (NFA_can_end_expr(Vec_get(&tokens, i - 1)) && NFA_can_start_expr(Vec_get(&tokens, i)))
+        {
+            Vec_insert(&tokens, i, &(Token){.kind = TOKEN_KIND_CONCATENATION});
+            i += 1;
+        }
+    }
+
+    Vec postfix = NFA_to_postfix(&tokens);
+
+    Vec_drop(&tokens);
+
+    return postfix;
+}
+
+NFA NFA_from_str(const String *str)
+{
+    Vec tokens = NFA_tokenize(str);
+
+    Vec states;
+    Vec_with_capacity(&states, sizeof(State), &(VecElementOps){}, Vec_len(&tokens) + 1);
+
+    VecDeque fragment_stack;
+    VecDeque_new(&fragment_stack, &(VecDequeElementProps){.size = sizeof(Fragment)});
+
+    size_t tag_count = 0;
+
+    for (size_t i = 0; i < Vec_len(&tokens); i++)
+    {
+        const Token *token = Vec_get(&tokens, i);
+
+        switch (token->kind)
+        {
+        case TOKEN_KIND_LITERAL:
+        {
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_LITERAL,
+                    .literal = {
+                        .c = token->literal.c,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_new((State **)&new->literal.out),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_LEFT_PARENS:
+        {
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_TAG,
+                    .tag = {
+                        .id = tag_count,
+                        .is_start = true,
+                    },
+                });
+
+            tag_count += 1;
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_new((State **)&new->tag.out),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_RIGHT_PARENS:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Fragment start_tag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            OutList_patch(start_tag.out_list, frag.start);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_TAG,
+                    .tag = {
+                        .id = start_tag.start->tag.id,
+                        .is_start = false,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            OutList_patch(frag.out_list, new);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = start_tag.start,
+                    .out_list = OutList_new((State **)&new->tag.out),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_CONCATENATION:
+        {
+            Fragment frag2 = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Fragment frag1 = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            OutList_patch(frag1.out_list, frag2.start);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = frag1.start,
+                    .out_list = frag2.out_list,
+                });
+        }
+        break;
+
+        case TOKEN_KIND_ALTERNATION:
+        {
+            Fragment frag2 = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Fragment frag1 = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out1 = frag1.start,
+                        .out2 = frag2.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_append(frag1.out_list, frag2.out_list),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_ZERO_OR_ONE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out1 = frag.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_append(frag.out_list, OutList_new(&new->split.out2)),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_LAZY_ZERO_OR_ONE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out2 = frag.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_append(frag.out_list, OutList_new(&new->split.out1)),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_ZERO_OR_MORE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out1 = frag.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            OutList_patch(frag.out_list, new);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_new(&new->split.out2),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_LAZY_ZERO_OR_MORE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out2 = frag.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            OutList_patch(frag.out_list, new);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = new,
+                    .out_list = OutList_new(&new->split.out1),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_ONE_OR_MORE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
                     .kind = STATE_KIND_SPLIT,
                     .split = {
                         .out1 = frag.start,
                     },
                 });
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            OutList_patch(frag.out_list, new);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = frag.start,
+                    .out_list = OutList_new(&new->split.out2),
+                });
+        }
+        break;
+
+        case TOKEN_KIND_LAZY_ONE_OR_MORE:
+        {
+            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+            VecDeque_pop_back(&fragment_stack);
+
+            Vec_push(
+                &states,
+                &(State){
+                    .kind = STATE_KIND_SPLIT,
+                    .split = {
+                        .out2 = frag.start,
+                    },
+                });
+
+            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+
+            OutList_patch(frag.out_list, new);
+
+            VecDeque_push_back(
+                &fragment_stack,
+                &(Fragment){
+                    .start = frag.start,
+                    .out_list = OutList_new(&new->split.out1),
+                });
+        }
+        break;
+
+        default:
+            assert(false);
+        }
+    }
+
+    Vec_push(&states, &(State){.kind = STATE_KIND_MATCH});
+
+    size_t match_idx = Vec_len(&states) - 1;
+    State *new = Vec_get_mut(&states, match_idx);
+    Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
+    OutList_patch(frag.out_list, new);
+
+    return (NFA){
+        .states = states,
+        .start = frag.start,
+        .tag_count = tag_count,
+        .match_idx = match_idx,
+    };
+}
+
+size_t NFA_state_idx(NFA *this, State *state)
+{
+    return ((uint8_t *)(state) - (uint8_t *)(Vec_get(&this->states, 0))) / this->states.element_size;
+}
+
+void NFA_drop(NFA *this)
+{
+    Vec_drop(&this->states);
+}
+
+typedef struct
+{
+    NFA nfa;
+} Regex;
+
+Regex Regex_new(const String *regex)
+{
+    return (Regex){
+        .nfa = NFA_from_str(regex),
+    };
+}
+
+typedef struct
+{
+    size_t start;
+    size_t end;
+} Capture;
+
+typedef struct
+{
+    uint8_t *splits;
+    size_t split_count;
+    size_t split_capacity;
+    Capture *tags;
+    size_t tag_capacity;
+} ThreadHistory;
+
+typedef struct
+{
+    State *state;
+    ThreadHistory history;
+} Thread;
+
+Thread Thread_new(State *state, size_t tag_capacity)
+{
+    Thread this = {
+        .state = state,
+    };
+
+    this.history.split_count = 0;
+    this.history.split_capacity = 64;
+    this.history.splits = malloc(this.history.split_capacity * sizeof(this.history.splits));
+
+    this.history.tag_capacity = tag_capacity;
+
+    if (tag_capacity)
+    {
+        this.history.tags = malloc(this.history.tag_capacity * sizeof(*this.history.tags));
+
+        for (size_t i = 0; i < this.history.tag_capacity; i++)
+        {
+            this.history.tags[i].start = SIZE_MAX;
+            this.history.tags[i].end = SIZE_MAX;
+        }
+    }
+
+    return this;
+}
+
+Thread Thread_clone(const Thread *other)
+{
+    Thread this = {
+        .state = other->state,
+        .history = {
+            .split_count = other->history.split_count,
+            .split_capacity = other->history.split_capacity,
+            .tag_capacity = other->history.tag_capacity,
+        },
+    };
+
+    this.history.splits = malloc(this.history.split_capacity * sizeof(this.history.splits));
+    memcpy(this.history.splits, other->history.splits, other->history.split_count * sizeof(this.history.splits));
+
+    if (this.history.tag_capacity)
+    {
+        this.history.tags = malloc(this.history.tag_capacity * sizeof(*this.history.tags));
+        memcpy(this.history.tags, other->history.tags, other->history.tag_capacity * sizeof(*this.history.tags));
+    }
+
+    return this;
+}
+
+void Thread_push_split(Thread *this, uint8_t split)
+{
+    if (this->history.split_count == this->history.split_capacity)
+    {
+        this->history.split_capacity *= 2;
+        this->history.splits = realloc(this->history.splits, this->history.split_capacity * sizeof(*this->history.splits));
+    }
+
+    this->history.splits[this->history.split_count] = split;
+    this->history.split_count += 1;
+}
+
+bool Thread_new_is_better(const Thread *this, const Thread *new)
+{
+    for (size_t i = 0; i < this->history.split_count; i++)
+    {
+        if (new->history.splits[i] > this->history.splits[i])
+        {
+            return true;
+        }
+        else if (new->history.splits[i] < this->history.splits[i])
+        {
+            return false;
+        }
+    }
+
+    // prevent cycles as in (.?)*:
+    //
+    // Split₀
+    // ├── out1 → Split₁
+    // │           ├── out1 → '.' → back to Split₀
+    // │           └── out2 → back to Split₀
+    // └── out2 → Match
+    //
+    // when the e-closure cycles back to the original state, it will have the original state's history as it's prefix. We see this and keep
+    // the original state. Since the e-closure computes the concrete states reachable from the original state and it is already being processed
+    // earlier in the e-closure, we can simply discard the recursive call
+
+    return false;
+}
+
+void Thread_set_tag(Thread *this, size_t id, bool is_start, size_t pos)
+{
+    if (is_start)
+    {
+        this->history.tags[id].start = pos;
+    }
+    else
+    {
+        this->history.tags[id].end = pos;
+    }
+}
+
+void Thread_drop(Thread *this)
+{
+    free(this->history.splits);
+
+    if (this->history.tag_capacity)
+    {
+        free(this->history.tags);
+    }
+}
+
+void Regex_e_closure(Regex *this, size_t pos, Thread *new, Vec *visited, Vec *list)
+{
+    size_t idx = NFA_state_idx(&this->nfa, new->state);
+    uint8_t *already_visited = (uint8_t *)Vec_get_mut(visited, idx);
+
+    if (*already_visited == 1)
+    {
+        Thread *old = (Thread *)Vec_get_mut(list, idx);
+
+        if (Thread_new_is_better(old, new))
+        {
+            Thread_drop(old);
+        }
+        else
+        {
+            Thread_drop(new);
+            return;
+        }
+    }
+
+    *already_visited = 1;
+    *(Thread *)Vec_get_mut(list, idx) = *new;
+
+    switch (new->state->kind)
+    {
+    case STATE_KIND_SPLIT:
+    {
+        Thread t1 = Thread_clone(new);
+        t1.state = new->state->split.out1;
+        Thread_push_split(&t1, 1);
+        Regex_e_closure(this, pos, &t1, visited, list);
+
+        Thread t2 = Thread_clone(new);
+        t2.state = new->state->split.out2;
+        Thread_push_split(&t2, 0);
+        Regex_e_closure(this, pos, &t2, visited, list);
+    }
+    break;
+
+    case STATE_KIND_TAG:
+    {
+        Thread t = Thread_clone(new);
+        t.state = new->state->tag.out;
+        Thread_set_tag(&t, new->state->tag.id, new->state->tag.is_start, pos);
+        Regex_e_closure(this, pos, &t, visited, list);
+    }
+    break;
+
+    default:
+        break;
+    }
+}
+
+void Regex_step(Regex *this, size_t pos, uint8_t c, Vec *current_visited, Vec *current_list, Vec *next_visited, Vec *next_list)
+{
+    memset(Vec_get_mut(next_visited, 0), 0, Vec_len(next_visited) * sizeof(uint8_t));
+
+    for (size_t i = 0; i < Vec_len(current_visited); i++)
+    {
+        if (*(uint8_t *)Vec_get(current_visited, i) == 1)
+        {
+            Thread *t = (Thread *)Vec_get(current_list, i);
+
+            if (t->state->kind == STATE_KIND_LITERAL && c == t->state->literal.c)
+            {
+                Thread new = Thread_clone(t);
+                new.state = t->state->literal.out;
+                Regex_e_closure(this, pos, &new, next_visited, next_list);
+            }
+
+            Thread_drop(t);
+        }
+    }
+
+    SWAP(*current_list, *next_list);
+    SWAP(*current_visited, *next_visited);
+}
+
+bool Regex_match(Regex *this, const String *str, Vec *captures)
+{
+    size_t state_count = Vec_len(&this->nfa.states);
+
+    Vec current_list;
+    Vec_with_capacity(&current_list, sizeof(Thread), &(VecElementOps){}, state_count);
+    Vec_set_len(&current_list, state_count);
+
+    Vec current_visited;
+    Vec_with_capacity(&current_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
+    Vec_set_len(&current_visited, state_count);
+
+    Vec next_list;
+    Vec_with_capacity(&next_list, sizeof(Thread), &(VecElementOps){}, state_count);
+    Vec_set_len(&next_list, state_count);
+
+    Vec next_visited;
+    Vec_with_capacity(&next_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
+    Vec_set_len(&next_visited, state_count);
+
+    memset(Vec_get_mut(&current_visited, 0), 0, Vec_len(&current_visited) * sizeof(uint8_t));
+
+    Thread start = Thread_new(this->nfa.start, this->nfa.tag_count);
+    Regex_e_closure(this, 0, &start, &current_visited, &current_list);
+
+    for (size_t i = 0; i < String_len(str); i++)
+    {
+        uint8_t c = String_get(str, i);
+        Regex_step(this, i + 1, c, &current_visited, &current_list, &next_visited, &next_list);
+
+        bool has_any = false;
+        for (size_t j = 0; j < Vec_len(&current_visited); j++)
+        {
+            if (*(uint8_t *)Vec_get(&current_visited, j) == 1)
+            {
+                has_any = true;
+                break;
+            }
+        }
+
+        if (!has_any)
+        {
+            break;
+        }
+    }
+
+    bool has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
+
+    if (has_match && this->nfa.tag_count != 0)
+    {
+        Vec_with_capacity(captures, sizeof(Capture), &(VecElementOps){}, this->nfa.tag_count);
+
+        const Thread *thread = Vec_get(&current_list, this->nfa.match_idx);
+
+        for (size_t j = 0; j < this->nfa.tag_count; j++)
+        {
+            Vec_push(captures, &thread->history.tags[j]);
+        }
+    }
+
+    Vec_drop(&current_list);
+    Vec_drop(&current_visited);
+    Vec_drop(&next_list);
+    Vec_drop(&next_visited);
+
+    return has_match;
+}
+
+void Regex_search(Regex *this, const String *str, size_t *match_start, size_t *match_end, Vec *captures)
+{
+    size_t state_count = Vec_len(&this->nfa.states);
+
+    Vec current_list;
+    Vec_with_capacity(&current_list, sizeof(Thread), &(VecElementOps){}, state_count);
+    Vec_set_len(&current_list, state_count);
+
+    Vec current_visited;
+    Vec_with_capacity(&current_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
+    Vec_set_len(&current_visited, state_count);
+
+    Vec next_list;
+    Vec_with_capacity(&next_list, sizeof(Thread), &(VecElementOps){}, state_count);
+    Vec_set_len(&next_list, state_count);
+
+    Vec next_visited;
+    Vec_with_capacity(&next_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
+    Vec_set_len(&next_visited, state_count);
+
+    for (size_t s = 0; s < String_len(str); s++)
+    {
+        memset(Vec_get_mut(&current_visited, 0), 0, Vec_len(&current_visited) * sizeof(uint8_t));
+
+        Thread best_match;
+        size_t best_match_end;
+        bool has_best_match = false;
+
+        Thread start = Thread_new(this->nfa.start, this->nfa.tag_count);
+        Regex_e_closure(this, s, &start, &current_visited, &current_list);
+
+        bool has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
+
+        if (has_match)
+        {
+            best_match = Thread_clone(Vec_get(&current_list, this->nfa.match_idx));
+            best_match_end = s;
+        }
+
+        for (size_t i = s; i < String_len(str); i++)
+        {
+            uint8_t c = String_get(str, i);
+            Regex_step(this, i + 1, c, &current_visited, &current_list, &next_visited, &next_list);
+
+            bool has_any = false;
+            for (size_t j = 0; j < Vec_len(&current_visited); j++)
+            {
+                if (*(uint8_t *)Vec_get(&current_visited, j) == 1)
+                {
+                    has_any = true;
+                    break;
+                }
+            }
+
+            if (!has_any)
+            {
+                break;
+            }
+
+            has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
+
+            if (has_match)
+            {
+                const Thread *new = Vec_get(&current_list, this->nfa.match_idx);
+
+                if (has_best_match)
+                {
+                    if (Thread_new_is_better(&best_match, new))
+                    {
+                        Thread_drop(&best_match);
+
+                        best_match = Thread_clone(new);
+                        best_match_end = i + 1;
+                    }
+                }
+                else
+                {
+                    has_best_match = true;
+                    best_match = Thread_clone(new);
+                    best_match_end = i + 1;
+                }
+            }
+        }
+
+        if (has_best_match)
+        {
+            *match_start = s;
+            *match_end = best_match_end;
+
+            Vec_with_capacity(captures, sizeof(Capture), &(VecElementOps){}, this->nfa.tag_count);
+
+            for (size_t j = 0; j < this->nfa.tag_count; j++)
+            {
+                Vec_push(captures, &best_match.history.tags[j]);
+            }
+
+            Thread_drop(&best_match);
+
+            break;
+        }
+    }
+
+    Vec_drop(&current_list);
+    Vec_drop(&current_visited);
+    Vec_drop(&next_list);
+    Vec_drop(&next_visited);
+}
+
+void Regex_drop(Regex *this)
+{
+    NFA_drop(&this->nfa);
+}
+
+bool eq_u8(const uint8_t *a, const uint8_t *b)
+{
+    return *a == *b;
+}
+
+void hash_u8(const uint8_t *key, Hasher *hasher)
+{
+    Hasher_write(hasher, key, sizeof(uint8_t));
+}
+
+int32_t compare_u8(const uint8_t *a, const uint8_t *b)
+{
+    if (*a > *b)
+    {
+        return 1;
+    }
+    else if (*a == *b)
+    {
+        return 0;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+int32_t compare_u64(const uint64_t *a, const uint64_t *b)
+{
+    if (*a > *b)
+    {
+        return 1;
+    }
+    else if (*a == *b)
+    {
+        return 0;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+int32_t compare_cstr(char *const *a, char *const *b)
+{
+    return strcmp(*a, *b);
+}
+
+void drop_cstr(char **ptr)
+{
+    free(*ptr);
+}
+
+int32_t compare_str(const Str *a, const Str *b)
+{
+    int result = memcmp(a->ptr, b->ptr, MIN(a->len, b->len));
+
+    if (result != 0)
+    {
+        return result < 0 ? -1 : 1;
+    }
+
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+uint64_t prefix_str(const Str *key)
+{
+    return BTreeMap_bytes_prefix(key->ptr, key->len);
+}
+
+// Asserts that range yields exactly the entries of the same range of expected
+void check_art_map_range(const ArtMap *map, const BTreeMap *expected, const RangeBound *start, const RangeBound *end)
+{
+    ArtMapRangeIter it = ArtMap_range(map, start, end);
+    BTreeMapRangeIter expected_it = BTreeMap_range(expected, start, end);
+
+    for (ArtMapEntry *entry = ArtMapRangeIter_next(&it); entry != NULL; entry = ArtMapRangeIter_next(&it))
+    {
+        BTreeMapEntry *expected_entry = BTreeMapRangeIter_next(&expected_it);
+
+        assert(expected_entry != NULL);
+        assert(compare_str(&entry->key, expected_entry->key) == 0);
+        assert(*(uint64_t *)entry->value == *(uint64_t *)expected_entry->value);
+    }
+
+    assert(BTreeMapRangeIter_next(&expected_it) == NULL);
+
+    ArtMapRangeIter_drop(&it);
+}
+
+// Asserts the B-tree invariants below node and returns its height
+size_t check_btreemap_node(const BTreeMap *map, const _BTreeMapNode *node)
+{
+    assert(node->key_count < map->layout.max_key_count);
+    assert(node->parent == NULL || node->key_count >= map->layout.min_key_count);
+
+    for (size_t i = 1; i < node->key_count; i++)
+    {
+        BTreeMapEntry previous = BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new((_BTreeMapNode *)node, i - 1), map);
+        BTreeMapEntry current = BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new((_BTreeMapNode *)node, i), map);
+        assert(map->key_props.cmp(previous.key, current.key) < 0);
+    }
+
+    for (size_t i = 0; map->key_props.prefix != NULL && i < node->key_count; i++)
+    {
+        BTreeMapEntry entry = BTreeMapEntryPos_to_entry(BTreeMapEntryPos_new((_BTreeMapNode *)node, i), map);
+        assert(_BTreeMap_prefixes(map, node)[i] == map->key_props.prefix(entry.key));
+    }
+
+    if (node->is_leaf)
+    {
+        return 1;
+    }
+
+    size_t height = 0;
+
+    for (size_t i = 0; i < node->key_count + 1; i++)
+    {
+        assert(node->children[i]->parent == node);
+        assert(!map->layout.has_order_statistics || _BTreeMap_child_lens(map, node)[i] == _BTreeMap_recount(map, node->children[i]));
+
+        size_t child_height = check_btreemap_node(map, node->children[i]);
+        assert(height == 0 || height == child_height);
+        height = child_height;
+    }
+
+    return height + 1;
+}
+
+// Asserts the chunk invariants of list and that it holds exactly the uint64_t elements of expected
+void check_unrolled_linked_list(UnrolledLinkedList *list, const Vec *expected)
+{
+    assert(UnrolledLinkedList_len(list) == Vec_len(expected));
+    assert((list->head == NULL) == (list->tail == NULL));
+
+    size_t idx = 0;
+
+    for (UnrolledLinkedListNode *node = list->head; node != NULL; node = node->next)
+    {
+        assert(node->count > 0 && node->start + node->count <= list->capacity);
+        assert(node->previous == NULL ? list->head == node : node->previous->next == node);
+        assert(node->next == NULL ? list->tail == node : node->next->previous == node);
+
+        for (size_t i = 0; i < node->count; i++, idx++)
+        {
+            assert(*(uint64_t *)_UnrolledLinkedList_element(list, node, i) == *(uint64_t *)Vec_get(expected, idx));
+        }
+    }
+
+    assert(idx == Vec_len(expected));
+
+    UnrolledLinkedListIter it = UnrolledLinkedList_iter(list);
+    Iterator iter = UnrolledLinkedListIter_iter(&it);
+
+    for (size_t i = Vec_len(expected); i > 0; i--)
+    {
+        assert(*(uint64_t *)iter.props.next_back(iter.concrete) == *(uint64_t *)Vec_get(expected, i - 1));
+    }
+
+    assert(iter.props.next(iter.concrete) == NULL);
+}
+
+// Asserts that the links of list agree in both directions and that it holds exactly the uint64_t elements of expected
+void check_linked_list(const LinkedList *list, const uint64_t *expected, size_t len)
+{
+    assert(LinkedList_len(list) == len);
+    assert((list->head == NULL) == (list->tail == NULL));
+
+    size_t idx = 0;
+
+    for (LinkedListNode *node = list->head; node != NULL; node = node->next, idx++)
+    {
+        assert(node->previous == NULL ? list->head == node : node->previous->next == node);
+        assert(node->next == NULL ? list->tail == node : node->next->previous == node);
+        assert(idx < len && *(uint64_t *)_LinkedListNode_get_data(node) == expected[idx]);
+    }
+
+    assert(idx == len);
+}
+
+typedef struct
+{
+    uint64_t key;
+    LinkedListNode lru;
+} LruEntry;
+
+typedef struct
+{
+    TimerWheelTimer timer;
+    size_t id;
+} TestTimer;
+
+// Asserts the heap order of a heap of uint64_t and, with handles, that every handle knows its element's position
+void check_binary_heap(const BinaryHeap *heap)
+{
+    for (size_t i = 1; i < BinaryHeap_len(heap); i++)
+    {
+        assert(*(uint64_t *)_BinaryHeap_get(heap, i) <= *(uint64_t *)_BinaryHeap_get(heap, (i - 1) / heap->arity));
+    }
+
+    for (size_t i = 0; heap->has_handles && i < BinaryHeap_len(heap); i++)
+    {
+        BinaryHeapHandle handle = _BinaryHeap_handle_of(heap, _BinaryHeap_get(heap, i));
+        assert(*(size_t *)Vec_get(&heap->positions, handle) == i);
+    }
+}
+
+void drop_nop(void *ptr)
+{
+    (void)ptr;
+}
+
+void add_size(void *ctx, size_t *accumulator, const size_t *element)
+{
+    (void)ctx;
+    *accumulator += *element;
+}
+
+void add_size_atomic(atomic_size_t *accumulator, const size_t *element)
+{
+    atomic_fetch_add(accumulator, *element);
+}
+
+void add_btreemap_entry_u8_key(void *ctx, size_t *accumulator, const BTreeMapEntry *entry)
+{
+    (void)ctx;
+    *accumulator += *(uint8_t *)entry->key;
+}
+
+// Sums the keys of a snapshot many times over while another thread keeps changing the map it was taken from
+int sum_persistent_btreemap_keys(PersistentBTreeMap *snapshot)
+{
+    uint64_t expected = 0;
+
+    for (int round = 0; round < 50; round++)
+    {
+        RangeBound unbound = RangeBound_unbound(NULL);
+        PersistentBTreeMapRangeIter it = PersistentBTreeMap_range(snapshot, &unbound, &unbound);
+        uint64_t sum = 0;
+        for (BTreeMapEntry *entry = PersistentBTreeMapRangeIter_next(&it); entry != NULL; entry = PersistentBTreeMapRangeIter_next(&it))
+        {
+            sum += *(uint64_t *)entry->key;
+        }
+        PersistentBTreeMapRangeIter_drop(&it);
+
+        if (round > 0 && sum != expected)
+        {
+            return 1;
+        }
+        expected = sum;
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    ConcurrentBTreeMap *map;
+    uint64_t first;
+    uint64_t stride;
+    uint64_t count;
+} ConcurrentBTreeMapWorker;
+
+// Inserts its share of the keys, removes every other one again, and checks what it can see along the way
+int run_concurrent_btreemap_writer(ConcurrentBTreeMapWorker *worker)
+{
+    for (uint64_t i = 0; i < worker->count; i++)
+    {
+        uint64_t key = worker->first + i * worker->stride;
+        uint64_t value = key * 2;
+        ConcurrentBTreeMap_insert(worker->map, &key, &value);
+
+        if (!ConcurrentBTreeMap_get(worker->map, &key, &value) || value != key * 2)
+        {
+            return 1;
+        }
+    }
+
+    for (uint64_t i = 0; i < worker->count; i += 2)
+    {
+        uint64_t key = worker->first + i * worker->stride;
+
+        if (!ConcurrentBTreeMap_remove(worker->map, &key))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Scans the map while writers change it; the entries seen must always be ascending and consistent
+int run_concurrent_btreemap_scanner(ConcurrentBTreeMapWorker *worker)
+{
+    uint64_t keys[64];
+    uint64_t values[64];
+
+    for (uint64_t i = 0; i < worker->count; i++)
+    {
+        uint64_t start = (i * 7919) % 40000;
+        RangeBound lower = RangeBound_included(&start);
+        size_t count = ConcurrentBTreeMap_scan(worker->map, &lower, 64, keys, values);
+
+        for (size_t j = 0; j < count; j++)
+        {
+            if (keys[j] < start || values[j] != keys[j] * 2 || (j > 0 && keys[j] <= keys[j - 1]))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    MpmcQueue *queue;
+    uint64_t idx;
+    uint64_t count;
+    uint64_t sum;
+} MpmcQueueWorker;
+
+// Pushes its index in the high half and a running counter in the low half, spinning while the queue is full
+int run_mpmc_queue_producer(MpmcQueueWorker *worker)
+{
+    for (uint64_t i = 0; i < worker->count; i++)
+    {
+        uint64_t value = worker->idx << 32 | i;
+        while (!MpmcQueue_try_push(worker->queue, &value))
+        {
+            thrd_yield();
+        }
+    }
+
+    return 0;
+}
+
+// Pops its share of the elements, the counters of each producer must come out in the order they were pushed
+int run_mpmc_queue_consumer(MpmcQueueWorker *worker)
+{
+    uint64_t next[8] = {0};
+
+    for (uint64_t i = 0; i < worker->count; i++)
+    {
+        uint64_t value;
+        while (!MpmcQueue_try_pop(worker->queue, &value))
+        {
+            thrd_yield();
+        }
+
+        uint64_t producer = value >> 32;
+        uint64_t counter = value & UINT32_MAX;
+        if (producer >= 8 || counter < next[producer])
+        {
+            return 1;
+        }
+
+        next[producer] = counter + 1;
+        worker->sum += counter;
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    WorkStealingDeque *deque;
+    atomic_bool *is_done;
+    uint64_t sum;
+    uint64_t count;
+} WorkStealingDequeThief;
+
+// Steals until the owner is done and the deque has run dry
+int run_work_stealing_deque_thief(WorkStealingDequeThief *thief)
+{
+    while (true)
+    {
+        bool is_done = atomic_load(thief->is_done);
+        uint64_t value;
+        WorkStealingDequeSteal result = WorkStealingDeque_steal(thief->deque, &value);
+
+        if (result == WORK_STEALING_DEQUE_STEAL_SUCCESS)
+        {
+            thief->sum += value;
+            thief->count++;
+        }
+        else if (result == WORK_STEALING_DEQUE_STEAL_EMPTY)
+        {
+            if (is_done)
+            {
+                return 0;
+            }
+
+            thrd_yield();
+        }
+    }
+}
+
+#include <stdio.h>
+#include <time.h>
+
+double bench_elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Keys are a bijection of 0..count, so they arrive in a scrambled order but are known to be distinct
+uint64_t bench_key(size_t i)
+{
+    return (uint64_t)i * 0x9E3779B97F4A7C15ull;
+}
+
+void bench_btreemap(size_t count)
+{
+    struct
+    {
+        const char *name;
+        size_t t;
+        BTreeMapKeyKind kind;
+    } configs[] = {
+        {"t=3, cmp", 3, BTREEMAP_KEY_KIND_OPAQUE},
+        {"default t, cmp", 0, BTREEMAP_KEY_KIND_OPAQUE},
+        {"default t, u64", 0, BTREEMAP_KEY_KIND_U64},
+    };
+
+    printf("BTreeMap<u64, u64>, %zu keys\n", count);
+    printf("%-16s %4s %10s %10s %10s\n", "config", "t", "insert", "get", "range");
+
+    for (size_t c = 0; c < SIZE(configs); c++)
+    {
+        BTreeMap map;
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+            .kind = configs[c].kind,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        if (configs[c].t == 0)
+        {
+            BTreeMap_new(&map, &key_props, &value_props);
+        }
+        else
+        {
+            BTreeMap_with_branching_factor(&map, &key_props, &value_props, configs[c].t);
+        }
+
+        struct timespec start;
+
+        timespec_get(&start, TIME_UTC);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key(i);
+            BTreeMap_insert(&map, &key, &i);
+        }
+        double insert = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        uint64_t checksum = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key((i * 7919) % count);
+            checksum += *(const uint64_t *)BTreeMap_get(&map, &key);
+        }
+        double get = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        RangeBound unbound = RangeBound_unbound(NULL);
+        BTreeMapRangeIter it = BTreeMap_range(&map, &unbound, &unbound);
+        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&it); entry != NULL; entry = BTreeMapRangeIter_next(&it))
+        {
+            checksum += *(uint64_t *)entry->value;
+        }
+        double range = bench_elapsed(&start);
+
+        printf("%-16s %4zu %9.3fs %9.3fs %9.3fs (checksum %llu)\n", configs[c].name, BTreeMap_branching_factor(&map), insert, get, range, (unsigned long long)checksum);
+
+        timespec_get(&start, TIME_UTC);
+        BTreeMap_compact(&map);
+        double compact = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key((i * 7919) % count);
+            checksum += *(const uint64_t *)BTreeMap_get(&map, &key);
+        }
+        get = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        it = BTreeMap_range(&map, &unbound, &unbound);
+        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&it); entry != NULL; entry = BTreeMapRangeIter_next(&it))
+        {
+            checksum += *(uint64_t *)entry->value;
+        }
+        range = bench_elapsed(&start);
+
+        printf("%-16s %4s %9.3fs %9.3fs %9.3fs (after BTreeMap_compact, which took the first column)\n", "", "", compact, get, range);
+
+        BTreeMap_drop(&map);
+    }
+}
+
+void bench_bplustreemap(size_t count)
+{
+    BTreeMapKeyProps key_props = {
+        .size = sizeof(uint64_t),
+        .cmp = (CmpFn)compare_u64,
+        .kind = BTREEMAP_KEY_KIND_U64,
+    };
+    BTreeMapValueProps value_props = {
+        .size = sizeof(uint64_t),
+    };
+
+    BPlusTreeMap map;
+    BPlusTreeMap_new(&map, &key_props, &value_props);
+
+    struct timespec start;
+
+    timespec_get(&start, TIME_UTC);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t key = bench_key(i);
+        BPlusTreeMap_insert(&map, &key, &i);
+    }
+    double insert = bench_elapsed(&start);
+
+    timespec_get(&start, TIME_UTC);
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t key = bench_key((i * 7919) % count);
+        checksum += *(const uint64_t *)BPlusTreeMap_get(&map, &key);
+    }
+    double get = bench_elapsed(&start);
+
+    timespec_get(&start, TIME_UTC);
+    RangeBound unbound = RangeBound_unbound(NULL);
+    BPlusTreeMapRangeIter it = BPlusTreeMap_range(&map, &unbound, &unbound);
+    for (BTreeMapEntry *entry = BPlusTreeMapRangeIter_next(&it); entry != NULL; entry = BPlusTreeMapRangeIter_next(&it))
+    {
+        checksum += *(uint64_t *)entry->value;
+    }
+    double range = bench_elapsed(&start);
+
+    printf("%-16s %4s %9.3fs %9.3fs %9.3fs (checksum %llu)\n", "B+, u64", "", insert, get, range, (unsigned long long)checksum);
+
+    BPlusTreeMap_drop(&map);
+}
+
+void bench_btreemap_from_sorted_iter(size_t count)
+{
+    BTreeMapKeyProps key_props = {
+        .size = sizeof(uint64_t),
+        .cmp = (CmpFn)compare_u64,
+        .kind = BTREEMAP_KEY_KIND_U64,
+    };
+    BTreeMapValueProps value_props = {
+        .size = sizeof(uint64_t),
+    };
+
+    uint64_t *keys = malloc(count * sizeof(uint64_t));
+    Vec entries;
+    Vec_with_capacity(&entries, sizeof(BTreeMapEntry), NULL, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        keys[i] = i;
+
+        BTreeMapEntry entry = _BTreeMapEntry_new(&keys[i], &keys[i]);
+        Vec_push(&entries, &entry);
+    }
+
+    BTreeMap map;
+    struct timespec start;
+
+    timespec_get(&start, TIME_UTC);
+    BTreeMap_new(&map, &key_props, &value_props);
+    for (size_t i = 0; i < count; i++)
+    {
+        BTreeMap_insert(&map, &keys[i], &keys[i]);
+    }
+    double insert = bench_elapsed(&start);
+    BTreeMap_drop(&map);
+
+    timespec_get(&start, TIME_UTC);
+    VecIter vec_it = Vec_iter(&entries);
+    Iterator it = VecIter_iter(&vec_it);
+    BTreeMap_from_sorted_iter(&map, &key_props, &value_props, &it);
+    double bulk = bench_elapsed(&start);
+    BTreeMap_drop(&map);
+
+    printf("sorted build of %zu keys: insert %.3fs, from_sorted_iter %.3fs\n", count, insert, bulk);
+
+    Vec_drop(&entries);
+    free(keys);
+}
+
+// YCSB-style mixes over uniformly chosen keys: reads are gets, writes overwrite an existing key, except in E where they
+// insert new keys and reads are short scans
+typedef struct
+{
+    const char *name;
+    unsigned read_percent;
+    bool is_scan;
+} BenchYcsbWorkload;
+
+typedef struct
+{
+    const BenchYcsbWorkload *workload;
+    ConcurrentBTreeMap *concurrent;
+    BTreeMap *locked;
+    mtx_t *lock;
+    size_t key_count;
+    size_t op_count;
+    size_t idx;
+    uint64_t checksum;
+} BenchYcsbWorker;
+
+#define BENCH_YCSB_SCAN_LEN 100
+
+int bench_ycsb_worker(BenchYcsbWorker *this)
+{
+    uint64_t state = this->idx + 1;
+    uint64_t keys[BENCH_YCSB_SCAN_LEN];
+    uint64_t values[BENCH_YCSB_SCAN_LEN];
+    size_t inserted = 0;
+
+    for (size_t i = 0; i < this->op_count; i++)
+    {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        uint64_t key = bench_key((state >> 16) % this->key_count);
+        bool is_read = (state >> 56) % 100 < this->workload->read_percent;
+
+        if (!is_read)
+        {
+            if (this->workload->is_scan)
+            {
+                // new keys, distinct between workers
+                key = bench_key(this->key_count + this->idx * this->op_count + inserted++);
+            }
+
+            if (this->concurrent != NULL)
+            {
+                ConcurrentBTreeMap_insert(this->concurrent, &key, &i);
+            }
+            else
+            {
+                mtx_lock(this->lock);
+                BTreeMap_insert(this->locked, &key, &i);
+                mtx_unlock(this->lock);
+            }
+        }
+        else if (this->workload->is_scan)
+        {
+            size_t len = (state >> 8) % BENCH_YCSB_SCAN_LEN + 1;
+            RangeBound lower = RangeBound_included(&key);
+
+            if (this->concurrent != NULL)
+            {
+                this->checksum += ConcurrentBTreeMap_scan(this->concurrent, &lower, len, keys, values);
+            }
+            else
+            {
+                mtx_lock(this->lock);
+                RangeBound upper = RangeBound_unbound(NULL);
+                BTreeMapRangeIter it = BTreeMap_range(this->locked, &lower, &upper);
+                for (size_t j = 0; j < len; j++)
+                {
+                    BTreeMapEntry *entry = BTreeMapRangeIter_next(&it);
+                    if (entry == NULL)
+                    {
+                        break;
+                    }
+
+                    keys[j] = *(uint64_t *)entry->key;
+                    values[j] = *(uint64_t *)entry->value;
+                    this->checksum++;
+                }
+                mtx_unlock(this->lock);
+            }
+        }
+        else
+        {
+            uint64_t value = 0;
+
+            if (this->concurrent != NULL)
+            {
+                ConcurrentBTreeMap_get(this->concurrent, &key, &value);
+            }
+            else
+            {
+                mtx_lock(this->lock);
+                const uint64_t *found = BTreeMap_get(this->locked, &key);
+                value = found != NULL ? *found : 0;
+                mtx_unlock(this->lock);
+            }
+
+            this->checksum += value;
+        }
+    }
+
+    return 0;
+}
+
+// Runs each workload at increasing thread counts on a BTreeMap behind one mutex and on a ConcurrentBTreeMap
+void bench_concurrent_btreemap(size_t count)
+{
+    BTreeMapKeyProps key_props = {
+        .size = sizeof(uint64_t),
+        .cmp = (CmpFn)compare_u64,
+        .kind = BTREEMAP_KEY_KIND_U64,
+    };
+    BTreeMapValueProps value_props = {
+        .size = sizeof(uint64_t),
+    };
+    BenchYcsbWorkload workloads[] = {
+        {.name = "A 50/50", .read_percent = 50},
+        {.name = "B 95/5", .read_percent = 95},
+        {.name = "C read", .read_percent = 100},
+        {.name = "E scan", .read_percent = 95, .is_scan = true},
+    };
+    size_t key_count = count / 10;
+    size_t op_count = count / 10;
+
+    printf("%-8s %7s %16s %16s (%zu keys, %zu ops)\n", "ycsb", "threads", "mutex Mops/s", "olc Mops/s", key_count, op_count);
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        for (size_t thread_count = 1; thread_count <= 8; thread_count *= 2)
+        {
+            double throughput[2];
+
+            for (size_t variant = 0; variant < 2; variant++)
+            {
+                ConcurrentBTreeMap concurrent;
+                BTreeMap locked;
+                mtx_t lock;
+
+                if (variant == 0)
+                {
+                    BTreeMap_new(&locked, &key_props, &value_props);
+                    mtx_init(&lock, mtx_plain);
+                }
+                else
+                {
+                    ConcurrentBTreeMap_new(&concurrent, &key_props, &value_props);
+                }
+
+                for (size_t i = 0; i < key_count; i++)
+                {
+                    uint64_t key = bench_key(i);
+
+                    if (variant == 0)
+                    {
+                        BTreeMap_insert(&locked, &key, &i);
+                    }
+                    else
+                    {
+                        ConcurrentBTreeMap_insert(&concurrent, &key, &i);
+                    }
+                }
+
+                BenchYcsbWorker workers[8];
+                thrd_t threads[8];
+                struct timespec start;
+                timespec_get(&start, TIME_UTC);
+
+                for (size_t i = 0; i < thread_count; i++)
+                {
+                    workers[i] = (BenchYcsbWorker){
+                        .workload = &workloads[w],
+                        .concurrent = variant == 0 ? NULL : &concurrent,
+                        .locked = &locked,
+                        .lock = &lock,
+                        .key_count = key_count,
+                        .op_count = op_count / thread_count,
+                        .idx = i,
+                    };
+                    thrd_create(&threads[i], (thrd_start_t)bench_ycsb_worker, &workers[i]);
+                }
+
+                for (size_t i = 0; i < thread_count; i++)
+                {
+                    thrd_join(threads[i], NULL);
+                }
+
+                throughput[variant] = (double)op_count / bench_elapsed(&start) / 1e6;
+
+                if (variant == 0)
+                {
+                    BTreeMap_drop(&locked);
+                    mtx_destroy(&lock);
+                }
+                else
+                {
+                    ConcurrentBTreeMap_drop(&concurrent);
+                }
+            }
+
+            printf("%-8s %7zu %16.2f %16.2f\n", workloads[w].name, thread_count, throughput[0], throughput[1]);
+        }
+    }
+}
+
+// Byte string keys of two shapes: URLs, which share long prefixes, and UUIDs, which are random from the first byte
+void bench_art_map(size_t count)
+{
+    size_t key_count = count / 10;
+    BTreeMapKeyProps key_props = {
+        .size = sizeof(Str),
+        .cmp = (CmpFn)compare_str,
+    };
+    BTreeMapKeyProps prefixed_props = key_props;
+    prefixed_props.prefix = (BTreeMapPrefixFn)prefix_str;
+    BTreeMapValueProps value_props = {
+        .size = sizeof(uint64_t),
+    };
+
+    uint8_t *key_bytes = malloc(key_count * 64);
+    Str *keys = malloc(key_count * sizeof(Str));
+
+    printf("%-20s %10s %10s %10s\n", "Str keys", "insert", "get", "range");
+
+    for (size_t shape = 0; shape < 2; shape++)
+    {
+        for (size_t i = 0; i < key_count; i++)
+        {
+            uint64_t a = bench_key(i);
+            uint64_t b = bench_key(a);
+            char *key = (char *)key_bytes + i * 64;
+            int len;
+
+            if (shape == 0)
+            {
+                len = snprintf(key, 64, "https://www.example.com/users/%llu/posts/%llu", (unsigned long long)(a % 100000), (unsigned long long)(b % 1000));
+            }
+            else
+            {
+                len = snprintf(key, 64, "%08x-%04x-%04x-%04x-%012llx", (unsigned)(a >> 32), (unsigned)(a >> 16) & 0xFFFF, (unsigned)a & 0xFFFF, (unsigned)(b >> 48), (unsigned long long)(b & 0xFFFFFFFFFFFF));
+            }
+
+            keys[i] = (Str){.ptr = (uint8_t *)key, .len = len};
+        }
+
+        for (size_t variant = 0; variant < 3; variant++)
+        {
+            BTreeMap btree;
+            ArtMap art;
+            uint64_t checksum = 0;
+            struct timespec start;
+
+            timespec_get(&start, TIME_UTC);
+            if (variant < 2)
+            {
+                BTreeMap_new(&btree, variant == 0 ? &key_props : &prefixed_props, &value_props);
+                for (size_t i = 0; i < key_count; i++)
+                {
+                    BTreeMap_insert(&btree, &keys[i], &i);
+                }
+            }
+            else
+            {
+                ArtMap_new(&art, &value_props);
+                for (size_t i = 0; i < key_count; i++)
+                {
+                    ArtMap_insert(&art, keys[i], &i);
+                }
+            }
+            double insert = bench_elapsed(&start);
+
+            timespec_get(&start, TIME_UTC);
+            for (size_t i = 0; i < key_count; i++)
+            {
+                size_t idx = bench_key(i) % key_count;
+                const uint64_t *value = variant < 2 ? BTreeMap_get(&btree, &keys[idx]) : ArtMap_get(&art, keys[idx]);
+                checksum += *value;
+            }
+            double get = bench_elapsed(&start);
+
+            RangeBound unbound = RangeBound_unbound(NULL);
+            timespec_get(&start, TIME_UTC);
+            if (variant < 2)
+            {
+                BTreeMapRangeIter it = BTreeMap_range(&btree, &unbound, &unbound);
+                for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&it); entry != NULL; entry = BTreeMapRangeIter_next(&it))
+                {
+                    checksum += ((Str *)entry->key)->len;
+                }
+            }
+            else
+            {
+                ArtMapRangeIter it = ArtMap_range(&art, &unbound, &unbound);
+                for (ArtMapEntry *entry = ArtMapRangeIter_next(&it); entry != NULL; entry = ArtMapRangeIter_next(&it))
+                {
+                    checksum += entry->key.len;
+                }
+                ArtMapRangeIter_drop(&it);
+            }
+            double range = bench_elapsed(&start);
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s, %s", variant == 0 ? "BTree" : variant == 1 ? "BTree+prefix" : "ART", shape == 0 ? "url" : "uuid");
+            printf("%-20s %9.3fs %9.3fs %9.3fs (checksum %llu)\n", name, insert, get, range, (unsigned long long)checksum);
+
+            if (variant < 2)
+            {
+                BTreeMap_drop(&btree);
+            }
+            else
+            {
+                ArtMap_drop(&art);
+            }
+        }
+    }
+
+    free(keys);
+    free(key_bytes);
+}
+
+// A FIFO queue holding a sliding window of elements, then a full traversal, one node per element against chunks
+void bench_unrolled_linked_list(size_t count)
+{
+    LinkedListElementProps element_props = {
+        .element_size = sizeof(uint64_t),
+    };
+
+    printf("%-20s %10s %10s\n", "list", "queue", "traverse");
+
+    for (size_t variant = 0; variant < 2; variant++)
+    {
+        LinkedList list;
+        UnrolledLinkedList unrolled;
+        uint64_t checksum = 0;
+        struct timespec start;
+
+        if (variant == 0)
+        {
+            LinkedList_new(&list, &element_props);
+        }
+        else
+        {
+            UnrolledLinkedList_new(&unrolled, &element_props);
+        }
+
+        timespec_get(&start, TIME_UTC);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (variant == 0)
+            {
+                LinkedList_push_back(&list, &i);
+                if (i >= 1000)
+                {
+                    checksum += *(uint64_t *)LinkedList_front(&list);
+                    LinkedList_pop_front(&list);
+                }
+            }
+            else
+            {
+                UnrolledLinkedList_push_back(&unrolled, &i);
+                if (i >= 1000)
+                {
+                    checksum += *(uint64_t *)UnrolledLinkedList_front(&unrolled);
+                    UnrolledLinkedList_pop_front(&unrolled);
+                }
+            }
+        }
+        double queue = bench_elapsed(&start);
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (variant == 0)
+            {
+                LinkedList_push_back(&list, &i);
+            }
+            else
+            {
+                UnrolledLinkedList_push_back(&unrolled, &i);
+            }
+        }
+
+        timespec_get(&start, TIME_UTC);
+        if (variant == 0)
+        {
+            for (LinkedListNode *node = list.head; node != NULL; node = node->next)
+            {
+                checksum += *(uint64_t *)_LinkedListNode_get_data(node);
+            }
+        }
+        else
+        {
+            UnrolledLinkedListIter it = UnrolledLinkedList_iter(&unrolled);
+            for (uint64_t *element = UnrolledLinkedListIter_next(&it); element != NULL; element = UnrolledLinkedListIter_next(&it))
+            {
+                checksum += *element;
+            }
+        }
+        double traverse = bench_elapsed(&start);
+
+        printf("%-20s %9.3fs %9.3fs (checksum %llu)\n", variant == 0 ? "LinkedList" : "UnrolledLinkedList", queue, traverse, (unsigned long long)checksum);
+
+        if (variant == 0)
+        {
+            LinkedList_drop(&list);
+        }
+        else
+        {
+            UnrolledLinkedList_drop(&unrolled);
+        }
+    }
+}
+
+// Moves count elements through a deque holding a window of 1000 in batches of 64, element by element with
+// push_back/front/pop_front against extend/drain_front
+void bench_vec_deque(size_t count)
+{
+    VecDequeElementProps props = {
+        .size = sizeof(uint64_t),
+    };
+    uint64_t batch[64];
+
+    printf("%-20s %10s\n", "deque", "time");
+
+    for (size_t variant = 0; variant < 2; variant++)
+    {
+        VecDeque deque;
+        VecDeque_new(&deque, &props);
+        uint64_t checksum = 0;
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+
+        for (uint64_t i = 0; i < count; i += SIZE(batch))
+        {
+            for (size_t j = 0; j < SIZE(batch); j++)
+            {
+                batch[j] = i + j;
+            }
+
+            if (variant == 0)
+            {
+                for (size_t j = 0; j < SIZE(batch); j++)
+                {
+                    VecDeque_push_back(&deque, &batch[j]);
+                }
+            }
+            else
+            {
+                VecDeque_extend(&deque, batch, SIZE(batch));
+            }
+
+            if (VecDeque_len(&deque) < 1000)
+            {
+                continue;
+            }
+
+            if (variant == 0)
+            {
+                for (size_t j = 0; j < SIZE(batch); j++)
+                {
+                    batch[j] = *(uint64_t *)VecDeque_front(&deque);
+                    VecDeque_pop_front(&deque);
+                }
+            }
+            else
+            {
+                VecDeque_drain_front(&deque, batch, SIZE(batch));
+            }
+
+            checksum += batch[0] + batch[SIZE(batch) - 1];
+        }
+
+        double elapsed = bench_elapsed(&start);
+        printf("%-20s %9.3fs (checksum %llu)\n", variant == 0 ? "per element" : "extend/drain_front", elapsed, (unsigned long long)checksum);
+
+        VecDeque_drop(&deque);
+    }
+}
+
+typedef struct
+{
+    ThreadPool *pool;
+    uint64_t n;
+    uint64_t result;
+} BenchFib;
+
+uint64_t bench_fib_sequential(uint64_t n)
+{
+    return n < 2 ? n : bench_fib_sequential(n - 1) + bench_fib_sequential(n - 2);
+}
+
+// Forks down to a small cutoff so that nearly all of the time goes into scheduling
+void bench_fib(BenchFib *this)
+{
+    if (this->n < 8)
+    {
+        this->result = bench_fib_sequential(this->n);
+        return;
+    }
+
+    BenchFib a = {.pool = this->pool, .n = this->n - 1};
+    BenchFib b = {.pool = this->pool, .n = this->n - 2};
+    ThreadPool_join(this->pool, (ThreadPoolJobFn)bench_fib, &a, (ThreadPoolJobFn)bench_fib, &b);
+
+    this->result = a.result + b.result;
+}
+
+typedef struct
+{
+    ThreadPool *pool;
+    uint64_t *data;
+    size_t len;
+} BenchQuicksort;
+
+// Lomuto partition around the median of three, returns the final index of the pivot
+size_t bench_quicksort_partition(uint64_t *data, size_t len)
+{
+    size_t mid = len / 2;
+    if (data[mid] < data[0])
+        SWAP(data[mid], data[0]);
+    if (data[len - 1] < data[0])
+        SWAP(data[len - 1], data[0]);
+    if (data[len - 1] < data[mid])
+        SWAP(data[len - 1], data[mid]);
+    SWAP(data[mid], data[len - 1]);
+
+    uint64_t pivot = data[len - 1];
+    size_t store = 0;
+
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (data[i] < pivot)
+        {
+            SWAP(data[i], data[store]);
+            store++;
+        }
+    }
+
+    SWAP(data[store], data[len - 1]);
+    return store;
+}
+
+// Sorts the halves in parallel above a cutoff, the pool is NULL for a fully sequential sort
+void bench_quicksort(BenchQuicksort *this)
+{
+    if (this->len < 2)
+    {
+        return;
+    }
+
+    size_t pivot = bench_quicksort_partition(this->data, this->len);
+    BenchQuicksort left = {.pool = this->pool, .data = this->data, .len = pivot};
+    BenchQuicksort right = {.pool = this->pool, .data = this->data + pivot + 1, .len = this->len - pivot - 1};
+
+    if (this->pool != NULL && this->len > 4096)
+    {
+        ThreadPool_join(this->pool, (ThreadPoolJobFn)bench_quicksort, &left, (ThreadPoolJobFn)bench_quicksort, &right);
+    }
+    else
+    {
+        bench_quicksort(&left);
+        bench_quicksort(&right);
+    }
+}
+
+// Fork/join on the thread pool: a fine grained parallel fib and a parallel quicksort of a Vec, against plain recursion
+void bench_fork_join(size_t count)
+{
+    uint64_t fib_n = 36;
+    Vec v;
+    Vec_with_capacity(&v, sizeof(uint64_t), NULL, count);
+
+    printf("%-10s %10s %10s\n", "fork/join", "fib", "quicksort");
+
+    for (size_t thread_count = 0; thread_count <= 4; thread_count = thread_count ? thread_count * 2 : 1)
+    {
+        ThreadPool pool;
+        if (thread_count > 0)
+        {
+            ThreadPool_new(&pool, thread_count);
+        }
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+
+        BenchFib fib = {.pool = &pool, .n = fib_n};
+        if (thread_count > 0)
+        {
+            bench_fib(&fib);
+        }
+        else
+        {
+            fib.result = bench_fib_sequential(fib_n);
+        }
+        double fib_time = bench_elapsed(&start);
+
+        Vec_clear(&v);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key(i);
+            Vec_push(&v, &key);
+        }
+
+        timespec_get(&start, TIME_UTC);
+        BenchQuicksort sort = {.pool = thread_count > 0 ? &pool : NULL, .data = Vec_get_mut(&v, 0), .len = count};
+        bench_quicksort(&sort);
+        double sort_time = bench_elapsed(&start);
+
+        for (size_t i = 1; i < count; i++)
+        {
+            assert(*(uint64_t *)Vec_get(&v, i - 1) <= *(uint64_t *)Vec_get(&v, i));
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), thread_count ? "%zu workers" : "sequential", thread_count);
+        printf("%-10s %9.3fs %9.3fs (fib %llu)\n", name, fib_time, sort_time, (unsigned long long)fib.result);
+
+        if (thread_count > 0)
+        {
+            ThreadPool_drop(&pool);
+        }
+    }
+
+    Vec_drop(&v);
+}
+
+// Pushes count random keys and pops them all again, for a binary heap against 4-ary and 8-ary ones
+void bench_binary_heap(size_t count)
+{
+    BinaryHeapElementProps props = {
+        .size = sizeof(uint64_t),
+        .cmp = (CmpFn)compare_u64,
+    };
+    size_t arities[] = {2, 4, 8};
+
+    printf("%-20s %10s %10s\n", "heap", "push", "pop");
+
+    for (size_t a = 0; a < SIZE(arities); a++)
+    {
+        BinaryHeap heap;
+        BinaryHeap_with_arity(&heap, &props, arities[a]);
+        uint64_t checksum = 0;
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key(i);
+            BinaryHeap_push(&heap, &key);
+        }
+        double push = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        while (BinaryHeap_len(&heap) > 0)
+        {
+            checksum += *(const uint64_t *)BinaryHeap_peek(&heap) >> 32;
+            BinaryHeap_pop(&heap);
+        }
+        double pop = bench_elapsed(&start);
+
+        char name[16];
+        snprintf(name, sizeof(name), "%zu-ary", arities[a]);
+        printf("%-20s %9.3fs %9.3fs (checksum %llu)\n", name, push, pop, (unsigned long long)checksum);
+
+        BinaryHeap_drop(&heap);
+    }
+}
+
+typedef struct
+{
+    uint64_t distance;
+    size_t node;
+} BenchDijkstraEntry;
+
+// Orders a max-heap so that the shortest distance is on top
+int_fast8_t bench_dijkstra_cmp(const BenchDijkstraEntry *a, const BenchDijkstraEntry *b)
+{
+    return a->distance < b->distance ? 1 : (a->distance > b->distance ? -1 : 0);
+}
+
+// Dijkstra over a random graph, pushing duplicates and skipping stale pops against updating entries through handles
+void bench_dijkstra(size_t count)
+{
+    size_t node_count = count / 10;
+    size_t degree = 8;
+    size_t *targets = malloc(node_count * degree * sizeof(size_t));
+    uint64_t *weights = malloc(node_count * degree * sizeof(uint64_t));
+    uint64_t *distances = malloc(node_count * sizeof(uint64_t));
+    BinaryHeapHandle *handles = malloc(node_count * sizeof(BinaryHeapHandle));
+
+    for (size_t i = 0; i < node_count * degree; i++)
+    {
+        targets[i] = bench_key(i) % node_count;
+        weights[i] = bench_key(i + node_count * degree) % 1000 + 1;
+    }
+
+    BinaryHeapElementProps props = {
+        .size = sizeof(BenchDijkstraEntry),
+        .cmp = (CmpFn)bench_dijkstra_cmp,
+    };
+
+    printf("%-20s %10s %10s\n", "dijkstra", "time", "max heap");
+
+    for (size_t variant = 0; variant < 3; variant++)
+    {
+        // variant 0 and 2 push duplicates and skip stale pops, on a 4-ary heap and on a radix heap keyed by distance
+        BinaryHeap heap;
+        RadixHeap radix_heap;
+        if (variant == 0)
+        {
+            BinaryHeap_with_arity(&heap, &props, 4);
+        }
+        else if (variant == 1)
+        {
+            BinaryHeap_with_handles(&heap, &props, 4);
+        }
+        else
+        {
+            RadixHeap_new(&radix_heap, &(RadixHeapElementProps){.size = sizeof(size_t)});
+        }
+
+        for (size_t i = 0; i < node_count; i++)
+        {
+            distances[i] = UINT64_MAX;
+        }
+
+        size_t max_len = 0;
+        uint64_t checksum = 0;
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+
+        distances[0] = 0;
+        BenchDijkstraEntry entry = {.distance = 0, .node = 0};
+        if (variant == 0)
+        {
+            BinaryHeap_push(&heap, &entry);
+        }
+        else if (variant == 1)
+        {
+            handles[0] = BinaryHeap_push_with_handle(&heap, &entry);
+        }
+        else
+        {
+            RadixHeap_push(&radix_heap, entry.distance, &entry.node);
+        }
+
+        while (variant == 2 ? RadixHeap_len(&radix_heap) > 0 : BinaryHeap_len(&heap) > 0)
+        {
+            if (variant == 2)
+            {
+                entry.node = *(const size_t *)RadixHeap_peek(&radix_heap, &entry.distance);
+                RadixHeap_pop(&radix_heap);
+            }
+            else
+            {
+                entry = *(const BenchDijkstraEntry *)BinaryHeap_peek(&heap);
+                BinaryHeap_pop(&heap);
+            }
+
+            if (entry.distance > distances[entry.node])
+            {
+                continue;
+            }
+
+            checksum += entry.distance;
+
+            for (size_t e = entry.node * degree; e < (entry.node + 1) * degree; e++)
+            {
+                BenchDijkstraEntry next = {.distance = entry.distance + weights[e], .node = targets[e]};
+                if (next.distance >= distances[next.node])
+                {
+                    continue;
+                }
+
+                // settled nodes never get shorter, so a node that was reached before is still queued
+                bool is_queued = distances[next.node] != UINT64_MAX;
+                distances[next.node] = next.distance;
+
+                if (variant == 0)
+                {
+                    BinaryHeap_push(&heap, &next);
+                }
+                else if (variant == 2)
+                {
+                    RadixHeap_push(&radix_heap, next.distance, &next.node);
+                }
+                else if (is_queued)
+                {
+                    // a shorter distance compares greater in this heap
+                    BinaryHeap_increase_key(&heap, handles[next.node], &next);
+                }
+                else
+                {
+                    handles[next.node] = BinaryHeap_push_with_handle(&heap, &next);
+                }
+            }
+
+            size_t len = variant == 2 ? RadixHeap_len(&radix_heap) : BinaryHeap_len(&heap);
+            max_len = MAX(max_len, len);
+        }
+
+        double elapsed = bench_elapsed(&start);
+        const char *names[] = {"lazy duplicates", "handles", "radix heap"};
+        printf("%-20s %9.3fs %10zu (checksum %llu)\n", names[variant], elapsed, max_len, (unsigned long long)checksum);
+
+        if (variant == 2)
+        {
+            RadixHeap_drop(&radix_heap);
+        }
+        else
+        {
+            BinaryHeap_drop(&heap);
+        }
+    }
+
+    free(handles);
+    free(distances);
+    free(weights);
+    free(targets);
+}
+
+typedef struct
+{
+    MpmcQueue *queue;
+    VecDeque *locked;
+    mtx_t *lock;
+    size_t capacity;
+    bool is_producer;
+    uint64_t count;
+    uint64_t checksum;
+} BenchQueueWorker;
+
+// Pushes or pops count elements, on the MpmcQueue or on a VecDeque bounded to the same capacity behind a mutex
+bool bench_queue_try(BenchQueueWorker *this, uint64_t *value)
+{
+    if (this->queue != NULL)
+    {
+        return this->is_producer ? MpmcQueue_try_push(this->queue, value) : MpmcQueue_try_pop(this->queue, value);
+    }
+
+    mtx_lock(this->lock);
+    bool is_done = false;
+    if (this->is_producer && VecDeque_len(this->locked) < this->capacity)
+    {
+        VecDeque_push_back(this->locked, value);
+        is_done = true;
+    }
+    else if (!this->is_producer && VecDeque_len(this->locked) > 0)
+    {
+        *value = *(uint64_t *)VecDeque_front(this->locked);
+        VecDeque_pop_front(this->locked);
+        is_done = true;
+    }
+    mtx_unlock(this->lock);
+
+    return is_done;
+}
+
+int bench_queue_worker(BenchQueueWorker *this)
+{
+    for (uint64_t i = 0; i < this->count; i++)
+    {
+        uint64_t value = i;
+        while (!bench_queue_try(this, &value))
+        {
+            thrd_yield();
+        }
+
+        this->checksum += value;
+    }
+
+    return 0;
+}
+
+// Pops from this[0] and sends every element straight back through this[1]
+int bench_queue_echo(BenchQueueWorker *this)
+{
+    BenchQueueWorker *reply = this + 1;
+
+    for (uint64_t i = 0; i < this->count; i++)
+    {
+        uint64_t value;
+        while (!bench_queue_try(this, &value))
+        {
+            thrd_yield();
+        }
+        while (!bench_queue_try(reply, &value))
+        {
+            thrd_yield();
+        }
+    }
+
+    return 0;
+}
+
+// Throughput at several producer/consumer counts, then round-trip latency between two threads, for a mutex around a
+// VecDeque, the MPMC queue, and the MPMC queue with the single producer/consumer flags the configuration allows
+void bench_mpmc_queue(size_t count)
+{
+    VecDequeElementProps props = {
+        .size = sizeof(uint64_t),
+    };
+    size_t capacity = 1024;
+    size_t configurations[][2] = {{1, 1}, {4, 1}, {1, 4}, {4, 4}};
+    uint64_t op_count = count / 10;
+
+    printf("%-10s %14s %14s %14s (%llu elements)\n", "queue", "mutex Mops/s", "mpmc Mops/s", "flags Mops/s", (unsigned long long)op_count);
+
+    for (size_t c = 0; c < SIZE(configurations); c++)
+    {
+        size_t producer_count = configurations[c][0];
+        size_t consumer_count = configurations[c][1];
+        MpmcQueueFlags flags = (producer_count == 1 ? MPMC_QUEUE_SINGLE_PRODUCER : 0) | (consumer_count == 1 ? MPMC_QUEUE_SINGLE_CONSUMER : 0);
+        double throughput[3];
+
+        for (size_t variant = 0; variant < 3; variant++)
+        {
+            MpmcQueue queue;
+            VecDeque locked;
+            mtx_t lock;
+
+            if (variant == 0)
+            {
+                VecDeque_new(&locked, &props);
+                mtx_init(&lock, mtx_plain);
+            }
+            else
+            {
+                MpmcQueue_with_flags(&queue, &props, capacity, variant == 1 ? MPMC_QUEUE_MULTI : flags);
+            }
+
+            BenchQueueWorker workers[8];
+            thrd_t threads[8];
+            struct timespec start;
+            timespec_get(&start, TIME_UTC);
+
+            for (size_t i = 0; i < producer_count + consumer_count; i++)
+            {
+                bool is_producer = i < producer_count;
+                workers[i] = (BenchQueueWorker){
+                    .queue = variant == 0 ? NULL : &queue,
+                    .locked = &locked,
+                    .lock = &lock,
+                    .capacity = capacity,
+                    .is_producer = is_producer,
+                    .count = op_count / (is_producer ? producer_count : consumer_count),
+                };
+                thrd_create(&threads[i], (thrd_start_t)bench_queue_worker, &workers[i]);
+            }
+
+            for (size_t i = 0; i < producer_count + consumer_count; i++)
+            {
+                thrd_join(threads[i], NULL);
+            }
+
+            throughput[variant] = (double)op_count / bench_elapsed(&start) / 1e6;
+
+            if (variant == 0)
+            {
+                VecDeque_drop(&locked);
+                mtx_destroy(&lock);
+            }
+            else
+            {
+                MpmcQueue_drop(&queue);
+            }
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "%zuP/%zuC", producer_count, consumer_count);
+        printf("%-10s %14.2f %14.2f %14.2f\n", name, throughput[0], throughput[1], throughput[2]);
+    }
+
+    uint64_t round_trips = op_count / 10;
+    double latency[3];
+
+    for (size_t variant = 0; variant < 3; variant++)
+    {
+        MpmcQueue queues[2];
+        VecDeque locked[2];
+        mtx_t locks[2];
+
+        for (size_t q = 0; q < 2; q++)
+        {
+            if (variant == 0)
+            {
+                VecDeque_new(&locked[q], &props);
+                mtx_init(&locks[q], mtx_plain);
+            }
+            else
+            {
+                MpmcQueue_with_flags(&queues[q], &props, capacity, variant == 1 ? MPMC_QUEUE_MULTI : MPMC_QUEUE_SINGLE_PRODUCER | MPMC_QUEUE_SINGLE_CONSUMER);
+            }
+        }
+
+        // the main thread pushes to queue 0 and pops from queue 1, the echo thread pops from queue 0 and pushes to queue 1
+        BenchQueueWorker ends[4];
+        for (size_t e = 0; e < 4; e++)
+        {
+            size_t q = e == 0 || e == 2 ? 0 : 1;
+            ends[e] = (BenchQueueWorker){
+                .queue = variant == 0 ? NULL : &queues[q],
+                .locked = &locked[q],
+                .lock = &locks[q],
+                .capacity = capacity,
+                .is_producer = e == 0 || e == 3,
+                .count = round_trips,
+            };
+        }
+
+        thrd_t echo;
+        thrd_create(&echo, (thrd_start_t)bench_queue_echo, &ends[2]);
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+
+        for (uint64_t i = 0; i < round_trips; i++)
+        {
+            uint64_t value = i;
+            while (!bench_queue_try(&ends[0], &value))
+            {
+                thrd_yield();
+            }
+            while (!bench_queue_try(&ends[1], &value))
+            {
+                thrd_yield();
+            }
+        }
+
+        latency[variant] = bench_elapsed(&start) / round_trips * 1e9;
+        thrd_join(echo, NULL);
+
+        for (size_t q = 0; q < 2; q++)
+        {
+            if (variant == 0)
+            {
+                VecDeque_drop(&locked[q]);
+                mtx_destroy(&locks[q]);
+            }
+            else
+            {
+                MpmcQueue_drop(&queues[q]);
+            }
+        }
+    }
+
+    printf("%-10s %12.0fns %12.0fns %12.0fns\n", "round trip", latency[0], latency[1], latency[2]);
+}
+
+// Building and draining a heap one element at a time against heapify and heapsort, and selecting the largest k
+void bench_top_k(size_t count)
+{
+    BinaryHeapElementProps props = {
+        .size = sizeof(uint64_t),
+        .cmp = (CmpFn)compare_u64,
+    };
+    size_t k = 100;
+
+    printf("%-20s %10s %10s\n", "heap sort", "build", "drain");
+
+    for (size_t method = 0; method < 3; method++)
+    {
+        Vec keys;
+        Vec_with_capacity(&keys, sizeof(uint64_t), NULL, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key(i);
+            Vec_push(&keys, &key);
+        }
+
+        BinaryHeap heap;
+        uint64_t checksum = 0;
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        if (method == 0)
+        {
+            BinaryHeap_new(&heap, &props);
+            for (size_t i = 0; i < count; i++)
+            {
+                BinaryHeap_push(&heap, Vec_get(&keys, i));
+            }
+        }
+        else
+        {
+            BinaryHeap_from_vec(&heap, &props, 2, &keys);
+        }
+        double build = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        if (method < 2)
+        {
+            while (BinaryHeap_len(&heap) > 0)
+            {
+                checksum += *(const uint64_t *)BinaryHeap_peek(&heap) >> 32;
+                BinaryHeap_pop(&heap);
+            }
+            BinaryHeap_drop(&heap);
+        }
+        else
+        {
+            Vec sorted;
+            BinaryHeap_into_sorted_vec(&heap, &sorted);
+            for (size_t i = 0; i < Vec_len(&sorted); i++)
+            {
+                checksum += *(const uint64_t *)Vec_get(&sorted, i) >> 32;
+            }
+            Vec_drop(&sorted);
+        }
+        double drain = bench_elapsed(&start);
+
+        const char *names[] = {"push + pop", "from_vec + pop", "from_vec + sorted"};
+        printf("%-20s %9.3fs %9.3fs (checksum %llu)\n", names[method], build, drain, (unsigned long long)checksum);
+
+        Vec_drop(&keys);
+    }
+
+    printf("%-20s %10s\n", "top 100", "select");
+
+    for (size_t method = 0; method < 2; method++)
+    {
+        Vec keys;
+        Vec_with_capacity(&keys, sizeof(uint64_t), NULL, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = bench_key(i);
+            Vec_push(&keys, &key);
+        }
+
+        uint64_t checksum = 0;
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        if (method == 0)
+        {
+            BinaryHeap heap;
+            BinaryHeap_from_vec(&heap, &props, 2, &keys);
+            for (size_t i = 0; i < k; i++)
+            {
+                checksum += *(const uint64_t *)BinaryHeap_peek(&heap) >> 32;
+                BinaryHeap_pop(&heap);
+            }
+            BinaryHeap_drop(&heap);
+        }
+        else
+        {
+            Vec top;
+            VecIter it = Vec_iter(&keys);
+            Iterator iter = VecIter_iter(&it);
+            BinaryHeap_top_k(&props, &iter, k, &top);
+            for (size_t i = 0; i < Vec_len(&top); i++)
+            {
+                checksum += *(const uint64_t *)Vec_get(&top, i) >> 32;
+            }
+            Vec_drop(&top);
+        }
+        double select = bench_elapsed(&start);
+
+        const char *names[] = {"from_vec + k pops", "top_k"};
+        printf("%-20s %9.3fs (checksum %llu)\n", names[method], select, (unsigned long long)checksum);
+
+        Vec_drop(&keys);
+    }
+}
+
+typedef struct
+{
+    TimerWheelTimer timer;
+    size_t id;
+} BenchTimer;
+
+typedef struct
+{
+    uint64_t deadline;
+    size_t id;
+} BenchTimerEntry;
+
+// Orders a max-heap so that the earliest deadline is on top
+int_fast8_t bench_timer_cmp(const BenchTimerEntry *a, const BenchTimerEntry *b)
+{
+    return a->deadline < b->deadline ? 1 : (a->deadline > b->deadline ? -1 : 0);
+}
+
+// Keeps a fixed number of timers pending for as many ticks, with deadlines spread over that many ticks. Every tick
+// reschedules the timers that expired and resets one other timer, as a server does on activity against a timeout
+void bench_timer_wheel(size_t count)
+{
+    size_t sizes[] = {count / 10, count};
+
+    printf("%-20s %10s %10s %10s\n", "timers", "pending", "insert", "run");
+
+    for (size_t s = 0; s < SIZE(sizes); s++)
+    {
+        size_t pending = sizes[s];
+
+        BenchTimer *timers = malloc(pending * sizeof(BenchTimer));
+        TimerWheel wheel;
+        TimerWheel_new(&wheel, 0);
+        LinkedList expired;
+        LinkedList_new_intrusive(&expired);
+        uint64_t checksum = 0;
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        for (size_t i = 0; i < pending; i++)
+        {
+            TimerWheelTimer_new(&timers[i].timer);
+            timers[i].id = i;
+            TimerWheel_insert(&wheel, &timers[i].timer, 1 + bench_key(i) % pending);
+        }
+        double insert = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        for (uint64_t now = 1; now <= pending; now++)
+        {
+            TimerWheel_advance(&wheel, now, &expired);
+            while (LinkedList_len(&expired) > 0)
+            {
+                LinkedListNode *node = LinkedList_front_node(&expired);
+                LinkedList_unlink_node(&expired, node);
+
+                size_t id = CONTAINER_OF(node, BenchTimer, timer.node)->id;
+                checksum += id;
+                TimerWheel_insert(&wheel, &timers[id].timer, now + 1 + bench_key(id + now) % pending);
+            }
+
+            size_t reset = bench_key(now) % pending;
+            TimerWheel_cancel(&wheel, &timers[reset].timer);
+            TimerWheel_insert(&wheel, &timers[reset].timer, now + 1 + bench_key(reset ^ now) % pending);
+        }
+        double run = bench_elapsed(&start);
+
+        printf("%-20s %10zu %9.3fs %9.3fs (checksum %llu)\n", "timer wheel", pending, insert, run, (unsigned long long)checksum);
+
+        TimerWheel_drop(&wheel);
+        free(timers);
+
+        BinaryHeapElementProps props = {
+            .size = sizeof(BenchTimerEntry),
+            .cmp = (CmpFn)bench_timer_cmp,
+        };
+        BinaryHeap heap;
+        BinaryHeap_with_handles(&heap, &props, 4);
+        BinaryHeapHandle *handles = malloc(pending * sizeof(BinaryHeapHandle));
+        checksum = 0;
+
+        timespec_get(&start, TIME_UTC);
+        for (size_t i = 0; i < pending; i++)
+        {
+            BenchTimerEntry entry = {.deadline = 1 + bench_key(i) % pending, .id = i};
+            handles[i] = BinaryHeap_push_with_handle(&heap, &entry);
+        }
+        insert = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        for (uint64_t now = 1; now <= pending; now++)
+        {
+            while (((const BenchTimerEntry *)BinaryHeap_peek(&heap))->deadline <= now)
+            {
+                size_t id = ((const BenchTimerEntry *)BinaryHeap_peek(&heap))->id;
+                checksum += id;
+                BinaryHeap_pop(&heap);
+
+                BenchTimerEntry entry = {.deadline = now + 1 + bench_key(id + now) % pending, .id = id};
+                handles[id] = BinaryHeap_push_with_handle(&heap, &entry);
+            }
+
+            size_t reset = bench_key(now) % pending;
+            BinaryHeap_remove(&heap, handles[reset]);
+            BenchTimerEntry entry = {.deadline = now + 1 + bench_key(reset ^ now) % pending, .id = reset};
+            handles[reset] = BinaryHeap_push_with_handle(&heap, &entry);
+        }
+        run = bench_elapsed(&start);
+
+        printf("%-20s %10zu %9.3fs %9.3fs (checksum %llu)\n", "4-ary heap", pending, insert, run, (unsigned long long)checksum);
+
+        BinaryHeap_drop(&heap);
+        free(handles);
+    }
+}
+
+// The memcmp at every offset that StrSearcher used before choosing between a first/last byte filter and Two-Way
+size_t bench_find_naive(Str haystack, Str needle)
+{
+    for (size_t i = 0; i + needle.len <= haystack.len; i++)
+    {
+        if (memcmp(haystack.ptr + i, needle.ptr, needle.len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+// Finds a needle planted at the very end of a count byte haystack, in random lowercase text against a needle that ends
+// in a byte found nowhere else, and in a run of 'a' against a needle of 'a' with one 'b' at its end or in its middle.
+// The last one matches the first and last byte everywhere, the worst case of both the naive scan and the byte filter
+void bench_str_search(size_t count)
+{
+    size_t needle_lens[] = {4, 16, 64, 512};
+    const char *names[] = {"random text", "run, b at end", "run, b in middle"};
+
+    printf("%-20s %10s %10s %10s\n", "str search", "needle", "naive", "searcher");
+
+    for (size_t kind = 0; kind < SIZE(names); kind++)
+    {
+        for (size_t n = 0; n < SIZE(needle_lens); n++)
+        {
+            size_t needle_len = needle_lens[n];
+            uint8_t *haystack = malloc(count);
+            uint8_t *needle = malloc(needle_len);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                haystack[i] = kind == 0 ? 'a' + (bench_key(i) >> 32) % 25 : 'a';
+            }
+
+            for (size_t i = 0; i < needle_len; i++)
+            {
+                needle[i] = kind == 0 ? 'a' + (bench_key(count + i) >> 32) % 25 : 'a';
+            }
+
+            if (kind == 0)
+            {
+                needle[needle_len - 1] = 'z';
+            }
+            else
+            {
+                needle[kind == 1 ? needle_len - 1 : needle_len / 2] = 'b';
+            }
+            memcpy(haystack + count - needle_len, needle, needle_len);
+
+            String s;
+            String_from(&s, (Str){.ptr = haystack, .len = count});
+            Str needle_str = {.ptr = needle, .len = needle_len};
+
+            struct timespec start;
+            timespec_get(&start, TIME_UTC);
+            size_t naive_match = bench_find_naive(String_as_str(&s), needle_str);
+            double naive = bench_elapsed(&start);
+
+            timespec_get(&start, TIME_UTC);
+            size_t match = String_find_str(&s, needle_str);
+            double searcher = bench_elapsed(&start);
+
+            assert(match == naive_match && match == count - needle_len);
+            printf("%-20s %10zu %9.3fs %9.3fs\n", names[kind], needle_len, naive, searcher);
+
+            String_drop(&s);
+            free(needle);
+            free(haystack);
+        }
+    }
+}
+
+// Finds the last match of a needle planted only at the start of a count byte haystack, so both sides scan it all:
+// keeping the last of the forward matches against String_rfind_str. The runs are the mirror image of bench_str_search
+void bench_str_rfind(size_t count)
+{
+    size_t needle_lens[] = {4, 16, 64, 512};
+    const char *names[] = {"random text", "run, b at start", "run, b in middle"};
+
+    printf("%-20s %10s %10s %10s\n", "str rfind", "needle", "forward", "rfind");
+
+    for (size_t kind = 0; kind < SIZE(names); kind++)
+    {
+        for (size_t n = 0; n < SIZE(needle_lens); n++)
+        {
+            size_t needle_len = needle_lens[n];
+            uint8_t *haystack = malloc(count);
+            uint8_t *needle = malloc(needle_len);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                haystack[i] = kind == 0 ? 'a' + (bench_key(i) >> 32) % 25 : 'a';
+            }
+
+            for (size_t i = 0; i < needle_len; i++)
+            {
+                needle[i] = kind == 0 ? 'a' + (bench_key(count + i) >> 32) % 25 : 'a';
+            }
+
+            if (kind == 0)
+            {
+                needle[0] = 'z';
+            }
+            else
+            {
+                needle[kind == 1 ? 0 : needle_len / 2] = 'b';
+            }
+            memcpy(haystack, needle, needle_len);
+
+            String s;
+            String_from(&s, (Str){.ptr = haystack, .len = count});
+            Str needle_str = {.ptr = needle, .len = needle_len};
+
+            struct timespec start;
+            timespec_get(&start, TIME_UTC);
+            size_t forward_match = SIZE_MAX;
+            MatchesIterator matches = String_matches_str(&s, needle_str);
+            for (Match *m = MatchesIterator_next(&matches); m != NULL; m = MatchesIterator_next(&matches))
+            {
+                forward_match = m->start;
+            }
+            MatchesIterator_drop(&matches);
+            double forward = bench_elapsed(&start);
+
+            timespec_get(&start, TIME_UTC);
+            size_t match = String_rfind_str(&s, needle_str);
+            double rfind = bench_elapsed(&start);
+
+            assert(match == forward_match && match == 0);
+            printf("%-20s %10zu %9.3fs %9.3fs\n", names[kind], needle_len, forward, rfind);
+
+            String_drop(&s);
+            free(needle);
+            free(haystack);
+        }
+    }
+}
+
+// Counts occurrences of n keywords in a count byte haystack of random words, one StrSearcher pass per keyword against
+// a single pass of an AhoCorasick. Every 1000th word is a keyword. Matches can differ where keywords overlap
+void bench_multi_str_search(size_t count)
+{
+    size_t keyword_counts[] = {10, 100, 500};
+
+    printf("%-20s %10s %10s %10s\n", "multi str search", "keywords", "per needle", "one pass");
+
+    for (size_t k = 0; k < SIZE(keyword_counts); k++)
+    {
+        size_t keyword_count = keyword_counts[k];
+        uint64_t state = 1;
+        uint8_t *keyword_bytes = malloc(keyword_count * 12);
+        Str *keywords = malloc(keyword_count * sizeof(Str));
+
+        for (size_t n = 0; n < keyword_count; n++)
+        {
+            keywords[n].ptr = keyword_bytes + n * 12;
+            state = state * 6364136223846793005 + 1442695040888963407;
+            keywords[n].len = 6 + (state >> 33) % 7;
+            for (size_t i = 0; i < keywords[n].len; i++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
+                keywords[n].ptr[i] = 'a' + (state >> 33) % 26;
+            }
+        }
+
+        uint8_t *haystack = malloc(count);
+        size_t len = 0;
+        for (size_t word = 0; len < count; word++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            if (word % 1000 == 0 && len + 13 <= count)
+            {
+                Str keyword = keywords[(state >> 33) % keyword_count];
+                memcpy(haystack + len, keyword.ptr, keyword.len);
+                len += keyword.len;
+            }
+            else
+            {
+                size_t word_len = MIN(4 + (state >> 33) % 7, count - len);
+                for (size_t i = 0; i < word_len; i++)
+                {
+                    state = state * 6364136223846793005 + 1442695040888963407;
+                    haystack[len++] = 'a' + (state >> 33) % 26;
+                }
+            }
+
+            if (len < count)
+            {
+                haystack[len++] = ' ';
+            }
+        }
+
+        String s;
+        String_from(&s, (Str){.ptr = haystack, .len = count});
+
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        size_t per_needle_matches = 0;
+        for (size_t n = 0; n < keyword_count; n++)
+        {
+            MatchesIterator matches = String_matches_str(&s, keywords[n]);
+            while (MatchesIterator_next(&matches) != NULL)
+            {
+                per_needle_matches++;
+            }
+            MatchesIterator_drop(&matches);
+        }
+        double per_needle = bench_elapsed(&start);
+
+        timespec_get(&start, TIME_UTC);
+        AhoCorasick automaton;
+        AhoCorasick_new(&automaton, keywords, keyword_count);
+        size_t one_pass_matches = 0;
+        MultiMatchesIterator matches = String_matches_any(&s, &automaton);
+        while (MultiMatchesIterator_next(&matches) != NULL)
+        {
+            one_pass_matches++;
+        }
+        MultiMatchesIterator_drop(&matches);
+        double one_pass = bench_elapsed(&start);
+
+        printf("%-20s %10zu %9.3fs %9.3fs (matches %zu, %zu)\n", automaton.dense ? "dense dfa" : "nfa", keyword_count, per_needle, one_pass, per_needle_matches, one_pass_matches);
+
+        AhoCorasick_drop(&automaton);
+        String_drop(&s);
+        free(haystack);
+        free(keywords);
+        free(keyword_bytes);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        size_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+
+        bench_btreemap(count);
+        bench_bplustreemap(count);
+        bench_btreemap_from_sorted_iter(count);
+        bench_concurrent_btreemap(count);
+        bench_art_map(count);
+        bench_unrolled_linked_list(count);
+        bench_vec_deque(count);
+        bench_mpmc_queue(count);
+        bench_fork_join(count);
+        bench_binary_heap(count);
+        bench_dijkstra(count);
+        bench_top_k(count);
+        bench_timer_wheel(count);
+        bench_str_search(count);
+        bench_multi_str_search(count);
+        bench_str_rfind(count);
+
+        return 0;
+    }
+
+    {
+        Vec u8vec;
+        Vec_new(&u8vec, sizeof(uint8_t), NULL);
+
+        assert(Vec_capacity(&u8vec) == 0);
+        assert(Vec_len(&u8vec) == 0);
+
+        uint8_t u8value = 1;
+        Vec_push(&u8vec, &u8value);
+        u8value = 2;
+        Vec_push(&u8vec, &u8value);
+        u8value = 3;
+        Vec_push(&u8vec, &u8value);
+
+        assert(Vec_len(&u8vec) == 3);
+        assert(Vec_capacity(&u8vec) > 3);
+
+        for (size_t i = 0; i < Vec_len(&u8vec); i++)
+        {
+            uint8_t *element = (uint8_t *)Vec_get_mut(&u8vec, i);
+
+            *element = *element * 2;
+
+            uint8_t new_element = 0;
+
+            Vec_insert(&u8vec, i, &new_element);
+            Vec_remove(&u8vec, i);
+        }
+
+        assert(Vec_len(&u8vec) == 3);
+        assert(*(uint8_t *)Vec_get(&u8vec, 0) == 2);
+        assert(*(uint8_t *)Vec_get(&u8vec, 1) == 4);
+        assert(*(uint8_t *)Vec_get(&u8vec, 2) == 6);
+
+        size_t previous_capacity = Vec_capacity(&u8vec);
+        Vec_clear(&u8vec);
+        assert(Vec_len(&u8vec) == 0);
+        assert(Vec_capacity(&u8vec) == previous_capacity);
+
+        Vec_shrink_to_fit(&u8vec);
+        assert(Vec_capacity(&u8vec) == 0);
+
+        Vec_drop(&u8vec);
+
+        Vec_with_capacity(&u8vec, sizeof(uint8_t), NULL, 3);
+        assert(Vec_capacity(&u8vec) == 3);
+
+        Vec_reserve(&u8vec, 3);
+        assert(Vec_capacity(&u8vec) == 3);
+
+        u8value = 1;
+        Vec_push(&u8vec, &u8value);
+        u8value = 2;
+        Vec_push(&u8vec, &u8value);
+        u8value = 3;
+        Vec_push(&u8vec, &u8value);
+
+        Vec_reserve(&u8vec, 3);
+        assert(Vec_capacity(&u8vec) == 6);
+
+        Vec_truncate(&u8vec, 1);
+        assert(Vec_len(&u8vec) == 1);
+
+        Vec_drop(&u8vec);
+    }
+
+    {
+        BTreeMap u8u8map;
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint8_t),
+            .cmp = (CmpFn)compare_u8,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint8_t),
+        };
+        BTreeMap_new(&u8u8map, &key_props, &value_props);
+
+        for (uint8_t i = 1; i <= 3; i++)
+        {
+            BTreeMap_insert(&u8u8map, &i, &i);
+        }
+
+        for (uint8_t i = 1; i <= 3; i++)
+        {
+            const void *value = BTreeMap_get(&u8u8map, &i);
+
+            assert(value != NULL);
+            assert(*(uint8_t *)value == i);
+        }
+
+        uint8_t key = 2, new_value = 42;
+        BTreeMap_insert(&u8u8map, &key, &new_value);
+
+        const void *value = BTreeMap_get(&u8u8map, &key);
+
+        assert(value != NULL);
+        assert(*(uint8_t *)value == 42);
+
+        // Remove key = 1 (leaf case)
+        key = 1;
+        BTreeMap_remove(&u8u8map, &key);
+        value = BTreeMap_get(&u8u8map, &key);
+        assert(value == NULL);
+
+        // Remove key = 2 (internal node candidate)
+        key = 2;
+        BTreeMap_remove(&u8u8map, &key);
+        value = BTreeMap_get(&u8u8map, &key);
+        assert(value == NULL);
+
+        // Try removing a non-existent key
+        key = 99;
+        BTreeMap_remove(&u8u8map, &key);
+        value = BTreeMap_get(&u8u8map, &key);
+        assert(value == NULL);
+
+        BTreeMap_drop(&u8u8map);
+
+        BTreeMap_new(&u8u8map, &key_props, &value_props);
+
+        // Insert keys 1..=5
+        for (uint8_t i = 1; i <= 5; i++)
+        {
+            BTreeMap_insert(&u8u8map, &i, &i);
+        }
+
+        // Create range [2, 4]
+        uint8_t start = 2;
+        uint8_t end = 4;
+
+        RangeBound lower = RangeBound_included(&start);
+        RangeBound upper = RangeBound_included(&end);
+
+        BTreeMapRangeIter iter = BTreeMap_range(&u8u8map, &lower, &upper);
+
+        // Expected sequence: 2, 3, 4
+        uint8_t expected = 2;
+        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&iter); entry != NULL; entry = BTreeMapRangeIter_next(&iter))
+        {
+            uint8_t key = *(uint8_t *)entry->key;
+            uint8_t value = *(uint8_t *)entry->value;
+
+            assert(key == expected);
+            assert(value == expected);
+            expected++;
+        }
+
+        BTreeMap_range(&u8u8map, &lower, &upper);
+
+        assert(expected == 5); // ensures we iterated 2,3,4
+
+        // Expected sequence: 4, 3, 2
+        expected = 4;
+        for (BTreeMapEntry *entry = BTreeMapRangeIter_next_back(&iter); entry != NULL; entry = BTreeMapRangeIter_next_back(&iter))
+        {
+            uint8_t key = *(uint8_t *)entry->key;
+            uint8_t value = *(uint8_t *)entry->value;
+
+            assert(key == expected);
+            assert(value == expected);
+            expected--;
+        }
+
+        // Test with excluded upper bound (2..4)
+        lower = RangeBound_included(&start);
+        upper = RangeBound_excluded(&end);
+        iter = BTreeMap_range(&u8u8map, &lower, &upper);
+
+        expected = 2;
+        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&iter); entry != NULL; entry = BTreeMapRangeIter_next(&iter))
+        {
+            uint8_t key = *(uint8_t *)entry->key;
+            assert(key == expected);
+            expected++;
+        }
+
+        assert(expected == 4); // iterated 2,3 only
+
+        BTreeMap_drop(&u8u8map);
+    }
+
+    {
+        // Ranges and removals over a multi-level tree, exercising splits, borrows and merges of internal nodes
+        BTreeMap map;
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint8_t),
+            .cmp = (CmpFn)compare_u8,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint8_t),
+        };
+        // A small branching factor keeps the tree several levels deep
+        BTreeMap_with_branching_factor(&map, &key_props, &value_props, 3);
+
+        const uint8_t key_count = 200;
+        bool present[200] = {false};
+
+        for (uint8_t i = 0; i < key_count; i++)
+        {
+            // 37 is coprime with 200, so this visits every key once in scrambled order
+            uint8_t key = (uint8_t)(i * 37 % key_count);
+            uint8_t value = key ^ 0x5A;
+            BTreeMap_insert(&map, &key, &value);
+            present[key] = true;
+        }
+
+        assert(BTreeMap_len(&map) == key_count);
+
+        for (int round = 0; round < 3; round++)
+        {
+            const uint8_t bounds[][2] = {{0, 199}, {0, 0}, {17, 18}, {3, 150}, {64, 65}, {120, 199}, {199, 199}};
+
+            for (size_t b = 0; b < SIZE(bounds); b++)
+            {
+                uint8_t start = bounds[b][0], end = bounds[b][1];
+
+                for (int kinds = 0; kinds < 4; kinds++)
+                {
+                    RangeBound lower = kinds & 1 ? RangeBound_excluded(&start) : RangeBound_included(&start);
+                    RangeBound upper = kinds & 2 ? RangeBound_excluded(&end) : RangeBound_included(&end);
+
+                    int first = kinds & 1 ? start + 1 : start;
+                    int last = kinds & 2 ? end - 1 : end;
+
+                    // Front to back
+                    BTreeMapRangeIter iter = BTreeMap_range(&map, &lower, &upper);
+                    int expected = first;
+
+                    for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&iter); entry != NULL; entry = BTreeMapRangeIter_next(&iter))
+                    {
+                        while (expected <= last && !present[expected])
+                        {
+                            expected++;
+                        }
+
+                        assert(expected <= last);
+                        assert(*(uint8_t *)entry->key == expected);
+                        assert(*(uint8_t *)entry->value == (uint8_t)(expected ^ 0x5A));
+                        expected++;
+                    }
+
+                    while (expected <= last && !present[expected])
+                    {
+                        expected++;
+                    }
+
+                    assert(expected > last);
+
+                    // Alternating from both ends until they meet
+                    iter = BTreeMap_range(&map, &lower, &upper);
+                    int front = first, back = last;
+
+                    for (int step = 0;; step++)
+                    {
+                        BTreeMapEntry *entry = step % 2 == 0 ? BTreeMapRangeIter_next(&iter) : BTreeMapRangeIter_next_back(&iter);
+
+                        if (step % 2 == 0)
+                        {
+                            while (front <= back && !present[front])
+                            {
+                                front++;
+                            }
+                        }
+                        else
+                        {
+                            while (front <= back && !present[back])
+                            {
+                                back--;
+                            }
+                        }
+
+                        if (front > back)
+                        {
+                            assert(entry == NULL);
+                            break;
+                        }
+
+                        assert(entry != NULL);
+                        assert(*(uint8_t *)entry->key == (step % 2 == 0 ? front++ : back--));
+                    }
+                }
+            }
+
+            // Remove a scrambled subset of the remaining keys, forcing borrows and merges at every level
+            const uint8_t keep_multiples_of[] = {3, 6, 0};
+
+            for (uint8_t i = 0; i < key_count; i++)
+            {
+                uint8_t key = (uint8_t)(i * 37 % key_count);
+                uint8_t keep = keep_multiples_of[round];
+
+                if (present[key] && (keep == 0 || key % keep != 0))
+                {
+                    BTreeMap_remove(&map, &key);
+                    present[key] = false;
+                    assert(BTreeMap_get(&map, &key) == NULL);
+                }
+            }
+
+            for (uint8_t key = 0; key < key_count; key++)
+            {
+                const void *value = BTreeMap_get(&map, &key);
+                assert((value != NULL) == present[key]);
+            }
+        }
+
+        assert(BTreeMap_len(&map) == 0);
+
+        BTreeMap_drop(&map);
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        BTreeMap map;
+        BTreeMap_new(&map, &key_props, &value_props);
+
+        // 16-byte entries fill a 512-byte node with 31 keys
+        assert(BTreeMap_branching_factor(&map) == 16);
+
+        BTreeMap_drop(&map);
+
+        BTreeMapKeyKind kinds[] = {BTREEMAP_KEY_KIND_OPAQUE, BTREEMAP_KEY_KIND_U64};
+        size_t branching_factors[] = {2, 3, 16, 64};
+
+        for (size_t k = 0; k < SIZE(kinds); k++)
+        {
+            for (size_t b = 0; b < SIZE(branching_factors); b++)
+            {
+                key_props.kind = kinds[k];
+                BTreeMap_with_branching_factor(&map, &key_props, &value_props, branching_factors[b]);
+
+                // 4999 is coprime with 5000, so every key in 0..10000 step 2 is inserted once
+                for (uint64_t i = 0; i < 5000; i++)
+                {
+                    uint64_t key = ((i * 4999) % 5000) * 2;
+                    uint64_t value = key + 1;
+                    BTreeMap_insert(&map, &key, &value);
+                }
+
+                assert(BTreeMap_len(&map) == 5000);
+
+                for (uint64_t key = 0; key < 10000; key++)
+                {
+                    const uint64_t *value = BTreeMap_get(&map, &key);
+                    assert(key % 2 == 0 ? value != NULL && *value == key + 1 : value == NULL);
+                }
+
+                for (uint64_t key = 0; key < 10000; key += 6)
+                {
+                    BTreeMap_remove(&map, &key);
+                }
+
+                assert(BTreeMap_len(&map) == 5000 - 1667);
+                check_btreemap_node(&map, map.root);
+
+                uint64_t start = 1001;
+                uint64_t end = 9000;
+                RangeBound lower = RangeBound_included(&start);
+                RangeBound upper = RangeBound_excluded(&end);
+                BTreeMapRangeIter it = BTreeMap_range(&map, &lower, &upper);
+
+                uint64_t expected = 1002;
+                for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&it); entry != NULL; entry = BTreeMapRangeIter_next(&it))
+                {
+                    if (expected % 6 == 0)
+                    {
+                        expected += 2;
+                    }
+
+                    assert(*(uint64_t *)entry->key == expected);
+                    assert(*(uint64_t *)entry->value == expected + 1);
+                    expected += 2;
+                }
+
+                assert(expected == 9000);
+
+                BTreeMap_drop(&map);
+            }
+        }
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        size_t branching_factors[] = {2, 3, 16};
+
+        for (size_t b = 0; b < SIZE(branching_factors); b++)
+        {
+            BTreeMap map;
+            BTreeMap_with_branching_factor(&map, &key_props, &value_props, branching_factors[b]);
+            BTreeMap_enable_order_statistics(&map);
+
+            for (uint64_t i = 0; i < 5000; i++)
+            {
+                uint64_t key = ((i * 4999) % 5000) * 2;
+                BTreeMap_insert(&map, &key, &key);
+            }
+
+            check_btreemap_node(&map, map.root);
+
+            // keep the keys k * 2 with k % 3 != 0
+            for (uint64_t key = 0; key < 10000; key += 6)
+            {
+                BTreeMap_remove(&map, &key);
+            }
+
+            check_btreemap_node(&map, map.root);
+
+            size_t index = 0;
+
+            for (uint64_t key = 0; key < 10000; key++)
+            {
+                bool is_present = key % 2 == 0 && key % 6 != 0;
+
+                assert(BTreeMap_rank(&map, &key) == index);
+
+                if (is_present)
+                {
+                    assert(*(uint64_t *)BTreeMap_nth(&map, index).key == key);
+                    index++;
+                }
+            }
+
+            assert(index == BTreeMap_len(&map));
+            assert(BTreeMap_nth(&map, index).key == NULL);
+
+            uint64_t start = 6;
+            uint64_t end = 1000;
+            RangeBound lower = RangeBound_included(&start);
+            RangeBound upper = RangeBound_included(&end);
+            assert(BTreeMap_range_len(&map, &lower, &upper) == 332);
+
+            lower = RangeBound_excluded(&end);
+            upper = RangeBound_unbound(NULL);
+            assert(BTreeMap_range_len(&map, &lower, &upper) == BTreeMap_len(&map) - 334);
+
+            upper = RangeBound_excluded(&start);
+            assert(BTreeMap_range_len(&map, &lower, &upper) == 0);
+
+            BTreeMap_drop(&map);
+        }
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        BTreeMap map;
+        BTreeMap_with_branching_factor(&map, &key_props, &value_props, 3);
+        BTreeMap_enable_order_statistics(&map);
+
+        for (uint64_t i = 0; i < 5000; i++)
+        {
+            uint64_t key = (i * 4999) % 5000;
+            BTreeMap_insert(&map, &key, &key);
+        }
+
+        for (uint64_t key = 0; key < 5000; key++)
+        {
+            if (key % 3 != 0)
+            {
+                BTreeMap_remove(&map, &key);
+            }
+        }
+
+        BTreeMap_compact(&map);
+        check_btreemap_node(&map, map.root);
+
+        // nodes are laid out level by level
+        for (size_t i = 0; i < map.root->key_count; i++)
+        {
+            assert((uintptr_t)map.root < (uintptr_t)map.root->children[i]);
+            assert((uintptr_t)map.root->children[i] < (uintptr_t)map.root->children[i + 1]);
+        }
+
+        for (uint64_t i = 0; i < BTreeMap_len(&map); i++)
+        {
+            assert(*(uint64_t *)BTreeMap_nth(&map, i).key == i * 3);
+        }
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_append(frag.out_list, OutList_new(&new->split.out2)),
-                });
+        // the compacted tree keeps working, reusing freed nodes and growing new chunks
+        for (uint64_t key = 0; key < 10000; key++)
+        {
+            if (key % 3 == 0)
+            {
+                BTreeMap_remove(&map, &key);
+            }
+            else
+            {
+                BTreeMap_insert(&map, &key, &key);
+            }
         }
-        break;
 
-        case TOKEN_KIND_LAZY_ZERO_OR_ONE:
+        check_btreemap_node(&map, map.root);
+        assert(BTreeMap_len(&map) == 6666);
+
+        BTreeMap_drop(&map);
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        size_t counts[] = {0, 1, 2, 5, 100, 1000, 4999};
+        size_t branching_factors[] = {2, 3, 16};
+
+        for (size_t c = 0; c < SIZE(counts); c++)
         {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            for (size_t b = 0; b < SIZE(branching_factors); b++)
+            {
+                size_t count = counts[c];
+                uint64_t *keys = malloc(count * sizeof(uint64_t));
+                uint64_t *values = malloc(count * sizeof(uint64_t));
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out2 = frag.start,
-                    },
-                });
+                Vec entries;
+                Vec_new(&entries, sizeof(BTreeMapEntry), NULL);
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+                for (size_t i = 0; i < count; i++)
+                {
+                    keys[i] = i * 2;
+                    values[i] = i;
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_append(frag.out_list, OutList_new(&new->split.out1)),
-                });
+                    BTreeMapEntry entry = _BTreeMapEntry_new(&keys[i], &values[i]);
+                    Vec_push(&entries, &entry);
+                }
+
+                // from_sorted_iter sizes nodes with BTreeMap_new(), rebuild by hand for the other factors
+                BTreeMap map;
+                VecIter vec_it = Vec_iter(&entries);
+                Iterator it = VecIter_iter(&vec_it);
+                BTreeMap_with_branching_factor(&map, &key_props, &value_props, branching_factors[b]);
+                BTreeMap_enable_order_statistics(&map);
+
+                _BTreeMapBulkBuilder builder;
+                _BTreeMapBulkBuilder_new(&builder, &map);
+
+                for (BTreeMapEntry *entry = Iterator_next(&it); entry != NULL; entry = Iterator_next(&it))
+                {
+                    _BTreeMapBulkBuilder_push(&builder, entry->key, entry->value);
+                }
+
+                _BTreeMapBulkBuilder_finish(&builder);
+
+                assert(BTreeMap_len(&map) == count);
+                check_btreemap_node(&map, map.root);
+
+                for (uint64_t i = 0; i < count; i++)
+                {
+                    uint64_t key = i * 2;
+                    assert(*(const uint64_t *)BTreeMap_get(&map, &key) == i);
+                    assert(*(uint64_t *)BTreeMap_nth(&map, i).key == key);
+                }
+
+                for (uint64_t key = 0; key < count * 2; key += 3)
+                {
+                    if (key % 2 == 0)
+                    {
+                        BTreeMap_remove(&map, &key);
+                    }
+                    else
+                    {
+                        BTreeMap_insert(&map, &key, &key);
+                    }
+                }
+
+                check_btreemap_node(&map, map.root);
+
+                BTreeMap_drop(&map);
+
+                vec_it = Vec_iter(&entries);
+                it = VecIter_iter(&vec_it);
+                BTreeMap_from_sorted_iter(&map, &key_props, &value_props, &it);
+
+                assert(BTreeMap_len(&map) == count);
+                check_btreemap_node(&map, map.root);
+
+                RangeBound unbound = RangeBound_unbound(NULL);
+                BTreeMapRangeIter range = BTreeMap_range(&map, &unbound, &unbound);
+                uint64_t expected = 0;
+
+                for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&range); entry != NULL; entry = BTreeMapRangeIter_next(&range))
+                {
+                    assert(*(uint64_t *)entry->key == expected * 2);
+                    assert(*(uint64_t *)entry->value == expected);
+                    expected++;
+                }
+
+                assert(expected == count);
+
+                BTreeMap_drop(&map);
+                Vec_drop(&entries);
+                free(keys);
+                free(values);
+            }
         }
-        break;
 
-        case TOKEN_KIND_ZERO_OR_MORE:
+        Vec elements;
+        Vec_new(&elements, sizeof(uint8_t), NULL);
+
+        for (size_t i = 0; i < 200; i++)
         {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            uint8_t element = i;
+            Vec_push(&elements, &element);
+        }
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out1 = frag.start,
-                    },
-                });
+        BTreeSet set;
+        BTreeSetElementProps props = {
+            .size = sizeof(uint8_t),
+            .cmp = (CmpFn)compare_u8,
+        };
+        VecIter vec_it = Vec_iter(&elements);
+        Iterator it = VecIter_iter(&vec_it);
+        BTreeSet_from_sorted_iter(&set, &props, &it);
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+        assert(BTreeSet_len(&set) == 200);
+        check_btreemap_node(set.map, set.map->root);
 
-            OutList_patch(frag.out_list, new);
+        for (uint8_t i = 0; i < 200; i++)
+        {
+            assert(BTreeSet_contains(&set, &i));
+        }
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_new(&new->split.out2),
-                });
+        BTreeSet_drop(&set);
+        Vec_drop(&elements);
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        BTreeMapKeyKind kinds[] = {BTREEMAP_KEY_KIND_OPAQUE, BTREEMAP_KEY_KIND_U64};
+        size_t branching_factors[] = {2, 3, 16};
+
+        for (size_t k = 0; k < SIZE(kinds); k++)
+        {
+            for (size_t b = 0; b < SIZE(branching_factors); b++)
+            {
+                BPlusTreeMap map;
+                key_props.kind = kinds[k];
+                BPlusTreeMap_with_branching_factor(&map, &key_props, &value_props, branching_factors[b]);
+
+                for (uint64_t i = 0; i < 5000; i++)
+                {
+                    uint64_t key = ((i * 4999) % 5000) * 2;
+                    uint64_t value = key + 1;
+                    BPlusTreeMap_insert(&map, &key, &value);
+                }
+
+                assert(BPlusTreeMap_len(&map) == 5000);
+
+                for (uint64_t key = 0; key < 10000; key++)
+                {
+                    const uint64_t *value = BPlusTreeMap_get(&map, &key);
+                    assert(key % 2 == 0 ? value != NULL && *value == key + 1 : value == NULL);
+                }
+
+                for (uint64_t key = 0; key < 10000; key += 6)
+                {
+                    BPlusTreeMap_remove(&map, &key);
+                }
+
+                assert(BPlusTreeMap_len(&map) == 5000 - 1667);
+
+                uint64_t start = 1001;
+                uint64_t end = 9000;
+                RangeBound lower = RangeBound_included(&start);
+                RangeBound upper = RangeBound_excluded(&end);
+                BPlusTreeMapRangeIter it = BPlusTreeMap_range(&map, &lower, &upper);
+
+                uint64_t expected = 1002;
+                for (BTreeMapEntry *entry = BPlusTreeMapRangeIter_next(&it); entry != NULL; entry = BPlusTreeMapRangeIter_next(&it))
+                {
+                    if (expected % 6 == 0)
+                    {
+                        expected += 2;
+                    }
+
+                    assert(*(uint64_t *)entry->key == expected);
+                    assert(*(uint64_t *)entry->value == expected + 1);
+                    expected += 2;
+                }
+
+                assert(expected == 9000);
+
+                upper = RangeBound_included(&end);
+                it = BPlusTreeMap_range(&map, &lower, &upper);
+
+                expected = 9000;
+                for (BTreeMapEntry *entry = BPlusTreeMapRangeIter_next_back(&it); entry != NULL; entry = BPlusTreeMapRangeIter_next_back(&it))
+                {
+                    if (expected % 6 == 0)
+                    {
+                        expected -= 2;
+                    }
+
+                    assert(*(uint64_t *)entry->key == expected);
+                    expected -= 2;
+                }
+
+                assert(expected == 1002);
+
+                // empty ranges
+                start = 1000000;
+                lower = RangeBound_included(&start);
+                upper = RangeBound_unbound(NULL);
+                it = BPlusTreeMap_range(&map, &lower, &upper);
+                assert(BPlusTreeMapRangeIter_next(&it) == NULL);
+
+                start = 13;
+                end = 13;
+                lower = RangeBound_included(&start);
+                upper = RangeBound_included(&end);
+                it = BPlusTreeMap_range(&map, &lower, &upper);
+                assert(BPlusTreeMapRangeIter_next(&it) == NULL);
+
+                for (uint64_t key = 0; key < 10000; key++)
+                {
+                    BPlusTreeMap_remove(&map, &key);
+                }
+
+                assert(BPlusTreeMap_len(&map) == 0);
+
+                lower = RangeBound_unbound(NULL);
+                it = BPlusTreeMap_range(&map, &lower, &upper);
+                assert(BPlusTreeMapRangeIter_next(&it) == NULL);
+
+                BPlusTreeMap_drop(&map);
+            }
         }
-        break;
 
-        case TOKEN_KIND_LAZY_ZERO_OR_MORE:
+        // Owned keys, separators must never outlive the key they were copied from
+        BPlusTreeMap map;
+        BTreeMapKeyProps cstr_props = {
+            .size = sizeof(char *),
+            .cmp = (CmpFn)compare_cstr,
+            .drop = (DropFn)drop_cstr,
+        };
+        BPlusTreeMap_with_branching_factor(&map, &cstr_props, &value_props, 2);
+
+        for (uint64_t i = 0; i < 500; i++)
         {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            char *key = malloc(8);
+            snprintf(key, 8, "%04u", (unsigned)((i * 7) % 500));
+            BPlusTreeMap_insert(&map, &key, &i);
+        }
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out2 = frag.start,
-                    },
-                });
+        for (uint64_t i = 0; i < 500; i += 3)
+        {
+            char buffer[8];
+            char *key = buffer;
+            snprintf(buffer, 8, "%04u", (unsigned)i);
+            BPlusTreeMap_remove(&map, &key);
+        }
+
+        assert(BPlusTreeMap_len(&map) == 333);
+
+        char *key = malloc(8);
+        snprintf(key, 8, "%04u", 1);
+        uint64_t value = 42;
+        BPlusTreeMap_insert(&map, &key, &value);
+
+        char buffer[8] = "0001";
+        key = buffer;
+        assert(*(const uint64_t *)BPlusTreeMap_get(&map, &key) == 42);
+
+        RangeBound unbound = RangeBound_unbound(NULL);
+        BPlusTreeMapRangeIter it = BPlusTreeMap_range(&map, &unbound, &unbound);
+        size_t count = 0;
+        for (BTreeMapEntry *entry = BPlusTreeMapRangeIter_next(&it); entry != NULL; entry = BPlusTreeMapRangeIter_next(&it))
+        {
+            assert(atoi(*(char **)entry->key) % 3 != 0);
+            count++;
+        }
+
+        assert(count == 333);
+
+        BPlusTreeMap_drop(&map);
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+            .kind = BTREEMAP_KEY_KIND_U64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        for (size_t t = 2; t <= 6; t += 4)
+        {
+            PersistentBTreeMap map;
+            PersistentBTreeMap_with_branching_factor(&map, &key_props, &value_props, t);
+
+            for (uint64_t i = 0; i < 2000; i++)
+            {
+                uint64_t key = (i * 7919) % 2000;
+                PersistentBTreeMap_insert(&map, &key, &key);
+            }
+
+            assert(PersistentBTreeMap_len(&map) == 2000);
+
+            PersistentBTreeMap before;
+            PersistentBTreeMap_snapshot(&map, &before);
+
+            for (uint64_t key = 0; key < 2000; key += 2)
+            {
+                PersistentBTreeMap_remove(&map, &key);
+            }
+
+            for (uint64_t key = 1; key < 2000; key += 4)
+            {
+                uint64_t value = key + 1;
+                PersistentBTreeMap_insert(&map, &key, &value);
+            }
+
+            PersistentBTreeMap after;
+            PersistentBTreeMap_snapshot(&map, &after);
+
+            for (uint64_t key = 3000; key < 4000; key++)
+            {
+                PersistentBTreeMap_insert(&map, &key, &key);
+            }
+
+            // removing an absent key changes nothing
+            uint64_t absent = 10000;
+            PersistentBTreeMap_remove(&after, &absent);
+
+            assert(PersistentBTreeMap_len(&before) == 2000);
+            assert(PersistentBTreeMap_len(&after) == 1000);
+            assert(PersistentBTreeMap_len(&map) == 2000);
+
+            for (uint64_t key = 0; key < 4000; key++)
+            {
+                const uint64_t *value = PersistentBTreeMap_get(&before, &key);
+                assert(key < 2000 ? value != NULL && *value == key : value == NULL);
+
+                value = PersistentBTreeMap_get(&after, &key);
+                if (key < 2000 && key % 2 == 1)
+                {
+                    assert(*value == (key % 4 == 1 ? key + 1 : key));
+                }
+                else
+                {
+                    assert(value == NULL);
+                }
+
+                assert((PersistentBTreeMap_get(&map, &key) != NULL) == (key < 2000 ? key % 2 == 1 : key >= 3000));
+            }
+
+            PersistentBTreeMap_drop(&map);
+
+            uint64_t start = 501;
+            uint64_t end = 1500;
+            RangeBound lower = RangeBound_excluded(&start);
+            RangeBound upper = RangeBound_included(&end);
+            PersistentBTreeMapRangeIter it = PersistentBTreeMap_range(&before, &lower, &upper);
+
+            uint64_t expected = 502;
+            for (BTreeMapEntry *entry = PersistentBTreeMapRangeIter_next(&it); entry != NULL; entry = PersistentBTreeMapRangeIter_next(&it))
+            {
+                assert(*(uint64_t *)entry->key == expected);
+                expected++;
+            }
+            PersistentBTreeMapRangeIter_drop(&it);
+
+            assert(expected == 1501);
+
+            start = 500;
+            lower = RangeBound_included(&start);
+            upper = RangeBound_excluded(&end);
+            it = PersistentBTreeMap_range(&after, &lower, &upper);
+
+            expected = 501;
+            for (BTreeMapEntry *entry = PersistentBTreeMapRangeIter_next(&it); entry != NULL; entry = PersistentBTreeMapRangeIter_next(&it))
+            {
+                assert(*(uint64_t *)entry->key == expected);
+                expected += 2;
+            }
+            PersistentBTreeMapRangeIter_drop(&it);
+
+            assert(expected == 1501);
+
+            for (uint64_t key = 0; key < 2000; key++)
+            {
+                PersistentBTreeMap_remove(&after, &key);
+            }
+
+            assert(PersistentBTreeMap_len(&after) == 0);
+
+            RangeBound unbound = RangeBound_unbound(NULL);
+            it = PersistentBTreeMap_range(&after, &unbound, &unbound);
+            assert(PersistentBTreeMapRangeIter_next(&it) == NULL);
+            PersistentBTreeMapRangeIter_drop(&it);
+
+            PersistentBTreeMap_drop(&after);
+            PersistentBTreeMap_drop(&before);
+        }
+
+        // Readers iterate a snapshot without locks while the map keeps changing
+        PersistentBTreeMap map;
+        PersistentBTreeMap_with_branching_factor(&map, &key_props, &value_props, 4);
+
+        for (uint64_t key = 0; key < 10000; key++)
+        {
+            PersistentBTreeMap_insert(&map, &key, &key);
+        }
+
+        PersistentBTreeMap snapshots[4];
+        thrd_t readers[4];
+        for (size_t i = 0; i < 4; i++)
+        {
+            PersistentBTreeMap_snapshot(&map, &snapshots[i]);
+            thrd_create(&readers[i], (thrd_start_t)sum_persistent_btreemap_keys, &snapshots[i]);
+        }
+
+        for (uint64_t key = 0; key < 10000; key += 3)
+        {
+            PersistentBTreeMap_remove(&map, &key);
+            key += 20000;
+            PersistentBTreeMap_insert(&map, &key, &key);
+            key -= 20000;
+        }
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            int result;
+            thrd_join(readers[i], &result);
+            assert(result == 0);
+            PersistentBTreeMap_drop(&snapshots[i]);
+        }
+
+        assert(PersistentBTreeMap_len(&map) == 10000);
+
+        PersistentBTreeMap_drop(&map);
+    }
+
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+            .kind = BTREEMAP_KEY_KIND_U64,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        // Single threaded, against BTreeMap
+        ConcurrentBTreeMap map;
+        ConcurrentBTreeMap_with_branching_factor(&map, &key_props, &value_props, 2);
+        BTreeMap expected;
+        BTreeMap_new(&expected, &key_props, &value_props);
+
+        uint64_t state = 1;
+        for (size_t i = 0; i < 20000; i++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            uint64_t key = (state >> 33) % 3000;
+            uint64_t value = state >> 40;
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+            if ((state >> 20) % 3 == 0)
+            {
+                assert(ConcurrentBTreeMap_remove(&map, &key) == (BTreeMap_get(&expected, &key) != NULL));
+                BTreeMap_remove(&expected, &key);
+            }
+            else
+            {
+                ConcurrentBTreeMap_insert(&map, &key, &value);
+                BTreeMap_insert(&expected, &key, &value);
+            }
+        }
 
-            OutList_patch(frag.out_list, new);
+        assert(ConcurrentBTreeMap_len(&map) == BTreeMap_len(&expected));
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = new,
-                    .out_list = OutList_new(&new->split.out1),
-                });
+        for (uint64_t key = 0; key < 3000; key++)
+        {
+            uint64_t value;
+            const uint64_t *expected_value = BTreeMap_get(&expected, &key);
+            assert(ConcurrentBTreeMap_get(&map, &key, &value) == (expected_value != NULL));
+            assert(expected_value == NULL || value == *expected_value);
         }
-        break;
 
-        case TOKEN_KIND_ONE_OR_MORE:
+        uint64_t keys[4000];
+        uint64_t values[4000];
+        RangeBound unbound = RangeBound_unbound(NULL);
+        size_t count = ConcurrentBTreeMap_scan(&map, &unbound, 4000, keys, values);
+        assert(count == BTreeMap_len(&expected));
+
+        BTreeMapRangeIter it = BTreeMap_range(&expected, &unbound, &unbound);
+        for (size_t i = 0; i < count; i++)
         {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            BTreeMapEntry *entry = BTreeMapRangeIter_next(&it);
+            assert(keys[i] == *(uint64_t *)entry->key && values[i] == *(uint64_t *)entry->value);
+        }
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out1 = frag.start,
-                    },
-                });
+        uint64_t start = keys[10];
+        RangeBound lower = RangeBound_excluded(&start);
+        assert(ConcurrentBTreeMap_scan(&map, &lower, 5, keys, values) == 5);
+        assert(keys[0] > start);
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+        start = 3000;
+        lower = RangeBound_included(&start);
+        assert(ConcurrentBTreeMap_scan(&map, &lower, 5, keys, values) == 0);
 
-            OutList_patch(frag.out_list, new);
+        BTreeMap_drop(&expected);
+        ConcurrentBTreeMap_drop(&map);
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = frag.start,
-                    .out_list = OutList_new(&new->split.out2),
-                });
+        // Negative i32 keys, which are searched without cmp
+        BTreeMapKeyProps i32_key_props = {
+            .size = sizeof(int32_t),
+            .kind = BTREEMAP_KEY_KIND_I32,
+        };
+        ConcurrentBTreeMap_with_branching_factor(&map, &i32_key_props, &value_props, 2);
+
+        for (int32_t i = 0; i < 1000; i++)
+        {
+            int32_t key = (i * 7919) % 1000 - 500;
+            uint64_t value = key + 500;
+            ConcurrentBTreeMap_insert(&map, &key, &value);
         }
-        break;
 
-        case TOKEN_KIND_LAZY_ONE_OR_MORE:
+        int32_t i32_keys[1000];
+        int32_t i32_start = -100;
+        lower = RangeBound_included(&i32_start);
+        assert(ConcurrentBTreeMap_scan(&map, &lower, 1000, i32_keys, values) == 600);
+        for (size_t i = 0; i < 600; i++)
         {
-            Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-            VecDeque_pop_back(&fragment_stack);
+            assert(i32_keys[i] == (int32_t)i - 100 && values[i] == i + 400);
+        }
 
-            Vec_push(
-                &states,
-                &(State){
-                    .kind = STATE_KIND_SPLIT,
-                    .split = {
-                        .out2 = frag.start,
-                    },
-                });
+        ConcurrentBTreeMap_drop(&map);
 
-            State *new = Vec_get_mut(&states, Vec_len(&states) - 1);
+        // Writers on interleaved keys and scanners at the same time
+        ConcurrentBTreeMap_with_branching_factor(&map, &key_props, &value_props, 3);
 
-            OutList_patch(frag.out_list, new);
+        ConcurrentBTreeMapWorker workers[6];
+        thrd_t threads[6];
+        for (size_t i = 0; i < 6; i++)
+        {
+            workers[i] = (ConcurrentBTreeMapWorker){.map = &map, .first = i, .stride = 4, .count = 10000};
+            thrd_create(&threads[i], (thrd_start_t)(i < 4 ? run_concurrent_btreemap_writer : run_concurrent_btreemap_scanner), &workers[i]);
+        }
 
-            VecDeque_push_back(
-                &fragment_stack,
-                &(Fragment){
-                    .start = frag.start,
-                    .out_list = OutList_new(&new->split.out1),
-                });
+        for (size_t i = 0; i < 6; i++)
+        {
+            int result;
+            thrd_join(threads[i], &result);
+            assert(result == 0);
         }
-        break;
 
-        default:
-            assert(false);
+        assert(ConcurrentBTreeMap_len(&map) == 20000);
+
+        for (uint64_t key = 0; key < 40000; key++)
+        {
+            uint64_t value;
+            bool is_present = (key / 4) % 2 == 1;
+            assert(ConcurrentBTreeMap_get(&map, &key, &value) == is_present);
+            assert(!is_present || value == key * 2);
         }
+
+        ConcurrentBTreeMap_drop(&map);
     }
 
-    Vec_push(&states, &(State){.kind = STATE_KIND_MATCH});
+    {
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(Str),
+            .cmp = (CmpFn)compare_str,
+        };
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
 
-    size_t match_idx = Vec_len(&states) - 1;
-    State *new = Vec_get_mut(&states, match_idx);
-    Fragment frag = *(Fragment *)VecDeque_back(&fragment_stack);
-    OutList_patch(frag.out_list, new);
+        // keys over a small alphabet share many prefixes and are often prefixes of each other, a few are long enough
+        // to go past the stored part of a compressed prefix and a few hold zero bytes
+        static uint8_t key_bytes[1500][48];
+        Str keys[1500];
+        uint64_t state = 7;
+        for (size_t i = 0; i < 1500; i++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            size_t len;
 
-    return (NFA){
-        .states = states,
-        .start = frag.start,
-        .tag_count = tag_count,
-        .match_idx = match_idx,
-    };
-}
+            if (i < 256)
+            {
+                // a node with every byte as a child
+                key_bytes[i][0] = 'x';
+                key_bytes[i][1] = (uint8_t)i;
+                len = 2;
+            }
+            else if (i < 400)
+            {
+                len = snprintf((char *)key_bytes[i], 48, "https://example.com/items/%zu", (i * 37) % 1000);
+            }
+            else
+            {
+                len = (state >> 33) % 12;
+                for (size_t j = 0; j < len; j++)
+                {
+                    key_bytes[i][j] = "ab\0"[(state >> (2 * j + 3)) % 3];
+                }
+            }
 
-size_t NFA_state_idx(NFA *this, State *state)
-{
-    return ((uint8_t *)(state) - (uint8_t *)(Vec_get(&this->states, 0))) / this->states.element_size;
-}
+            keys[i] = (Str){.ptr = key_bytes[i], .len = len};
+        }
 
-void NFA_drop(NFA *this)
-{
-    Vec_drop(&this->states);
-}
+        ArtMap map;
+        ArtMap_new(&map, &value_props);
+        BTreeMap expected;
+        BTreeMap_new(&expected, &key_props, &value_props);
 
-typedef struct
-{
-    NFA nfa;
-} Regex;
+        RangeBound unbound = RangeBound_unbound(NULL);
 
-Regex Regex_new(const String *regex)
-{
-    return (Regex){
-        .nfa = NFA_from_str(regex),
-    };
-}
+        for (size_t i = 0; i < 20000; i++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            Str *key = &keys[(state >> 33) % 1500];
+            uint64_t value = i;
 
-typedef struct
-{
-    size_t start;
-    size_t end;
-} Capture;
+            if ((state >> 16) % 5 < 2)
+            {
+                ArtMap_remove(&map, *key);
+                BTreeMap_remove(&expected, key);
+            }
+            else
+            {
+                ArtMap_insert(&map, *key, &value);
+                BTreeMap_insert(&expected, key, &value);
+            }
 
-typedef struct
-{
-    uint8_t *splits;
-    size_t split_count;
-    size_t split_capacity;
-    Capture *tags;
-    size_t tag_capacity;
-} ThreadHistory;
+            assert(ArtMap_len(&map) == BTreeMap_len(&expected));
 
-typedef struct
-{
-    State *state;
-    ThreadHistory history;
-} Thread;
+            if (i % 500 == 0)
+            {
+                check_art_map_range(&map, &expected, &unbound, &unbound);
 
-Thread Thread_new(State *state, size_t tag_capacity)
-{
-    Thread this = {
-        .state = state,
-    };
+                for (size_t j = 0; j < 1500; j++)
+                {
+                    const uint64_t *found = ArtMap_get(&map, keys[j]);
+                    const uint64_t *expected_found = BTreeMap_get(&expected, &keys[j]);
 
-    this.history.split_count = 0;
-    this.history.split_capacity = 64;
-    this.history.splits = malloc(this.history.split_capacity * sizeof(this.history.splits));
+                    assert((found == NULL) == (expected_found == NULL));
+                    assert(found == NULL || *found == *expected_found);
+                }
 
-    this.history.tag_capacity = tag_capacity;
+                Str *lower_key = &keys[(state >> 20) % 1500];
+                Str *upper_key = &keys[(state >> 40) % 1500];
+                RangeBound lower = RangeBound_included(lower_key);
+                RangeBound upper = RangeBound_excluded(upper_key);
+                check_art_map_range(&map, &expected, &lower, &upper);
 
-    if (tag_capacity)
-    {
-        this.history.tags = malloc(this.history.tag_capacity * sizeof(*this.history.tags));
+                lower = RangeBound_excluded(lower_key);
+                upper = RangeBound_included(upper_key);
+                check_art_map_range(&map, &expected, &lower, &unbound);
+                check_art_map_range(&map, &expected, &unbound, &upper);
+            }
+        }
 
-        for (size_t i = 0; i < this.history.tag_capacity; i++)
+        // bounds that are not keys themselves
+        Str absent[] = {Str_from_cstr("a"), Str_from_cstr("https://example.com/items/5"), Str_from_cstr("x"), Str_from_cstr("zzz"), Str_from_cstr("")};
+        for (size_t i = 0; i < sizeof(absent) / sizeof(absent[0]); i++)
         {
-            this.history.tags[i].start = SIZE_MAX;
-            this.history.tags[i].end = SIZE_MAX;
+            RangeBound lower = RangeBound_excluded(&absent[i]);
+            check_art_map_range(&map, &expected, &lower, &unbound);
+            lower = RangeBound_included(&absent[i]);
+            check_art_map_range(&map, &expected, &lower, &unbound);
         }
-    }
 
-    return this;
-}
+        for (size_t i = 0; i < 1500; i++)
+        {
+            ArtMap_remove(&map, keys[i]);
+        }
 
-Thread Thread_clone(const Thread *other)
-{
-    Thread this = {
-        .state = other->state,
-        .history = {
-            .split_count = other->history.split_count,
-            .split_capacity = other->history.split_capacity,
-            .tag_capacity = other->history.tag_capacity,
-        },
-    };
+        assert(ArtMap_len(&map) == 0);
+        ArtMapRangeIter it = ArtMap_range(&map, &unbound, &unbound);
+        assert(ArtMapRangeIter_next(&it) == NULL);
+        ArtMapRangeIter_drop(&it);
 
-    this.history.splits = malloc(this.history.split_capacity * sizeof(this.history.splits));
-    memcpy(this.history.splits, other->history.splits, other->history.split_count * sizeof(this.history.splits));
+        for (size_t i = 0; i < 1500; i += 2)
+        {
+            uint64_t value = i;
+            ArtMap_insert(&map, keys[i], &value);
+        }
 
-    if (this.history.tag_capacity)
-    {
-        this.history.tags = malloc(this.history.tag_capacity * sizeof(*this.history.tags));
-        memcpy(this.history.tags, other->history.tags, other->history.tag_capacity * sizeof(*this.history.tags));
-    }
+        BTreeMap_drop(&expected);
+        ArtMap_drop(&map);
 
-    return this;
-}
+        // Owned values are dropped when replaced, removed and with the map
+        ArtMap owned;
+        BTreeMapValueProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+        };
+        ArtMap_new(&owned, &owned_props);
 
-void Thread_push_split(Thread *this, uint8_t split)
-{
-    if (this->history.split_count == this->history.split_capacity)
-    {
-        this->history.split_capacity *= 2;
-        this->history.splits = realloc(this->history.splits, this->history.split_capacity * sizeof(*this->history.splits));
-    }
+        for (size_t i = 0; i < 400; i++)
+        {
+            char *value = malloc(8);
+            snprintf(value, 8, "%zu", i);
+            ArtMap_insert(&owned, keys[i], &value);
+        }
 
-    this->history.splits[this->history.split_count] = split;
-    this->history.split_count += 1;
-}
+        for (size_t i = 0; i < 400; i += 3)
+        {
+            ArtMap_remove(&owned, keys[i]);
+        }
+
+        assert(strcmp(*(char **)ArtMap_get(&owned, keys[401 % 400]), "1") == 0);
+
+        ArtMap_drop(&owned);
+    }
 
-bool Thread_new_is_better(const Thread *this, const Thread *new)
-{
-    for (size_t i = 0; i < this->history.split_count; i++)
     {
-        if (new->history.splits[i] > this->history.splits[i])
+        // Prefixes stored in the nodes, checked against a map that compares every key
+        BTreeMapKeyProps key_props = {
+            .size = sizeof(Str),
+            .cmp = (CmpFn)compare_str,
+        };
+        BTreeMapKeyProps prefixed_props = key_props;
+        prefixed_props.prefix = (BTreeMapPrefixFn)prefix_str;
+        BTreeMapValueProps value_props = {
+            .size = sizeof(uint64_t),
+        };
+
+        assert(BTreeMap_bytes_prefix("ab", 2) == 0x6162000000000000);
+        assert(BTreeMap_bytes_prefix("abcdefghij", 10) == 0x6162636465666768);
+
+        // many keys share their first 8 bytes or more, others are shorter than 8 bytes
+        static uint8_t key_bytes[1000][40];
+        Str keys[1000];
+        for (size_t i = 0; i < 1000; i++)
         {
-            return true;
+            size_t len = snprintf((char *)key_bytes[i], 40, i % 3 == 0 ? "%zx" : i % 3 == 1 ? "https://a/%zu" : "https://b/%zu/c", (i * 7919) % 1000);
+            keys[i] = (Str){.ptr = key_bytes[i], .len = len};
         }
-        else if (new->history.splits[i] < this->history.splits[i])
+
+        for (size_t t = 2; t <= 8; t += 6)
         {
-            return false;
-        }
-    }
+            BTreeMap map;
+            BTreeMap expected;
+            BTreeMap_with_branching_factor(&map, &prefixed_props, &value_props, t);
+            BTreeMap_with_branching_factor(&expected, &key_props, &value_props, t);
 
-    // prevent cycles as in (.?)*:
-    //
-    // Split₀
-    // ├── out1 → Split₁
-    // │           ├── out1 → '.' → back to Split₀
-    // │           └── out2 → back to Split₀
-    // └── out2 → Match
-    //
-    // when the e-closure cycles back to the original state, it will have the original state's history as it's prefix. We see this and keep
-    // the original state. Since the e-closure computes the concrete states reachable from the original state and it is already being processed
-    // earlier in the e-closure, we can simply discard the recursive call
+            uint64_t state = 3;
+            for (size_t i = 0; i < 5000; i++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
+                Str *key = &keys[(state >> 33) % 1000];
 
-    return false;
-}
+                if ((state >> 20) % 3 == 0)
+                {
+                    BTreeMap_remove(&map, key);
+                    BTreeMap_remove(&expected, key);
+                }
+                else
+                {
+                    BTreeMap_insert(&map, key, &i);
+                    BTreeMap_insert(&expected, key, &i);
+                }
+            }
 
-void Thread_set_tag(Thread *this, size_t id, bool is_start, size_t pos)
-{
-    if (is_start)
-    {
-        this->history.tags[id].start = pos;
-    }
-    else
-    {
-        this->history.tags[id].end = pos;
-    }
-}
+            check_btreemap_node(&map, map.root);
+            assert(BTreeMap_len(&map) == BTreeMap_len(&expected));
+
+            for (size_t i = 0; i < 1000; i++)
+            {
+                const uint64_t *value = BTreeMap_get(&map, &keys[i]);
+                const uint64_t *expected_value = BTreeMap_get(&expected, &keys[i]);
+                assert((value == NULL) == (expected_value == NULL));
+                assert(value == NULL || *value == *expected_value);
+            }
 
-void Thread_drop(Thread *this)
-{
-    free(this->history.splits);
+            Str start = Str_from_cstr("https://a/5");
+            Str end = Str_from_cstr("https://b/");
+            RangeBound lower = RangeBound_included(&start);
+            RangeBound upper = RangeBound_excluded(&end);
+            BTreeMapRangeIter it = BTreeMap_range(&map, &lower, &upper);
+            BTreeMapRangeIter expected_it = BTreeMap_range(&expected, &lower, &upper);
+            size_t count = 0;
 
-    if (this->history.tag_capacity)
-    {
-        free(this->history.tags);
-    }
-}
+            for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&it); entry != NULL; entry = BTreeMapRangeIter_next(&it))
+            {
+                BTreeMapEntry *expected_entry = BTreeMapRangeIter_next(&expected_it);
+                assert(compare_str(entry->key, expected_entry->key) == 0);
+                count++;
+            }
 
-void Regex_e_closure(Regex *this, size_t pos, Thread *new, Vec *visited, Vec *list)
-{
-    size_t idx = NFA_state_idx(&this->nfa, new->state);
-    uint8_t *already_visited = (uint8_t *)Vec_get_mut(visited, idx);
+            assert(BTreeMapRangeIter_next(&expected_it) == NULL);
+            assert(count > 0);
+
+            BTreeMap_drop(&expected);
+            BTreeMap_drop(&map);
+        }
+    }
 
-    if (*already_visited == 1)
     {
-        Thread *old = (Thread *)Vec_get_mut(list, idx);
+        BTreeSet set;
+        BTreeSetElementProps props = {
+            .size = sizeof(uint8_t),
+            .cmp = (CmpFn)compare_u8,
+            .drop = NULL,
+        };
+        BTreeSet_new(&set, &props);
 
-        if (Thread_new_is_better(old, new))
+        for (uint8_t i = 1; i <= 3; i++)
         {
-            Thread_drop(old);
+            BTreeSet_insert(&set, &i);
         }
-        else
+
+        for (uint8_t i = 1; i <= 3; i++)
         {
-            Thread_drop(new);
-            return;
+            assert(BTreeSet_contains(&set, &i));
         }
-    }
 
-    *already_visited = 1;
-    *(Thread *)Vec_get_mut(list, idx) = *new;
+        assert(BTreeSet_len(&set) == 3);
 
-    switch (new->state->kind)
-    {
-    case STATE_KIND_SPLIT:
-    {
-        Thread t1 = Thread_clone(new);
-        t1.state = new->state->split.out1;
-        Thread_push_split(&t1, 1);
-        Regex_e_closure(this, pos, &t1, visited, list);
+        uint8_t val = 2;
+        BTreeSet_remove(&set, &val);
+        assert(!BTreeSet_contains(&set, &val));
+        assert(BTreeSet_len(&set) == 2);
 
-        Thread t2 = Thread_clone(new);
-        t2.state = new->state->split.out2;
-        Thread_push_split(&t2, 0);
-        Regex_e_closure(this, pos, &t2, visited, list);
-    }
-    break;
+        BTreeSet_insert(&set, &val);
+        assert(BTreeSet_contains(&set, &val));
+        assert(BTreeSet_len(&set) == 3);
 
-    case STATE_KIND_TAG:
-    {
-        Thread t = Thread_clone(new);
-        t.state = new->state->tag.out;
-        Thread_set_tag(&t, new->state->tag.id, new->state->tag.is_start, pos);
-        Regex_e_closure(this, pos, &t, visited, list);
-    }
-    break;
+        uint8_t nonexistent = 99;
+        BTreeSet_remove(&set, &nonexistent);
+        assert(BTreeSet_len(&set) == 3);
 
-    default:
-        break;
-    }
-}
+        BTreeSet_drop(&set);
 
-void Regex_step(Regex *this, size_t pos, uint8_t c, Vec *current_visited, Vec *current_list, Vec *next_visited, Vec *next_list)
-{
-    memset(Vec_get_mut(next_visited, 0), 0, Vec_len(next_visited) * sizeof(uint8_t));
+        // BTreeSet_range
 
-    for (size_t i = 0; i < Vec_len(current_visited); i++)
-    {
-        if (*(uint8_t *)Vec_get(current_visited, i) == 1)
-        {
-            Thread *t = (Thread *)Vec_get(current_list, i);
+        BTreeSet_new(&set, &props);
 
-            if (t->state->kind == STATE_KIND_LITERAL && c == t->state->literal.c)
-            {
-                Thread new = Thread_clone(t);
-                new.state = t->state->literal.out;
-                Regex_e_closure(this, pos, &new, next_visited, next_list);
-            }
+        for (uint8_t i = 1; i <= 5; i++)
+            BTreeSet_insert(&set, &i);
 
-            Thread_drop(t);
+        uint8_t start = 2;
+        uint8_t end = 4;
+        RangeBound lower = RangeBound_included(&start);
+        RangeBound upper = RangeBound_included(&end);
+
+        BTreeSetRangeIter iter = BTreeSet_range(&set, &lower, &upper);
+
+        uint8_t expected = 2;
+        for (void *key = BTreeSetRangeIter_next(&iter); key != NULL; key = BTreeSetRangeIter_next(&iter))
+        {
+            assert(*(uint8_t *)key == expected);
+            expected++;
         }
-    }
+        assert(expected == 5);
 
-    SWAP(*current_list, *next_list);
-    SWAP(*current_visited, *next_visited);
-}
+        BTreeSetRangeIter_drop(&iter);
+        iter = BTreeSet_range(&set, &lower, &upper);
 
-bool Regex_match(Regex *this, const String *str, Vec *captures)
-{
-    size_t state_count = Vec_len(&this->nfa.states);
+        expected = 4;
+        for (void *key = BTreeSetRangeIter_next_back(&iter); key != NULL; key = BTreeSetRangeIter_next_back(&iter))
+        {
+            assert(*(uint8_t *)key == expected);
+            expected--;
+        }
+        assert(expected == 1);
 
-    Vec current_list;
-    Vec_with_capacity(&current_list, sizeof(Thread), &(VecElementOps){}, state_count);
-    Vec_set_len(&current_list, state_count);
+        BTreeSetRangeIter_drop(&iter);
+        BTreeSet_drop(&set);
 
-    Vec current_visited;
-    Vec_with_capacity(&current_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
-    Vec_set_len(&current_visited, state_count);
+        // BTreeSet_union
 
-    Vec next_list;
-    Vec_with_capacity(&next_list, sizeof(Thread), &(VecElementOps){}, state_count);
-    Vec_set_len(&next_list, state_count);
+        BTreeSet a;
+        BTreeSet b;
+        BTreeSet_new(&a, &props);
+        BTreeSet_new(&b, &props);
 
-    Vec next_visited;
-    Vec_with_capacity(&next_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
-    Vec_set_len(&next_visited, state_count);
+        for (uint8_t i = 1; i <= 3; i++)
+            BTreeSet_insert(&a, &i);
 
-    memset(Vec_get_mut(&current_visited, 0), 0, Vec_len(&current_visited) * sizeof(uint8_t));
+        for (uint8_t i = 3; i <= 5; i++)
+            BTreeSet_insert(&b, &i);
 
-    Thread start = Thread_new(this->nfa.start, this->nfa.tag_count);
-    Regex_e_closure(this, 0, &start, &current_visited, &current_list);
+        BTreeSetUnionIter union_iter = BTreeSet_union(&a, &b);
 
-    for (size_t i = 0; i < String_len(str); i++)
-    {
-        uint8_t c = String_get(str, i);
-        Regex_step(this, i + 1, c, &current_visited, &current_list, &next_visited, &next_list);
+        uint8_t expected_union[] = {1, 2, 3, 4, 5};
+        size_t idx = 0;
 
-        bool has_any = false;
-        for (size_t j = 0; j < Vec_len(&current_visited); j++)
+        for (void *key = BTreeSetUnionIter_next(&union_iter); key != NULL; key = BTreeSetUnionIter_next(&union_iter))
         {
-            if (*(uint8_t *)Vec_get(&current_visited, j) == 1)
-            {
-                has_any = true;
-                break;
-            }
+            assert(*(uint8_t *)(key) == expected_union[idx]);
+            idx++;
         }
 
-        if (!has_any)
-        {
-            break;
-        }
-    }
+        assert(idx == 5);
+        BTreeSetUnionIter_drop(&union_iter);
+        BTreeSet_drop(&a);
+        BTreeSet_drop(&b);
 
-    bool has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
+        // BTreeSet_intersection
 
-    if (has_match && this->nfa.tag_count != 0)
-    {
-        Vec_with_capacity(captures, sizeof(Capture), &(VecElementOps){}, this->nfa.tag_count);
+        BTreeSet_new(&a, &props);
+        BTreeSet_new(&b, &props);
 
-        const Thread *thread = Vec_get(&current_list, this->nfa.match_idx);
+        for (uint8_t i = 1; i <= 3; i++)
+            BTreeSet_insert(&a, &i);
+        for (uint8_t i = 3; i <= 5; i++)
+            BTreeSet_insert(&b, &i);
 
-        for (size_t j = 0; j < this->nfa.tag_count; j++)
+        BTreeSetIntersectionIter intersection_iter = BTreeSet_intersection(&a, &b);
+        uint8_t expected_intersection[] = {3};
+        idx = 0;
+
+        for (void *key = BTreeSetIntersectionIter_next(&intersection_iter); key != NULL; key = BTreeSetIntersectionIter_next(&intersection_iter))
         {
-            Vec_push(captures, &thread->history.tags[j]);
+            assert(*(uint8_t *)key == expected_intersection[idx]);
+            idx++;
         }
-    }
 
-    Vec_drop(&current_list);
-    Vec_drop(&current_visited);
-    Vec_drop(&next_list);
-    Vec_drop(&next_visited);
-
-    return has_match;
-}
+        assert(idx == 1);
+        BTreeSetIntersectionIter_drop(&intersection_iter);
+        BTreeSet_drop(&a);
+        BTreeSet_drop(&b);
 
-void Regex_search(Regex *this, const String *str, size_t *match_start, size_t *match_end, Vec *captures)
-{
-    size_t state_count = Vec_len(&this->nfa.states);
+        // BTreeSet_difference
 
-    Vec current_list;
-    Vec_with_capacity(&current_list, sizeof(Thread), &(VecElementOps){}, state_count);
-    Vec_set_len(&current_list, state_count);
+        BTreeSet_new(&a, &props);
+        BTreeSet_new(&b, &props);
 
-    Vec current_visited;
-    Vec_with_capacity(&current_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
-    Vec_set_len(&current_visited, state_count);
+        for (uint8_t i = 1; i <= 3; i++)
+            BTreeSet_insert(&a, &i);
+        for (uint8_t i = 3; i <= 5; i++)
+            BTreeSet_insert(&b, &i);
 
-    Vec next_list;
-    Vec_with_capacity(&next_list, sizeof(Thread), &(VecElementOps){}, state_count);
-    Vec_set_len(&next_list, state_count);
+        BTreeSetDifferenceIter difference_iter = BTreeSet_difference(&a, &b);
+        uint8_t expected_difference[] = {1, 2};
+        idx = 0;
 
-    Vec next_visited;
-    Vec_with_capacity(&next_visited, sizeof(uint8_t), &(VecElementOps){}, state_count);
-    Vec_set_len(&next_visited, state_count);
+        for (void *key = BTreeSetDifferenceIter_next(&difference_iter); key != NULL; key = BTreeSetDifferenceIter_next(&difference_iter))
+        {
+            assert(*(uint8_t *)key == expected_difference[idx]);
+            idx++;
+        }
 
-    for (size_t s = 0; s < String_len(str); s++)
-    {
-        memset(Vec_get_mut(&current_visited, 0), 0, Vec_len(&current_visited) * sizeof(uint8_t));
+        assert(idx == 2);
+        BTreeSetDifferenceIter_drop(&difference_iter);
+        BTreeSet_drop(&a);
+        BTreeSet_drop(&b);
 
-        Thread best_match;
-        size_t best_match_end;
-        bool has_best_match = false;
+        // BTreeSet_symmetric_difference
 
-        Thread start = Thread_new(this->nfa.start, this->nfa.tag_count);
-        Regex_e_closure(this, s, &start, &current_visited, &current_list);
+        BTreeSet_new(&a, &props);
+        BTreeSet_new(&b, &props);
 
-        bool has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
+        for (uint8_t i = 1; i <= 3; i++)
+            BTreeSet_insert(&a, &i);
+        for (uint8_t i = 3; i <= 5; i++)
+            BTreeSet_insert(&b, &i);
 
-        if (has_match)
+        BTreeSetSymmetricDifferenceIter symmetric_difference_iter = BTreeSet_symmetric_difference(&a, &b);
+        uint8_t expected_symmetric_difference[] = {1, 2, 4, 5};
+        idx = 0;
+
+        for (void *key = BTreeSetSymmetricDifferenceIter_next(&symmetric_difference_iter);
+             key != NULL;
+             key = BTreeSetSymmetricDifferenceIter_next(&symmetric_difference_iter))
         {
-            best_match = Thread_clone(Vec_get(&current_list, this->nfa.match_idx));
-            best_match_end = s;
+            assert(*(uint8_t *)key == expected_symmetric_difference[idx]);
+            idx++;
         }
 
-        for (size_t i = s; i < String_len(str); i++)
+        assert(idx == 4);
+        BTreeSetSymmetricDifferenceIter_drop(&symmetric_difference_iter);
+        BTreeSet_drop(&a);
+        BTreeSet_drop(&b);
+
+        // BTreeSet_*_into, both as a merge of similar sizes and galloping through a much larger set
+
+        size_t steps_b[] = {3, 97};
+
+        for (size_t s = 0; s < SIZE(steps_b); s++)
         {
-            uint8_t c = String_get(str, i);
-            Regex_step(this, i + 1, c, &current_visited, &current_list, &next_visited, &next_list);
+            BTreeSet_new(&a, &props);
+            BTreeSet_new(&b, &props);
 
-            bool has_any = false;
-            for (size_t j = 0; j < Vec_len(&current_visited); j++)
+            for (size_t i = 0; i < 256; i += 2)
             {
-                if (*(uint8_t *)Vec_get(&current_visited, j) == 1)
-                {
-                    has_any = true;
-                    break;
-                }
+                uint8_t element = i;
+                BTreeSet_insert(&a, &element);
             }
 
-            if (!has_any)
+            for (size_t i = 0; i < 256; i += steps_b[s])
             {
-                break;
+                uint8_t element = i;
+                BTreeSet_insert(&b, &element);
             }
 
-            has_match = *(uint8_t *)Vec_get(&current_visited, this->nfa.match_idx) == 1;
-
-            if (has_match)
+            for (size_t order = 0; order < 2; order++)
             {
-                const Thread *new = Vec_get(&current_list, this->nfa.match_idx);
+                const BTreeSet *x = order == 0 ? &a : &b;
+                const BTreeSet *y = order == 0 ? &b : &a;
 
-                if (has_best_match)
+                BTreeSet results[4];
+                BTreeSet_union_into(x, y, &results[0]);
+                BTreeSet_intersection_into(x, y, &results[1]);
+                BTreeSet_difference_into(x, y, &results[2]);
+                BTreeSet_symmetric_difference_into(x, y, &results[3]);
+
+                for (size_t r = 0; r < SIZE(results); r++)
                 {
-                    if (Thread_new_is_better(&best_match, new))
-                    {
-                        Thread_drop(&best_match);
+                    check_btreemap_node(results[r].map, results[r].map->root);
+                }
 
-                        best_match = Thread_clone(new);
-                        best_match_end = i + 1;
-                    }
+                size_t lengths[4] = {0};
+
+                for (size_t i = 0; i < 256; i++)
+                {
+                    uint8_t element = i;
+                    bool in_x = BTreeSet_contains(x, &element);
+                    bool in_y = BTreeSet_contains(y, &element);
+
+                    assert(BTreeSet_contains(&results[0], &element) == (in_x || in_y));
+                    assert(BTreeSet_contains(&results[1], &element) == (in_x && in_y));
+                    assert(BTreeSet_contains(&results[2], &element) == (in_x && !in_y));
+                    assert(BTreeSet_contains(&results[3], &element) == (in_x != in_y));
+
+                    lengths[0] += in_x || in_y;
+                    lengths[1] += in_x && in_y;
+                    lengths[2] += in_x && !in_y;
+                    lengths[3] += in_x != in_y;
                 }
-                else
+
+                for (size_t r = 0; r < SIZE(results); r++)
                 {
-                    has_best_match = true;
-                    best_match = Thread_clone(new);
-                    best_match_end = i + 1;
+                    assert(BTreeSet_len(&results[r]) == lengths[r]);
+                    BTreeSet_drop(&results[r]);
                 }
             }
-        }
-
-        if (has_best_match)
-        {
-            *match_start = s;
-            *match_end = best_match_end;
 
-            Vec_with_capacity(captures, sizeof(Capture), &(VecElementOps){}, this->nfa.tag_count);
+            BTreeSet_drop(&a);
+            BTreeSet_drop(&b);
+        }
 
-            for (size_t j = 0; j < this->nfa.tag_count; j++)
-            {
-                Vec_push(captures, &best_match.history.tags[j]);
-            }
+        // deep trees, so that seeking has to climb and descend
+        BTreeSetElementProps u64_props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        BTreeSet_new(&a, &u64_props);
+        BTreeSet_new(&b, &u64_props);
 
-            Thread_drop(&best_match);
+        for (uint64_t i = 0; i < 40000; i += 2)
+        {
+            BTreeSet_insert(&a, &i);
+        }
 
-            break;
+        for (uint64_t i = 0; i < 40000; i += 997)
+        {
+            BTreeSet_insert(&b, &i);
         }
-    }
 
-    Vec_drop(&current_list);
-    Vec_drop(&current_visited);
-    Vec_drop(&next_list);
-    Vec_drop(&next_visited);
-}
+        BTreeSet intersection;
+        BTreeSet_intersection_into(&a, &b, &intersection);
 
-void Regex_drop(Regex *this)
-{
-    NFA_drop(&this->nfa);
-}
+        BTreeSet difference;
+        BTreeSet_difference_into(&b, &a, &difference);
 
-bool eq_u8(const uint8_t *a, const uint8_t *b)
-{
-    return *a == *b;
-}
+        for (uint64_t i = 0; i < 40000; i += 997)
+        {
+            assert(BTreeSet_contains(&intersection, &i) == (i % 2 == 0));
+            assert(BTreeSet_contains(&difference, &i) == (i % 2 == 1));
+        }
 
-void hash_u8(const uint8_t *key, Hasher *hasher)
-{
-    Hasher_write(hasher, key, sizeof(uint8_t));
-}
+        assert(BTreeSet_len(&intersection) + BTreeSet_len(&difference) == BTreeSet_len(&b));
 
-int32_t compare_u8(const uint8_t *a, const uint8_t *b)
-{
-    if (*a > *b)
-    {
-        return 1;
-    }
-    else if (*a == *b)
-    {
-        return 0;
-    }
-    else
-    {
-        return -1;
+        BTreeSet_drop(&intersection);
+        BTreeSet_drop(&difference);
+        BTreeSet_drop(&a);
+        BTreeSet_drop(&b);
     }
-}
 
-void drop_nop(void *ptr)
-{
-    (void)ptr;
-}
-
-int main(int argc, const char **argv)
-{
     {
-        Vec u8vec;
-        Vec_new(&u8vec, sizeof(uint8_t), NULL);
-
-        assert(Vec_capacity(&u8vec) == 0);
-        assert(Vec_len(&u8vec) == 0);
-
-        uint8_t u8value = 1;
-        Vec_push(&u8vec, &u8value);
-        u8value = 2;
-        Vec_push(&u8vec, &u8value);
-        u8value = 3;
-        Vec_push(&u8vec, &u8value);
-
-        assert(Vec_len(&u8vec) == 3);
-        assert(Vec_capacity(&u8vec) > 3);
-
-        for (size_t i = 0; i < Vec_len(&u8vec); i++)
-        {
-            uint8_t *element = (uint8_t *)Vec_get_mut(&u8vec, i);
-
-            *element = *element * 2;
-
-            uint8_t new_element = 0;
+        LinkedListElementProps element_props;
+        element_props.element_size = sizeof(uint8_t);
+        element_props.drop = drop_nop;
 
-            Vec_insert(&u8vec, i, &new_element);
-            Vec_remove(&u8vec, i);
-        }
+        LinkedList list;
+        LinkedList_new(&list, &element_props);
 
-        assert(Vec_len(&u8vec) == 3);
-        assert(*(uint8_t *)Vec_get(&u8vec, 0) == 2);
-        assert(*(uint8_t *)Vec_get(&u8vec, 1) == 4);
-        assert(*(uint8_t *)Vec_get(&u8vec, 2) == 6);
+        uint8_t value = 10;
+        LinkedList_push_front(&list, &value);
+        value = 20;
+        LinkedList_push_back(&list, &value);
+        value = 30;
+        LinkedList_push_back(&list, &value);
 
-        size_t previous_capacity = Vec_capacity(&u8vec);
-        Vec_clear(&u8vec);
-        assert(Vec_len(&u8vec) == 0);
-        assert(Vec_capacity(&u8vec) == previous_capacity);
+        assert(LinkedList_len(&list) == 3);
 
-        Vec_shrink_to_fit(&u8vec);
-        assert(Vec_capacity(&u8vec) == 0);
+        uint8_t *front = LinkedList_front(&list);
+        assert(front && *front == 10);
 
-        Vec_drop(&u8vec);
+        uint8_t *back = LinkedList_back(&list);
+        assert(back && *back == 30);
 
-        Vec_with_capacity(&u8vec, sizeof(uint8_t), NULL, 3);
-        assert(Vec_capacity(&u8vec) == 3);
+        LinkedList_pop_front(&list);
+        front = LinkedList_front(&list);
+        assert(front && *front == 20);
+        assert(LinkedList_len(&list) == 2);
 
-        Vec_reserve(&u8vec, 3);
-        assert(Vec_capacity(&u8vec) == 3);
+        LinkedList_pop_back(&list);
+        back = LinkedList_back(&list);
+        assert(back && *back == 20);
+        assert(LinkedList_len(&list) == 1);
 
-        u8value = 1;
-        Vec_push(&u8vec, &u8value);
-        u8value = 2;
-        Vec_push(&u8vec, &u8value);
-        u8value = 3;
-        Vec_push(&u8vec, &u8value);
+        LinkedList_pop_back(&list);
+        assert(LinkedList_len(&list) == 0);
+        assert(LinkedList_front(&list) == NULL);
+        assert(LinkedList_back(&list) == NULL);
 
-        Vec_reserve(&u8vec, 3);
-        assert(Vec_capacity(&u8vec) == 6);
+        value = 10;
+        LinkedList_push_back(&list, &value);
+        value = 20;
+        LinkedList_push_back(&list, &value);
 
-        Vec_truncate(&u8vec, 1);
-        assert(Vec_len(&u8vec) == 1);
+        assert(LinkedList_len(&list) == 2);
+        assert(*((uint8_t *)LinkedList_front(&list)) == 10);
+        assert(*((uint8_t *)LinkedList_back(&list)) == 20);
 
-        Vec_drop(&u8vec);
+        LinkedList_drop(&list);
     }
 
     {
-        BTreeMap u8u8map;
-        BTreeMapKeyProps key_props = {
-            .size = sizeof(uint8_t),
-            .cmp = (CmpFn)compare_u8,
-        };
-        BTreeMapValueProps value_props = {
-            .size = sizeof(uint8_t),
+        LinkedListElementProps element_props = {
+            .element_size = sizeof(uint64_t),
         };
-        BTreeMap_new(&u8u8map, &key_props, &value_props);
 
-        for (uint8_t i = 1; i <= 3; i++)
+        LinkedList list;
+        LinkedList_new(&list, &element_props);
+
+        for (uint64_t i = 0; i < 6; i++)
         {
-            BTreeMap_insert(&u8u8map, &i, &i);
+            LinkedList_push_back(&list, &i);
         }
 
-        for (uint8_t i = 1; i <= 3; i++)
+        // cursor edits in the middle keep the cursor on the same element and its index in sync
+        LinkedListCursor cursor = LinkedList_cursor_front(&list);
+        LinkedListCursor_move_next(&cursor);
+        LinkedListCursor_move_next(&cursor);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 2 && LinkedListCursor_index(&cursor) == 2);
+
+        uint64_t value = 10;
+        LinkedListCursor_insert_before(&cursor, &value);
+        value = 11;
+        LinkedListCursor_insert_after(&cursor, &value);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 2 && LinkedListCursor_index(&cursor) == 3);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 2, 11, 3, 4, 5}, 8);
+
+        LinkedListCursor_remove_current(&cursor);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 11 && LinkedListCursor_index(&cursor) == 3);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 11, 3, 4, 5}, 7);
+
+        // moving a node to another list reuses its allocation
+        LinkedList other;
+        LinkedList_new(&other, &element_props);
+        LinkedListNode *node = LinkedListCursor_remove_current_node(&cursor);
+        LinkedList_push_back_node(&other, node);
+        assert(LinkedList_front_node(&other) == node && LinkedList_back_node(&other) == node);
+        check_linked_list(&other, (uint64_t[]){11}, 1);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 3, 4, 5}, 6);
+
+        // split_after keeps the cursor and its prefix, splice_before puts the rest back in front of the cursor
+        LinkedList tail;
+        LinkedListCursor_split_after(&cursor, &tail);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 3}, 4);
+        check_linked_list(&tail, (uint64_t[]){4, 5}, 2);
+
+        LinkedListCursor_splice_before(&cursor, &tail);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 3 && LinkedListCursor_index(&cursor) == 5);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 4, 5, 3}, 6);
+        check_linked_list(&tail, NULL, 0);
+
+        LinkedListCursor_splice_after(&cursor, &other);
+        check_linked_list(&list, (uint64_t[]){0, 1, 10, 4, 5, 3, 11}, 7);
+
+        // wrapping through the ghost in both directions
+        cursor = LinkedList_cursor_back(&list);
+        LinkedListCursor_move_next(&cursor);
+        assert(LinkedListCursor_current(&cursor) == NULL && LinkedListCursor_index(&cursor) == 7);
+        value = 20;
+        LinkedListCursor_insert_after(&cursor, &value);
+        LinkedListCursor_insert_before(&cursor, &value);
+        assert(LinkedListCursor_index(&cursor) == 9);
+        LinkedListCursor_move_next(&cursor);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 20 && LinkedListCursor_index(&cursor) == 0);
+        LinkedListCursor_move_prev(&cursor);
+        LinkedListCursor_move_prev(&cursor);
+        assert(*(uint64_t *)LinkedListCursor_current(&cursor) == 20 && LinkedListCursor_index(&cursor) == 8);
+        check_linked_list(&list, (uint64_t[]){20, 0, 1, 10, 4, 5, 3, 11, 20}, 9);
+
+        // split_off walks from the closer end, append moves everything back
+        for (size_t at = 0; at <= 9; at++)
         {
-            const void *value = BTreeMap_get(&u8u8map, &i);
-
-            assert(value != NULL);
-            assert(*(uint8_t *)value == i);
+            LinkedList_split_off(&list, at, &tail);
+            assert(LinkedList_len(&list) == at && LinkedList_len(&tail) == 9 - at);
+            LinkedList_append(&list, &tail);
+            check_linked_list(&list, (uint64_t[]){20, 0, 1, 10, 4, 5, 3, 11, 20}, 9);
         }
 
-        uint8_t key = 2, new_value = 42;
-        BTreeMap_insert(&u8u8map, &key, &new_value);
+        LinkedList_drop(&tail);
+        LinkedList_drop(&other);
+        LinkedList_drop(&list);
 
-        const void *value = BTreeMap_get(&u8u8map, &key);
+        // an intrusive LRU list over caller-owned entries, touching moves an entry to the front and eviction takes
+        // the back
+        LruEntry entries[5];
+        LinkedList lru;
+        LinkedList_new_intrusive(&lru);
 
-        assert(value != NULL);
-        assert(*(uint8_t *)value == 42);
+        for (size_t i = 0; i < SIZE(entries); i++)
+        {
+            entries[i].key = i;
+            LinkedList_push_front_node(&lru, &entries[i].lru);
+        }
 
-        // Remove key = 1 (leaf case)
-        key = 1;
-        BTreeMap_remove(&u8u8map, &key);
-        value = BTreeMap_get(&u8u8map, &key);
-        assert(value == NULL);
+        LinkedList_unlink_node(&lru, &entries[0].lru);
+        LinkedList_push_front_node(&lru, &entries[0].lru);
+        LinkedList_unlink_node(&lru, &entries[2].lru);
+        LinkedList_push_front_node(&lru, &entries[2].lru);
 
-        // Remove key = 2 (internal node candidate)
-        key = 2;
-        BTreeMap_remove(&u8u8map, &key);
-        value = BTreeMap_get(&u8u8map, &key);
-        assert(value == NULL);
+        uint64_t expected_lru[] = {2, 0, 4, 3, 1};
+        cursor = LinkedList_cursor_front(&lru);
+        for (size_t i = 0; i < SIZE(expected_lru); i++, LinkedListCursor_move_next(&cursor))
+        {
+            assert(CONTAINER_OF(LinkedListCursor_current_node(&cursor), LruEntry, lru)->key == expected_lru[i]);
+        }
+        assert(LinkedListCursor_current_node(&cursor) == NULL);
 
-        // Try removing a non-existent key
-        key = 99;
-        BTreeMap_remove(&u8u8map, &key);
-        value = BTreeMap_get(&u8u8map, &key);
-        assert(value == NULL);
+        LruEntry *evicted = CONTAINER_OF(LinkedList_back_node(&lru), LruEntry, lru);
+        assert(evicted->key == 1);
+        LinkedList_pop_back(&lru);
+        assert(LinkedList_len(&lru) == 4);
+        assert(CONTAINER_OF(LinkedList_back_node(&lru), LruEntry, lru)->key == 3);
 
-        BTreeMap_drop(&u8u8map);
+        LinkedList_drop(&lru);
+    }
+
+    {
+        LinkedListElementProps element_props = {
+            .element_size = sizeof(uint64_t),
+            .drop = drop_nop,
+        };
 
-        BTreeMap_new(&u8u8map, &key_props, &value_props);
+        UnrolledLinkedList list;
+        UnrolledLinkedList_new(&list, &element_props);
+        assert(list.capacity == UNROLLED_LINKED_LIST_MAXIMUM_CAPACITY);
+        assert(UnrolledLinkedList_front(&list) == NULL);
+        assert(UnrolledLinkedList_back(&list) == NULL);
 
-        // Insert keys 1..=5
-        for (uint8_t i = 1; i <= 5; i++)
+        // queue usage fills whole chunks from both ends
+        for (uint64_t i = 0; i < 1000; i++)
         {
-            BTreeMap_insert(&u8u8map, &i, &i);
+            UnrolledLinkedList_push_back(&list, &i);
         }
 
-        // Create range [2, 4]
-        uint8_t start = 2;
-        uint8_t end = 4;
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            assert(*(uint64_t *)UnrolledLinkedList_front(&list) == i);
+            assert(*(uint64_t *)UnrolledLinkedList_back(&list) == 999);
+            UnrolledLinkedList_pop_front(&list);
+        }
 
-        RangeBound lower = RangeBound_included(&start);
-        RangeBound upper = RangeBound_included(&end);
+        assert(UnrolledLinkedList_len(&list) == 0);
+        assert(list.head == NULL && list.tail == NULL);
 
-        BTreeMapRangeIter iter = BTreeMap_range(&u8u8map, &lower, &upper);
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            UnrolledLinkedList_push_front(&list, &i);
+        }
 
-        // Expected sequence: 2, 3, 4
-        uint8_t expected = 2;
-        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&iter); entry != NULL; entry = BTreeMapRangeIter_next(&iter))
+        size_t node_count = 0;
+        for (UnrolledLinkedListNode *node = list.head; node != NULL; node = node->next)
         {
-            uint8_t key = *(uint8_t *)entry->key;
-            uint8_t value = *(uint8_t *)entry->value;
+            node_count++;
+        }
+        assert(node_count == (1000 + list.capacity - 1) / list.capacity);
 
-            assert(key == expected);
-            assert(value == expected);
-            expected++;
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            assert(*(uint64_t *)UnrolledLinkedList_back(&list) == i);
+            UnrolledLinkedList_pop_back(&list);
         }
 
-        BTreeMap_range(&u8u8map, &lower, &upper);
+        assert(UnrolledLinkedList_len(&list) == 0);
+        UnrolledLinkedList_drop(&list);
 
-        assert(expected == 5); // ensures we iterated 2,3,4
+        // random pushes, pops and cursor edits against a Vec, with tiny chunks to force splits and merges
+        size_t capacities[] = {UNROLLED_LINKED_LIST_MINIMUM_CAPACITY, 7, UNROLLED_LINKED_LIST_MAXIMUM_CAPACITY};
 
-        // Expected sequence: 4, 3, 2
-        expected = 4;
-        for (BTreeMapEntry *entry = BTreeMapRangeIter_next_back(&iter); entry != NULL; entry = BTreeMapRangeIter_next_back(&iter))
+        for (size_t c = 0; c < SIZE(capacities); c++)
         {
-            uint8_t key = *(uint8_t *)entry->key;
-            uint8_t value = *(uint8_t *)entry->value;
+            UnrolledLinkedList_with_capacity(&list, &element_props, capacities[c]);
 
-            assert(key == expected);
-            assert(value == expected);
-            expected--;
-        }
+            Vec expected;
+            Vec_new(&expected, sizeof(uint64_t), NULL);
 
-        // Test with excluded upper bound (2..4)
-        lower = RangeBound_included(&start);
-        upper = RangeBound_excluded(&end);
-        iter = BTreeMap_range(&u8u8map, &lower, &upper);
+            UnrolledLinkedListCursor cursor = UnrolledLinkedList_cursor_front(&list);
+            size_t position = 0; // equal to the length on the ghost
+            uint64_t state = c + 1;
 
-        expected = 2;
-        for (BTreeMapEntry *entry = BTreeMapRangeIter_next(&iter); entry != NULL; entry = BTreeMapRangeIter_next(&iter))
-        {
-            uint8_t key = *(uint8_t *)entry->key;
-            assert(key == expected);
-            expected++;
-        }
+            for (uint64_t i = 0; i < 20000; i++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
+                size_t len = Vec_len(&expected);
+                // bias towards growth first, then towards shrinking
+                size_t op = (state >> 33) % (i < 10000 ? 10 : 12);
 
-        assert(expected == 4); // iterated 2,3 only
+                switch (op)
+                {
+                case 0:
+                    UnrolledLinkedList_push_front(&list, &i);
+                    Vec_insert(&expected, 0, &i);
+                    break;
+                case 1:
+                    UnrolledLinkedList_push_back(&list, &i);
+                    Vec_push(&expected, &i);
+                    break;
+                case 2:
+                    UnrolledLinkedList_pop_front(&list);
+                    if (len > 0)
+                        Vec_remove(&expected, 0);
+                    break;
+                case 3:
+                    UnrolledLinkedList_pop_back(&list);
+                    if (len > 0)
+                        Vec_pop(&expected);
+                    break;
+                case 4:
+                    UnrolledLinkedListCursor_move_next(&cursor);
+                    position = position == len ? 0 : position + 1;
+                    break;
+                case 5:
+                    UnrolledLinkedListCursor_move_prev(&cursor);
+                    position = position == 0 ? len : (position == len ? len - 1 : position - 1);
+                    break;
+                case 6:
+                    UnrolledLinkedListCursor_insert_before(&cursor, &i);
+                    Vec_insert(&expected, position, &i);
+                    position++;
+                    break;
+                case 7:
+                    UnrolledLinkedListCursor_insert_after(&cursor, &i);
+                    Vec_insert(&expected, position == len ? 0 : position + 1, &i);
+                    position += position == len;
+                    break;
+                default:
+                    UnrolledLinkedListCursor_remove_current(&cursor);
+                    if (position < len)
+                        Vec_remove(&expected, position);
+                    break;
+                }
 
-        BTreeMap_drop(&u8u8map);
+                // pushing and popping invalidates cursors
+                if (op < 4)
+                {
+                    cursor = UnrolledLinkedList_cursor_front(&list);
+                    position = 0;
+                }
+
+                if (position == Vec_len(&expected))
+                {
+                    assert(UnrolledLinkedListCursor_current(&cursor) == NULL);
+                }
+                else
+                {
+                    assert(*(uint64_t *)UnrolledLinkedListCursor_current(&cursor) == *(uint64_t *)Vec_get(&expected, position));
+                }
+
+                if (i % 97 == 0)
+                {
+                    check_unrolled_linked_list(&list, &expected);
+                }
+            }
+
+            check_unrolled_linked_list(&list, &expected);
+
+            // walking back from the end visits everything once before reaching the ghost
+            cursor = UnrolledLinkedList_cursor_back(&list);
+            for (size_t k = Vec_len(&expected); k > 0; k--)
+            {
+                assert(*(uint64_t *)UnrolledLinkedListCursor_current(&cursor) == *(uint64_t *)Vec_get(&expected, k - 1));
+                UnrolledLinkedListCursor_move_prev(&cursor);
+            }
+            assert(UnrolledLinkedListCursor_current(&cursor) == NULL);
+
+            Vec_drop(&expected);
+            UnrolledLinkedList_drop(&list);
+        }
     }
 
     {
-        BTreeSet set;
-        BTreeSetElementProps props = {
+        VecDeque deque;
+        VecDequeElementProps props = {
             .size = sizeof(uint8_t),
-            .cmp = (CmpFn)compare_u8,
-            .drop = NULL,
+            .drop = drop_nop,
         };
-        BTreeSet_new(&set, &props);
+        VecDeque_new(&deque, &props);
 
-        for (uint8_t i = 1; i <= 3; i++)
-        {
-            BTreeSet_insert(&set, &i);
-        }
+        assert(VecDeque_len(&deque) == 0);
+        assert(VecDeque_capacity(&deque) == 0);
 
-        for (uint8_t i = 1; i <= 3; i++)
-        {
-            assert(BTreeSet_contains(&set, &i));
-        }
+        uint8_t value = 10;
+        VecDeque_push_back(&deque, &value);
+        value = 20;
+        VecDeque_push_back(&deque, &value);
+        value = 30;
+        VecDeque_push_back(&deque, &value);
 
-        assert(BTreeSet_len(&set) == 3);
+        assert(VecDeque_len(&deque) == 3);
+        assert(VecDeque_capacity(&deque) >= 3);
 
-        uint8_t val = 2;
-        BTreeSet_remove(&set, &val);
-        assert(!BTreeSet_contains(&set, &val));
-        assert(BTreeSet_len(&set) == 2);
+        uint8_t *front = VecDeque_front(&deque);
+        uint8_t *back = VecDeque_back(&deque);
+        assert(front != NULL && *front == 10);
+        assert(back != NULL && *back == 30);
 
-        BTreeSet_insert(&set, &val);
-        assert(BTreeSet_contains(&set, &val));
-        assert(BTreeSet_len(&set) == 3);
+        value = 5;
+        VecDeque_push_front(&deque, &value);
+        assert(VecDeque_len(&deque) == 4);
+        assert(*(uint8_t *)VecDeque_front(&deque) == 5);
 
-        uint8_t nonexistent = 99;
-        BTreeSet_remove(&set, &nonexistent);
-        assert(BTreeSet_len(&set) == 3);
+        VecDeque_pop_back(&deque);
+        assert(VecDeque_len(&deque) == 3);
+        assert(*(uint8_t *)VecDeque_back(&deque) == 20);
 
-        BTreeSet_drop(&set);
+        VecDeque_pop_front(&deque);
+        assert(VecDeque_len(&deque) == 2);
+        assert(*(uint8_t *)VecDeque_front(&deque) == 10);
 
-        // BTreeSet_range
+        size_t previous_capacity = VecDeque_capacity(&deque);
+        VecDeque_shrink_to_fit(&deque);
+        assert(VecDeque_capacity(&deque) == VecDeque_len(&deque));
+        assert(VecDeque_capacity(&deque) <= previous_capacity);
 
-        BTreeSet_new(&set, &props);
+        VecDeque_clear(&deque);
+        assert(VecDeque_len(&deque) == 0);
 
-        for (uint8_t i = 1; i <= 5; i++)
-            BTreeSet_insert(&set, &i);
+        VecDeque_drop(&deque);
+    }
 
-        uint8_t start = 2;
-        uint8_t end = 4;
-        RangeBound lower = RangeBound_included(&start);
-        RangeBound upper = RangeBound_included(&end);
+    {
+        VecDequeElementProps props = {
+            .size = sizeof(uint32_t),
+        };
+        VecDeque deque;
+        VecDeque_new(&deque, &props);
 
-        BTreeSetRangeIter iter = BTreeSet_range(&set, &lower, &upper);
+        // batches of varying size through a ring that keeps wrapping, the elements must come out in order and the
+        // slices must always cover them exactly
+        uint32_t batch[100];
+        uint32_t next_in = 0;
+        uint32_t next_out = 0;
+        uint64_t state = 1;
 
-        uint8_t expected = 2;
-        for (void *key = BTreeSetRangeIter_next(&iter); key != NULL; key = BTreeSetRangeIter_next(&iter))
+        for (size_t round = 0; round < 2000; round++)
         {
-            assert(*(uint8_t *)key == expected);
-            expected++;
+            state = state * 6364136223846793005 + 1442695040888963407;
+            size_t count = (state >> 33) % SIZE(batch);
+
+            if ((state >> 20) % 2 == 0)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    batch[i] = next_in++;
+                }
+                VecDeque_extend(&deque, batch, count);
+            }
+            else
+            {
+                size_t drained = VecDeque_drain_front(&deque, batch, count);
+                assert(drained == MIN(count, (size_t)(next_in - next_out)));
+                for (size_t i = 0; i < drained; i++)
+                {
+                    assert(batch[i] == next_out++);
+                }
+            }
+
+            size_t capacity = VecDeque_capacity(&deque);
+            assert(VecDeque_len(&deque) == next_in - next_out);
+            assert((capacity & (capacity - 1)) == 0);
+
+            VecDequeSlices slices = VecDeque_as_slices(&deque);
+            assert(slices.first_len + slices.second_len == VecDeque_len(&deque));
+            for (size_t i = 0; i < slices.first_len + slices.second_len; i++)
+            {
+                uint32_t *element = i < slices.first_len ? (uint32_t *)slices.first + i : (uint32_t *)slices.second + (i - slices.first_len);
+                assert(*element == next_out + i && element == VecDeque_get(&deque, i));
+            }
         }
-        assert(expected == 5);
 
-        BTreeSetRangeIter_drop(&iter);
-        iter = BTreeSet_range(&set, &lower, &upper);
+        VecDeque_drop(&deque);
 
-        expected = 4;
-        for (void *key = BTreeSetRangeIter_next_back(&iter); key != NULL; key = BTreeSetRangeIter_next_back(&iter))
+        // push_front wraps below index 0
+        VecDeque_new(&deque, &props);
+        for (uint32_t i = 0; i < 20; i++)
         {
-            assert(*(uint8_t *)key == expected);
-            expected--;
+            VecDeque_push_front(&deque, &i);
+        }
+        assert(VecDeque_capacity(&deque) == 32);
+        VecDeque_shrink_to_fit(&deque);
+        assert(VecDeque_capacity(&deque) == 32);
+        VecDeque_drain_front(&deque, NULL, 10);
+        VecDeque_shrink_to_fit(&deque);
+        assert(VecDeque_capacity(&deque) == 16);
+        for (uint32_t i = 0; i < 10; i++)
+        {
+            assert(*(uint32_t *)VecDeque_get(&deque, i) == 9 - i);
         }
-        assert(expected == 1);
 
-        BTreeSetRangeIter_drop(&iter);
-        BTreeSet_drop(&set);
+        VecDeque_drop(&deque);
 
-        // BTreeSet_union
+        // draining without an output buffer drops the elements
+        VecDequeElementProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+        };
+        VecDeque_new(&deque, &owned_props);
+        for (size_t i = 0; i < 12; i++)
+        {
+            char *element = malloc(8);
+            snprintf(element, 8, "%zu", i);
+            VecDeque_push_back(&deque, &element);
+        }
 
-        BTreeSet a;
-        BTreeSet b;
-        BTreeSet_new(&a, &props);
-        BTreeSet_new(&b, &props);
+        assert(VecDeque_drain_front(&deque, NULL, 5) == 5);
+        assert(strcmp(*(char **)VecDeque_front(&deque), "5") == 0);
+        VecDeque_drop(&deque);
+    }
 
-        for (uint8_t i = 1; i <= 3; i++)
-            BTreeSet_insert(&a, &i);
+    {
+        VecDequeElementProps props = {
+            .size = sizeof(uint64_t),
+        };
 
-        for (uint8_t i = 3; i <= 5; i++)
-            BTreeSet_insert(&b, &i);
+        MpmcQueue queue;
+        MpmcQueue_new(&queue, &props, 5);
+        assert(MpmcQueue_capacity(&queue) == 8);
 
-        BTreeSetUnionIter union_iter = BTreeSet_union(&a, &b);
+        // FIFO through several laps of the ring
+        uint64_t value;
+        for (uint64_t lap = 0; lap < 3; lap++)
+        {
+            for (uint64_t i = 0; i < 8; i++)
+            {
+                value = lap * 8 + i;
+                assert(MpmcQueue_try_push(&queue, &value));
+            }
 
-        uint8_t expected_union[] = {1, 2, 3, 4, 5};
-        size_t idx = 0;
+            assert(!MpmcQueue_try_push(&queue, &value));
+            assert(MpmcQueue_len(&queue) == 8);
 
-        for (void *key = BTreeSetUnionIter_next(&union_iter); key != NULL; key = BTreeSetUnionIter_next(&union_iter))
+            for (uint64_t i = 0; i < 8; i++)
+            {
+                assert(MpmcQueue_try_pop(&queue, &value) && value == lap * 8 + i);
+            }
+
+            assert(!MpmcQueue_try_pop(&queue, &value));
+            assert(MpmcQueue_len(&queue) == 0);
+        }
+
+        MpmcQueue_drop(&queue);
+
+        // elements still queued are dropped with the queue
+        VecDequeElementProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+        };
+        MpmcQueue_with_flags(&queue, &owned_props, 4, MPMC_QUEUE_SINGLE_PRODUCER | MPMC_QUEUE_SINGLE_CONSUMER);
+        for (size_t i = 0; i < 3; i++)
         {
-            assert(*(uint8_t *)(key) == expected_union[idx]);
-            idx++;
+            char *element = malloc(8);
+            snprintf(element, 8, "%zu", i);
+            assert(MpmcQueue_try_push(&queue, &element));
         }
 
-        assert(idx == 5);
-        BTreeSetUnionIter_drop(&union_iter);
-        BTreeSet_drop(&a);
-        BTreeSet_drop(&b);
+        char *popped;
+        assert(MpmcQueue_try_pop(&queue, &popped) && strcmp(popped, "0") == 0);
+        free(popped);
+        MpmcQueue_drop(&queue);
 
-        // BTreeSet_intersection
+        // producers and consumers on a small ring so that both sides keep running into full and empty
+        MpmcQueueFlags flags[] = {
+            MPMC_QUEUE_MULTI,
+            MPMC_QUEUE_SINGLE_CONSUMER,
+            MPMC_QUEUE_SINGLE_PRODUCER | MPMC_QUEUE_SINGLE_CONSUMER,
+        };
 
-        BTreeSet_new(&a, &props);
-        BTreeSet_new(&b, &props);
+        for (size_t f = 0; f < SIZE(flags); f++)
+        {
+            size_t producer_count = flags[f] & MPMC_QUEUE_SINGLE_PRODUCER ? 1 : 4;
+            size_t consumer_count = flags[f] & MPMC_QUEUE_SINGLE_CONSUMER ? 1 : 4;
+            uint64_t per_producer = 20000;
 
-        for (uint8_t i = 1; i <= 3; i++)
-            BTreeSet_insert(&a, &i);
-        for (uint8_t i = 3; i <= 5; i++)
-            BTreeSet_insert(&b, &i);
+            MpmcQueue_with_flags(&queue, &props, 16, flags[f]);
 
-        BTreeSetIntersectionIter intersection_iter = BTreeSet_intersection(&a, &b);
-        uint8_t expected_intersection[] = {3};
-        idx = 0;
+            MpmcQueueWorker workers[8];
+            thrd_t threads[8];
+            for (size_t i = 0; i < producer_count + consumer_count; i++)
+            {
+                bool is_producer = i < producer_count;
+                workers[i] = (MpmcQueueWorker){
+                    .queue = &queue,
+                    .idx = i,
+                    .count = is_producer ? per_producer : per_producer * producer_count / consumer_count,
+                };
+                thrd_create(&threads[i], (thrd_start_t)(is_producer ? run_mpmc_queue_producer : run_mpmc_queue_consumer), &workers[i]);
+            }
 
-        for (void *key = BTreeSetIntersectionIter_next(&intersection_iter); key != NULL; key = BTreeSetIntersectionIter_next(&intersection_iter))
-        {
-            assert(*(uint8_t *)key == expected_intersection[idx]);
-            idx++;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < producer_count + consumer_count; i++)
+            {
+                int result;
+                thrd_join(threads[i], &result);
+                assert(result == 0);
+                sum += workers[i].sum;
+            }
+
+            assert(sum == producer_count * (per_producer * (per_producer - 1) / 2));
+            assert(!MpmcQueue_try_pop(&queue, &value));
+
+            MpmcQueue_drop(&queue);
         }
+    }
 
-        assert(idx == 1);
-        BTreeSetIntersectionIter_drop(&intersection_iter);
-        BTreeSet_drop(&a);
-        BTreeSet_drop(&b);
+    {
+        BinaryHeapElementProps props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
+        size_t arities[] = {2, 3, 4, 8};
 
-        // BTreeSet_difference
+        for (size_t a = 0; a < SIZE(arities); a++)
+        {
+            BinaryHeap heap;
+            BinaryHeap_with_arity(&heap, &props, arities[a]);
 
-        BTreeSet_new(&a, &props);
-        BTreeSet_new(&b, &props);
+            // sibling groups are aligned whenever their size divides a cache line
+            size_t group_size = arities[a] * sizeof(uint64_t);
+            for (size_t i = 0; i < 100; i++)
+            {
+                BinaryHeap_push(&heap, &i);
+            }
 
-        for (uint8_t i = 1; i <= 3; i++)
-            BTreeSet_insert(&a, &i);
-        for (uint8_t i = 3; i <= 5; i++)
-            BTreeSet_insert(&b, &i);
+            for (size_t first = 1; first < 100 && BINARY_HEAP_CACHE_LINE_SIZE % group_size == 0; first += arities[a])
+            {
+                assert((uintptr_t)_BinaryHeap_get(&heap, first) % group_size == 0);
+            }
 
-        BTreeSetDifferenceIter difference_iter = BTreeSet_difference(&a, &b);
-        uint8_t expected_difference[] = {1, 2};
-        idx = 0;
+            while (BinaryHeap_len(&heap) > 0)
+            {
+                BinaryHeap_pop(&heap);
+            }
 
-        for (void *key = BTreeSetDifferenceIter_next(&difference_iter); key != NULL; key = BTreeSetDifferenceIter_next(&difference_iter))
-        {
-            assert(*(uint8_t *)key == expected_difference[idx]);
-            idx++;
-        }
+            // interleaved pushes and pops, every pop must return the largest element left
+            uint64_t state = a + 1;
+            uint64_t pushed = 0;
+            uint64_t popped = 0;
+            uint64_t last = UINT64_MAX;
 
-        assert(idx == 2);
-        BTreeSetDifferenceIter_drop(&difference_iter);
-        BTreeSet_drop(&a);
-        BTreeSet_drop(&b);
+            for (size_t i = 0; i < 20000; i++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
 
-        // BTreeSet_symmetric_difference
+                if ((state >> 60) < (i < 10000 ? 11 : 5))
+                {
+                    uint64_t key = (state >> 20) % 1000;
+                    BinaryHeap_push(&heap, &key);
+                    pushed++;
+                    // elements pushed after a pop may be larger than what was popped before
+                    last = UINT64_MAX;
+                }
+                else if (BinaryHeap_len(&heap) > 0)
+                {
+                    uint64_t top = *(const uint64_t *)BinaryHeap_peek(&heap);
+                    assert(top <= last);
+                    for (size_t j = 1; j < BinaryHeap_len(&heap); j++)
+                    {
+                        assert(*(uint64_t *)_BinaryHeap_get(&heap, j) <= *(uint64_t *)_BinaryHeap_get(&heap, (j - 1) / arities[a]));
+                    }
 
-        BTreeSet_new(&a, &props);
-        BTreeSet_new(&b, &props);
+                    BinaryHeap_pop(&heap);
+                    popped++;
+                    last = top;
+                }
+            }
 
-        for (uint8_t i = 1; i <= 3; i++)
-            BTreeSet_insert(&a, &i);
-        for (uint8_t i = 3; i <= 5; i++)
-            BTreeSet_insert(&b, &i);
+            assert(BinaryHeap_len(&heap) == pushed - popped);
 
-        BTreeSetSymmetricDifferenceIter symmetric_difference_iter = BTreeSet_symmetric_difference(&a, &b);
-        uint8_t expected_symmetric_difference[] = {1, 2, 4, 5};
-        idx = 0;
+            BinaryHeap_drop(&heap);
+        }
 
-        for (void *key = BTreeSetSymmetricDifferenceIter_next(&symmetric_difference_iter);
-             key != NULL;
-             key = BTreeSetSymmetricDifferenceIter_next(&symmetric_difference_iter))
+        // elements left in the heap are dropped with it
+        BinaryHeapElementProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+            .cmp = (CmpFn)compare_cstr,
+        };
+        BinaryHeap heap;
+        BinaryHeap_with_arity(&heap, &owned_props, 4);
+        for (size_t i = 0; i < 30; i++)
         {
-            assert(*(uint8_t *)key == expected_symmetric_difference[idx]);
-            idx++;
+            char *element = malloc(8);
+            snprintf(element, 8, "%02zu", (i * 7) % 30);
+            BinaryHeap_push(&heap, &element);
         }
 
-        assert(idx == 4);
-        BTreeSetSymmetricDifferenceIter_drop(&symmetric_difference_iter);
-        BTreeSet_drop(&a);
-        BTreeSet_drop(&b);
+        assert(strcmp(*(char **)BinaryHeap_peek(&heap), "29") == 0);
+        BinaryHeap_pop(&heap);
+        assert(strcmp(*(char **)BinaryHeap_peek(&heap), "28") == 0);
+        BinaryHeap_drop(&heap);
     }
 
     {
-        LinkedListElementProps element_props;
-        element_props.element_size = sizeof(uint8_t);
-        element_props.drop = drop_nop;
-
-        LinkedList list;
-        LinkedList_new(&list, &element_props);
+        BinaryHeapElementProps props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
+        };
 
-        uint8_t value = 10;
-        LinkedList_push_front(&list, &value);
-        value = 20;
-        LinkedList_push_back(&list, &value);
-        value = 30;
-        LinkedList_push_back(&list, &value);
+        // random pushes, pops and updates through handles against an array indexed by handle
+        for (size_t arity = 2; arity <= 4; arity += 2)
+        {
+            BinaryHeap heap;
+            BinaryHeap_with_handles(&heap, &props, arity);
 
-        assert(LinkedList_len(&list) == 3);
+            uint64_t values[512];
+            bool is_live[512] = {false};
+            size_t live_count = 0;
+            uint64_t state = arity;
 
-        uint8_t *front = LinkedList_front(&list);
-        assert(front && *front == 10);
+            for (size_t i = 0; i < 20000; i++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
+                uint64_t value = (state >> 24) % 100000;
+                BinaryHeapHandle handle = (state >> 12) % 512;
+                size_t op = (state >> 60) % 5;
 
-        uint8_t *back = LinkedList_back(&list);
-        assert(back && *back == 30);
+                if (op == 0 && live_count < 400)
+                {
+                    handle = BinaryHeap_push_with_handle(&heap, &value);
+                    assert(handle < 512 && !is_live[handle]);
+                    values[handle] = value;
+                    is_live[handle] = true;
+                    live_count++;
+                }
+                else if (op == 1 && live_count > 0)
+                {
+                    handle = BinaryHeap_peek_handle(&heap);
+                    uint64_t top = *(const uint64_t *)BinaryHeap_peek(&heap);
+                    for (size_t h = 0; h < 512; h++)
+                    {
+                        assert(!is_live[h] || values[h] <= top);
+                    }
+                    assert(values[handle] == top);
 
-        LinkedList_pop_front(&list);
-        front = LinkedList_front(&list);
-        assert(front && *front == 20);
-        assert(LinkedList_len(&list) == 2);
+                    BinaryHeap_pop(&heap);
+                    is_live[handle] = false;
+                    live_count--;
+                }
+                else if (op >= 2 && is_live[handle])
+                {
+                    assert(*(const uint64_t *)BinaryHeap_get(&heap, handle) == values[handle]);
 
-        LinkedList_pop_back(&list);
-        back = LinkedList_back(&list);
-        assert(back && *back == 20);
-        assert(LinkedList_len(&list) == 1);
+                    if (op == 2)
+                    {
+                        BinaryHeap_remove(&heap, handle);
+                        is_live[handle] = false;
+                        live_count--;
+                    }
+                    else if (value >= values[handle])
+                    {
+                        BinaryHeap_increase_key(&heap, handle, &value);
+                        values[handle] = value;
+                    }
+                    else
+                    {
+                        BinaryHeap_decrease_key(&heap, handle, &value);
+                        values[handle] = value;
+                    }
+                }
 
-        LinkedList_pop_back(&list);
-        assert(LinkedList_len(&list) == 0);
-        assert(LinkedList_front(&list) == NULL);
-        assert(LinkedList_back(&list) == NULL);
+                assert(BinaryHeap_len(&heap) == live_count);
+                if (i % 101 == 0)
+                {
+                    check_binary_heap(&heap);
+                }
+            }
 
-        value = 10;
-        LinkedList_push_back(&list, &value);
-        value = 20;
-        LinkedList_push_back(&list, &value);
+            check_binary_heap(&heap);
 
-        assert(LinkedList_len(&list) == 2);
-        assert(*((uint8_t *)LinkedList_front(&list)) == 10);
-        assert(*((uint8_t *)LinkedList_back(&list)) == 20);
+            // plain pushes still work on a heap with handles
+            uint64_t value = 1000000;
+            BinaryHeap_push(&heap, &value);
+            assert(*(const uint64_t *)BinaryHeap_peek(&heap) == value);
 
-        LinkedList_drop(&list);
+            BinaryHeap_drop(&heap);
+        }
     }
 
     {
-        VecDeque deque;
-        VecDequeElementProps props = {
-            .size = sizeof(uint8_t),
-            .drop = drop_nop,
+        BinaryHeapElementProps props = {
+            .size = sizeof(uint64_t),
+            .cmp = (CmpFn)compare_u64,
         };
-        VecDeque_new(&deque, &props);
 
-        assert(VecDeque_len(&deque) == 0);
-        assert(VecDeque_capacity(&deque) == 0);
+        for (size_t arity = 2; arity <= 5; arity++)
+        {
+            // heapify, then heapsort back out
+            Vec v;
+            Vec_new(&v, sizeof(uint64_t), NULL);
+            for (uint64_t i = 0; i < 1000; i++)
+            {
+                uint64_t key = bench_key(i) % 500;
+                Vec_push(&v, &key);
+            }
 
-        uint8_t value = 10;
-        VecDeque_push_back(&deque, &value);
-        value = 20;
-        VecDeque_push_back(&deque, &value);
-        value = 30;
-        VecDeque_push_back(&deque, &value);
+            BinaryHeap heap;
+            BinaryHeap_from_vec(&heap, &props, arity, &v);
+            assert(Vec_len(&v) == 0 && BinaryHeap_len(&heap) == 1000);
+            check_binary_heap(&heap);
+            Vec_drop(&v);
 
-        assert(VecDeque_len(&deque) == 3);
-        assert(VecDeque_capacity(&deque) >= 3);
+            // a small heap sifted in one element at a time, then a large one that triggers a rebuild
+            for (size_t round = 0; round < 2; round++)
+            {
+                BinaryHeap other;
+                BinaryHeap_with_arity(&other, &props, arity);
+                for (uint64_t i = 0; i < (round == 0 ? 10 : 5000); i++)
+                {
+                    uint64_t key = 1000 + i;
+                    BinaryHeap_push(&other, &key);
+                }
 
-        uint8_t *front = VecDeque_front(&deque);
-        uint8_t *back = VecDeque_back(&deque);
-        assert(front != NULL && *front == 10);
-        assert(back != NULL && *back == 30);
+                BinaryHeap_append(&heap, &other);
+                assert(BinaryHeap_len(&other) == 0);
+                check_binary_heap(&heap);
+                BinaryHeap_drop(&other);
+            }
 
-        value = 5;
-        VecDeque_push_front(&deque, &value);
-        assert(VecDeque_len(&deque) == 4);
-        assert(*(uint8_t *)VecDeque_front(&deque) == 5);
+            assert(BinaryHeap_len(&heap) == 6010);
 
-        VecDeque_pop_back(&deque);
-        assert(VecDeque_len(&deque) == 3);
-        assert(*(uint8_t *)VecDeque_back(&deque) == 20);
+            Vec sorted;
+            BinaryHeap_into_sorted_vec(&heap, &sorted);
+            assert(Vec_len(&sorted) == 6010);
+            for (size_t i = 1; i < Vec_len(&sorted); i++)
+            {
+                assert(*(uint64_t *)Vec_get(&sorted, i - 1) <= *(uint64_t *)Vec_get(&sorted, i));
+            }
+            assert(*(uint64_t *)Vec_get(&sorted, 6009) == 5999);
+            Vec_drop(&sorted);
+        }
 
-        VecDeque_pop_front(&deque);
-        assert(VecDeque_len(&deque) == 2);
-        assert(*(uint8_t *)VecDeque_front(&deque) == 10);
+        // heaps with handles are narrowed down to the elements
+        BinaryHeap heap;
+        BinaryHeap_with_handles(&heap, &props, 2);
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            uint64_t key = (i * 37) % 100;
+            BinaryHeap_push(&heap, &key);
+        }
 
-        size_t previous_capacity = VecDeque_capacity(&deque);
-        VecDeque_shrink_to_fit(&deque);
-        assert(VecDeque_capacity(&deque) == VecDeque_len(&deque));
-        assert(VecDeque_capacity(&deque) <= previous_capacity);
+        Vec sorted;
+        BinaryHeap_into_sorted_vec(&heap, &sorted);
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            assert(*(uint64_t *)Vec_get(&sorted, i) == i);
+        }
+        Vec_drop(&sorted);
 
-        VecDeque_clear(&deque);
-        assert(VecDeque_len(&deque) == 0);
+        // bounded pushes keep the k smallest
+        BinaryHeap_new(&heap, &props);
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            uint64_t key = bench_key(i) % 100000;
+            BinaryHeap_push_bounded(&heap, &key, 10);
+        }
+        assert(BinaryHeap_len(&heap) == 10);
 
-        VecDeque_drop(&deque);
+        // top_k agrees with a full sort, and the bounded heap holds its tail
+        Vec v;
+        Vec_new(&v, sizeof(uint64_t), NULL);
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            uint64_t key = bench_key(i) % 100000;
+            Vec_push(&v, &key);
+        }
+
+        BinaryHeap all;
+        BinaryHeap_new(&all, &props);
+        for (size_t i = 0; i < Vec_len(&v); i++)
+        {
+            BinaryHeap_push(&all, Vec_get(&v, i));
+        }
+
+        Vec top;
+        VecIter it = Vec_iter(&v);
+        Iterator iter = VecIter_iter(&it);
+        BinaryHeap_top_k(&props, &iter, 25, &top);
+        assert(Vec_len(&top) == 25);
+
+        Vec smallest;
+        BinaryHeap_into_sorted_vec(&heap, &smallest);
+        Vec_new(&sorted, sizeof(uint64_t), NULL);
+        while (BinaryHeap_len(&all) > 0)
+        {
+            Vec_push(&sorted, BinaryHeap_peek(&all));
+            BinaryHeap_pop(&all);
+        }
+
+        for (size_t i = 0; i < 25; i++)
+        {
+            assert(*(uint64_t *)Vec_get(&top, i) == *(uint64_t *)Vec_get(&sorted, i));
+        }
+        for (size_t i = 0; i < 10; i++)
+        {
+            assert(*(uint64_t *)Vec_get(&smallest, i) == *(uint64_t *)Vec_get(&sorted, 999 - i));
+        }
+
+        Vec_drop(&smallest);
+        Vec_drop(&sorted);
+        Vec_drop(&top);
+        Vec_drop(&v);
+        BinaryHeap_drop(&all);
+
+        // rejected and displaced elements are dropped by push_bounded, the ones left with the sorted vec
+        BinaryHeapElementProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+            .cmp = (CmpFn)compare_cstr,
+        };
+        BinaryHeap_new(&heap, &owned_props);
+        for (size_t i = 0; i < 30; i++)
+        {
+            char *element = malloc(8);
+            snprintf(element, 8, "%02zu", (i * 7) % 30);
+            BinaryHeap_push_bounded(&heap, &element, 5);
+        }
+
+        BinaryHeap_into_sorted_vec(&heap, &sorted);
+        assert(Vec_len(&sorted) == 5);
+        assert(strcmp(*(char **)Vec_get(&sorted, 0), "00") == 0);
+        assert(strcmp(*(char **)Vec_get(&sorted, 4), "04") == 0);
+        Vec_drop(&sorted);
     }
 
     {
@@ -5823,13 +18282,209 @@ int main(int argc, const char **argv)
         assert(BinaryHeap_len(&heap) == 0);
         assert(BinaryHeap_peek(&heap) == NULL);
 
-        v = 42;
-        BinaryHeap_push(&heap, &v);
-        assert(BinaryHeap_len(&heap) == 1);
-        top = BinaryHeap_peek(&heap);
-        assert(top != NULL && *top == 42);
+        v = 42;
+        BinaryHeap_push(&heap, &v);
+        assert(BinaryHeap_len(&heap) == 1);
+        top = BinaryHeap_peek(&heap);
+        assert(top != NULL && *top == 42);
+
+        BinaryHeap_drop(&heap);
+    }
+
+    {
+        // random inserts, cancels and advances against an array of due ticks, with deadlines that already passed, that
+        // are close, and that are far enough ahead to cascade through many levels
+        TestTimer timers[256];
+        bool is_pending[256] = {false};
+        uint64_t due[256];
+        for (size_t i = 0; i < SIZE(timers); i++)
+        {
+            TimerWheelTimer_new(&timers[i].timer);
+            timers[i].id = i;
+        }
+
+        TimerWheel wheel;
+        TimerWheel_new(&wheel, 1000);
+        LinkedList expired;
+        LinkedList_new_intrusive(&expired);
+        size_t pending = 0;
+        uint64_t state = 7;
+
+        for (size_t step = 0; step < 50000; step++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            size_t id = (state >> 33) % SIZE(timers);
+            uint64_t r = state >> 40;
+            uint64_t now = TimerWheel_now(&wheel);
+
+            switch ((state >> 28) % 4)
+            {
+            case 0:
+            case 1:
+                if (!is_pending[id])
+                {
+                    uint64_t spreads[] = {r % 2, r % 64, r % 5000, r << 20};
+                    uint64_t deadline = (r & 0x100) ? now + spreads[(r >> 9) % 4] : now - r % 100;
+                    TimerWheel_insert(&wheel, &timers[id].timer, deadline);
+                    due[id] = deadline > now ? deadline : now + 1;
+                    is_pending[id] = true;
+                    pending++;
+                }
+                break;
+            case 2:
+                assert(TimerWheel_cancel(&wheel, &timers[id].timer) == is_pending[id]);
+                pending -= is_pending[id];
+                is_pending[id] = false;
+                break;
+            case 3:
+            {
+                uint64_t target = now + ((r & 0xf) == 0 ? r << 20 : r % 100);
+                TimerWheel_advance(&wheel, target, &expired);
+                assert(TimerWheel_now(&wheel) == target);
+
+                uint64_t previous = 0;
+                while (LinkedList_len(&expired) > 0)
+                {
+                    LinkedListNode *node = LinkedList_front_node(&expired);
+                    LinkedList_unlink_node(&expired, node);
+
+                    size_t expired_id = CONTAINER_OF(node, TestTimer, timer.node)->id;
+                    assert(is_pending[expired_id] && due[expired_id] > now && due[expired_id] <= target);
+                    assert(due[expired_id] >= previous);
+                    assert(!TimerWheel_cancel(&wheel, &timers[expired_id].timer));
+
+                    previous = due[expired_id];
+                    is_pending[expired_id] = false;
+                    pending--;
+                }
+
+                for (size_t i = 0; i < SIZE(timers); i++)
+                {
+                    assert(!is_pending[i] || due[i] > target);
+                }
+                break;
+            }
+            }
+
+            assert(TimerWheel_len(&wheel) == pending);
+        }
+
+        // a deadline on the current tick is due on the next one, and advancing to the same tick expires nothing
+        for (size_t i = 0; i < SIZE(timers); i++)
+        {
+            TimerWheel_cancel(&wheel, &timers[i].timer);
+        }
+
+        uint64_t now = TimerWheel_now(&wheel);
+        TimerWheel_insert(&wheel, &timers[0].timer, now);
+        TimerWheel_advance(&wheel, now, &expired);
+        assert(LinkedList_len(&expired) == 0);
+        TimerWheel_advance(&wheel, now + 1, &expired);
+        assert(LinkedList_len(&expired) == 1 && TimerWheel_len(&wheel) == 0);
+
+        TimerWheel_drop(&wheel);
+    }
+
+    {
+        // random pushes at or after the last popped key, at several scales, against a linear scan for the minimum
+        RadixHeap heap;
+        RadixHeap_new(&heap, &(RadixHeapElementProps){.size = sizeof(uint32_t)});
+        uint64_t keys[4096];
+        bool is_queued[4096] = {false};
+        uint32_t pushed = 0;
+        uint64_t last = 0;
+        uint64_t state = 11;
+
+        for (size_t step = 0; step < 20000; step++)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            uint64_t r = state >> 24;
+
+            if (pushed < SIZE(keys) && (r & 3) != 0)
+            {
+                uint64_t spreads[] = {0, r % 8, r % 100000, (r & 0xfffff) << 24};
+                keys[pushed] = last + spreads[(r >> 2) % 4];
+                is_queued[pushed] = true;
+                RadixHeap_push(&heap, keys[pushed], &pushed);
+                pushed++;
+
+                // peeking in between must not get in the way of pushes below the peeked key
+                uint64_t peeked;
+                if ((r >> 4) % 4 == 0 && RadixHeap_peek(&heap, &peeked) != NULL)
+                {
+                    assert(peeked >= last);
+                }
+            }
+            else if (RadixHeap_len(&heap) > 0)
+            {
+                uint64_t minimum = UINT64_MAX;
+                for (size_t i = 0; i < pushed; i++)
+                {
+                    if (is_queued[i])
+                    {
+                        minimum = MIN(minimum, keys[i]);
+                    }
+                }
+
+                uint64_t key;
+                uint32_t id = *(uint32_t *)RadixHeap_peek(&heap, &key);
+                assert(key == minimum && keys[id] == key && is_queued[id]);
+
+                RadixHeap_pop(&heap);
+                is_queued[id] = false;
+                last = key;
+            }
+        }
+
+        size_t queued = 0;
+        for (size_t i = 0; i < pushed; i++)
+        {
+            queued += is_queued[i];
+        }
+        assert(RadixHeap_len(&heap) == queued);
+
+        while (RadixHeap_len(&heap) > 0)
+        {
+            uint64_t key;
+            RadixHeap_peek(&heap, &key);
+            assert(key >= last);
+            last = key;
+            RadixHeap_pop(&heap);
+        }
+        assert(RadixHeap_peek(&heap, &last) == NULL);
+        RadixHeap_drop(&heap);
+
+        // a peek does not raise the bound for pushes, only a pop does
+        RadixHeap_new(&heap, &(RadixHeapElementProps){.size = sizeof(uint32_t)});
+        uint32_t ids[] = {0, 1, 2};
+        uint64_t peeked;
+        RadixHeap_push(&heap, 10, &ids[0]);
+        assert(*(uint32_t *)RadixHeap_peek(&heap, &peeked) == 0 && peeked == 10);
+        RadixHeap_push(&heap, 5, &ids[1]);
+        assert(*(uint32_t *)RadixHeap_peek(&heap, &peeked) == 1 && peeked == 5);
+        RadixHeap_pop(&heap);
+        RadixHeap_push(&heap, 7, &ids[2]);
+        assert(*(uint32_t *)RadixHeap_peek(&heap, &peeked) == 2 && peeked == 7);
+        RadixHeap_pop(&heap);
+        assert(*(uint32_t *)RadixHeap_peek(&heap, &peeked) == 0 && peeked == 10);
+        RadixHeap_pop(&heap);
+        assert(RadixHeap_len(&heap) == 0);
+        RadixHeap_drop(&heap);
+
+        // values left in the heap are dropped with it
+        RadixHeap_new(&heap, &(RadixHeapElementProps){.size = sizeof(char *), .drop = (DropFn)drop_cstr});
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            char *value = malloc(8);
+            snprintf(value, 8, "%llu", (unsigned long long)(i * 37 % 100));
+            RadixHeap_push(&heap, i * 37 % 100, &value);
+        }
 
-        BinaryHeap_drop(&heap);
+        uint64_t key;
+        assert(strcmp(*(char **)RadixHeap_peek(&heap, &key), "0") == 0 && key == 0);
+        RadixHeap_pop(&heap);
+        assert(strcmp(*(char **)RadixHeap_peek(&heap, &key), "1") == 0 && key == 1);
+        RadixHeap_drop(&heap);
     }
 
     {
@@ -6112,6 +18767,277 @@ int main(int argc, const char **argv)
             SplitIterator_drop(&split);
             String_drop(&s);
         }
+
+        // --- String_rsplit_str, String_rsplitn_str and a double-ended SplitIterator ---
+        {
+            String s;
+            String_from(&s, Str_from_cstr("usr/local/lib/libfoo.so.1"));
+
+            RSplitIterator rsplit = String_rsplit_str(&s, Str_from_cstr("/"));
+            const char *expected[] = {"libfoo.so.1", "lib", "local", "usr"};
+            size_t i = 0;
+            for (Str *part = RSplitIterator_next(&rsplit); part != NULL; part = RSplitIterator_next(&rsplit))
+            {
+                assert(part->len == strlen(expected[i]) && memcmp(part->ptr, expected[i], part->len) == 0);
+                i++;
+            }
+            assert(i == 4);
+            RSplitIterator_drop(&rsplit);
+
+            // the extension and everything before it
+            RSplitNIterator rsplitn = String_rsplitn_str(&s, 2, Str_from_cstr("."));
+            Str *extension = RSplitNIterator_next(&rsplitn);
+            assert(extension->len == 1 && extension->ptr[0] == '1');
+            Str *rest = RSplitNIterator_next(&rsplitn);
+            assert(rest->len == strlen("usr/local/lib/libfoo.so") && memcmp(rest->ptr, "usr/local/lib/libfoo.so", rest->len) == 0);
+            assert(RSplitNIterator_next(&rsplitn) == NULL);
+            RSplitNIterator_drop(&rsplitn);
+
+            rsplitn = String_rsplitn_str(&s, 1, Str_from_cstr("/"));
+            Str *whole = RSplitNIterator_next(&rsplitn);
+            assert(whole->len == String_as_str(&s).len);
+            assert(RSplitNIterator_next(&rsplitn) == NULL);
+            RSplitNIterator_drop(&rsplitn);
+
+            rsplitn = String_rsplitn_str(&s, 0, Str_from_cstr("/"));
+            assert(RSplitNIterator_next(&rsplitn) == NULL);
+            RSplitNIterator_drop(&rsplitn);
+
+            // more pieces asked for than there are
+            rsplitn = String_rsplitn_str(&s, 10, Str_from_cstr("/"));
+            for (i = 0; RSplitNIterator_next(&rsplitn) != NULL; i++)
+            {
+            }
+            assert(i == 4);
+            RSplitNIterator_drop(&rsplitn);
+
+            // both ends meet in the middle without yielding a piece twice
+            SplitIterator split = String_split_str(&s, Str_from_cstr("/"));
+            Iterator it = SplitIterator_iter(&split);
+            Str *first = Iterator_next(&it);
+            assert(first->len == 3 && memcmp(first->ptr, "usr", 3) == 0);
+            Str *last = Iterator_next_back(&it);
+            assert(last->len == strlen("libfoo.so.1") && memcmp(last->ptr, "libfoo.so.1", last->len) == 0);
+            Str *middle = Iterator_next_back(&it);
+            assert(middle->len == 3 && memcmp(middle->ptr, "lib", 3) == 0);
+            middle = Iterator_next(&it);
+            assert(middle->len == 5 && memcmp(middle->ptr, "local", 5) == 0);
+            assert(Iterator_next(&it) == NULL);
+            assert(Iterator_next_back(&it) == NULL);
+            SplitIterator_drop(&split);
+
+            String_drop(&s);
+
+            // separators at both ends give empty pieces
+            String_from(&s, Str_from_cstr("--a----b--"));
+            split = String_split_str(&s, Str_from_cstr("--"));
+            const size_t lens[] = {0, 1, 0, 1, 0};
+            for (i = 0; i < SIZE(lens); i++)
+            {
+                Str *part = SplitIterator_next_back(&split);
+                assert(part->len == lens[SIZE(lens) - 1 - i]);
+            }
+            assert(SplitIterator_next_back(&split) == NULL);
+            SplitIterator_drop(&split);
+            String_drop(&s);
+        }
+
+        // --- short and Two-Way searches against a naive scan ---
+        {
+            // small alphabets and periodic needles make for many partial matches
+            uint64_t state = 5;
+            for (size_t round = 0; round < 3000; round++)
+            {
+                state = state * 6364136223846793005 + 1442695040888963407;
+                size_t alphabet = 2 + (state >> 60) % 3;
+                size_t haystack_len = (state >> 33) % 300;
+                size_t needle_len = 1 + (state >> 20) % 80;
+                size_t needle_period = 1 + (state >> 12) % 8;
+
+                uint8_t haystack[300];
+                uint8_t needle[80];
+                for (size_t i = 0; i < needle_len; i++)
+                {
+                    state = state * 6364136223846793005 + 1442695040888963407;
+                    needle[i] = i < needle_period || (state >> 40) % 16 == 0 ? 'a' + (state >> 33) % alphabet : needle[i - needle_period];
+                }
+
+                for (size_t i = 0; i < haystack_len; i++)
+                {
+                    state = state * 6364136223846793005 + 1442695040888963407;
+                    bool copies_needle = (state >> 40) % 64 != 0;
+                    haystack[i] = copies_needle ? needle[i % needle_len] : 'a' + (state >> 33) % alphabet;
+                }
+
+                String s;
+                String_from(&s, (Str){.ptr = haystack, .len = haystack_len});
+                Str needle_str = {.ptr = needle, .len = needle_len};
+
+                size_t expected = SIZE_MAX;
+                for (size_t i = 0; i + needle_len <= haystack_len; i++)
+                {
+                    if (memcmp(haystack + i, needle, needle_len) == 0)
+                    {
+                        expected = i;
+                        break;
+                    }
+                }
+                assert(String_find_str(&s, needle_str) == expected);
+
+                size_t expected_last = SIZE_MAX;
+                for (size_t end = haystack_len; end >= needle_len; end--)
+                {
+                    if (memcmp(haystack + end - needle_len, needle, needle_len) == 0)
+                    {
+                        expected_last = end - needle_len;
+                        break;
+                    }
+                }
+                assert(String_rfind_str(&s, needle_str) == expected_last);
+
+                // steps from the back cover the haystack without gaps, with matches where a backwards scan finds them
+                StrSearcher searcher;
+                StrSearcher_new(&searcher, String_as_str(&s), needle_str);
+                size_t end = haystack_len;
+                for (SearchStep step = StrSearcher_next_back(&searcher); step.kind != SEARCH_STEP_DONE; step = StrSearcher_next_back(&searcher))
+                {
+                    if (step.kind == SEARCH_STEP_REJECT)
+                    {
+                        assert(step.reject.end == end && step.reject.start < end);
+                        for (size_t j = step.reject.start; j + needle_len <= end; j++)
+                        {
+                            assert(memcmp(haystack + j, needle, needle_len) != 0);
+                        }
+                        end = step.reject.start;
+                    }
+                    else
+                    {
+                        assert(step.match.end == end && memcmp(haystack + step.match.start, needle, needle_len) == 0);
+                        end = step.match.start;
+                    }
+                }
+                assert(end == 0);
+                StrSearcher_drop(&searcher);
+
+                MatchesIterator matches = String_matches_str(&s, needle_str);
+                size_t i = 0;
+                for (Match *m = MatchesIterator_next(&matches); m != NULL; m = MatchesIterator_next(&matches))
+                {
+                    while (memcmp(haystack + i, needle, needle_len) != 0)
+                    {
+                        i++;
+                    }
+                    assert(m->start == i && m->end == i + needle_len);
+                    i += needle_len;
+                }
+
+                for (; i + needle_len <= haystack_len; i++)
+                {
+                    assert(memcmp(haystack + i, needle, needle_len) != 0);
+                }
+
+                MatchesIterator_drop(&matches);
+                String_drop(&s);
+            }
+        }
+
+        // --- AhoCorasick against a leftmost-longest naive scan ---
+        {
+            // few short needles get the dense DFA and the prefilter, 80 needles go without the prefilter, and 2000 long
+            // needles over the whole alphabet need too many transitions for the dense DFA
+            size_t needle_counts[] = {1, 5, 20, 80, 2000};
+            uint64_t state = 9;
+
+            for (size_t round = 0; round < 100; round++)
+            {
+                size_t needle_count = needle_counts[round % SIZE(needle_counts)];
+                size_t alphabet = needle_count == 2000 ? 26 : 2 + round % 3;
+                size_t min_needle_len = needle_count == 2000 ? 20 : 1;
+                size_t max_needle_len = needle_count == 2000 ? 30 : 6;
+
+                uint8_t needle_bytes[2000][30];
+                Str needles[2000];
+                for (size_t n = 0; n < needle_count; n++)
+                {
+                    state = state * 6364136223846793005 + 1442695040888963407;
+                    needles[n].ptr = needle_bytes[n];
+                    needles[n].len = min_needle_len + (state >> 33) % (max_needle_len - min_needle_len + 1);
+
+                    for (size_t i = 0; i < needles[n].len; i++)
+                    {
+                        state = state * 6364136223846793005 + 1442695040888963407;
+                        needle_bytes[n][i] = 'a' + (state >> 33) % alphabet;
+                    }
+                }
+
+                uint8_t haystack[400];
+                size_t haystack_len = 0;
+                while (haystack_len < 350)
+                {
+                    state = state * 6364136223846793005 + 1442695040888963407;
+                    if ((state >> 40) % 3 == 0)
+                    {
+                        Str needle = needles[(state >> 33) % needle_count];
+                        memcpy(haystack + haystack_len, needle.ptr, needle.len);
+                        haystack_len += needle.len;
+                    }
+                    else
+                    {
+                        haystack[haystack_len++] = 'a' + (state >> 33) % (alphabet + 1);
+                    }
+                }
+
+                AhoCorasick automaton;
+                AhoCorasick_new(&automaton, needles, needle_count);
+                assert(AhoCorasick_pattern_count(&automaton) == needle_count);
+                assert((automaton.dense == NULL) == (needle_count == 2000));
+                assert(automaton.has_prefilter == (needle_count <= AHO_CORASICK_TEDDY_MAX_PATTERNS));
+                // every other round takes the scalar prefilter where the SIMD one is available
+                automaton.has_ssse3 = automaton.has_ssse3 && round / SIZE(needle_counts) % 2 == 0;
+
+                String s;
+                String_from(&s, (Str){.ptr = haystack, .len = haystack_len});
+                MultiMatchesIterator matches = String_matches_any(&s, &automaton);
+
+                size_t position = 0;
+                for (size_t start = 0; start < haystack_len; start++)
+                {
+                    size_t best = SIZE_MAX;
+                    for (size_t n = 0; n < needle_count; n++)
+                    {
+                        bool fits = needles[n].len <= haystack_len - start;
+                        if (fits && memcmp(haystack + start, needles[n].ptr, needles[n].len) == 0 && (best == SIZE_MAX || needles[n].len > needles[best].len))
+                        {
+                            best = n;
+                        }
+                    }
+
+                    if (best != SIZE_MAX && start >= position)
+                    {
+                        Match *m = MultiMatchesIterator_next(&matches);
+                        assert(m != NULL && m->start == start && m->end == start + needles[best].len && m->pattern == best);
+                        position = m->end;
+                    }
+                }
+                assert(MultiMatchesIterator_next(&matches) == NULL);
+                MultiMatchesIterator_drop(&matches);
+
+                // rejections and matches tile the haystack
+                MultiStrSearcher searcher;
+                MultiStrSearcher_new(&searcher, &automaton, String_as_str(&s));
+                position = 0;
+                for (SearchStep step = MultiStrSearcher_next(&searcher); step.kind != SEARCH_STEP_DONE; step = MultiStrSearcher_next(&searcher))
+                {
+                    assert(step.match.start == position && step.match.end > position);
+                    position = step.match.end;
+                }
+                assert(position == haystack_len);
+                MultiStrSearcher_drop(&searcher);
+
+                String_drop(&s);
+                AhoCorasick_drop(&automaton);
+            }
+        }
     }
 
     {
@@ -6247,6 +19173,38 @@ int main(int argc, const char **argv)
             assert(i == 3);
         }
 
+        // AdapterIter_new_in
+        {
+            AdapterIterSpec specs[] = {
+                AdapterIterSpec_skip(1),
+                AdapterIterSpec_take(3),
+                AdapterIterSpec_rev(),
+                AdapterIterSpec_none(),
+            };
+            ADAPTER_ITER_BUFFER(buffer, SIZE(specs) - 1);
+            assert(sizeof(buffer) >= AdapterIter_buffer_size(specs));
+
+            for (size_t round = 0; round < 2; round++)
+            {
+                VecIter it = Vec_iter(&v);
+                AdapterIter _it = AdapterIter_new_in(VecIter_linked_iter(&it), specs, buffer, sizeof(buffer));
+
+                assert(AdapterIter_len(&_it) == 3);
+
+                size_t i = 4;
+
+                for (EACH_IN(elem, _it))
+                {
+                    assert(*(size_t *)elem == i);
+                    i--;
+                }
+
+                AdapterIter_drop(&_it);
+
+                assert(i == 1);
+            }
+        }
+
         // StepByIter + Rev
         {
             VecIter it = Vec_iter(&v);
@@ -6277,6 +19235,323 @@ int main(int argc, const char **argv)
         Vec_drop(&v);
     }
 
+    {
+        VecDequeElementProps props = {
+            .size = sizeof(uint64_t),
+        };
+        WorkStealingDeque deque;
+        WorkStealingDeque_new(&deque, &props);
+
+        // the owner sees a stack, thieves a queue, across several growths of the buffer
+        uint64_t value;
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            WorkStealingDeque_push(&deque, &i);
+        }
+        assert(WorkStealingDeque_len(&deque) == 100);
+
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            assert(WorkStealingDeque_steal(&deque, &value) == WORK_STEALING_DEQUE_STEAL_SUCCESS && value == i);
+            assert(WorkStealingDeque_pop(&deque, &value) && value == 99 - i);
+        }
+
+        for (uint64_t i = 0; i < 80; i++)
+        {
+            assert(WorkStealingDeque_pop(&deque, &value) && value == 89 - i);
+        }
+
+        assert(!WorkStealingDeque_pop(&deque, &value));
+        assert(WorkStealingDeque_steal(&deque, &value) == WORK_STEALING_DEQUE_STEAL_EMPTY);
+        assert(WorkStealingDeque_len(&deque) == 0);
+
+        // the owner keeps pushing and popping while thieves take from the other end, every element must be taken
+        // exactly once
+        atomic_bool is_done;
+        atomic_init(&is_done, false);
+
+        WorkStealingDequeThief thieves[3];
+        thrd_t threads[3];
+        for (size_t i = 0; i < SIZE(thieves); i++)
+        {
+            thieves[i] = (WorkStealingDequeThief){.deque = &deque, .is_done = &is_done};
+            thrd_create(&threads[i], (thrd_start_t)run_work_stealing_deque_thief, &thieves[i]);
+        }
+
+        uint64_t sum = 0;
+        uint64_t count = 0;
+        uint64_t total = 200000;
+        for (uint64_t i = 1; i <= total; i++)
+        {
+            WorkStealingDeque_push(&deque, &i);
+
+            if (i % 3 == 0 && WorkStealingDeque_pop(&deque, &value))
+            {
+                sum += value;
+                count++;
+            }
+        }
+
+        atomic_store(&is_done, true);
+
+        for (size_t i = 0; i < SIZE(thieves); i++)
+        {
+            thrd_join(threads[i], NULL);
+            sum += thieves[i].sum;
+            count += thieves[i].count;
+        }
+
+        while (WorkStealingDeque_pop(&deque, &value))
+        {
+            sum += value;
+            count++;
+        }
+
+        assert(count == total && sum == total * (total + 1) / 2);
+
+        WorkStealingDeque_drop(&deque);
+
+        // elements left behind are dropped with the deque
+        VecDequeElementProps owned_props = {
+            .size = sizeof(char *),
+            .drop = (DropFn)drop_cstr,
+        };
+        WorkStealingDeque_new(&deque, &owned_props);
+        for (size_t i = 0; i < 40; i++)
+        {
+            char *element = malloc(8);
+            snprintf(element, 8, "%zu", i);
+            WorkStealingDeque_push(&deque, &element);
+        }
+
+        char *stolen;
+        assert(WorkStealingDeque_steal(&deque, &stolen) == WORK_STEALING_DEQUE_STEAL_SUCCESS && strcmp(stolen, "0") == 0);
+        free(stolen);
+        WorkStealingDeque_drop(&deque);
+
+        // elements that are not a whole number of words
+        typedef struct
+        {
+            uint32_t a, b, c;
+        } Triple;
+        WorkStealingDeque_new(&deque, &(VecDequeElementProps){.size = sizeof(Triple)});
+        for (uint32_t i = 0; i < 50; i++)
+        {
+            WorkStealingDeque_push(&deque, &(Triple){i, i + 1, i + 2});
+        }
+
+        Triple triple;
+        assert(WorkStealingDeque_steal(&deque, &triple) == WORK_STEALING_DEQUE_STEAL_SUCCESS);
+        assert(triple.a == 0 && triple.b == 1 && triple.c == 2);
+        for (uint32_t i = 49; i > 0; i--)
+        {
+            assert(WorkStealingDeque_pop(&deque, &triple) && triple.a == i && triple.b == i + 1 && triple.c == i + 2);
+        }
+        WorkStealingDeque_drop(&deque);
+    }
+
+    {
+        ThreadPool pool;
+        ThreadPool_new(&pool, 4);
+
+        Vec v;
+        Vec_new(&v, sizeof(size_t), NULL);
+
+        for (size_t i = 1; i <= 10000; i++)
+        {
+            Vec_push(&v, &i);
+        }
+
+        size_t zero = 0;
+        ParIterReduceProps sum_props = {
+            .size = sizeof(size_t),
+            .identity = &zero,
+            .fold = (ParIterFoldFn)add_size,
+            .combine = (ParIterCombineFn)add_size,
+        };
+
+        // ParIter_reduce
+        {
+            VecIter it = Vec_iter(&v);
+            ParIter par = ParIter_new(VecIter_iter(&it), &pool);
+
+            size_t sum;
+            ParIter_reduce(&par, &sum_props, NULL, &sum);
+            assert(sum == 50005000);
+
+            ParIter_drop(&par);
+        }
+
+        // ParIter_for_each
+        {
+            VecIter it = Vec_iter(&v);
+            ParIter par = ParIter_new(VecIter_iter(&it), &pool);
+            ParIter_with_min_len(&par, 100);
+
+            atomic_size_t sum = 0;
+            ParIter_for_each(&par, (ParIterForEachFn)add_size_atomic, &sum);
+            assert(atomic_load(&sum) == 50005000);
+
+            ParIter_drop(&par);
+        }
+
+        // ParIter_collect
+        {
+            VecIter it = Vec_iter(&v);
+            ParIter par = ParIter_new(VecIter_iter(&it), &pool);
+
+            Vec collected;
+            ParIter_collect(&par, &collected, sizeof(size_t));
+
+            assert(Vec_len(&collected) == 10000);
+
+            for (size_t i = 0; i < Vec_len(&collected); i++)
+            {
+                assert(*(size_t *)Vec_get(&collected, i) == i + 1);
+            }
+
+            Vec_drop(&collected);
+            ParIter_drop(&par);
+        }
+
+        // Splits propagate through SkipIter, TakeIter and StepByIter
+        {
+            VecIter it = Vec_iter(&v);
+            AdapterIter _it = AdapterIter_new(
+                VecIter_linked_iter(&it),
+                (AdapterIterSpec[]){
+                    AdapterIterSpec_skip(10),
+                    AdapterIterSpec_take(1000),
+                    AdapterIterSpec_step_by(3),
+                    AdapterIterSpec_none(),
+                });
+
+            ParIter par = ParIter_new(AdapterIter_iter(&_it), &pool);
+
+            Vec collected;
+            ParIter_collect(&par, &collected, sizeof(size_t));
+
+            assert(Vec_len(&collected) == 334);
+
+            for (size_t i = 0; i < Vec_len(&collected); i++)
+            {
+                assert(*(size_t *)Vec_get(&collected, i) == 11 + 3 * i);
+            }
+
+            Vec_drop(&collected);
+            ParIter_drop(&par);
+            AdapterIter_drop(&_it);
+        }
+
+        // VecDeque
+        {
+            VecDeque deque;
+            VecDeque_new(&deque, &(VecDequeElementProps){.size = sizeof(size_t)});
+
+            for (size_t i = 501; i <= 1000; i++)
+            {
+                VecDeque_push_back(&deque, &i);
+            }
+
+            for (size_t i = 500; i >= 1; i--)
+            {
+                VecDeque_push_front(&deque, &i);
+            }
+
+            VecDequeIter it = VecDeque_iter(&deque);
+            ParIter par = ParIter_new(VecDequeIter_iter(&it), &pool);
+
+            Vec collected;
+            ParIter_collect(&par, &collected, sizeof(size_t));
+
+            assert(Vec_len(&collected) == 1000);
+
+            for (size_t i = 0; i < Vec_len(&collected); i++)
+            {
+                assert(*(size_t *)Vec_get(&collected, i) == i + 1);
+            }
+
+            Vec_drop(&collected);
+            ParIter_drop(&par);
+            VecDeque_drop(&deque);
+        }
+
+        // BTreeMap ranges
+        {
+            BTreeMap map;
+            BTreeMapKeyProps key_props = {
+                .size = sizeof(uint8_t),
+                .cmp = (CmpFn)compare_u8,
+            };
+            BTreeMapValueProps value_props = {
+                .size = sizeof(uint8_t),
+            };
+            BTreeMap_with_branching_factor(&map, &key_props, &value_props, 3);
+
+            for (size_t i = 0; i < 200; i++)
+            {
+                uint8_t key = (i * 7) % 200;
+                BTreeMap_insert(&map, &key, &key);
+            }
+
+            for (uint8_t key = 0; key < 200; key += 4)
+            {
+                BTreeMap_remove(&map, &key);
+            }
+
+            assert(BTreeMap_len(&map) == 150);
+
+            uint8_t start = 10;
+            uint8_t end = 190;
+            RangeBound lower = RangeBound_included(&start);
+            RangeBound upper = RangeBound_excluded(&end);
+
+            BTreeMapRangeIter it = BTreeMap_range(&map, &lower, &upper);
+            ParIter par = ParIter_new(BTreeMapRangeIter_iter(&it), &pool);
+
+            Vec collected;
+            ParIter_collect(&par, &collected, sizeof(BTreeMapEntry));
+
+            size_t expected = 0;
+            uint8_t expected_key = 10;
+
+            for (size_t i = 0; i < Vec_len(&collected); i++, expected_key++)
+            {
+                if (expected_key % 4 == 0)
+                {
+                    expected_key++;
+                }
+
+                const BTreeMapEntry *entry = Vec_get(&collected, i);
+                assert(*(uint8_t *)entry->key == expected_key);
+                assert(*(uint8_t *)entry->value == expected_key);
+
+                expected += expected_key;
+            }
+
+            assert(Vec_len(&collected) == 135);
+
+            Vec_drop(&collected);
+            ParIter_drop(&par);
+
+            ParIterReduceProps key_sum_props = sum_props;
+            key_sum_props.fold = (ParIterFoldFn)add_btreemap_entry_u8_key;
+
+            it = BTreeMap_range(&map, &lower, &upper);
+            par = ParIter_new(BTreeMapRangeIter_iter(&it), &pool);
+
+            size_t sum;
+            ParIter_reduce(&par, &key_sum_props, NULL, &sum);
+            assert(sum == expected);
+
+            ParIter_drop(&par);
+            BTreeMap_drop(&map);
+        }
+
+        Vec_drop(&v);
+        ThreadPool_drop(&pool);
+    }
+
     {
         String str;
         String_from(&str, Str_from_cstr("a?b+c"));